@@ -0,0 +1,305 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <eegdev.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acq-source.h"
+
+/**************************************************************************
+ *                                                                        *
+ *                      Internals of eegdev source                        *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * struct eegdev_source - acquisition source reading an eegdev device
+ * @src:        acquisition source interface
+ * @dev:        opened device
+ */
+struct eegdev_source {
+	struct acq_source src;
+	struct eegdev* dev;
+};
+
+#define get_eegdev(src) (((struct eegdev_source*)(src))->dev)
+
+static
+void eegdev_close(struct acq_source* src)
+{
+	egd_close(get_eegdev(src));
+	free(src);
+}
+
+
+static
+int eegdev_get_fs(struct acq_source* src)
+{
+	return egd_get_cap(get_eegdev(src), EGD_CAP_FS, NULL);
+}
+
+
+static
+int eegdev_get_numch(struct acq_source* src, int stype)
+{
+	return egd_get_numch(get_eegdev(src), stype);
+}
+
+
+static
+int eegdev_get_chinfo(struct acq_source* src, int stype, unsigned int ich,
+                      struct acq_chinfo* info)
+{
+	return egd_channel_info(get_eegdev(src), stype, ich,
+	                        EGD_LABEL, info->label,
+	                        EGD_ISINT, &info->isint,
+	                        EGD_MM_D, info->mm,
+	                        EGD_PREFILTERING, info->filtering,
+	                        EGD_TRANSDUCTER, info->transducter,
+	                        EGD_UNIT, info->unit,
+	                        EGD_EOL);
+}
+
+
+static
+void eegdev_get_devinfo(struct acq_source* src, const char** type,
+                        const char** model)
+{
+	char *device_type, *device_id;
+
+	egd_get_cap(get_eegdev(src), EGD_CAP_DEVTYPE, &device_type);
+	egd_get_cap(get_eegdev(src), EGD_CAP_DEVID, &device_id);
+	*type = device_type;
+	*model = device_id;
+}
+
+
+static
+int eegdev_setup(struct acq_source* src, const size_t strides[3],
+                 unsigned int ngrp, const struct grpconf* grp)
+{
+	return egd_acq_setup(get_eegdev(src), 3, strides, ngrp, grp);
+}
+
+
+static
+int eegdev_start(struct acq_source* src)
+{
+	return egd_start(get_eegdev(src));
+}
+
+
+static
+int eegdev_stop(struct acq_source* src)
+{
+	return egd_stop(get_eegdev(src));
+}
+
+
+static
+ssize_t eegdev_get_data(struct acq_source* src, size_t ns,
+                        void* eeg, void* sensor, void* trigger)
+{
+	return egd_get_data(get_eegdev(src), ns, eeg, sensor, trigger);
+}
+
+
+static
+ssize_t eegdev_get_available(struct acq_source* src)
+{
+	return egd_get_available(get_eegdev(src));
+}
+
+
+static const struct acq_source_ops eegdev_ops = {
+	.close = eegdev_close,
+	.get_fs = eegdev_get_fs,
+	.get_numch = eegdev_get_numch,
+	.get_chinfo = eegdev_get_chinfo,
+	.get_devinfo = eegdev_get_devinfo,
+	.setup = eegdev_setup,
+	.start = eegdev_start,
+	.stop = eegdev_stop,
+	.get_data = eegdev_get_data,
+	.get_available = eegdev_get_available,
+};
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      API of acquisition source                         *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * acq_source_open_eegdev() - open an eegdev device as acquisition source
+ * @devstring:  device string passed to egd_open() (can be NULL)
+ *
+ * Return: the opened source, NULL in case of failure with errno set
+ */
+struct acq_source* acq_source_open_eegdev(const char* devstring)
+{
+	struct eegdev_source* esrc;
+
+	esrc = malloc(sizeof(*esrc));
+	if (!esrc)
+		return NULL;
+
+	esrc->dev = egd_open(devstring);
+	if (!esrc->dev) {
+		free(esrc);
+		return NULL;
+	}
+
+	esrc->src.ops = &eegdev_ops;
+	return &esrc->src;
+}
+
+
+void acq_source_close(struct acq_source* src)
+{
+	src->ops->close(src);
+}
+
+
+int acq_source_get_fs(struct acq_source* src)
+{
+	return src->ops->get_fs(src);
+}
+
+
+int acq_source_get_numch(struct acq_source* src, int stype)
+{
+	return src->ops->get_numch(src, stype);
+}
+
+
+/**
+ * acq_source_get_chinfo() - get properties of a channel
+ * @src:        opened acquisition source
+ * @stype:      sensor type of the channel (EGD_EEG, EGD_SENSOR...)
+ * @ich:        index of the channel in the sensor type
+ * @info:       pointer receiving the properties
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+int acq_source_get_chinfo(struct acq_source* src, int stype,
+                          unsigned int ich, struct acq_chinfo* info)
+{
+	return src->ops->get_chinfo(src, stype, ich, info);
+}
+
+
+void acq_source_get_devinfo(struct acq_source* src, const char** type,
+                            const char** model)
+{
+	src->ops->get_devinfo(src, type, model);
+}
+
+
+/**
+ * acq_source_setup() - configure the channels to acquire
+ * @src:        opened acquisition source
+ * @strides:    size of one sample in each of the 3 acquisition arrays
+ * @ngrp:       number of groups in @grp
+ * @grp:        groups of consecutive channels of a sensor type, each one
+ *              stored at an offset of a sample of an acquisition array
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+int acq_source_setup(struct acq_source* src, const size_t strides[3],
+                     unsigned int ngrp, const struct grpconf* grp)
+{
+	return src->ops->setup(src, strides, ngrp, grp);
+}
+
+
+int acq_source_start(struct acq_source* src)
+{
+	return src->ops->start(src);
+}
+
+
+int acq_source_stop(struct acq_source* src)
+{
+	return src->ops->stop(src);
+}
+
+
+/**
+ * acq_source_get_data() - get samples from acquisition source
+ * @src:        opened and started acquisition source
+ * @ns:         number of samples to get
+ * @eeg:        array receiving the samples of the first group
+ * @sensor:     array receiving the samples of the second group
+ * @trigger:    array receiving the samples of the third group
+ *
+ * This blocks until @ns samples are available.
+ *
+ * Return: @ns in case of success (less if a replayed file ends in the
+ * middle of the block), -1 otherwise with errno set
+ */
+ssize_t acq_source_get_data(struct acq_source* src, size_t ns,
+                            void* eeg, void* sensor, void* trigger)
+{
+	return src->ops->get_data(src, ns, eeg, sensor, trigger);
+}
+
+
+/**
+ * acq_source_get_status() - get timing and losses of acquisition source
+ * @src:        opened and started acquisition source
+ * @status:     pointer receiving the status
+ *
+ * Return: 0 in case of success, -1 if the source does not report its
+ * status (errno is then set to ENOTSUP)
+ */
+int acq_source_get_status(struct acq_source* src, struct acq_status* status)
+{
+	if (!src->ops->get_status) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	return src->ops->get_status(src, status);
+}
+
+
+/**
+ * acq_source_get_available() - get number of samples ready to be read
+ * @src:        opened and started acquisition source
+ *
+ * A number of samples growing beyond a few blocks means that the samples
+ * are not read as fast as they are acquired.
+ *
+ * Return: the number of samples acquired but not yet delivered by
+ * acq_source_get_data(), -1 in case of failure or if the source cannot
+ * tell (errno is then set to ENOTSUP)
+ */
+ssize_t acq_source_get_available(struct acq_source* src)
+{
+	if (!src->ops->get_available) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	return src->ops->get_available(src);
+}
@@ -0,0 +1,124 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef ACQ_SOURCE_H
+#define ACQ_SOURCE_H
+
+#include <eegdev.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * struct acq_chinfo - properties of a channel of an acquisition source
+ * @label:      name of the channel
+ * @isint:      true if the channel is acquired as integer
+ * @mm:         physical minimum and maximum
+ * @filtering:  prefiltering description
+ * @transducter: transducter description
+ * @unit:       physical unit
+ */
+struct acq_chinfo {
+	char label[32];
+	int isint;
+	double mm[2];
+	char filtering[128];
+	char transducter[128];
+	char unit[16];
+};
+
+/**
+ * struct acq_status - timing and losses of an acquisition source
+ * @last_ts:    CLOCK_MONOTONIC time (in ns) at which the last delivered
+ *              sample has been acquired
+ * @noverrun:   number of times the buffer of the source has overflowed
+ * @nlost:      number of samples lost by the overflows
+ */
+struct acq_status {
+	int64_t last_ts;
+	unsigned int noverrun;
+	int64_t nlost;
+};
+
+struct acq_source;
+
+/**
+ * struct acq_source_ops - implementation of an acquisition source
+ * @close:      release the source
+ * @get_fs:     get sampling frequency
+ * @get_numch:  get number of channels of a sensor type (EGD_EEG...)
+ * @get_chinfo: get properties of a channel
+ * @get_devinfo: get type and model of device
+ * @setup:      configure the groups of channels acquired in 3 arrays, with
+ *              the semantics of egd_acq_setup()
+ * @start:      start acquisition
+ * @stop:       stop acquisition
+ * @get_data:   get @ns samples in the 3 arrays, blocking until they are
+ *              available. Return @ns (less only when a finite source
+ *              reaches its end) or -1 with errno set.
+ * @get_status: get timing of the last delivered sample and the losses
+ *              since start (NULL if the source cannot tell)
+ * @get_available: get number of samples acquired but not delivered yet
+ *              (NULL if the source cannot tell)
+ *
+ * The semantics of all the operations are the ones of the corresponding
+ * eegdev functions.
+ */
+struct acq_source_ops {
+	void (*close)(struct acq_source* src);
+	int (*get_fs)(struct acq_source* src);
+	int (*get_numch)(struct acq_source* src, int stype);
+	int (*get_chinfo)(struct acq_source* src, int stype, unsigned int ich,
+	                  struct acq_chinfo* info);
+	void (*get_devinfo)(struct acq_source* src, const char** type,
+	                    const char** model);
+	int (*setup)(struct acq_source* src, const size_t strides[3],
+	             unsigned int ngrp, const struct grpconf* grp);
+	int (*start)(struct acq_source* src);
+	int (*stop)(struct acq_source* src);
+	ssize_t (*get_data)(struct acq_source* src, size_t ns,
+	                    void* eeg, void* sensor, void* trigger);
+	int (*get_status)(struct acq_source* src, struct acq_status* status);
+	ssize_t (*get_available)(struct acq_source* src);
+};
+
+/**
+ * struct acq_source - source of acquired samples
+ * @ops:        implementation of the source
+ *
+ * This is the first field of the structure of each implementation.
+ */
+struct acq_source {
+	const struct acq_source_ops* ops;
+};
+
+struct acq_source* acq_source_open_eegdev(const char* devstring);
+void acq_source_close(struct acq_source* src);
+int acq_source_get_fs(struct acq_source* src);
+int acq_source_get_numch(struct acq_source* src, int stype);
+int acq_source_get_chinfo(struct acq_source* src, int stype,
+                          unsigned int ich, struct acq_chinfo* info);
+void acq_source_get_devinfo(struct acq_source* src, const char** type,
+                            const char** model);
+int acq_source_setup(struct acq_source* src, const size_t strides[3],
+                     unsigned int ngrp, const struct grpconf* grp);
+int acq_source_start(struct acq_source* src);
+int acq_source_stop(struct acq_source* src);
+ssize_t acq_source_get_data(struct acq_source* src, size_t ns,
+                            void* eeg, void* sensor, void* trigger);
+int acq_source_get_status(struct acq_source* src, struct acq_status* status);
+ssize_t acq_source_get_available(struct acq_source* src);
+
+#endif
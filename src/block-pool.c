@@ -0,0 +1,234 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <mmerrno.h>
+#include <mmlog.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+# include <sys/mman.h>
+#endif
+
+#include "block-pool.h"
+
+// Alignment of each sample array (cache line, suitable for SIMD)
+#define ARRAY_ALIGN     64
+#define HUGEPAGE_SIZE   (2*1024*1024)
+
+#define ALIGN_UP(x, a)  (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Memory allocation                                         *
+ *                                                                        *
+ **************************************************************************/
+#if !defined(_WIN32)
+
+static
+int pool_alloc_mem(struct block_pool* pool, size_t size, int flags)
+{
+	void* mem = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	// Try explicit huge pages first (needs pages reserved by sysadmin)
+	if (flags & BLOCK_POOL_HUGEPAGES) {
+		size = ALIGN_UP(size, HUGEPAGE_SIZE);
+		mem = mmap(NULL, size, PROT_READ|PROT_WRITE,
+		           MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (mem == MAP_FAILED)
+			mm_log_info("No huge page reserved, "
+			            "falling back to transparent huge pages");
+	}
+#endif
+
+	if (mem == MAP_FAILED) {
+		mem = mmap(NULL, size, PROT_READ|PROT_WRITE,
+		           MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED)
+			return mm_raise_from_errno("cannot map block pool");
+
+#ifdef MADV_HUGEPAGE
+		if (flags & BLOCK_POOL_HUGEPAGES)
+			madvise(mem, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	pool->mem = mem;
+	pool->memsize = size;
+	pool->mapped = 1;
+
+	if (flags & BLOCK_POOL_MLOCK) {
+		if (mlock(mem, size))
+			mm_log_warn("Cannot lock block pool in memory: %s",
+			            strerror(errno));
+		else
+			pool->locked = 1;
+	}
+
+	// Touch all pages now so that no page fault happen on hot path
+	memset(mem, 0, size);
+
+	return 0;
+}
+
+
+static
+void pool_free_mem(struct block_pool* pool)
+{
+	if (!pool->mem)
+		return;
+
+	if (pool->locked)
+		munlock(pool->mem, pool->memsize);
+
+	munmap(pool->mem, pool->memsize);
+	pool->mem = NULL;
+}
+
+#else /* _WIN32 */
+
+static
+int pool_alloc_mem(struct block_pool* pool, size_t size, int flags)
+{
+	if (flags)
+		mm_log_warn("Huge pages and memory locking are not supported");
+
+	pool->mem = calloc(1, size);
+	if (!pool->mem)
+		return mm_raise_from_errno("cannot allocate block pool");
+
+	pool->memsize = size;
+	return 0;
+}
+
+
+static
+void pool_free_mem(struct block_pool* pool)
+{
+	free(pool->mem);
+	pool->mem = NULL;
+}
+
+#endif /* _WIN32 */
+
+
+/**************************************************************************
+ *                                                                        *
+ *                       API of block pool                                *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * block_pool_init() - allocate pool of sample blocks
+ * @pool:       pool to initialize
+ * @nblock:     number of blocks in the pool
+ * @strides:    size of one sample for each of the 3 arrays
+ * @ns_max:     maximal number of samples in a block
+ * @flags:      OR-combination of BLOCK_POOL_HUGEPAGES and BLOCK_POOL_MLOCK
+ *
+ * All the memory of the pool is allocated and touched at initialization,
+ * so that getting and filling a block does not involve any allocation nor
+ * page fault.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ */
+int block_pool_init(struct block_pool* pool, int nblock,
+                    const size_t strides[3], int ns_max, int flags)
+{
+	size_t arrsize[3], blksize;
+	char* ptr;
+	int i, j;
+
+	*pool = (struct block_pool) {.nblock = nblock};
+
+	blksize = 0;
+	for (j = 0; j < 3; j++) {
+		arrsize[j] = ALIGN_UP(strides[j] * ns_max, ARRAY_ALIGN);
+		blksize += arrsize[j];
+	}
+
+	pool->blocks = calloc(nblock, sizeof(*pool->blocks));
+	if (!pool->blocks)
+		return mm_raise_from_errno("cannot allocate block pool");
+
+	if (pool_alloc_mem(pool, nblock * blksize, flags)) {
+		free(pool->blocks);
+		pool->blocks = NULL;
+		return -1;
+	}
+
+	// Dispatch the pool memory over the sample arrays of blocks
+	ptr = pool->mem;
+	for (i = 0; i < nblock; i++) {
+		atomic_init(&pool->blocks[i].refcount, 0);
+		for (j = 0; j < 3; j++) {
+			pool->blocks[i].data[j] = arrsize[j] ? ptr : NULL;
+			ptr += arrsize[j];
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * block_pool_deinit() - free resources of pool
+ * @pool:       initialized pool whose blocks have all been released
+ */
+void block_pool_deinit(struct block_pool* pool)
+{
+	pool_free_mem(pool);
+	free(pool->blocks);
+	pool->blocks = NULL;
+}
+
+
+/**
+ * block_pool_get() - get a free block from the pool
+ * @pool:       initialized pool
+ *
+ * Only one thread (the acquisition thread) can get blocks from a pool. The
+ * other threads only release the references they hold.
+ *
+ * Return: pointer to a block holding one reference for the caller, NULL if
+ * all blocks are in use.
+ */
+struct sample_block* block_pool_get(struct block_pool* pool)
+{
+	struct sample_block* blk;
+	int i, idx;
+
+	for (i = 0; i < pool->nblock; i++) {
+		idx = (pool->next + i) % pool->nblock;
+		blk = &pool->blocks[idx];
+
+		if (atomic_load_explicit(&blk->refcount,
+		                         memory_order_acquire) == 0) {
+			atomic_store_explicit(&blk->refcount, 1,
+			                      memory_order_relaxed);
+			pool->next = (idx + 1) % pool->nblock;
+			return blk;
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,92 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef BLOCK_POOL_H
+#define BLOCK_POOL_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "event-tracker.h"
+
+#define BLOCK_POOL_HUGEPAGES    0x01
+#define BLOCK_POOL_MLOCK        0x02
+
+/**
+ * struct sample_block - block of acquired data shared between consumers
+ * @refcount:   number of consumers holding the block. The block is free
+ *              when it drops to 0.
+ * @ns:         number of samples in the block
+ * @data:       sample arrays (eeg, exg, tri) laid out as acquired
+ * @evt:        software events received while the block was acquired
+ */
+struct sample_block {
+	atomic_int refcount;
+	int ns;
+	void* data[3];
+	struct event_stack evt;
+};
+
+/**
+ * struct block_pool - preallocated set of sample blocks
+ * @nblock:     number of blocks in @blocks
+ * @blocks:     array of blocks
+ * @mem:        memory backing the sample arrays of @blocks
+ * @memsize:    size of @mem
+ * @mapped:     true if @mem has been allocated with mmap()
+ * @locked:     true if @mem is locked in RAM
+ * @next:       index where to start looking for a free block
+ */
+struct block_pool {
+	int nblock;
+	struct sample_block* blocks;
+	void* mem;
+	size_t memsize;
+	int mapped;
+	int locked;
+	int next;
+};
+
+int block_pool_init(struct block_pool* pool, int nblock,
+                    const size_t strides[3], int ns_max, int flags);
+void block_pool_deinit(struct block_pool* pool);
+struct sample_block* block_pool_get(struct block_pool* pool);
+
+
+/**
+ * sample_block_ref() - take an additional reference on a block
+ * @blk:        block held by the caller
+ */
+static inline
+void sample_block_ref(struct sample_block* blk)
+{
+	atomic_fetch_add_explicit(&blk->refcount, 1, memory_order_relaxed);
+}
+
+
+/**
+ * sample_block_unref() - release a reference on a block
+ * @blk:        block held by the caller
+ *
+ * Once the last reference is released, the block is given back to the pool.
+ * Its content must not be accessed after the call.
+ */
+static inline
+void sample_block_unref(struct sample_block* blk)
+{
+	atomic_fetch_sub_explicit(&blk->refcount, 1, memory_order_release);
+}
+
+#endif
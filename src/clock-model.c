@@ -0,0 +1,239 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <math.h>
+
+#include "clock-model.h"
+
+// Relative deviation of the fitted period from the nominal one beyond
+// which the regression is considered as unreliable (ie, 1%)
+#define MAX_PERIOD_DEVIATION    0.01
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      Internals of clock model                          *
+ *                                                                        *
+ **************************************************************************/
+
+/*
+ * The centered moments of the window are updated incrementally when a point
+ * enters or leaves it (Welford's method), so that an update does not visit
+ * the whole window. The points are taken relative to an anchor point and
+ * the host times are detrended by the nominal sampling period, to keep the
+ * values small with respect to the precision of double: otherwise the
+ * residuals would be lost in the cancellation of the moments. Since the
+ * window slides away from the anchor and since the incremental updates
+ * accumulate rounding errors, the window is re-anchored on its most recent
+ * point and its moments are recomputed from scratch every time it has been
+ * entirely renewed.
+ */
+
+/**
+ * add_point() - account a new point in the moments of the window
+ * @cm:         clock model
+ * @n:          number of points in the window, including the new one
+ * @pos:        sample index of the point
+ * @ts:         host time (in ns) of the point
+ */
+static
+void add_point(struct clock_model* cm, int n, int64_t pos, int64_t ts)
+{
+	double x = pos - cm->anchor_pos;
+	double y = (ts - cm->anchor_ts) - x * (1e9 / cm->fs);
+	double dx = x - cm->xm;
+	double dy = y - cm->ym;
+
+	cm->xm += dx / n;
+	cm->ym += dy / n;
+	cm->sxx += dx * (x - cm->xm);
+	cm->sxy += dx * (y - cm->ym);
+	cm->syy += dy * (y - cm->ym);
+}
+
+
+/**
+ * remove_point() - withdraw a point from the moments of the window
+ * @cm:         clock model
+ * @n:          number of points remaining in the window (at least 1)
+ * @pos:        sample index of the point
+ * @ts:         host time (in ns) of the point
+ */
+static
+void remove_point(struct clock_model* cm, int n, int64_t pos, int64_t ts)
+{
+	double x = pos - cm->anchor_pos;
+	double y = (ts - cm->anchor_ts) - x * (1e9 / cm->fs);
+	double dx = x - cm->xm;
+	double dy = y - cm->ym;
+
+	cm->xm -= dx / n;
+	cm->ym -= dy / n;
+	cm->sxx -= dx * (x - cm->xm);
+	cm->sxy -= dx * (y - cm->ym);
+	cm->syy -= dy * (y - cm->ym);
+}
+
+
+/**
+ * reanchor() - recompute moments of the window relative to its last point
+ * @cm:         clock model
+ */
+static
+void reanchor(struct clock_model* cm)
+{
+	int i, n = cm->npoint;
+	double x, y, tnom = 1e9 / cm->fs;
+
+	cm->anchor_pos = cm->pos[cm->last];
+	cm->anchor_ts = cm->ts[cm->last];
+	cm->nupdate = 0;
+
+	cm->xm = cm->ym = 0.0;
+	for (i = 0; i < n; i++) {
+		x = cm->pos[i] - cm->anchor_pos;
+		cm->xm += x;
+		cm->ym += (cm->ts[i] - cm->anchor_ts) - x * tnom;
+	}
+	cm->xm /= n;
+	cm->ym /= n;
+
+	cm->sxx = cm->sxy = cm->syy = 0.0;
+	for (i = 0; i < n; i++) {
+		x = cm->pos[i] - cm->anchor_pos;
+		y = ((cm->ts[i] - cm->anchor_ts) - x * tnom) - cm->ym;
+		x -= cm->xm;
+		cm->sxx += x*x;
+		cm->sxy += x*y;
+		cm->syy += y*y;
+	}
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      API of clock model                                *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * clock_model_init() - initialize clock model
+ * @cm:         clock model to initialize
+ * @fs:         nominal sampling frequency
+ * @wsize:      number of most recent points used in the regression
+ *
+ * Until at least 2 points have been added, the model assumes that the
+ * samples are acquired at the nominal sampling frequency.
+ */
+void clock_model_init(struct clock_model* cm, float fs, int wsize)
+{
+	if (wsize < 2)
+		wsize = 2;
+
+	if (wsize > CLOCK_MODEL_MAXPOINT)
+		wsize = CLOCK_MODEL_MAXPOINT;
+
+	cm->fs = fs;
+	cm->wsize = wsize;
+	cm->npoint = 0;
+	cm->last = -1;
+	cm->nupdate = 0;
+	cm->fit = (struct clock_fit) {.period_ns = 1e9 / fs};
+	cm->jitter_ns = 0.0;
+	cm->ppm = 0.0;
+}
+
+
+/**
+ * clock_model_update() - add a point and refit the clock model
+ * @cm:         initialized clock model
+ * @pos:        index of sample
+ * @ts:         host time (in ns) at which sample @pos has been observed
+ *
+ * This adds the point to the window (dropping the oldest one if full) and
+ * updates the least square fit of @ts against @pos over the window. The
+ * cost does not depend on the size of the window, except when the moments
+ * are recomputed after the window has been renewed. The fit reference point
+ * is the centroid of the window, which is where the estimation is the most
+ * accurate.
+ *
+ * If the window has less than 2 points or if the fitted period is not
+ * plausible, the previous period is kept and the model is anchored on the
+ * new point.
+ */
+void clock_model_update(struct clock_model* cm, int64_t pos, int64_t ts)
+{
+	int next, n, full_update;
+	double slope, period, srr, ym, tnom = 1e9 / cm->fs;
+
+	// Recompute the moments from scratch when the window is renewed
+	full_update = (cm->npoint == 0 || cm->nupdate >= cm->wsize);
+
+	next = (cm->last + 1) % cm->wsize;
+	if (cm->npoint == cm->wsize) {
+		if (!full_update)
+			remove_point(cm, cm->npoint - 1,
+			             cm->pos[next], cm->ts[next]);
+	} else {
+		cm->npoint++;
+	}
+
+	cm->last = next;
+	cm->pos[next] = pos;
+	cm->ts[next] = ts;
+	n = cm->npoint;
+
+	if (full_update)
+		reanchor(cm);
+	else
+		add_point(cm, n, pos, ts);
+
+	cm->nupdate++;
+	if (n < 2)
+		goto keep_period;
+
+	// Discard degenerated or nonsensical fits (eg, window too short)
+	if (cm->sxx <= 0.0)
+		goto keep_period;
+
+	// Deviation of the period from the nominal one
+	slope = cm->sxy / cm->sxx;
+	period = tnom + slope;
+	if (fabs(period * cm->fs * 1e-9 - 1.0) > MAX_PERIOD_DEVIATION)
+		goto keep_period;
+
+	// Sum of squared residuals around the fitted line
+	srr = cm->syy - slope * cm->sxy;
+	if (srr < 0.0)
+		srr = 0.0;
+
+	// Mean host time of the window relative to the anchor
+	ym = cm->ym + cm->xm * tnom;
+	cm->fit.ref_ns = cm->anchor_ts + (int64_t)ym;
+	cm->fit.ref_pos = cm->anchor_pos + cm->xm
+	                  + ((int64_t)ym - ym) / period;
+	cm->fit.period_ns = period;
+	cm->jitter_ns = sqrt(srr / n);
+	cm->ppm = (1e9 / (period * cm->fs) - 1.0) * 1e6;
+	return;
+
+keep_period:
+	cm->fit.ref_ns = ts;
+	cm->fit.ref_pos = pos;
+}
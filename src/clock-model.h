@@ -0,0 +1,94 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef CLOCK_MODEL_H
+#define CLOCK_MODEL_H
+
+#include <stdint.h>
+
+// Maximal number of points in the regression window
+#define CLOCK_MODEL_MAXPOINT    2048
+
+/**
+ * struct clock_fit - linear relation between host time and sample index
+ * @ref_ns:     host time (in ns) of the reference point
+ * @ref_pos:    sample index of the reference point
+ * @period_ns:  estimated duration of one sample in host time (in ns)
+ */
+struct clock_fit {
+	int64_t ref_ns;
+	double ref_pos;
+	double period_ns;
+};
+
+/**
+ * struct clock_model - windowed regression of host time on sample index
+ * @fs:         nominal sampling frequency
+ * @wsize:      maximal number of points used in the regression (at most
+ *              CLOCK_MODEL_MAXPOINT)
+ * @npoint:     number of points currently in the window
+ * @last:       index in @pos and @ts of the most recent point
+ * @pos:        sample indices of the points (ring buffer)
+ * @ts:         host time (in ns) of the points (ring buffer)
+ * @anchor_pos: sample index relative to which the moments are accumulated
+ * @anchor_ts:  host time (in ns) relative to which the moments are
+ *              accumulated
+ * @nupdate:    number of points added since the moments have been
+ *              recomputed relative to the current anchor
+ * @xm:         mean of sample indices of the window relative to @anchor_pos
+ * @ym:         mean of detrended host times of the window, ie, relative to
+ *              @anchor_ts and to the nominal duration of the samples since
+ *              @anchor_pos
+ * @sxx:        sum of squared deviations of sample indices from @xm
+ * @sxy:        sum of products of deviations of indices and detrended times
+ * @syy:        sum of squared deviations of detrended host times from @ym
+ * @fit:        result of the last regression
+ * @jitter_ns:  RMS of residual host time around @fit (in ns)
+ * @ppm:        estimated deviation of sampling rate from @fs in ppm
+ */
+struct clock_model {
+	float fs;
+	int wsize;
+	int npoint;
+	int last;
+	int64_t pos[CLOCK_MODEL_MAXPOINT];
+	int64_t ts[CLOCK_MODEL_MAXPOINT];
+	int64_t anchor_pos;
+	int64_t anchor_ts;
+	int nupdate;
+	double xm, ym;
+	double sxx, sxy, syy;
+	struct clock_fit fit;
+	double jitter_ns;
+	double ppm;
+};
+
+void clock_model_init(struct clock_model* cm, float fs, int wsize);
+void clock_model_update(struct clock_model* cm, int64_t pos, int64_t ts);
+
+/**
+ * clock_fit_get_pos() - estimate sample index at a given host time
+ * @fit:        fitted clock relation
+ * @ts:         host time (in ns)
+ *
+ * Return: the (fractional) sample index corresponding to @ts
+ */
+static inline
+double clock_fit_get_pos(const struct clock_fit* fit, int64_t ts)
+{
+	return fit->ref_pos + (ts - fit->ref_ns) / fit->period_ns;
+}
+
+#endif
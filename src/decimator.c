@@ -0,0 +1,161 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <math.h>
+#include <mmerrno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decimator.h"
+
+// Number of filter coefficients per unit of decimation factor
+#define TAPS_PER_FACTOR 8
+
+// Cutoff frequency relative to the Nyquist frequency of the decimated
+// signal. Keeping it below 1 leaves room for the transition band.
+#define REL_CUTOFF      0.8
+
+
+/**
+ * design_lowpass() - compute coefficients of anti-aliasing filter
+ * @coefs:      array of @ntap coefficients to fill
+ * @ntap:       number of coefficients (odd)
+ * @factor:     decimation factor
+ *
+ * The filter is a Hamming windowed sinc whose gain is normalized to 1 at
+ * DC, so that the offsets of signals are preserved.
+ */
+static
+void design_lowpass(float* coefs, int ntap, int factor)
+{
+	int i, mid = ntap / 2;
+	double fc, x, w, sum = 0.0;
+
+	fc = REL_CUTOFF * 0.5 / factor;
+	for (i = 0; i < ntap; i++) {
+		x = i - mid;
+		w = 0.54 - 0.46 * cos(2.0 * M_PI * i / (ntap-1));
+		coefs[i] = w * ((x == 0) ? 2*fc : sin(2*M_PI*fc*x) / (M_PI*x));
+		sum += coefs[i];
+	}
+
+	for (i = 0; i < ntap; i++)
+		coefs[i] /= sum;
+}
+
+
+/**
+ * decimator_init() - initialize decimation stage
+ * @dec:        decimator to initialize
+ * @nch:        number of channels
+ * @factor:     decimation factor (1 means no decimation)
+ * @ns_max:     maximal number of samples that will be processed at once
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ */
+int decimator_init(struct decimator* dec, int nch, int factor, int ns_max)
+{
+	int ntap;
+
+	ntap = (factor > 1) ? TAPS_PER_FACTOR*factor + 1 : 1;
+
+	*dec = (struct decimator) {
+		.factor = factor,
+		.nch = nch,
+		.ntap = ntap,
+		.ns_max = ns_max,
+	};
+
+	dec->coefs = malloc(ntap * sizeof(*dec->coefs));
+	dec->buff = calloc((ntap - 1 + ns_max) * nch, sizeof(*dec->buff));
+	if (!dec->coefs || !dec->buff) {
+		decimator_deinit(dec);
+		return mm_raise_from_errno("cannot allocate decimator");
+	}
+
+	if (factor > 1)
+		design_lowpass(dec->coefs, ntap, factor);
+	else
+		dec->coefs[0] = 1.0f;
+
+	return 0;
+}
+
+
+/**
+ * decimator_deinit() - free resources of decimation stage
+ * @dec:        decimator initialized with decimator_init()
+ */
+void decimator_deinit(struct decimator* dec)
+{
+	free(dec->coefs);
+	free(dec->buff);
+	dec->coefs = NULL;
+	dec->buff = NULL;
+}
+
+
+/**
+ * decimator_process() - filter and decimate a block of samples
+ * @dec:        initialized decimator
+ * @ns:         number of samples in @in (at most @ns_max)
+ * @in:         input samples with channels interleaved
+ * @out:        output samples with channels interleaved. Must be large
+ *              enough to hold @ns / @factor + 1 samples.
+ *
+ * The state of the filter is kept between calls, so the successive
+ * blocks are processed as a continuous stream. The output samples
+ * correspond to the input samples whose index in the stream is a multiple
+ * of @factor.
+ *
+ * Return: the number of samples written in @out
+ */
+int decimator_process(struct decimator* dec, int ns,
+                      const float* in, float* out)
+{
+	int i, k, ch, nout;
+	int nch = dec->nch, ntap = dec->ntap;
+	const float *x, *c = dec->coefs;
+	float* y;
+
+	// Append new samples after the past ones
+	memcpy(dec->buff + (ntap-1)*nch, in, ns*nch*sizeof(*in));
+
+	nout = 0;
+	for (i = dec->skip; i < ns; i += dec->factor) {
+		// Convolve filter with the ntap samples ending at i
+		x = dec->buff + i*nch;
+		y = out + nout*nch;
+		for (ch = 0; ch < nch; ch++)
+			y[ch] = 0.0f;
+
+		for (k = 0; k < ntap; k++) {
+			for (ch = 0; ch < nch; ch++)
+				y[ch] += c[k] * x[k*nch + ch];
+		}
+
+		nout++;
+	}
+	dec->skip = i - ns;
+
+	// Keep the last ntap-1 samples for the next call
+	memmove(dec->buff, dec->buff + ns*nch, (ntap-1)*nch*sizeof(*in));
+
+	return nout;
+}
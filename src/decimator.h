@@ -0,0 +1,45 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+/**
+ * struct decimator - anti-aliased decimation of multichannel signal
+ * @factor:     decimation factor
+ * @nch:        number of channels
+ * @ntap:       number of coefficients of the anti-aliasing FIR filter
+ * @ns_max:     maximal number of samples processed at once
+ * @coefs:      coefficients of the FIR filter
+ * @buff:       (@ntap-1) past samples followed by the samples being
+ *              processed, with channels interleaved
+ * @skip:       number of input samples to skip before next output sample
+ */
+struct decimator {
+	int factor;
+	int nch;
+	int ntap;
+	int ns_max;
+	float* coefs;
+	float* buff;
+	int skip;
+};
+
+int decimator_init(struct decimator* dec, int nch, int factor, int ns_max);
+void decimator_deinit(struct decimator* dec);
+int decimator_process(struct decimator* dec, int ns,
+                      const float* in, float* out);
+
+#endif
@@ -0,0 +1,783 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <mmargparse.h>
+#include <mmlib.h>
+#include <mmsysio.h>
+#include <mmtime.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xdfio.h>
+
+#include "preproc.h"
+#include "sample-conv.h"
+#include "spool.h"
+
+static int fs = 2048;
+static int neeg = 64;
+static int nsensor = 8;
+static int duration = 60;
+static const char* spool_path = "eegview-bench." SPOOL_EXT;
+static const char* xdf_stem = "eegview-bench";
+
+static char bench_doc[] =
+	"eegview-bench measures the cost of the processing stages of eegview "
+	"on synthetic signals. If no benchmark is specified, all are run. "
+	"Available benchmarks: spool, conv, preproc.";
+
+static char bench_synopsys[] = "[options] [benchmark...]";
+
+static const struct mm_arg_opt cmdline_optv[] = {
+	{"fs", MM_OPT_NEEDINT, NULL, {.iptr = &fs},
+	 "Sampling frequency of the synthetic signals"},
+	{"eeg-channels", MM_OPT_NEEDINT, NULL, {.iptr = &neeg},
+	 "Number of EEG channels"},
+	{"sensor-channels", MM_OPT_NEEDINT, NULL, {.iptr = &nsensor},
+	 "Number of sensor channels"},
+	{"d|duration", MM_OPT_NEEDINT, NULL, {.iptr = &duration},
+	 "Duration in seconds of the synthetic signals"},
+	{"spool-file", MM_OPT_NEEDSTR, NULL, {.sptr = &spool_path},
+	 "Path of the temporary file written by the spool benchmark"},
+	{"xdf-file", MM_OPT_NEEDSTR, NULL, {.sptr = &xdf_stem},
+	 "Path without extension of the temporary BDF and GDF files written "
+	 "by the conv benchmark"},
+};
+
+/**
+ * struct signal - synthetic acquisition arrays
+ * @ns:         number of samples
+ * @nch:        number of channels in each array
+ * @strides:    size of one sample in each array
+ * @data:       interleaved samples of each array (float, float, int32)
+ */
+struct signal {
+	int ns;
+	int nch[3];
+	size_t strides[3];
+	void* data[3];
+};
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Synthetic signals                                         *
+ *                                                                        *
+ **************************************************************************/
+// Resolution of a 24 bit EEG amplifier (in uV)
+#define EEG_LSB         (1.0f / 32)
+
+// Physical range of each array, as advertised by a device
+static const double signal_mm[2][2] = {
+	{-262144.0, 262143.96875},      // EEG: 24 bit of EEG_LSB
+	{-10.0, 10.0},                  // sensors
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static
+double rand_uniform(void)
+{
+	// xorshift64*: fast and deterministic across runs
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return ((rng_state * 2685821657736338717ull) >> 11) * 0x1.0p-53;
+}
+
+
+static
+double rand_noise(void)
+{
+	// Sum of uniforms: approximately gaussian of unit variance
+	return (rand_uniform() + rand_uniform() + rand_uniform()
+	        + rand_uniform() - 2.0) * 1.7320508;
+}
+
+
+/**
+ * gen_signal() - generate EEG-like synthetic arrays
+ * @sig:        signal whose @ns and @nch are set
+ *
+ * EEG channels are a mix of alpha rhythm, slow drift and noise, quantized
+ * like the output of an amplifier. Sensors are slow signals and triggers
+ * change seldom.
+ *
+ * Return: 0 in case of success, -1 if allocation failed
+ */
+static
+int gen_signal(struct signal* sig)
+{
+	float *eeg, *sensor;
+	int32_t* trigger;
+	double t, v;
+	int i, ch;
+
+	for (i = 0; i < 3; i++) {
+		sig->strides[i] = sig->nch[i] * sizeof(int32_t);
+		sig->data[i] = malloc(sig->ns * sig->strides[i] + 1);
+		if (!sig->data[i])
+			return -1;
+	}
+
+	eeg = sig->data[0];
+	sensor = sig->data[1];
+	trigger = sig->data[2];
+	for (i = 0; i < sig->ns; i++) {
+		t = (double)i / fs;
+		for (ch = 0; ch < sig->nch[0]; ch++) {
+			v = 20.0 * sin(2*M_PI*10.0*t + ch*0.1)
+			    + 50.0 * sin(2*M_PI*0.1*t + ch)
+			    + 5.0 * rand_noise();
+			eeg[i*sig->nch[0] + ch] = roundf(v / EEG_LSB) * EEG_LSB;
+		}
+
+		for (ch = 0; ch < sig->nch[1]; ch++)
+			sensor[i*sig->nch[1] + ch] = sin(2*M_PI*0.5*t + ch)
+			                             + 0.01 * rand_noise();
+
+		for (ch = 0; ch < sig->nch[2]; ch++)
+			trigger[i*sig->nch[2] + ch] = (i / fs) % 4 ? 0 : 0xff;
+	}
+
+	return 0;
+}
+
+
+static
+void free_signal(struct signal* sig)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		free(sig->data[i]);
+		sig->data[i] = NULL;
+	}
+}
+
+
+static
+int64_t elapsed_ns(const struct mm_timespec* start, clockid_t clk)
+{
+	struct mm_timespec now;
+
+	mm_gettime(clk, &now);
+	return mm_timediff_ns(&now, start);
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Benchmarks                                                *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * bench_spool() - measure compression ratio and cost of spool files
+ * @sig:        synthetic signal to compress
+ *
+ * The signal is written as fast as possible in a spool file by blocks of
+ * 32 samples, as the recorder would do, then read back through the memory
+ * mapping and compared with the original.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int bench_spool(const struct signal* sig)
+{
+	struct spool_chdesc* chdesc;
+	struct spool_stats stats;
+	struct spool_reader rd;
+	struct spool* sp;
+	struct mm_timespec start;
+	int64_t write_ns, decode_ns;
+	void* out[3];
+	int i, j, ns, nchtot, first, mismatch;
+	const int blk_ns = 32;
+
+	nchtot = sig->nch[0] + sig->nch[1] + sig->nch[2];
+	chdesc = calloc(nchtot + 1, sizeof(*chdesc));
+	if (!chdesc)
+		return -1;
+
+	sp = spool_create(spool_path, fs, 0.0, sig->nch, chdesc);
+	free(chdesc);
+	if (!sp) {
+		fprintf(stderr, "Cannot create %s: %s\n",
+		        spool_path, strerror(errno));
+		return -1;
+	}
+
+	mm_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < sig->ns; i += blk_ns) {
+		ns = (sig->ns - i < blk_ns) ? sig->ns - i : blk_ns;
+		spool_write(sp, ns,
+		            (char*)sig->data[0] + i*sig->strides[0],
+		            (char*)sig->data[1] + i*sig->strides[1],
+		            (char*)sig->data[2] + i*sig->strides[2]);
+	}
+
+	if (spool_close(sp, &stats)) {
+		fprintf(stderr, "Cannot write %s: %s\n",
+		        spool_path, strerror(errno));
+		mm_unlink(spool_path);
+		return -1;
+	}
+	write_ns = elapsed_ns(&start, CLOCK_MONOTONIC);
+
+	if (spool_reader_open(&rd, spool_path)) {
+		fprintf(stderr, "Cannot read %s: %s\n",
+		        spool_path, strerror(errno));
+		mm_unlink(spool_path);
+		return -1;
+	}
+
+	for (i = 0; i < 3; i++)
+		out[i] = malloc(rd.hdr->chunk_ns * sig->strides[i] + 1);
+
+	// Decode all chunks and check that compression is lossless
+	mismatch = !out[0] || !out[1] || !out[2];
+	decode_ns = 0;
+	for (i = 0; i < rd.nchunk && !mismatch; i++) {
+		first = rd.chunks[i]->first;
+		mm_gettime(CLOCK_MONOTONIC, &start);
+		ns = spool_reader_decode(&rd, i, out);
+		decode_ns += elapsed_ns(&start, CLOCK_MONOTONIC);
+		for (j = 0; j < 3; j++)
+			if (ns < 0 || memcmp(out[j],
+			                     (char*)sig->data[j]
+			                     + first*sig->strides[j],
+			                     ns*sig->strides[j]))
+				mismatch = 1;
+	}
+
+	if (rd.ns != sig->ns)
+		mismatch = 1;
+
+	printf("spool: %i+%i+%i channels, %i s at %i Hz\n",
+	       sig->nch[0], sig->nch[1], sig->nch[2], duration, fs);
+	printf("  compression ratio:     %.2f (%.1f MiB -> %.1f MiB)\n",
+	       (double)stats.raw_size / stats.size,
+	       stats.raw_size / 1048576.0, stats.size / 1048576.0);
+	printf("  compression CPU time:  %.1f ms "
+	       "(%.3f ms per second of signal)\n",
+	       stats.cpu_ns * 1e-6, stats.cpu_ns * 1e-6 / duration);
+	printf("  write wall time:       %.1f ms (%.0fx real time)\n",
+	       write_ns * 1e-6, duration * 1e9 / write_ns);
+	printf("  decompression time:    %.1f ms "
+	       "(%.3f ms per second of signal)\n",
+	       decode_ns * 1e-6, decode_ns * 1e-6 / duration);
+	printf("  lossless:              %s\n",
+	       mismatch ? "NO" : "yes");
+
+	for (i = 0; i < 3; i++)
+		free(out[i]);
+
+	spool_reader_close(&rd);
+	mm_unlink(spool_path);
+	return mismatch ? -1 : 0;
+}
+
+
+/**
+ * init_conv() - initialize conversions of synthetic float arrays
+ * @conv:       conversions of the EEG and sensor arrays to initialize
+ * @sig:        synthetic signal
+ * @width:      size in bytes of a converted value
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int init_conv(struct sample_conv conv[2], const struct signal* sig, int width)
+{
+	int i, j;
+
+	for (j = 0; j < 2; j++) {
+		if (sample_conv_init(&conv[j], sig->nch[j], width)) {
+			if (j == 1)
+				sample_conv_deinit(&conv[0]);
+			return -1;
+		}
+
+		for (i = 0; i < sig->nch[j]; i++)
+			sample_conv_set_range(&conv[j], i,
+			                      signal_mm[j][0], signal_mm[j][1]);
+	}
+
+	return 0;
+}
+
+
+/**
+ * time_conv() - measure speed of conversion of float arrays
+ * @sig:        synthetic signal to convert
+ * @conv:       conversions of the EEG and sensor arrays
+ * @out:        buffers receiving the converted EEG and sensor arrays
+ *
+ * The signal is converted by blocks of 32 samples, as the recorder would
+ * do.
+ *
+ * Return: conversion time in ns
+ */
+static
+int64_t time_conv(const struct signal* sig, const struct sample_conv conv[2],
+                  void* out[2])
+{
+	struct mm_timespec start;
+	size_t stride;
+	int i, j, ns;
+	const int blk_ns = 32;
+
+	mm_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < sig->ns; i += blk_ns) {
+		ns = (sig->ns - i < blk_ns) ? sig->ns - i : blk_ns;
+		for (j = 0; j < 2; j++) {
+			stride = conv[j].nch * conv[j].width;
+			sample_conv_run(&conv[j], ns,
+			                (const float*)((char*)sig->data[j]
+			                               + i*sig->strides[j]),
+			                sig->strides[j],
+			                (char*)out[j] + i*stride, stride);
+		}
+	}
+
+	return elapsed_ns(&start, CLOCK_MONOTONIC);
+}
+
+
+static
+long long get_file_size(const char* path)
+{
+	struct mm_stat st;
+	int fd;
+
+	fd = mm_open(path, O_RDONLY, 0);
+	if (fd < 0)
+		return -1;
+
+	if (mm_fstat(fd, &st)) {
+		mm_close(fd);
+		return -1;
+	}
+
+	mm_close(fd);
+	return st.size;
+}
+
+
+/**
+ * write_xdf() - write synthetic signal in BDF or GDF file
+ * @sig:        synthetic signal to write
+ * @path:       path of the file to create
+ * @fmt:        XDF_BDF or XDF_GDF2
+ * @conv:       conversions of the EEG and sensor arrays, NULL to let
+ *              xdffileio convert the float arrays
+ * @wall_ns:    pointer receiving the time spent to write the file
+ *
+ * The float arrays are written by blocks of 32 samples, either as float,
+ * or converted by @conv into packed integers first, as the recorder
+ * would do.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int write_xdf(const struct signal* sig, const char* path, int fmt,
+              const struct sample_conv* conv, int64_t* wall_ns)
+{
+	struct xdf* xdf;
+	struct xdfch* ch;
+	struct mm_timespec start;
+	const void* data[3];
+	void* buf[2] = {NULL, NULL};
+	size_t strides[3] = {sig->strides[0], sig->strides[1],
+	                     sig->strides[2]};
+	char label[16];
+	int i, j, ns, dtype, width, rv = -1;
+	const int blk_ns = 32;
+
+	xdf = xdf_open(path, XDF_WRITE, fmt);
+	if (!xdf) {
+		fprintf(stderr, "Cannot create %s: %s\n",
+		        path, strerror(errno));
+		return -1;
+	}
+
+	xdf_set_conf(xdf, XDF_F_REC_DURATION, 1.0,
+	             XDF_F_REC_NSAMPLE, fs, XDF_NOF);
+
+	for (i = 0; i < 3; i++) {
+		width = (i < 2 && conv) ? conv[i].width : 4;
+		dtype = XDFINT32;
+		if (i < 2)
+			dtype = conv ? (width == 2 ? XDFINT16 : XDFINT24)
+			             : XDFFLOAT;
+
+		for (j = 0; j < sig->nch[i]; j++) {
+			snprintf(label, sizeof(label), "%c%i", "EST"[i], j+1);
+			ch = xdf_add_channel(xdf, label);
+			if (!ch
+			   || xdf_set_chconf(ch,
+			                     XDF_CF_ARRDIGITAL, (i < 2 && conv),
+			                     XDF_CF_ARRINDEX, i,
+			                     XDF_CF_ARROFFSET, j * width,
+			                     XDF_CF_ARRTYPE, dtype,
+			                     XDF_CF_STOTYPE,
+			                     xdf_closest_type(xdf, dtype),
+			                     XDF_NOF))
+				goto exit;
+
+			if (i == 2)
+				continue;
+
+			xdf_set_chconf(ch, XDF_CF_PMIN, signal_mm[i][0],
+			               XDF_CF_PMAX, signal_mm[i][1], XDF_NOF);
+			if (conv)
+				xdf_set_chconf(ch,
+				               XDF_CF_DMIN, (double)conv[i].dmin,
+				               XDF_CF_DMAX, (double)conv[i].dmax,
+				               XDF_NOF);
+		}
+
+		if (i < 2 && conv) {
+			strides[i] = sig->nch[i] * width;
+			buf[i] = malloc(blk_ns * strides[i] + 1);
+			if (!buf[i])
+				goto exit;
+		}
+	}
+
+	xdf_define_arrays(xdf, 3, strides);
+	if (xdf_prepare_transfer(xdf))
+		goto exit;
+
+	mm_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < sig->ns; i += blk_ns) {
+		ns = (sig->ns - i < blk_ns) ? sig->ns - i : blk_ns;
+		for (j = 0; j < 3; j++)
+			data[j] = (char*)sig->data[j] + i*sig->strides[j];
+
+		for (j = 0; j < 2 && conv; j++) {
+			sample_conv_run(&conv[j], ns, data[j], sig->strides[j],
+			                buf[j], strides[j]);
+			data[j] = buf[j];
+		}
+
+		if (xdf_write(xdf, ns, data[0], data[1], data[2]) < 0)
+			goto exit;
+	}
+
+	rv = 0;
+
+exit:
+	if (xdf_close(xdf))
+		rv = -1;
+
+	if (rv)
+		fprintf(stderr, "Cannot write %s: %s\n",
+		        path, strerror(errno));
+	else
+		*wall_ns = elapsed_ns(&start, CLOCK_MONOTONIC);
+
+	free(buf[0]);
+	free(buf[1]);
+	return rv;
+}
+
+
+/**
+ * bench_conv() - compare float to integer conversions
+ * @sig:        synthetic signal to convert
+ *
+ * The EEG and sensor arrays are converted into int24 and int16 with each
+ * implementation supported by the CPU, and the results are checked to be
+ * identical. Then the signal is written in BDF and GDF files through the
+ * float path of xdffileio and through the conversion kernels to compare
+ * the cost and size of each storage.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int bench_conv(const struct signal* sig)
+{
+	static const struct {
+		const char* ext;
+		int fmt;
+		int width;
+	} files[] = {
+		{"bdf", XDF_BDF, 0},
+		{"bdf", XDF_BDF, 3},
+		{"gdf", XDF_GDF2, 0},
+		{"gdf", XDF_GDF2, 3},
+		{"gdf", XDF_GDF2, 2},
+	};
+	struct sample_conv conv[2];
+	void *ref[2], *out[2];
+	char path[1024];
+	int64_t conv_ns, wall_ns;
+	long long size;
+	size_t len[2];
+	int i, j, width, impl, failed = 0, mismatch = 0;
+	int nch = sig->nch[0] + sig->nch[1];
+
+	printf("conv: %i+%i float channels, %i s at %i Hz\n",
+	       sig->nch[0], sig->nch[1], duration, fs);
+
+	for (width = 3; width >= 2 && !failed; width--) {
+		if (init_conv(conv, sig, width))
+			return -1;
+
+		for (j = 0; j < 2; j++) {
+			len[j] = (size_t)sig->ns * sig->nch[j] * width;
+			ref[j] = malloc(len[j] + 1);
+			out[j] = malloc(len[j] + 1);
+			if (!ref[j] || !out[j])
+				failed = 1;
+		}
+
+		for (impl = 0; impl < SAMPLE_CONV_NIMPL && !failed; impl++) {
+			if (sample_conv_set_impl(&conv[0], impl)
+			    || sample_conv_set_impl(&conv[1], impl))
+				continue;
+
+			// Check all implementations against the scalar one
+			conv_ns = time_conv(sig, conv,
+			                    impl == SAMPLE_CONV_SCALAR ? ref : out);
+			if (impl != SAMPLE_CONV_SCALAR
+			    && (memcmp(ref[0], out[0], len[0])
+			        || memcmp(ref[1], out[1], len[1])))
+				mismatch = 1;
+
+			printf("  int%i %-6s conversion: %.3f ns/sample/channel "
+			       "(%.3f ms per second of signal)\n",
+			       width*8, sample_conv_get_impl_name(impl),
+			       (double)conv_ns / sig->ns / (nch ? nch : 1),
+			       conv_ns * 1e-6 / duration);
+		}
+
+		for (j = 0; j < 2; j++) {
+			free(ref[j]);
+			free(out[j]);
+			sample_conv_deinit(&conv[j]);
+		}
+	}
+
+	// Compare the float path of xdffileio with prior conversion
+	for (i = 0; i < (int)MM_NELEM(files) && !failed; i++) {
+		snprintf(path, sizeof(path), "%s.%s", xdf_stem, files[i].ext);
+		width = files[i].width;
+		if (width && init_conv(conv, sig, width))
+			return -1;
+
+		failed = write_xdf(sig, path, files[i].fmt,
+		                   width ? conv : NULL, &wall_ns);
+		size = get_file_size(path);
+		mm_unlink(path);
+		if (width) {
+			sample_conv_deinit(&conv[0]);
+			sample_conv_deinit(&conv[1]);
+		}
+
+		if (failed)
+			break;
+
+		printf("  %s %-5s write by %-9s: %.1f ms "
+		       "(%.0fx real time), %.1f MiB\n", files[i].ext,
+		       width ? (width == 2 ? "int16" : "int24") : "float",
+		       width ? "eegview" : "xdffileio", wall_ns * 1e-6,
+		       duration * 1e9 / wall_ns, size / 1048576.0);
+	}
+
+	printf("  identical conversions: %s\n", mismatch ? "NO" : "yes");
+	return (failed || mismatch) ? -1 : 0;
+}
+
+
+/**
+ * bench_preproc() - measure cost of EEG preprocessing
+ * @sig:        synthetic signal to process
+ *
+ * The EEG array goes through a 50 Hz notch, a 1-40 Hz band-pass and the
+ * common average reference by blocks of 32 samples, as the acquisition
+ * thread would do, with each implementation supported by the CPU. The
+ * output is compared with the one of the scalar implementation.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int bench_preproc(const struct signal* sig)
+{
+	const struct preproc_cfg cfg = {
+		.notch = 50.0,
+		.notch_q = 30.0,
+		.hp_cutoff = 1.0,
+		.lp_cutoff = 40.0,
+		.car = 1,
+	};
+	struct preproc pp;
+	struct mm_timespec start;
+	const float* in = sig->data[0];
+	float *ref, *out, *dst;
+	double dev, maxdev;
+	int64_t proc_ns;
+	size_t len, k;
+	int i, ns, impl, nch = sig->nch[0], rv = 0;
+	const int blk_ns = 32;
+
+	if (preproc_init(&pp, nch, blk_ns, fs, &cfg)) {
+		fprintf(stderr, "Cannot setup preprocessing: %s\n",
+		        strerror(errno));
+		return -1;
+	}
+
+	len = (size_t)sig->ns * nch;
+	ref = malloc(len * sizeof(*ref) + 1);
+	out = malloc(len * sizeof(*out) + 1);
+	if (!ref || !out) {
+		rv = -1;
+		goto exit;
+	}
+
+	printf("preproc: %i EEG channels, %i s at %i Hz, "
+	       "%i filter sections and common average\n",
+	       nch, duration, fs, pp.nbiquad);
+
+	for (impl = 0; impl < PREPROC_NIMPL; impl++) {
+		if (preproc_set_impl(&pp, impl))
+			continue;
+
+		preproc_reset(&pp);
+		dst = (impl == PREPROC_SCALAR) ? ref : out;
+		mm_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < sig->ns; i += blk_ns) {
+			ns = (sig->ns - i < blk_ns) ? sig->ns - i : blk_ns;
+			preproc_process(&pp, ns, in + i*nch, dst + i*nch);
+		}
+		proc_ns = elapsed_ns(&start, CLOCK_MONOTONIC);
+
+		// Only the rounding of the common average may differ
+		maxdev = 0.0;
+		for (k = 0; k < len && impl != PREPROC_SCALAR; k++) {
+			dev = fabs((double)out[k] - ref[k]);
+			if (dev > maxdev)
+				maxdev = dev;
+		}
+
+		printf("  %-6s %.3f ns/sample/channel "
+		       "(%.3f ms per second of signal), "
+		       "max deviation %.2g uV\n",
+		       preproc_get_impl_name(impl),
+		       (double)proc_ns / sig->ns / (nch ? nch : 1),
+		       proc_ns * 1e-6 / duration, maxdev);
+	}
+
+exit:
+	free(ref);
+	free(out);
+	preproc_deinit(&pp);
+	return rv;
+}
+
+
+/**
+ * struct benchmark - benchmark selectable on command line
+ * @name:       name of the benchmark
+ * @run:        function running the benchmark
+ */
+struct benchmark {
+	const char* name;
+	int (*run)(const struct signal* sig);
+};
+
+static const struct benchmark benchmarks[] = {
+	{"spool", bench_spool},
+	{"conv", bench_conv},
+	{"preproc", bench_preproc},
+};
+
+
+static
+const struct benchmark* find_benchmark(const char* name)
+{
+	int i;
+
+	for (i = 0; i < (int)MM_NELEM(benchmarks); i++)
+		if (!strcmp(benchmarks[i].name, name))
+			return &benchmarks[i];
+
+	return NULL;
+}
+
+
+int main(int argc, char* argv[])
+{
+	struct signal sig = {.data = {NULL, NULL, NULL}};
+	const struct benchmark* bench;
+	int argi, i, retcode = EXIT_SUCCESS;
+	struct mm_arg_parser parser = {
+		.doc = bench_doc,
+		.args_doc = bench_synopsys,
+		.optv = cmdline_optv,
+		.num_opt = MM_NELEM(cmdline_optv),
+		.execname = "eegview-bench",
+	};
+
+	argi = mm_arg_parse(&parser, argc, argv);
+	if (argi < 0)
+		return EXIT_FAILURE;
+
+	if (fs <= 0 || duration <= 0 || neeg < 0 || nsensor < 0) {
+		fprintf(stderr, "Invalid signal parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = argi; i < argc; i++) {
+		if (!find_benchmark(argv[i])) {
+			fprintf(stderr, "Unknown benchmark: %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	sig.ns = fs * duration;
+	sig.nch[0] = neeg;
+	sig.nch[1] = nsensor;
+	sig.nch[2] = 1;
+	if (gen_signal(&sig)) {
+		fprintf(stderr, "Cannot allocate signal\n");
+		free_signal(&sig);
+		return EXIT_FAILURE;
+	}
+
+	if (argi == argc) {
+		for (i = 0; i < (int)MM_NELEM(benchmarks); i++)
+			if (benchmarks[i].run(&sig))
+				retcode = EXIT_FAILURE;
+	} else {
+		for (i = argi; i < argc; i++) {
+			bench = find_benchmark(argv[i]);
+			if (bench->run(&sig))
+				retcode = EXIT_FAILURE;
+		}
+	}
+
+	free_signal(&sig);
+	return retcode;
+}
@@ -0,0 +1,85 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef EEGVIEW_EVENTS_H
+#define EEGVIEW_EVENTS_H
+
+#include <stdint.h>
+
+/*
+ * Protocol of software events sent to eegview
+ *
+ * A client connected to the event port of eegview can send events in one
+ * of the two following modes. All fields are in native byte order.
+ *
+ * Legacy mode: the client sends a stream of uint32_t, each being the code
+ * of an event. The event is timestamped upon reception by eegview.
+ *
+ * Framed mode: the client first sends a struct eegview_evt_hello whose
+ * magic field is EEGVIEW_EVT_MAGIC, then a stream of records, each starting
+ * with struct eegview_evt_record. The size field of a record allows future
+ * versions to append data to it: eegview skips the bytes it does not know.
+ * Many records can (and should) be sent in a single write.
+ *
+ * Since a legacy client can send an event whose code is EEGVIEW_EVT_MAGIC,
+ * eegview selects the framed mode only when the header (with reserved field
+ * set to 0) and the first complete record are valid. In particular, the
+ * flags of the record must be known and its reserved field must be 0. Until
+ * then, the data of the connection is kept pending.
+ */
+
+#define EEGVIEW_EVT_MAGIC       0x56454745      // "EGEV" in little endian
+#define EEGVIEW_EVT_VERSION     1
+
+// Flags of struct eegview_evt_record
+#define EEGVIEW_EVT_TIMESTAMP   0x0001  // timestamp field is valid
+#define EEGVIEW_EVT_DURATION    0x0002  // duration field is valid
+
+/**
+ * struct eegview_evt_hello - header of framed mode
+ * @magic:      must be EEGVIEW_EVT_MAGIC
+ * @version:    version of protocol used by client (EEGVIEW_EVT_VERSION)
+ * @reserved:   must be 0
+ */
+struct eegview_evt_hello {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+};
+
+/**
+ * struct eegview_evt_record - event sent in framed mode
+ * @size:       size in bytes of the record (at least
+ *              sizeof(struct eegview_evt_record))
+ * @flags:      combination of EEGVIEW_EVT_* flags
+ * @code:       code of the event
+ * @timestamp:  time of the event (in ns) measured with CLOCK_MONOTONIC on
+ *              the host running eegview
+ * @duration:   duration of the event in seconds
+ * @reserved:   must be 0
+ *
+ * If EEGVIEW_EVT_TIMESTAMP is not set, the event is timestamped upon
+ * reception. If EEGVIEW_EVT_DURATION is not set, the duration is 0.
+ */
+struct eegview_evt_record {
+	uint16_t size;
+	uint16_t flags;
+	uint32_t code;
+	int64_t timestamp;
+	float duration;
+	uint32_t reserved;
+};
+
+#endif
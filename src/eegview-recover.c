@@ -0,0 +1,525 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <mmargparse.h>
+#include <mmlib.h>
+#include <mmsysio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "journal.h"
+
+#define FIXED_HDR_SIZE  256
+
+/**
+ * struct rec_file - layout of a recorded file
+ * @fd:         file descriptor of the opened file
+ * @is_gdf:     true for a GDF file, false for a BDF file
+ * @nch:        number of channels
+ * @hdrlen:     size of the header (fixed and channel parts)
+ * @recsize:    size of a data record
+ * @spr:        number of samples per record
+ * @nrec_hdr:   number of records reported in the header
+ * @size:       size of the file
+ */
+struct rec_file {
+	int fd;
+	int is_gdf;
+	int nch;
+	int64_t hdrlen;
+	int64_t recsize;
+	int spr;
+	int64_t nrec_hdr;
+	int64_t size;
+};
+
+static const char* dry_run = NULL;
+static const char* keep_journal = NULL;
+static const char* force = NULL;
+
+static char recover_doc[] =
+	"eegview-recover repairs a GDF or BDF file whose recording has been "
+	"interrupted, using the journal kept along it when eegview records "
+	"with --checkpoint.";
+
+static char recover_synopsys[] =
+	"[--dry-run] [--keep-journal] [--force] <file>";
+
+static const struct mm_arg_opt cmdline_optv[] = {
+	{"n|dry-run", MM_OPT_NOVAL, "set", {.sptr = &dry_run},
+	 "Report what would be done without modifying the file"},
+	{"keep-journal", MM_OPT_NOVAL, "set", {.sptr = &keep_journal},
+	 "Do not remove the journal once the file has been repaired"},
+	{"f|force", MM_OPT_NOVAL, "set", {.sptr = &force},
+	 "Repair the file even if its header looks complete"},
+};
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Header parsing                                            *
+ *                                                                        *
+ **************************************************************************/
+static
+uint64_t get_le(const unsigned char* buf, int len)
+{
+	uint64_t val = 0;
+	int i;
+
+	for (i = len-1; i >= 0; i--)
+		val = (val << 8) | buf[i];
+
+	return val;
+}
+
+
+static
+void put_le(unsigned char* buf, uint64_t val, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		buf[i] = val & 0xff;
+		val >>= 8;
+	}
+}
+
+
+// Parse a number in an ASCII field of BDF header
+static
+int64_t get_ascii(const unsigned char* buf, int len)
+{
+	char str[32];
+
+	memcpy(str, buf, len);
+	str[len] = '\0';
+	return strtoll(str, NULL, 10);
+}
+
+
+// Size in bytes of a GDF data type, 0 if unsupported
+static
+int gdf_type_size(uint32_t type)
+{
+	switch (type) {
+	case 1: case 2: return 1;               // int8, uint8
+	case 3: case 4: return 2;               // int16, uint16
+	case 5: case 6: case 16: return 4;      // int32, uint32, float32
+	case 7: case 8: case 17: return 8;      // int64, uint64, float64
+	case 279: case 535: return 3;           // int24, uint24
+	default: return 0;
+	}
+}
+
+
+static
+int read_at(int fd, int64_t offset, void* buf, size_t len)
+{
+	ssize_t rsz;
+
+	if (mm_seek(fd, offset, SEEK_SET) < 0)
+		return -1;
+
+	rsz = mm_read(fd, buf, len);
+	if (rsz < 0)
+		return -1;
+
+	if ((size_t)rsz != len) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static
+int write_at(int fd, int64_t offset, const void* buf, size_t len)
+{
+	ssize_t rsz;
+
+	if (mm_seek(fd, offset, SEEK_SET) < 0)
+		return -1;
+
+	rsz = mm_write(fd, buf, len);
+	if (rsz < 0)
+		return -1;
+
+	if ((size_t)rsz != len) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * parse_header() - get layout of a recorded file from its header
+ * @file:       file whose @fd field is set
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int parse_header(struct rec_file* file)
+{
+	unsigned char fixed[FIXED_HDR_SIZE];
+	unsigned char* chhdr;
+	struct mm_stat st;
+	int i, size, spr;
+	uint32_t type;
+
+	if (read_at(file->fd, 0, fixed, sizeof(fixed))
+	   || mm_fstat(file->fd, &st))
+		return -1;
+
+	file->size = st.size;
+	if (memcmp(fixed, "GDF 2", 5) == 0) {
+		file->is_gdf = 1;
+		file->hdrlen = get_le(fixed + 184, 2) * FIXED_HDR_SIZE;
+		file->nrec_hdr = (int64_t)get_le(fixed + 236, 8);
+		file->nch = get_le(fixed + 252, 2);
+	} else if (fixed[0] == 0xff && memcmp(fixed + 1, "BIOSEMI", 7) == 0) {
+		file->is_gdf = 0;
+		file->hdrlen = get_ascii(fixed + 184, 8);
+		file->nrec_hdr = get_ascii(fixed + 236, 8);
+		file->nch = get_ascii(fixed + 252, 4);
+	} else {
+		fprintf(stderr, "Not a GDF 2 or BDF file\n");
+		return -1;
+	}
+
+	// GDF header may be followed by an extended header
+	if (file->nch <= 0
+	   || file->hdrlen < FIXED_HDR_SIZE * (file->nch + 1)
+	   || (!file->is_gdf
+	       && file->hdrlen != FIXED_HDR_SIZE * (file->nch + 1))) {
+		fprintf(stderr, "Inconsistent header\n");
+		return -1;
+	}
+
+	chhdr = malloc(FIXED_HDR_SIZE * file->nch);
+	if (!chhdr)
+		return -1;
+
+	if (read_at(file->fd, FIXED_HDR_SIZE,
+	            chhdr, FIXED_HDR_SIZE * file->nch)) {
+		free(chhdr);
+		return -1;
+	}
+
+	// Number of samples per record is at the same place in both formats
+	file->recsize = 0;
+	file->spr = 0;
+	for (i = 0; i < file->nch; i++) {
+		if (file->is_gdf) {
+			spr = get_le(chhdr + 216*file->nch + 4*i, 4);
+			type = get_le(chhdr + 220*file->nch + 4*i, 4);
+			size = gdf_type_size(type);
+		} else {
+			spr = get_ascii(chhdr + 216*file->nch + 8*i, 8);
+			size = 3;
+		}
+
+		if (size == 0 || spr <= 0) {
+			fprintf(stderr, "Unsupported channel %i\n", i);
+			free(chhdr);
+			return -1;
+		}
+
+		file->recsize += (int64_t)spr * size;
+		if (spr > file->spr)
+			file->spr = spr;
+	}
+
+	free(chhdr);
+	return 0;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Repair                                                    *
+ *                                                                        *
+ **************************************************************************/
+/**
+ * read_journal() - load events of journal if any
+ * @path:       path of the journal
+ * @ns_max:     number of samples recovered in the file
+ * @fs:         pointer receiving sampling rate of recording
+ * @events:     pointer receiving the array of events located before @ns_max
+ * @nevent:     pointer receiving the number of events in @events
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int read_journal(const char* path, int64_t ns_max, float* fs,
+                 struct journal_rec** events, int* nevent)
+{
+	struct journal_hdr hdr;
+	struct journal_rec rec, *evts = NULL, *newevts;
+	int fd, nevt = 0, nmax = 0, nlost = 0;
+
+	*events = NULL;
+	*nevent = 0;
+	fd = mm_open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			return -1;
+
+		printf("no journal found, events cannot be recovered\n");
+		return 0;
+	}
+
+	if (mm_read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+	   || hdr.magic != JOURNAL_MAGIC
+	   || hdr.version != JOURNAL_VERSION) {
+		fprintf(stderr, "Invalid journal %s\n", path);
+		mm_close(fd);
+		return -1;
+	}
+
+	// A partial record at the end is the one being written at crash
+	while (mm_read(fd, &rec, sizeof(rec)) == sizeof(rec)) {
+		if (rec.type != JOURNAL_EVENT)
+			continue;
+
+		if (rec.value < 0 || rec.value >= ns_max) {
+			nlost++;
+			continue;
+		}
+
+		if (nevt == nmax) {
+			nmax = nmax ? 2*nmax : 64;
+			newevts = realloc(evts, nmax * sizeof(*evts));
+			if (!newevts) {
+				free(evts);
+				mm_close(fd);
+				return -1;
+			}
+			evts = newevts;
+		}
+		evts[nevt++] = rec;
+	}
+	mm_close(fd);
+
+	if (nlost)
+		printf("%i events beyond recovered data are dropped\n", nlost);
+
+	*fs = hdr.fs;
+	*events = evts;
+	*nevent = nevt;
+	return 0;
+}
+
+
+/**
+ * write_gdf_events() - write event table of GDF file
+ * @file:       GDF file whose data has been truncated to whole records
+ * @offset:     offset of the end of data
+ * @fs:         sampling frequency of event positions
+ * @events:     array of events
+ * @nevent:     number of events in @events
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int write_gdf_events(struct rec_file* file, int64_t offset, float fs,
+                     const struct journal_rec* events, int nevent)
+{
+	unsigned char* table;
+	unsigned char* ptr;
+	size_t evtsize;
+	int i, mode, ret;
+	uint32_t fsbits;
+
+	// Durations are stored only if some event has one (mode 3)
+	mode = 1;
+	for (i = 0; i < nevent; i++)
+		if (events[i].duration != 0.0f)
+			mode = 3;
+
+	evtsize = (mode == 3) ? 12 : 6;
+	table = calloc(1, 8 + nevent * evtsize);
+	if (!table)
+		return -1;
+
+	memcpy(&fsbits, &fs, sizeof(fsbits));
+	table[0] = mode;
+	put_le(table + 1, nevent, 3);
+	put_le(table + 4, fsbits, 4);
+
+	// Positions are 1-based in GDF
+	ptr = table + 8;
+	for (i = 0; i < nevent; i++)
+		put_le(ptr + 4*i, events[i].value + 1, 4);
+
+	ptr += 4*nevent;
+	for (i = 0; i < nevent; i++)
+		put_le(ptr + 2*i, events[i].code, 2);
+
+	if (mode == 3) {
+		ptr += 2*nevent;
+		ptr += 2*nevent;        // channels are left to 0 (all)
+		for (i = 0; i < nevent; i++)
+			put_le(ptr + 4*i, lround(events[i].duration * fs), 4);
+	}
+
+	ret = write_at(file->fd, offset, table, 8 + nevent * evtsize);
+	free(table);
+	return ret;
+}
+
+
+/**
+ * repair_file() - truncate data and fix header of interrupted recording
+ * @file:       parsed recorded file
+ * @jnlpath:    path of the journal
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int repair_file(struct rec_file* file, const char* jnlpath)
+{
+	unsigned char nrec_field[8];
+	char str[16];
+	struct journal_rec* events = NULL;
+	int64_t nrec, end;
+	int nevent = 0;
+	float fs = 0.0f;
+
+	nrec = (file->size - file->hdrlen) / file->recsize;
+	end = file->hdrlen + nrec * file->recsize;
+	printf("%lli complete records (%lli samples), %lli trailing bytes\n",
+	       (long long)nrec, (long long)(nrec * file->spr),
+	       (long long)(file->size - end));
+
+	if (read_journal(jnlpath, nrec * file->spr, &fs, &events, &nevent)) {
+		perror(jnlpath);
+		return -1;
+	}
+
+	if (file->is_gdf)
+		printf("%i events recovered\n", nevent);
+
+	if (dry_run) {
+		free(events);
+		return 0;
+	}
+
+	// Drop the incomplete record, and the event table if any
+	if (mm_ftruncate(file->fd, end))
+		goto failure;
+
+	if (file->is_gdf) {
+		put_le(nrec_field, nrec, 8);
+	} else {
+		snprintf(str, sizeof(str), "%-8lli", (long long)nrec);
+		memcpy(nrec_field, str, sizeof(nrec_field));
+	}
+
+	if (write_at(file->fd, 236, nrec_field, sizeof(nrec_field)))
+		goto failure;
+
+	if (file->is_gdf && nevent
+	   && write_gdf_events(file, end, fs, events, nevent))
+		goto failure;
+
+	if (mm_fsync(file->fd))
+		goto failure;
+
+	free(events);
+	return 0;
+
+failure:
+	perror("Cannot repair file");
+	free(events);
+	return -1;
+}
+
+
+int main(int argc, char* argv[])
+{
+	struct rec_file file = {.fd = -1};
+	const char* path;
+	char* jnlpath;
+	int argi, retcode = EXIT_FAILURE;
+	size_t len;
+	struct mm_arg_parser parser = {
+		.doc = recover_doc,
+		.args_doc = recover_synopsys,
+		.optv = cmdline_optv,
+		.num_opt = MM_NELEM(cmdline_optv),
+		.execname = "eegview-recover",
+	};
+
+	argi = mm_arg_parse(&parser, argc, argv);
+	if (argi < 0)
+		return EXIT_FAILURE;
+
+	if (argi != argc - 1) {
+		fprintf(stderr, "Usage: eegview-recover %s\n", recover_synopsys);
+		return EXIT_FAILURE;
+	}
+	path = argv[argi];
+
+	len = strlen(path) + sizeof(JOURNAL_SUFFIX);
+	jnlpath = malloc(len);
+	if (!jnlpath)
+		return EXIT_FAILURE;
+
+	snprintf(jnlpath, len, "%s%s", path, JOURNAL_SUFFIX);
+
+	file.fd = mm_open(path, dry_run ? O_RDONLY : O_RDWR, 0);
+	if (file.fd < 0) {
+		perror(path);
+		goto exit;
+	}
+
+	if (parse_header(&file))
+		goto exit;
+
+	// A properly closed file has its number of records set
+	if (file.nrec_hdr > 0 && !force) {
+		printf("%s looks complete (%lli records), use --force to "
+		       "repair anyway\n", path, (long long)file.nrec_hdr);
+		retcode = EXIT_SUCCESS;
+		goto exit;
+	}
+
+	if (repair_file(&file, jnlpath))
+		goto exit;
+
+	if (!dry_run && !keep_journal)
+		mm_unlink(jnlpath);
+
+	printf("%s %s\n", path, dry_run ? "can be repaired" : "repaired");
+	retcode = EXIT_SUCCESS;
+
+exit:
+	if (file.fd >= 0)
+		mm_close(file.fd);
+
+	free(jnlpath);
+	return retcode;
+}
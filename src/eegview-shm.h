@@ -0,0 +1,119 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef EEGVIEW_SHM_H
+#define EEGVIEW_SHM_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Shared memory ring of software events
+ *
+ * When started with --event-shm=NAME, eegview creates a shared memory object
+ * NAME (see shm_open()) holding a struct eegview_shm_ring. A client on the
+ * same host maps it read-write, checks that magic is EEGVIEW_SHM_MAGIC and
+ * version is EEGVIEW_SHM_VERSION, and posts events with
+ * eegview_shm_post(). Posting an event does not involve any system call:
+ * eegview collects the events once per block of acquired data.
+ *
+ * Several clients (or threads) can post events concurrently.
+ */
+
+#define EEGVIEW_SHM_MAGIC       0x4d485345      // "ESHM" in little endian
+#define EEGVIEW_SHM_VERSION     1
+
+/**
+ * struct eegview_shm_slot - event in the shared memory ring
+ * @seq:        sequence number synchronizing the producers and eegview
+ * @code:       code of the event
+ * @timestamp:  time of the event (in ns) measured with CLOCK_MONOTONIC, or
+ *              0 if the event must be timestamped when collected by eegview
+ */
+struct eegview_shm_slot {
+	_Atomic uint32_t seq;
+	uint32_t code;
+	int64_t timestamp;
+};
+
+/**
+ * struct eegview_shm_ring - layout of the shared memory object
+ * @magic:      EEGVIEW_SHM_MAGIC once the ring is ready to be used
+ * @version:    version of the layout (EEGVIEW_SHM_VERSION)
+ * @reserved:   unused
+ * @nslot:      number of slots in @slots (power of 2)
+ * @head:       index of the next slot to be written by producers
+ * @tail:       index of the next slot to be read by eegview
+ * @slots:      ring of events
+ */
+struct eegview_shm_ring {
+	_Atomic uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t nslot;
+	_Alignas(64) _Atomic uint32_t head;
+	_Alignas(64) _Atomic uint32_t tail;
+	_Alignas(64) struct eegview_shm_slot slots[];
+};
+
+// Size of the shared memory object holding a ring of nslot events
+#define EEGVIEW_SHM_SIZE(nslot) \
+	(sizeof(struct eegview_shm_ring) \
+	 + (size_t)(nslot) * sizeof(struct eegview_shm_slot))
+
+
+/**
+ * eegview_shm_post() - post event in shared memory ring
+ * @ring:       mapped shared memory ring
+ * @code:       code of the event
+ * @timestamp:  CLOCK_MONOTONIC time of the event in ns (0 for none)
+ *
+ * Return: 0 in case of success, -1 if the ring is full.
+ */
+static inline
+int eegview_shm_post(struct eegview_shm_ring* ring, uint32_t code,
+                     int64_t timestamp)
+{
+	struct eegview_shm_slot* slot;
+	uint32_t pos, seq;
+	int32_t diff;
+
+	pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	while (1) {
+		slot = &ring->slots[pos & (ring->nslot - 1)];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		diff = (int32_t)(seq - pos);
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&ring->head,
+			                                &pos, pos + 1,
+			                                memory_order_relaxed,
+			                                memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = atomic_load_explicit(&ring->head,
+			                           memory_order_relaxed);
+		}
+	}
+
+	slot->code = code;
+	slot->timestamp = timestamp;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	return 0;
+}
+
+#endif
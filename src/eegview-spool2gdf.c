@@ -0,0 +1,206 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <mmargparse.h>
+#include <mmlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xdfio.h>
+
+#include "spool.h"
+
+static char spool2gdf_doc[] =
+	"eegview-spool2gdf converts a compressed spool file recorded by "
+	"eegview into a GDF file, with its channel properties and events.";
+
+static char spool2gdf_synopsys[] = "<spool file> <gdf file>";
+
+
+static
+int setup_channels(struct xdf* xdf, const struct spool_reader* rd)
+{
+	const struct spool_chdesc* desc = rd->chdesc;
+	struct xdfch* ch;
+	unsigned int igrp, j;
+	int arrtype, stotype;
+
+	for (igrp = 0; igrp < 3; igrp++) {
+		// EEG and sensors are stored as float, triggers as int32
+		arrtype = (igrp == 2) ? XDFINT32 : XDFFLOAT;
+		for (j = 0; j < rd->hdr->nch[igrp]; j++, desc++) {
+			ch = xdf_add_channel(xdf, desc->label);
+			if (!ch)
+				return -1;
+
+			stotype = desc->isint ? XDFINT32 : XDFFLOAT;
+			if (xdf_set_chconf(ch,
+			                   XDF_CF_ARRDIGITAL, 0,
+			                   XDF_CF_ARRINDEX, igrp,
+			                   XDF_CF_ARROFFSET, j * sizeof(int32_t),
+			                   XDF_CF_STOTYPE,
+			                   xdf_closest_type(xdf, stotype),
+			                   XDF_CF_ARRTYPE, arrtype,
+			                   XDF_CF_PMAX, desc->mm[1],
+			                   XDF_CF_PMIN, desc->mm[0],
+			                   XDF_CF_PREFILTERING, desc->filtering,
+			                   XDF_CF_TRANSDUCTER, desc->transducter,
+			                   XDF_CF_UNIT, desc->unit,
+			                   XDF_NOF))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+static
+int write_events(struct xdf* xdf, const struct spool_reader* rd)
+{
+	const struct spool_event* events;
+	int i, e, nevent, evttype;
+
+	for (i = 0; i < rd->nchunk; i++) {
+		nevent = spool_reader_get_events(rd, i, &events);
+		for (e = 0; e < nevent; e++) {
+			evttype = xdf_add_evttype(xdf, events[e].code, NULL);
+			if (evttype == -1
+			    || xdf_add_event(xdf, evttype,
+			                     events[e].pos / rd->hdr->fs,
+			                     events[e].duration))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * convert() - write content of spool file in GDF file
+ * @rd:         opened spool reader
+ * @xdf:        GDF file opened for writing
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+static
+int convert(const struct spool_reader* rd, struct xdf* xdf)
+{
+	size_t strides[3];
+	void* data[3] = {NULL, NULL, NULL};
+	int i, ns, retval = -1;
+
+	xdf_set_conf(xdf,
+	             XDF_F_REC_DURATION, 1.0,
+	             XDF_F_REC_NSAMPLE, (int)rd->hdr->fs,
+	             XDF_F_RECTIME, rd->hdr->rectime,
+	             XDF_NOF);
+
+	if (setup_channels(xdf, rd))
+		return -1;
+
+	for (i = 0; i < 3; i++) {
+		strides[i] = rd->hdr->nch[i] * sizeof(int32_t);
+		data[i] = malloc(rd->hdr->chunk_ns * strides[i] + 1);
+		if (!data[i])
+			goto exit;
+	}
+
+	xdf_define_arrays(xdf, 3, strides);
+	if (xdf_prepare_transfer(xdf))
+		goto exit;
+
+	for (i = 0; i < rd->nchunk; i++) {
+		ns = spool_reader_decode(rd, i, data);
+		if (ns < 0
+		    || xdf_write(xdf, ns, data[0], data[1], data[2]) < 0)
+			goto exit;
+	}
+
+	retval = write_events(xdf, rd);
+
+exit:
+	for (i = 0; i < 3; i++)
+		free(data[i]);
+
+	return retval;
+}
+
+
+int main(int argc, char* argv[])
+{
+	struct spool_reader rd;
+	struct xdf* xdf;
+	const char *inpath, *outpath;
+	int argi, failed;
+	struct mm_arg_parser parser = {
+		.doc = spool2gdf_doc,
+		.args_doc = spool2gdf_synopsys,
+		.execname = "eegview-spool2gdf",
+	};
+
+	argi = mm_arg_parse(&parser, argc, argv);
+	if (argi < 0)
+		return EXIT_FAILURE;
+
+	if (argi != argc - 2) {
+		fprintf(stderr, "Usage: eegview-spool2gdf %s\n",
+		        spool2gdf_synopsys);
+		return EXIT_FAILURE;
+	}
+	inpath = argv[argi];
+	outpath = argv[argi + 1];
+
+	if (spool_reader_open(&rd, inpath)) {
+		fprintf(stderr, "Cannot read %s: %s\n", inpath, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (rd.end != rd.size)
+		fprintf(stderr, "%s: ignoring %zu bytes of incomplete chunk\n",
+		        inpath, rd.size - rd.end);
+
+	xdf = xdf_open(outpath, XDF_WRITE, XDF_GDF2);
+	if (!xdf) {
+		fprintf(stderr, "Cannot create %s: %s\n",
+		        outpath, strerror(errno));
+		spool_reader_close(&rd);
+		return EXIT_FAILURE;
+	}
+
+	failed = convert(&rd, xdf);
+	if (failed)
+		fprintf(stderr, "Conversion failed: %s\n", strerror(errno));
+
+	if (xdf_close(xdf) && !failed) {
+		fprintf(stderr, "Cannot close %s: %s\n",
+		        outpath, strerror(errno));
+		failed = 1;
+	}
+
+	if (!failed)
+		printf("%s: %lli samples and %i events converted\n",
+		       outpath, (long long)rd.ns, rd.nevent);
+
+	spool_reader_close(&rd);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
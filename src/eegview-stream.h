@@ -0,0 +1,108 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef EEGVIEW_STREAM_H
+#define EEGVIEW_STREAM_H
+
+#include <stdint.h>
+
+/*
+ * Protocol of live sample streaming
+ *
+ * When started with --stream-port or --stream-unix-socket, eegview serves
+ * the acquired samples to the connected subscribers. All fields are in
+ * native byte order.
+ *
+ * 1. Upon connection, eegview sends a struct eegview_stream_info describing
+ *    the acquisition.
+ * 2. The subscriber sends a struct eegview_stream_sub, followed by the
+ *    uint16_t indices of the selected channels of each group for which
+ *    nch is not EEGVIEW_STREAM_ALLCH (first the EEG channels, then the
+ *    sensor channels and finally the trigger channels).
+ * 3. eegview then sends a struct eegview_stream_msg for each block of data:
+ *    - EEGVIEW_STREAM_DATA: followed by ns samples. Each sample is made of
+ *      the selected EEG channels (float), then the selected sensor channels
+ *      (float), then the selected trigger channels (int32_t).
+ *    - EEGVIEW_STREAM_DROP: ns samples starting at index have not been
+ *      sent because the subscriber was not reading fast enough.
+ *
+ * If the EEGVIEW_STREAM_PREPROC flag is set in struct eegview_stream_info,
+ * the EEG channels are streamed after the filters and re-referencing
+ * configured in the [preprocessing] group of eegview.conf. The sensor and
+ * trigger channels are always streamed as acquired.
+ *
+ * Acquisition is never delayed by a subscriber: the data that cannot be
+ * sent is dropped and notified.
+ */
+
+#define EEGVIEW_STREAM_MAGIC    0x4d525453      // "STRM" in little endian
+#define EEGVIEW_STREAM_VERSION  1
+
+// Value of nch in struct eegview_stream_sub selecting all channels
+#define EEGVIEW_STREAM_ALLCH    0xffff
+
+// Flags of struct eegview_stream_info
+#define EEGVIEW_STREAM_PREPROC  0x0001
+
+// Types of struct eegview_stream_msg
+#define EEGVIEW_STREAM_DATA     1
+#define EEGVIEW_STREAM_DROP     2
+
+/**
+ * struct eegview_stream_info - description of the streamed acquisition
+ * @magic:      EEGVIEW_STREAM_MAGIC
+ * @version:    version of the protocol (EEGVIEW_STREAM_VERSION)
+ * @flags:      EEGVIEW_STREAM_PREPROC if EEG channels are preprocessed,
+ *              0 otherwise (this field was reserved and 0 before)
+ * @fs:         sampling frequency
+ * @nch:        number of EEG, sensor and trigger channels
+ */
+struct eegview_stream_info {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	float fs;
+	uint32_t nch[3];
+};
+
+/**
+ * struct eegview_stream_sub - subscription request
+ * @magic:      EEGVIEW_STREAM_MAGIC
+ * @nch:        number of selected EEG, sensor and trigger channels, or
+ *              EEGVIEW_STREAM_ALLCH to select all channels of the group
+ * @reserved:   0
+ */
+struct eegview_stream_sub {
+	uint32_t magic;
+	uint16_t nch[3];
+	uint16_t reserved;
+};
+
+/**
+ * struct eegview_stream_msg - header of message sent to subscribers
+ * @type:       EEGVIEW_STREAM_DATA or EEGVIEW_STREAM_DROP
+ * @ns:         number of samples
+ * @index:      index of the first sample since the acquisition start
+ * @timestamp:  CLOCK_MONOTONIC time (in ns) at which the last sample of the
+ *              block has been received (0 for EEGVIEW_STREAM_DROP)
+ */
+struct eegview_stream_msg {
+	uint32_t type;
+	uint32_t ns;
+	int64_t index;
+	int64_t timestamp;
+};
+
+#endif
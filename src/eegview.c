@@ -24,12 +24,16 @@
 #include <eegdev.h>
 #include <errno.h>
 #include <getopt.h>
+#include <math.h>
 #include <mcpanel.h>
 #include <mmargparse.h>
 #include <mmerrno.h>
 #include <mmlib.h>
 #include <mmlog.h>
+#include <mmsysio.h>
+#include <mmtime.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,7 +41,24 @@
 #include <sys/types.h>
 #include <xdfio.h>
 
+#include "acq-source.h"
+#include "block-pool.h"
+#include "decimator.h"
+#include "eegview-stream.h"
 #include "event-tracker.h"
+#include "gap-detector.h"
+#include "label-set.h"
+#include "latency-hist.h"
+#include "preproc.h"
+#include "profiler.h"
+#include "recorder.h"
+#include "replay.h"
+#include "sample-conv.h"
+#include "settings.h"
+#include "spool.h"
+#include "streamer.h"
+#include "synth.h"
+#include "time-utils.h"
 
 enum {
 	REC_PAUSE = 0,
@@ -49,6 +70,7 @@ struct rectimer_data {
 	struct mcp_widget* timerlabel;
 	float fs;
 	int last_displayed_rectime;
+	int last_displayed_ngap;
 };
 
 
@@ -59,19 +81,44 @@ struct rectimer_data {
  **************************************************************************/
 static const char* uifilename = NULL;
 static const char* devstring = NULL;
+static const char* replay_filename = NULL;
+static const char* replay_speed_str = NULL;
+static const char* synth_spec = NULL;
+static int bench_duration = 0;
 static const char* version = NULL;
 static int eventport = 1234;
+static int event_udp_port = 0;
+static const char* event_unix_path = NULL;
+static const char* event_shm_name = NULL;
+static int stream_port = 0;
+static const char* stream_unix_path = NULL;
+static int recbuf_duration = 10;
+static int pretrigger_duration = 0;
+static const char* headless = NULL;
+static const char* output_filename = NULL;
+static int rec_duration = 0;
+static int segment_duration = 0;
+static int segment_size = 0;
+static int checkpoint_period = 0;
+static const char* block_size_str = NULL;
+static const char* use_hugepages = NULL;
+static const char* lock_memory = NULL;
+static const char* counter_label = NULL;
+static const char* storage_str = NULL;
 static char const * unselected_labels_csv = NULL;  /* single csv of channels */
-static char ** unselected_labels = NULL;  /* NULL-terminated array version */
+static struct label_set unselected_set;  /* set version */
 static int* unselected_found = NULL;  /* number of use of selected channels
-                                         same length as unselected_labels
-					 minus NULL terminator*/
+                                         same length as unselected_set */
+static const char* drop_unselected = NULL;
 
 static char eegview_doc[] =
 	"eegview is a gui program to display and record eeg data.";
 
 static char eegview_synopsys[] =
 	"[GTK+ options...] [--device=<devstring>] [--ui-file=<file>]\n"
+	"--headless --output=<file> [--device=<devstring>] [--duration=<secs>]\n"
+	"--replay=<file> [--replay-speed=<factor|max>] [other options...]\n"
+	"--benchmark=<secs> [--synthetic[=<spec>]] [other options...]\n"
 	"[--help]\n"
 	"[--version]";
 
@@ -80,27 +127,95 @@ static const struct mm_arg_opt cmdline_optv[] = {
 	 "Set eegview ui-file"},
 	{"d|device", MM_OPT_OPTSTR, NULL, {.sptr = &devstring},
 	 "Set eegview device"},
+	{"replay", MM_OPT_NEEDSTR, NULL, {.sptr = &replay_filename},
+	 "Acquire from the specified BDF or GDF file instead of a device"},
+	{"replay-speed", MM_OPT_NEEDSTR, NULL, {.sptr = &replay_speed_str},
+	 "Replay the file at specified factor of real time (default 1), or "
+	 "as fast as possible if max"},
+	{"synthetic", MM_OPT_OPTSTR, "", {.sptr = &synth_spec},
+	 "Acquire synthetic signals instead of a device, generated according "
+	 "to spec (list of key=value separated by ';', keys: fs, eeg, "
+	 "sensor, trigger, trigger-period, marker-period, buffer, counter)"},
+	{"benchmark", MM_OPT_NEEDINT, NULL, {.iptr = &bench_duration},
+	 "Acquire, record and display for the specified number of seconds "
+	 "and report the throughput and latency of the acquisition loop"},
 	{"v|version", MM_OPT_NOVAL, "set", {.sptr = &version},
 	 "Display eegview version"},
 	{"p|event-port", MM_OPT_OPTINT, NULL, {.iptr = &eventport},
 	 "Set eegdev event port number"},
+	{"event-udp-port", MM_OPT_NEEDINT, NULL, {.iptr = &event_udp_port},
+	 "Also receive events as datagrams on specified UDP port"},
+	{"event-unix-socket", MM_OPT_NEEDSTR, NULL, {.sptr = &event_unix_path},
+	 "Also receive events as datagrams on Unix socket at specified path"},
+	{"event-shm", MM_OPT_NEEDSTR, NULL, {.sptr = &event_shm_name},
+	 "Also receive events posted in shared memory ring of specified name"},
+	{"stream-port", MM_OPT_NEEDINT, NULL, {.iptr = &stream_port},
+	 "Stream acquired samples to subscribers connecting on specified "
+	 "TCP port"},
+	{"stream-unix-socket", MM_OPT_NEEDSTR, NULL, {.sptr = &stream_unix_path},
+	 "Stream acquired samples to subscribers connecting on Unix socket "
+	 "at specified path"},
 	{"unselect-channels", MM_OPT_NEEDSTR, NULL, {.sptr = &unselected_labels_csv},
 	 "csv list of channels to unselect"},
+	{"drop-unselected", MM_OPT_NOVAL, "set", {.sptr = &drop_unselected},
+	 "Do not acquire nor record the channels unselected by "
+	 "--unselect-channels, instead of only hiding them"},
+	{"record-buffer", MM_OPT_NEEDINT, NULL, {.iptr = &recbuf_duration},
+	 "Set the amount of signal (in seconds) buffered before being written "
+	 "on file"},
+	{"pre-trigger", MM_OPT_NEEDINT, NULL, {.iptr = &pretrigger_duration},
+	 "Start recordings with the specified number of seconds of signal "
+	 "acquired before"},
+	{"headless", MM_OPT_NOVAL, "set", {.sptr = &headless},
+	 "Record without GUI in file specified by --output"},
+	{"o|output", MM_OPT_NEEDSTR, NULL, {.sptr = &output_filename},
+	 "Set file to record in headless mode"},
+	{"duration", MM_OPT_NEEDINT, NULL, {.iptr = &rec_duration},
+	 "Stop recording after specified number of seconds in headless mode"},
+	{"segment-duration", MM_OPT_NEEDINT, NULL, {.iptr = &segment_duration},
+	 "Split the recording in files of specified number of seconds"},
+	{"segment-size", MM_OPT_NEEDINT, NULL, {.iptr = &segment_size},
+	 "Split the recording in files of at most specified size in MiB"},
+	{"checkpoint", MM_OPT_NEEDINT, NULL, {.iptr = &checkpoint_period},
+	 "Keep a journal of events allowing to recover the recording after "
+	 "a crash, synced on disk every specified number of seconds"},
+	{"b|block-size", MM_OPT_NEEDSTR, NULL, {.sptr = &block_size_str},
+	 "Set number of samples read at once. If suffixed by ms or s, the "
+	 "number of samples is adapted to the sampling rate to read a block "
+	 "every specified period"},
+	{"huge-pages", MM_OPT_NOVAL, "set", {.sptr = &use_hugepages},
+	 "Use huge pages for acquisition buffers"},
+	{"lock-memory", MM_OPT_NOVAL, "set", {.sptr = &lock_memory},
+	 "Lock acquisition buffers in RAM"},
+	{"counter-channel", MM_OPT_NEEDSTR, NULL, {.sptr = &counter_label},
+	 "Detect the lost samples from the discontinuities of the channel of "
+	 "specified label, which the device increments at each sample"},
+	{"storage", MM_OPT_NEEDSTR, NULL, {.sptr = &storage_str},
+	 "Store the float channels of BDF/GDF recordings as float, int16 or "
+	 "int24, scaled to the physical range of each channel (default: "
+	 "int24 for BDF, float for GDF)"},
 };
 
 
 pthread_t thread_id;
 pthread_mutex_t sync_mtx = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t file_mtx = PTHREAD_MUTEX_INITIALIZER;
-struct eegdev* dev = NULL;
-struct xdf* xdf = NULL;
-int skip_event_recording = 1;
+struct acq_source* dev = NULL;
+static int file_set = 0;
 int run_eeg = 0;
 int record_file = 0;
 static int reset_record_counter = 0;
-#define NSAMPLES	32
+static int acq_done = 0;
+static int rec_nsmax = 0;
+static volatile sig_atomic_t quit_requested = 0;
+#define DEFAULT_BLOCK_SIZE	32
+#define MAX_BLOCK_DURATION	2.0
+static int block_ns = DEFAULT_BLOCK_SIZE;
 
 struct event_tracker evttrk;
+struct recorder recorder;
+struct block_pool pool;
+struct streamer streamer;
 
 size_t strides[3];
 struct grpconf grp[] = {
@@ -126,9 +241,33 @@ struct grpconf grp[] = {
 		.datatype = EGD_INT32
 	}
 };
+
+/*
+ * Groups of channels passed to the acquisition source. Each array above is
+ * filled by one or several of them if some channels are not acquired. The
+ * index in the device of the channels of each array is in ch_index.
+ */
+static struct grpconf* acq_grp = NULL;
+static unsigned int acq_ngrp = 0;
+static int* ch_index[3] = {NULL, NULL, NULL};
 	
 static char **labels[3] = {NULL, NULL, NULL};
 
+/*
+ * Channel properties written in the recording files. They are queried once
+ * at connection, so that the files of the segments can be created by the
+ * writer thread without accessing the device.
+ */
+static struct acq_chinfo* chinfo[3] = {NULL, NULL, NULL};
+static int chinfo_error = 0;
+
+// Size of the integers storing the float arrays in BDF/GDF files (-1 for
+// default of file format, 0 for float)
+static int storage_width = -1;
+static int xdf_width = 0;
+static struct sample_conv xdf_conv[2];
+static double rec_start_time;
+
 #define NSCALE 2
 static const char* scale_labels[NSCALE] = {"25.0mV", "50.0mV"};
 static const float scale_values[NSCALE] = {25.0e3, 50.0e3};
@@ -142,7 +281,90 @@ static struct panel_tabconf tabconf[NTAB] = {
 	{.type = TABTYPE_SCOPE, .name = "Sensors"}
 };
 
+// Index of acquisition array displayed by each tab
+static const int tab_iarray[NTAB] = {0, 0, 0, 1};
+
+// True for the tabs displaying the EEG after preprocessing if enabled. The
+// offsets tab shows the electrode offsets, hence needs the raw signal.
+static const int tab_preproc[NTAB] = {1, 1, 0, 0};
+
+/**
+ * struct display_feed - samples sent to one or several tabs
+ * @iarray:     index of acquisition array displayed (0 for eeg, 1 for sensors)
+ * @preproc:    true if the feed displays the preprocessed EEG
+ * @dec:        decimation stage applied before display
+ * @buff:       buffer receiving the decimated samples
+ * @ns:         number of samples in @data for the last block
+ * @data:       samples of the last block to display
+ */
+struct display_feed {
+	int iarray;
+	int preproc;
+	struct decimator dec;
+	float* buff;
+	int ns;
+	const float* data;
+};
+
+/**
+ * struct display - state of the display fan-out of the acquisition thread
+ * @feeds:      array of @nfeed display feeds
+ * @nfeed:      number of different feeds (tabs with same input and same
+ *              decimation share the same feed)
+ * @tab_feed:   index of the feed in @feeds used by each tab
+ * @trig_dec:   decimation factor of triggers (the one of first tab)
+ * @trig_skip:  number of trigger samples to skip before next output
+ * @trig_acc:   triggers accumulated since last output
+ * @trig_buff:  buffer receiving the decimated triggers
+ * @evts:       events whose position is expressed in the first tab timebase
+ */
+struct display {
+	struct display_feed feeds[NTAB];
+	int nfeed;
+	int tab_feed[NTAB];
+	int trig_dec;
+	int trig_skip;
+	int32_t* trig_acc;
+	int32_t* trig_buff;
+	struct mcp_event evts[NEVENT_MAX];
+};
+
+static struct display display;
+
+// Filters and reference applied once to the EEG for all the display tabs
+// and the stream subscribers
+static struct preproc preproc;
+static int preproc_enabled = 0;
+
+/**
+ * struct bench_stats - measures of the acquisition loop in benchmark mode
+ * @latency:    delay between the acquisition of the last sample of each
+ *              block and the end of its processing
+ * @ns:         number of samples processed
+ * @ns_first:   number of samples of the first block
+ * @first_ts:   time (in ns) at which the first block has been processed
+ * @last_ts:    time (in ns) at which the last block has been processed
+ * @has_status: true if the source reports acquisition time and overruns
+ * @noverrun:   number of overruns reported by the source
+ * @nlost:      number of samples lost in overruns
+ */
+struct bench_stats {
+	struct lat_hist latency;
+	int64_t ns;
+	int64_t ns_first;
+	int64_t first_ts;
+	int64_t last_ts;
+	int has_status;
+	unsigned int noverrun;
+	int64_t nlost;
+};
+
+static struct bench_stats bench;
+
 static int StopRecording(void* user_data);
+static void display_block(struct display* disp, mcpanel* panel, int ns,
+                          const void* data[3], const float* eeg_pp,
+                          const struct event_stack* evt_stk);
 /**************************************************************************
  *                                                                        *
  *              Error message helper functions                            *
@@ -151,6 +373,9 @@ static int StopRecording(void* user_data);
 static
 const char* get_acq_msg(int error)
 {
+	if (error == ENODATA && replay_filename)
+		return "End of replayed file";
+
 	return strerror(error);
 }
 
@@ -165,7 +390,8 @@ static char bdffile_message[128];
 /**
  * rectimer_data_init() - initialize data for updating recorded time label
  * @data:       rectimer_data structure to initialize
- * @panel:      mcpanel instance that should contain the label
+ * @panel:      mcpanel instance that should contain the label (NULL if
+ *              there is no GUI)
  * @fs:         sampling frequency of the recorded signal
  */
 static
@@ -173,8 +399,9 @@ void rectimer_data_init(struct rectimer_data* data, mcpanel* panel, float fs)
 {
 	*data = (struct rectimer_data) {
 		.fs = fs,
-		.timerlabel = mcp_get_widget(panel, "file_length_label"),
+		.timerlabel = panel ? mcp_get_widget(panel, "file_length_label") : NULL,
 		.last_displayed_rectime = 0,
+		.last_displayed_ngap = 0,
 	};
 }
 
@@ -183,21 +410,34 @@ void rectimer_data_init(struct rectimer_data* data, mcpanel* panel, float fs)
  * rectimer_data_update() - update recorded time label in GUI
  * @data:       initialized rectimer_data structure
  * @total_rec:  number of sample since file started to be recorded
+ * @ngap:       number of gaps detected since file started to be recorded
+ *
+ * The number of gaps is displayed next to the recorded time as soon as
+ * one has been detected.
  */
 static
-void rectimer_data_update(struct rectimer_data* data, ssize_t total_rec)
+void rectimer_data_update(struct rectimer_data* data, ssize_t total_rec,
+                          int ngap)
 {
 	int rectime;
 	char text_label[32];
 
+	if (!data->timerlabel)
+		return;
+
 	rectime = total_rec / data->fs;
-	if (rectime == data->last_displayed_rectime)
+	if (rectime == data->last_displayed_rectime
+	    && ngap == data->last_displayed_ngap)
 		return;
 
-	sprintf(text_label, "%d", rectime);
+	if (ngap)
+		sprintf(text_label, "%d (%d gaps)", rectime, ngap);
+	else
+		sprintf(text_label, "%d", rectime);
 	mcp_widget_set_label(data->timerlabel, text_label);
 
 	data->last_displayed_rectime = rectime;
+	data->last_displayed_ngap = ngap;
 }
 
 
@@ -206,6 +446,151 @@ void rectimer_data_update(struct rectimer_data* data, ssize_t total_rec)
  *              Acquition system callbacks                                *
  *                                                                        * 
  **************************************************************************/
+/**************************************************************************
+ *                                                                        *
+ *              Channel selection                                         *
+ *                                                                        *
+ **************************************************************************/
+static void
+update_unselected_channel_use(char const ** clabels, int nch)
+{
+	int i, j;
+
+	if (unselected_found == NULL || clabels == NULL)
+		return;
+
+	for (j = 0 ; j < nch ; j++) {
+		i = label_set_find(&unselected_set, clabels[j]);
+		if (i >= 0)
+			unselected_found[i]++;
+	}
+}
+
+
+static
+void report_unknown_unselected_channels(void)
+{
+	int i;
+	const char* label;
+
+	for (i = 0; i < unselected_set.nlabel; i++) {
+		label = unselected_set.labels[i];
+		if (!unselected_found[i])
+			mm_log_warn("unselected channel %s not found", label);
+	}
+}
+
+
+static int
+is_unselected_channel(char const * label)
+{
+	return label_set_find(&unselected_set, label) >= 0;
+}
+
+
+static
+void free_channel_selection(void)
+{
+	int igrp;
+
+	for (igrp = 0; igrp < 3; igrp++) {
+		free(ch_index[igrp]);
+		ch_index[igrp] = NULL;
+	}
+
+	free(acq_grp);
+	acq_grp = NULL;
+	acq_ngrp = 0;
+}
+
+
+/**
+ * select_channels() - set the channels acquired in each array
+ *
+ * All the channels of the device are acquired in the array of their type,
+ * except with --drop-unselected the ones listed in --unselect-channels:
+ * they then cost neither copy, nor display nor disk. The device index of
+ * each channel of an array is stored in @ch_index and @grp[].nch is set to
+ * the number of channels of the array. Since each group of acquisition
+ * holds consecutive channels, the channels kept form as many groups in
+ * @acq_grp as there are runs of them.
+ *
+ * Return: 0 in case of success, ENOMEM otherwise
+ */
+static
+int select_channels(void)
+{
+	static const char* const type_names[3] = {"EEG", "sensor", "trigger"};
+	int nmax[3], igrp, ich, nch, ntot, i;
+	struct acq_chinfo info;
+	struct grpconf* g;
+	size_t elsize;
+
+	ntot = 0;
+	for (igrp = 0; igrp < 3; igrp++) {
+		nmax[igrp] = acq_source_get_numch(dev, grp[igrp].sensortype);
+		if (nmax[igrp] < 0)
+			nmax[igrp] = 0;
+
+		ntot += nmax[igrp];
+		ch_index[igrp] = malloc((nmax[igrp] + 1) * sizeof(**ch_index));
+		if (!ch_index[igrp])
+			goto failure;
+	}
+
+	acq_grp = malloc((ntot + 1) * sizeof(*acq_grp));
+	if (!acq_grp)
+		goto failure;
+
+	for (igrp = 0; igrp < 3; igrp++) {
+		elsize = (grp[igrp].datatype == EGD_INT32)
+		         ? sizeof(int32_t) : sizeof(float);
+		g = NULL;
+		nch = 0;
+		for (ich = 0; ich < nmax[igrp]; ich++) {
+			if (drop_unselected
+			    && !acq_source_get_chinfo(dev, grp[igrp].sensortype,
+			                              ich, &info)) {
+				i = label_set_find(&unselected_set, info.label);
+				if (i >= 0) {
+					unselected_found[i]++;
+					continue;
+				}
+			}
+
+			// Start a new group if the channel does not follow
+			// the last one kept
+			if (!g || g->index + g->nch != (unsigned int)ich) {
+				g = &acq_grp[acq_ngrp++];
+				*g = grp[igrp];
+				g->index = ich;
+				g->nch = 0;
+				g->arr_offset = nch * elsize;
+			}
+			g->nch++;
+			ch_index[igrp][nch++] = ich;
+		}
+
+		grp[igrp].nch = nch;
+		if (nch < nmax[igrp])
+			mm_log_info("%i of %i %s channels not acquired",
+			            nmax[igrp] - nch, nmax[igrp],
+			            type_names[igrp]);
+	}
+
+	return 0;
+
+failure:
+	free_channel_selection();
+	return ENOMEM;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Channel properties                                        *
+ *                                                                        *
+ **************************************************************************/
 static
 void free_labels(void)
 {
@@ -227,6 +612,7 @@ int get_labels_from_device(void)
 {
 	unsigned int i, igrp;
 	int type;
+	struct acq_chinfo info;
 
 	// Allocate and copy each labels
 	for (igrp=0; igrp<3; igrp++) {
@@ -234,14 +620,61 @@ int get_labels_from_device(void)
 		type = grp[igrp].sensortype;
 		for (i=0; i<grp[igrp].nch; i++) {
 			labels[igrp][i] = malloc(32);
-			egd_channel_info(dev, type, i,
-			               EGD_LABEL, labels[igrp][i], EGD_EOL);
+			if (acq_source_get_chinfo(dev, type,
+			                          ch_index[igrp][i], &info))
+				info.label[0] = '\0';
+			strcpy(labels[igrp][i], info.label);
 		}
 	}
 	return 0;
 }
 
 
+static
+void free_chinfo(void)
+{
+	int igrp;
+
+	for (igrp = 0; igrp < 3; igrp++) {
+		free(chinfo[igrp]);
+		chinfo[igrp] = NULL;
+	}
+}
+
+
+static
+void free_xdf_conv(void)
+{
+	sample_conv_deinit(&xdf_conv[0]);
+	sample_conv_deinit(&xdf_conv[1]);
+	xdf_width = 0;
+}
+
+
+static
+void get_chinfo_from_device(void)
+{
+	unsigned int i, igrp;
+	struct acq_chinfo* info;
+
+	chinfo_error = 0;
+	for (igrp = 0; igrp < 3; igrp++) {
+		chinfo[igrp] = calloc(grp[igrp].nch + 1, sizeof(*info));
+		if (!chinfo[igrp]) {
+			chinfo_error = ENOMEM;
+			continue;
+		}
+
+		for (i = 0; i < grp[igrp].nch; i++) {
+			info = &chinfo[igrp][i];
+			if (acq_source_get_chinfo(dev, grp[igrp].sensortype,
+			                          ch_index[igrp][i], info))
+				chinfo_error = errno;
+		}
+	}
+}
+
+
 static
 void* display_bdf_error(void* arg)
 {
@@ -250,28 +683,75 @@ void* display_bdf_error(void* arg)
 	return NULL;
 }
 
+/**
+ * open_replay() - open file specified by --replay as acquisition source
+ *
+ * Return: the opened source, NULL in case of failure with errno set
+ */
+static
+struct acq_source* open_replay(void)
+{
+	double speed = 1.0;
+	char* end;
+
+	if (replay_speed_str) {
+		if (!strcmp(replay_speed_str, "max")) {
+			speed = 0.0;
+		} else {
+			speed = strtod(replay_speed_str, &end);
+			if (*end != '\0' || speed <= 0.0) {
+				mm_log_error("Invalid replay speed: %s",
+				             replay_speed_str);
+				errno = EINVAL;
+				return NULL;
+			}
+		}
+	}
+
+	// The events of the file are re-emitted through the event tracker
+	return replay_open(replay_filename, speed, &evttrk);
+}
+
+
 static
 int device_connection(void)
 {
 	int retval;
-	if (!(dev = egd_open(devstring)))
+
+	if (replay_filename)
+		dev = open_replay();
+	else if (synth_spec)
+		dev = synth_open(synth_spec, &evttrk);
+	else
+		dev = acq_source_open_eegdev(devstring);
+
+	if (!dev)
 		return errno;
 
-	// Set the number of channels of the "All channels" values
-	grp[0].nch = egd_get_numch(dev, EGD_EEG);
-	grp[1].nch = egd_get_numch(dev, EGD_SENSOR);
-	grp[2].nch = egd_get_numch(dev, EGD_TRIGGER);
+	// Set the channels acquired in each array
+	retval = select_channels();
+	if (retval) {
+		acq_source_close(dev);
+		return retval;
+	}
+
+	if (drop_unselected)
+		report_unknown_unselected_channels();
 
 	strides[0] = grp[0].nch * sizeof(float);
 	strides[1] = grp[1].nch * sizeof(float);
 	strides[2] = grp[2].nch * sizeof(int32_t);
 
 	get_labels_from_device();
+	get_chinfo_from_device();
 
 	// Set the acquisition according to the settings
-	if (egd_acq_setup(dev, 3, strides, 3, grp)) {
+	if (acq_source_setup(dev, strides, acq_ngrp, acq_grp)) {
 		retval = errno;
-		egd_close(dev);
+		free_labels();
+		free_chinfo();
+		free_channel_selection();
+		acq_source_close(dev);
 		return retval;
 	}
 
@@ -282,75 +762,244 @@ int device_connection(void)
 static
 int device_disconnection(void)
 {
+	free_xdf_conv();
+	preproc_deinit(&preproc);
+	preproc_enabled = 0;
 	free_labels();
-	egd_close(dev);
+	free_chinfo();
+	free_channel_selection();
+	acq_source_close(dev);
 	return 0;
 }
 
 
 /**
- * record_event() - add events to xdffile
- * @evt_stk:    stack of event to store in file
- * @fs:         sampling frequency of acquisition
- * @diff_idx:   index of acquired sample when recording started
+ * bench_update() - account processed block in benchmark measures
+ * @b:          benchmark measures
+ * @ns:         number of samples of the block
+ * @read_ts:    time (in ns) at which the block has been read
+ *
+ * If the source does not report the acquisition time of its samples, the
+ * latency is measured from the time the block has been read.
  */
 static
-int record_event(struct event_stack* evt_stk, float fs, int diff_idx)
+void bench_update(struct bench_stats* b, int ns, int64_t read_ts)
 {
-	int e, evttype;
-	double onset;
+	struct acq_status status;
+	int64_t now = get_time_ns();
+
+	b->has_status = !acq_source_get_status(dev, &status);
+	if (b->has_status) {
+		read_ts = status.last_ts;
+		b->noverrun = status.noverrun;
+		b->nlost = status.nlost;
+	}
 
-	if (skip_event_recording)
-		return 0;
+	lat_hist_add(&b->latency, now - read_ts);
+	if (!b->ns) {
+		b->ns_first = ns;
+		b->first_ts = now;
+	}
+	b->ns += ns;
+	b->last_ts = now;
+}
 
-	for (e = 0; e < evt_stk->nevent; e++) {
-		// Get XDF event type
-		evttype = xdf_add_evttype(xdf, evt_stk->events[e].type, NULL);
-		if (evttype == -1) {
-			mm_raise_from_errno("xdf_add_evttype() failed");
-			return -1;
-		}
 
-		// Compute onset in floating point (in seconds) since
-		// beginning of recording
-		onset = (evt_stk->events[e].pos - diff_idx) / fs;
-		if (xdf_add_event(xdf, evttype, onset, 0.0f)) {
-			mm_raise_from_errno("xdf_add_event(..., %d, ...) failed", evttype);
-			return -1;
+/**
+ * setup_gap_detector() - initialize detection of gaps in acquisition
+ * @gd:         gap detector to initialize
+ * @fs:         sampling frequency
+ *
+ * If --counter-channel is set, the gaps are detected from the channel of
+ * this label, whose wrap-around value is deduced from its range.
+ */
+static
+void setup_gap_detector(struct gap_detector* gd, float fs)
+{
+	int realtime, igrp, i;
+	int64_t modulus;
+	size_t offset;
+	const struct acq_chinfo* info;
+
+	realtime = !(replay_speed_str && !strcmp(replay_speed_str, "max"));
+	gap_detector_init(gd, dev, fs, block_ns, realtime);
+
+	if (!counter_label)
+		return;
+
+	for (igrp = 0; igrp < 3; igrp++) {
+		for (i = 0; i < (int)grp[igrp].nch; i++) {
+			if (strcmp(labels[igrp][i], counter_label))
+				continue;
+
+			modulus = INT64_C(1) << 32;
+			info = chinfo[igrp] ? &chinfo[igrp][i] : NULL;
+			if (info && info->mm[1] > info->mm[0])
+				modulus = llround(info->mm[1] - info->mm[0]) + 1;
+
+			offset = i * strides[igrp] / grp[igrp].nch;
+			gap_detector_set_counter(gd, igrp, offset, strides[igrp],
+			                         grp[igrp].datatype == EGD_FLOAT,
+			                         modulus);
+			return;
 		}
 	}
-	return 0;
+
+	mm_log_warn("Counter channel %s not found", counter_label);
+}
+
+
+/**
+ * get_preproc_cfg() - read settings of EEG preprocessing
+ * @cfg:        pointer receiving the settings of [preprocessing] group
+ *
+ * Return: 1 if any preprocessing is requested, 0 otherwise
+ */
+static
+int get_preproc_cfg(struct preproc_cfg* cfg)
+{
+	const char* group = "preprocessing";
+	const char* ref = settings_get(group, "reference");
+
+	*cfg = (struct preproc_cfg) {
+		.notch = settings_get_double(group, "notch", 0.0),
+		.notch_q = settings_get_double(group, "notch-q", 30.0),
+		.hp_cutoff = settings_get_double(group, "hp-cutoff", 0.0),
+		.lp_cutoff = settings_get_double(group, "lp-cutoff", 0.0),
+		.car = ref && !mm_strcasecmp(ref, "average"),
+	};
+
+	if (ref && !cfg->car && mm_strcasecmp(ref, "none"))
+		mm_log_warn("Unknown preprocessing reference: %s", ref);
+
+	return cfg->notch > 0.0 || cfg->hp_cutoff > 0.0
+	       || cfg->lp_cutoff > 0.0 || cfg->car;
+}
+
+
+/**
+ * warn_redundant_panel_filters() - report panel settings doubling preprocessing
+ * @cfg:        enabled preprocessing configuration
+ *
+ * The tabs displaying the preprocessed EEG would filter or re-reference it
+ * a second time if their settings also enable the filters or a reference.
+ */
+static
+void warn_redundant_panel_filters(const struct preproc_cfg* cfg)
+{
+	char group[16];
+	const char* ref;
+	int tabid, filt;
+
+	filt = cfg->notch > 0.0 || cfg->hp_cutoff > 0.0 || cfg->lp_cutoff > 0.0;
+	for (tabid = 0; tabid < NTAB; tabid++) {
+		if (!tab_preproc[tabid])
+			continue;
+
+		sprintf(group, "panel%i", tabid);
+		if (filt && (settings_get_bool(group, "lp-filter-on", 0)
+		             || settings_get_bool(group, "hp-filter-on", 0)))
+			mm_log_warn("[%s] filters applied on top of "
+			            "preprocessing", group);
+
+		ref = settings_get(group, "reference-type");
+		if (cfg->car && ref && mm_strcasecmp(ref, "none"))
+			mm_log_warn("[%s] %s reference applied on top of "
+			            "common average", group, ref);
+	}
+}
+
+
+/**
+ * setup_preproc() - initialize preprocessing of EEG channels
+ * @fs:         sampling frequency
+ *
+ * The unselected channels are excluded from the common average. If the
+ * settings are invalid, the EEG is displayed and streamed as acquired.
+ */
+static
+void setup_preproc(float fs)
+{
+	struct preproc_cfg cfg;
+	int i;
+
+	preproc_enabled = 0;
+	if (!get_preproc_cfg(&cfg))
+		return;
+
+	if (preproc_init(&preproc, grp[0].nch, block_ns, fs, &cfg)) {
+		mm_log_warn("Preprocessing disabled: %s",
+		            mm_get_lasterror_desc());
+		return;
+	}
+
+	for (i = 0; i < (int)grp[0].nch; i++)
+		if (is_unselected_channel(labels[0][i]))
+			preproc_exclude_from_average(&preproc, i);
+
+	preproc_enabled = 1;
+	if (!headless)
+		warn_redundant_panel_filters(&cfg);
+	mm_log_info("EEG preprocessed by %i filter sections%s (%s kernels)",
+	            preproc.nbiquad, cfg.car ? " and common average" : "",
+	            preproc_get_impl_name(preproc.impl));
+}
+
+
+/**
+ * preprocess_block() - filter and re-reference EEG of acquired block
+ * @blk:        acquired block (left untouched for recording)
+ *
+ * The preprocessed EEG is written in a block of the pool, along with a
+ * copy of the other arrays if it is to be streamed.
+ *
+ * Return: the preprocessed block, NULL if no block is available (the raw
+ * EEG is then used instead)
+ */
+static
+struct sample_block* preprocess_block(const struct sample_block* blk)
+{
+	struct sample_block* pblk;
+
+	pblk = block_pool_get(&pool);
+	if (!pblk)
+		return NULL;
+
+	pblk->ns = blk->ns;
+	pblk->evt.nevent = 0;
+	preproc_process(&preproc, blk->ns, blk->data[0], pblk->data[0]);
+	if (streamer.nblock) {
+		memcpy(pblk->data[1], blk->data[1], blk->ns * strides[1]);
+		memcpy(pblk->data[2], blk->data[2], blk->ns * strides[2]);
+	}
+
+	return pblk;
 }
 
+
 // EEG acquisition thread
 static
 void* reading_thread(void* arg)
 {
-	float *eeg, *exg;
-	int32_t *tri;
 	mcpanel* panel = arg;
-	unsigned int neeg, nexg, ntri;
 	int run_acq, error, saving = 0;
-	int nsread, total_rec, total_read, rec_start;
+	int nsread, nsrec, total_rec, total_read, rec_start;
+	int ngap, rec_ngap;
 	float fs;
 	struct rectimer_data rectimer;
 	struct event_tracker* trk = &evttrk;
-	struct event_stack* evt_stk;
+	struct sample_block *blk, *pblk;
+	struct gap_detector gapdet;
+	int64_t read_start, read_ts;
 
-	fs = egd_get_cap(dev, EGD_CAP_FS, NULL);
+	fs = acq_source_get_fs(dev);
 	rectimer_data_init(&rectimer, panel, fs);
 
-	neeg = grp[0].nch;
-	nexg = grp[1].nch;
-	ntri = grp[2].nch;
-
-	eeg = neeg ? calloc(neeg*NSAMPLES, sizeof(*eeg)) : NULL;
-	exg = nexg ? calloc(nexg*NSAMPLES, sizeof(*exg)) : NULL;
-	tri = ntri ? calloc(ntri*NSAMPLES, sizeof(*tri)) : NULL;
-
-	egd_start(dev);
+	acq_source_start(dev);
+	setup_gap_detector(&gapdet, fs);
 	total_read = 0;
 	total_rec = 0;
+	rec_ngap = 0;
 	rec_start = 0;
 
 	while (1) {
@@ -366,9 +1015,15 @@ void* reading_thread(void* arg)
 				pthread_mutex_unlock(&file_mtx);
 			saving = record_file;
 
+			// A new recording starts with the history of
+			// acquisition, a resumed one continues where it paused
 			if (saving == REC_RESET_AND_SAVING) {
 				total_rec = 0;
-				rec_start = total_read;
+				rec_ngap = 0;
+				rec_start = recorder_push_history(&recorder,
+				                                  total_read);
+			} else if (saving == REC_SAVING) {
+				recorder_clear_history(&recorder);
 			}
 		}
 		pthread_mutex_unlock(&sync_mtx);
@@ -377,115 +1032,141 @@ void* reading_thread(void* arg)
 		if (!run_acq)
 			break;
 
-		// Get data from the system
-		nsread = egd_get_data(dev, NSAMPLES, eeg, exg, tri);
+		// Get a free block from the pool. The pool is sized to hold
+		// the recording ring at full load, so this may only fail if
+		// a consumer is leaking references.
+		blk = block_pool_get(&pool);
+		if (!blk) {
+			mm_log_error("No free sample block");
+			break;
+		}
+
+		// Get data from the system directly in the block
+		PROF_START();
+		read_start = get_time_ns();
+		nsread = acq_source_get_data(dev, block_ns, blk->data[0],
+		                             blk->data[1], blk->data[2]);
 		if (nsread < 0) {
 			error = errno;			
-			mcp_notify(panel, DISCONNECTED);
-			mcp_popup_message(panel, get_acq_msg(error));
+			sample_block_unref(blk);
+			if (panel) {
+				mcp_notify(panel, DISCONNECTED);
+				mcp_popup_message(panel, get_acq_msg(error));
+			} else if (error == ENODATA && replay_filename) {
+				mm_log_info("%s", get_acq_msg(error));
+			} else {
+				mm_log_error("Acquisition failed: %s",
+				             get_acq_msg(error));
+			}
 			break;
 		}
+		PROF_LAP(PROF_ACQ_GET_DATA);
+		read_ts = get_time_ns();
+		blk->ns = nsread;
+
+		// Mark the samples lost before this block, if any, by events
+		// attached to the block
+		ngap = gap_detector_check(&gapdet, dev, blk, total_read,
+		                          read_ts - read_start, trk);
+		if (saving != REC_PAUSE)
+			rec_ngap += ngap;
+
 		total_read += nsread;
 		event_tracker_update_ns_read(trk, total_read);
-		evt_stk = event_tracker_swap_eventstack(trk);
+		event_tracker_pop_events(trk, &blk->evt);
+		PROF_LAP(PROF_ACQ_EVENTS);
+
+		// Filter and re-reference once for all the consumers but the
+		// recording
+		pblk = NULL;
+		if (preproc_enabled) {
+			pblk = preprocess_block(blk);
+			PROF_LAP(PROF_ACQ_PREPROC);
+		}
 
-		// Write samples on file
+		// Serve live data to subscribers (never blocks)
+		streamer_push(&streamer, pblk ? pblk : blk,
+		              total_read - nsread, read_ts);
+		PROF_LAP(PROF_ACQ_STREAM);
+
+		// Queue samples for writing on file
 		if (saving != REC_PAUSE) {
-			if (xdf_write(xdf, nsread, eeg, exg, tri) < 0) {
+			// Do not record beyond the requested duration if any
+			nsrec = nsread;
+			if (rec_nsmax && total_rec + nsrec > rec_nsmax)
+				nsrec = rec_nsmax - total_rec;
+
+			recorder_push(&recorder, blk, nsrec, rec_start);
+
+			error = recorder_get_error(&recorder);
+			if (error) {
 				pthread_attr_t attr;
 				pthread_t thid;
-				sprintf(bdffile_message,"XDF Error: %s",strerror(errno));
+				sprintf(bdffile_message,"XDF Error: %s",strerror(error));
 			
 				// Stop recording
 				saving = 0;
 				pthread_mutex_unlock(&file_mtx);
 				StopRecording(NULL);
 
+				if (!panel) {
+					mm_log_error("%s", bdffile_message);
+					sample_block_unref(blk);
+					if (pblk)
+						sample_block_unref(pblk);
+					break;
+				}
+
 				// Pop up message
 				pthread_attr_init(&attr);
 				pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 				pthread_create(&thid, &attr, display_bdf_error, panel);
 				pthread_attr_destroy(&attr);
 			}
-			record_event(evt_stk, fs, rec_start);
 
-			total_rec += nsread;
+			total_rec += nsrec;
+			if (rec_nsmax && total_rec >= rec_nsmax) {
+				sample_block_unref(blk);
+				if (pblk)
+					sample_block_unref(pblk);
+				break;
+			}
 
 			// display how long we are recording
-			rectimer_data_update(&rectimer, total_rec);
+			rectimer_data_update(&rectimer, total_rec, rec_ngap);
+		} else {
+			recorder_keep_history(&recorder, blk);
+		}
+		PROF_LAP(PROF_ACQ_RECORD);
+
+		if (panel) {
+			display_block(&display, panel, blk->ns,
+			              (const void**)blk->data,
+			              pblk ? pblk->data[0] : NULL, &blk->evt);
+			PROF_LAP(PROF_ACQ_DISPLAY);
 		}
 
-		mcp_add_events(panel, 0, evt_stk->nevent, evt_stk->events);
-		mcp_add_samples(panel, 0, nsread, eeg);
-		mcp_add_samples(panel, 1, nsread, eeg);
-		mcp_add_samples(panel, 2, nsread, eeg);
-		mcp_add_samples(panel, 3, nsread, exg);
-		mcp_add_triggers(panel, nsread, (const uint32_t*)tri);
+		if (bench_duration)
+			bench_update(&bench, nsread, read_ts);
 
+		sample_block_unref(blk);
+		if (pblk)
+			sample_block_unref(pblk);
+		PROF_BLOCK_DONE();
 	}
 
 	if (saving)
 		pthread_mutex_unlock(&file_mtx);
 
-	egd_stop(dev);
-
-	free(eeg);
-	free(exg);
-	free(tri);
-
-	return 0;
-}
-
-
-static void
-update_unselected_channel_use(char const ** clabels, int nch)
-{
-	const char* ignored_label;
-	int i, j;
-
-	if (unselected_labels == NULL || clabels == NULL)
-		return;
-
-	for (i = 0; unselected_labels[i] != NULL; i++) {
-		ignored_label = unselected_labels[i];
-		for (j = 0 ; j < nch ; j++) {
-			if (strcmp(clabels[j], ignored_label) == 0) {
-				unselected_found[i]++;
-				break;
-			}
-		}
-	}
-}
-
-
-static
-void report_unknown_unselected_channels(void)
-{
-	int i;
-	const char* label;
-
-	if (!unselected_labels)
-		return;
-
-	for (i = 0; unselected_labels[i] != NULL; i++) {
-		label = unselected_labels[i];
-		if (!unselected_found[i])
-			mm_log_warn("unselected channel %s not found", label);
-	}
-}
-
+	gap_detector_report(&gapdet);
 
-static int
-is_unselected_channel(char const * label)
-{
-	char ** c;
+	// Report that acquisition loop has stopped by itself (only useful in
+	// headless mode)
+	pthread_mutex_lock(&sync_mtx);
+	acq_done = 1;
+	pthread_mutex_unlock(&sync_mtx);
 
-	if (unselected_labels != NULL) {
-		for (c = unselected_labels ; *c != NULL ; c++) {
-			if (strcmp(label, *c) == 0)
-				return 1;
-		}
-	}
+	acq_source_stop(dev);
 
 	return 0;
 }
@@ -515,41 +1196,392 @@ static int setup_tab_input(mcpanel* panel, int tabid, int nch,
 }
 
 
+/**
+ * get_tab_decimation() - get decimation factor of the display of a tab
+ * @tabid:      index of the tab
+ * @fs:         sampling frequency of acquisition
+ *
+ * The decimation factor is set so that the rate of samples sent to the tab
+ * does not exceed the display-max-fs key of the [panel<tabid>] group of
+ * the configuration file.
+ *
+ * Return: the decimation factor (1 if no decimation)
+ */
+static
+int get_tab_decimation(int tabid, float fs)
+{
+	char group[16];
+	double max_fs;
+	int factor;
+
+	sprintf(group, "panel%i", tabid);
+	max_fs = settings_get_double(group, "display-max-fs", 0.0);
+	if (max_fs <= 0.0 || max_fs >= fs)
+		return 1;
+
+	factor = fs / max_fs;
+	if (factor * max_fs < fs)
+		factor++;
+
+	return factor;
+}
+
+
+/**
+ * display_init() - setup display feeds and the tabs of the panel
+ * @disp:       display state to initialize
+ * @panel:      mcpanel instance
+ * @fs:         sampling frequency of acquisition
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int display_init(struct display* disp, mcpanel* panel, float fs)
+{
+	const char*** clabels = (const char***)labels;
+	struct display_feed* feed;
+	int i, tabid, factor, iarray, nch, pp;
+
+	*disp = (struct display) {.nfeed = 0};
+
+	for (tabid = 0; tabid < NTAB; tabid++) {
+		iarray = tab_iarray[tabid];
+		nch = grp[iarray].nch;
+		factor = get_tab_decimation(tabid, fs);
+		pp = preproc_enabled && tab_preproc[tabid];
+
+		// Reuse the feed of a previous tab if it is the same
+		for (i = 0; i < disp->nfeed; i++) {
+			feed = &disp->feeds[i];
+			if (feed->iarray == iarray && feed->preproc == pp
+			    && feed->dec.factor == factor)
+				break;
+		}
+
+		if (i == disp->nfeed) {
+			feed = &disp->feeds[disp->nfeed++];
+			feed->iarray = iarray;
+			feed->preproc = pp;
+			if (decimator_init(&feed->dec, nch, factor, block_ns))
+				return -1;
+
+			if (factor > 1) {
+				feed->buff = malloc((block_ns/factor + 1) * nch
+				                    * sizeof(*feed->buff));
+				if (!feed->buff)
+					return -1;
+			}
+		}
+		disp->tab_feed[tabid] = i;
+
+		if (factor > 1)
+			mm_log_info("Display of tab %i decimated by %i",
+			            tabid, factor);
+
+		setup_tab_input(panel, tabid, nch, fs/factor, clabels[iarray]);
+	}
+	if (!drop_unselected)
+		report_unknown_unselected_channels();
+
+	// Triggers are displayed along the first tab
+	disp->trig_dec = disp->feeds[disp->tab_feed[0]].dec.factor;
+	if (disp->trig_dec > 1 && grp[2].nch) {
+		disp->trig_acc = calloc(grp[2].nch, sizeof(*disp->trig_acc));
+		disp->trig_buff = malloc((block_ns/disp->trig_dec + 1)
+		                         * grp[2].nch * sizeof(*disp->trig_buff));
+		if (!disp->trig_acc || !disp->trig_buff)
+			return -1;
+	}
+	mcp_define_trigg_input(panel, 16, grp[2].nch,
+	                       fs/disp->trig_dec, clabels[2]);
+
+	return 0;
+}
+
+
+/**
+ * display_deinit() - free resources of display feeds
+ * @disp:       display state initialized with display_init()
+ */
+static
+void display_deinit(struct display* disp)
+{
+	int i;
+
+	for (i = 0; i < disp->nfeed; i++) {
+		decimator_deinit(&disp->feeds[i].dec);
+		free(disp->feeds[i].buff);
+	}
+
+	free(disp->trig_acc);
+	free(disp->trig_buff);
+	*disp = (struct display) {.nfeed = 0};
+}
+
+
+/**
+ * decimate_triggers() - decimate trigger samples for display
+ * @disp:       initialized display state
+ * @ns:         number of samples in @tri
+ * @tri:        trigger samples
+ *
+ * Each output sample is the bitwise OR of the input samples since the
+ * previous output, so that no short trigger pulse disappears from display.
+ *
+ * Return: number of decimated samples written in @disp->trig_buff
+ */
+static
+int decimate_triggers(struct display* disp, int ns, const int32_t* tri)
+{
+	int i, ch, nout = 0;
+	int ntri = grp[2].nch;
+
+	for (i = 0; i < ns; i++) {
+		for (ch = 0; ch < ntri; ch++)
+			disp->trig_acc[ch] |= tri[i*ntri + ch];
+
+		if (disp->trig_skip-- > 0)
+			continue;
+
+		memcpy(disp->trig_buff + nout*ntri, disp->trig_acc,
+		       ntri*sizeof(*tri));
+		memset(disp->trig_acc, 0, ntri*sizeof(*tri));
+		disp->trig_skip = disp->trig_dec - 1;
+		nout++;
+	}
+
+	return nout;
+}
+
+
+/**
+ * display_block() - send acquired block to the tabs of the panel
+ * @disp:       initialized display state
+ * @panel:      mcpanel instance
+ * @ns:         number of samples in the block
+ * @data:       eeg, sensor and trigger arrays of the block
+ * @eeg_pp:     preprocessed eeg array of the block (NULL if unavailable)
+ * @evt_stk:    software events received during the block
+ */
+static
+void display_block(struct display* disp, mcpanel* panel, int ns,
+                   const void* data[3], const float* eeg_pp,
+                   const struct event_stack* evt_stk)
+{
+	struct display_feed* feed;
+	const struct mcp_event* evts;
+	const int32_t* tri = data[2];
+	const float* in;
+	int i, nstri, factor;
+
+	// Apply decimation stages
+	for (i = 0; i < disp->nfeed; i++) {
+		feed = &disp->feeds[i];
+		in = data[feed->iarray];
+		if (feed->preproc && eeg_pp)
+			in = eeg_pp;
+
+		if (feed->dec.factor == 1) {
+			feed->ns = ns;
+			feed->data = in;
+		} else {
+			feed->ns = decimator_process(&feed->dec, ns, in,
+			                             feed->buff);
+			feed->data = feed->buff;
+		}
+	}
+
+	// Express event positions in the timebase of the first tab
+	evts = evt_stk->events;
+	factor = disp->feeds[disp->tab_feed[0]].dec.factor;
+	if (factor > 1) {
+		for (i = 0; i < evt_stk->nevent; i++) {
+			disp->evts[i].type = evt_stk->events[i].type;
+			disp->evts[i].pos = evt_stk->events[i].pos / factor;
+		}
+		evts = disp->evts;
+	}
+
+	nstri = ns;
+	if (disp->trig_dec > 1 && tri) {
+		nstri = decimate_triggers(disp, ns, tri);
+		tri = disp->trig_buff;
+	}
+
+	mcp_add_events(panel, 0, evt_stk->nevent, evts);
+	for (i = 0; i < NTAB; i++) {
+		feed = &disp->feeds[disp->tab_feed[i]];
+		mcp_add_samples(panel, i, feed->ns, feed->data);
+	}
+	mcp_add_triggers(panel, nstri, (const uint32_t*)tri);
+}
+
+
+/**
+ * parse_block_size() - convert block size specification in samples
+ * @str:        block size in samples or period suffixed by "ms" or "s"
+ * @fs:         sampling frequency of acquisition
+ *
+ * The block size must not exceed MAX_BLOCK_DURATION seconds of samples (or
+ * DEFAULT_BLOCK_SIZE if larger), since the buffers sharing the blocks
+ * are sized after it.
+ *
+ * Return: number of samples per block if @str is valid, -1 otherwise
+ */
+static
+int parse_block_size(const char* str, float fs)
+{
+	char* end;
+	double val, max_ns;
+	int ns;
+
+	max_ns = MAX_BLOCK_DURATION * fs;
+	if (max_ns < DEFAULT_BLOCK_SIZE)
+		max_ns = DEFAULT_BLOCK_SIZE;
+
+	val = strtod(str, &end);
+	if (end == str || !isfinite(val) || val <= 0)
+		return -1;
+
+	if (strcmp(end, "ms") == 0)
+		val *= 1e-3 * fs;
+	else if (strcmp(end, "s") == 0)
+		val *= fs;
+	else if (*end != '\0')
+		return -1;
+
+	if (!isfinite(val) || val > max_ns)
+		return -1;
+
+	ns = val + 0.5;
+	return (ns < 1) ? 1 : ns;
+}
+
+
+/**
+ * get_block_size() - get the number of samples to read at once
+ * @fs:         sampling frequency of acquisition
+ *
+ * The block size is set by --block-size if specified, by the block-size key
+ * of the [main] group of the configuration file otherwise.
+ *
+ * Return: the number of samples per block
+ */
+static
+int get_block_size(float fs)
+{
+	const char* str;
+	int ns;
+
+	str = block_size_str;
+	if (!str)
+		str = settings_get("main", "block-size");
+
+	if (!str)
+		return DEFAULT_BLOCK_SIZE;
+
+	ns = parse_block_size(str, fs);
+	if (ns < 0) {
+		mm_log_warn("Invalid block size %s, using %i samples",
+		            str, DEFAULT_BLOCK_SIZE);
+		return DEFAULT_BLOCK_SIZE;
+	}
+
+	return ns;
+}
+
+
 // Connection to the system
 static
 int Connect(mcpanel* panel)
 {
-	int retval;
-	const char*** clabels;
+	int retval, pool_flags, nblock;
 	float fs;
-	unsigned int ntri;
+	int nch[3];
+	struct streamer_cfg stream_cfg = {
+		.tcp_port = stream_port,
+		.unix_path = stream_unix_path,
+	};
+	struct event_tracker_cfg evt_cfg = {
+		.tcp_port = eventport,
+		.udp_port = event_udp_port,
+		.unix_path = event_unix_path,
+		.shm_name = event_shm_name,
+	};
 
 	retval = device_connection();
 	if (retval)
 		return retval;
 
-	fs = egd_get_cap(dev, EGD_CAP_FS, NULL);
-	clabels = (const char***)labels;
+	fs = acq_source_get_fs(dev);
+
+	block_ns = get_block_size(fs);
+	mm_log_info("Acquisition by blocks of %i samples (%.1f ms)",
+	            block_ns, 1000.0f * block_ns / fs);
+
+	// Allocate recording buffer and start the writer thread
+	if (recorder_init(&recorder, fs, block_ns, recbuf_duration,
+	                  pretrigger_duration)) {
+		device_disconnection();
+		return ENOMEM;
+	}
+
+	// Preprocessing must be known before advertising the stream
+	setup_preproc(fs);
+	if (preproc_enabled)
+		stream_cfg.flags = EEGVIEW_STREAM_PREPROC;
+
+	// Serve live data to downstream consumers if requested. Failing to
+	// do so does not prevent acquisition.
+	nch[0] = grp[0].nch;
+	nch[1] = grp[1].nch;
+	nch[2] = grp[2].nch;
+	if (streamer_init(&streamer, fs, block_ns, nch, &stream_cfg)) {
+		mm_log_warn("Live streaming disabled");
+		streamer_deinit(&streamer);
+	}
 
-	// Retrieve the number of trigger channels
-	ntri = grp[2].nch;
+	// Allocate the blocks shared by acquisition and its consumers: the
+	// recording history and the recording and streaming rings may hold
+	// all their blocks while one is being acquired and displayed. With
+	// preprocessing, the streaming ring holds the preprocessed blocks
+	// and one more is being preprocessed.
+	pool_flags = (use_hugepages ? BLOCK_POOL_HUGEPAGES : 0)
+	           | (lock_memory ? BLOCK_POOL_MLOCK : 0);
+	nblock = recorder.nblock + recorder.nhist + streamer.nblock + 2;
+	if (preproc_enabled)
+		nblock++;
+
+	if (block_pool_init(&pool, nblock, strides, block_ns, pool_flags)) {
+		streamer_deinit(&streamer);
+		recorder_deinit(&recorder);
+		device_disconnection();
+		return ENOMEM;
+	}
 
 	// Setup the panel with the settings
-	setup_tab_input(panel, 0, grp[0].nch, fs, clabels[0]);
-	setup_tab_input(panel, 1, grp[0].nch, fs, clabels[0]);
-	setup_tab_input(panel, 2, grp[0].nch, fs, clabels[0]);
-	setup_tab_input(panel, 3, grp[1].nch, fs, clabels[1]);
-	report_unknown_unselected_channels();
-	mcp_define_trigg_input(panel, 16, ntri, fs, clabels[2]);
+	if (panel && display_init(&display, panel, fs)) {
+		display_deinit(&display);
+		streamer_deinit(&streamer);
+		block_pool_deinit(&pool);
+		recorder_deinit(&recorder);
+		device_disconnection();
+		return ENOMEM;
+	}
+
+	// Profile measures are reported per acquisition session
+	PROF_RESET();
+
+	// Network event connection and reception. This must be ready before
+	// the acquisition starts since it is updated by the reading thread.
+	event_tracker_init(&evttrk, fs, block_ns, &evt_cfg);
 
 	pthread_mutex_lock(&sync_mtx);
 	run_eeg = 1;
+	acq_done = 0;
 	pthread_mutex_unlock(&sync_mtx);
 	pthread_create(&thread_id, NULL, reading_thread, panel);
 
-	// Network event connection and reception
-	event_tracker_init(&evttrk, fs, eventport);
-
 	return 0;
 }
 
@@ -566,10 +1598,16 @@ int Disconnect(mcpanel* panel)
 	pthread_mutex_unlock(&sync_mtx);
 
 	pthread_join(thread_id, NULL);
+	recorder_deinit(&recorder);
+	streamer_deinit(&streamer);
+	block_pool_deinit(&pool);
+	display_deinit(&display);
 	device_disconnection();
 
 	event_tracker_deinit(&evttrk);
 
+	PROF_DUMP();
+
 	return 0;
 }
 
@@ -597,21 +1635,23 @@ void on_device_info(int id, void* data)
 {
 	(void)id;
 	unsigned int sampling_freq, eeg_nmax, sensor_nmax, trigger_nmax;
-	char *device_type, *device_id;
-	char prefiltering[128];
+	const char *device_type, *device_id;
+	struct acq_chinfo info;
+	double jitter_us, ppm, rx_mean_us, rx_max_us;
 	mcpanel* panel = data;
 
 	if (!run_eeg)
 		return;
 
-	egd_get_cap(dev, EGD_CAP_DEVTYPE, &device_type);
-	egd_get_cap(dev, EGD_CAP_DEVID, &device_id);
-	egd_get_cap(dev, EGD_CAP_FS, &sampling_freq);
-	eeg_nmax = egd_get_numch(dev, EGD_EEG);
-	sensor_nmax = egd_get_numch(dev, EGD_SENSOR);
-	trigger_nmax = egd_get_numch(dev, EGD_TRIGGER);
-	egd_channel_info(dev, EGD_EEG, 0,
-			EGD_PREFILTERING, prefiltering, EGD_EOL);
+	acq_source_get_devinfo(dev, &device_type, &device_id);
+	sampling_freq = acq_source_get_fs(dev);
+	eeg_nmax = acq_source_get_numch(dev, EGD_EEG);
+	sensor_nmax = acq_source_get_numch(dev, EGD_SENSOR);
+	trigger_nmax = acq_source_get_numch(dev, EGD_TRIGGER);
+	if (acq_source_get_chinfo(dev, EGD_EEG, 0, &info))
+		info.filtering[0] = '\0';
+	event_tracker_get_clock_stats(&evttrk, &jitter_us, &ppm);
+	event_tracker_get_rx_delay(&evttrk, &rx_mean_us, &rx_max_us);
 	
 	snprintf(devinfo, sizeof(devinfo)-1,
 	       "system info:\n\n"
@@ -621,9 +1661,15 @@ void on_device_info(int id, void* data)
 	       "num EEG channels: %u\n"
 	       "num sensor channels: %u\n"
 	       "num trigger channels: %u\n"
-	       "prefiltering: %s\n",
+	       "prefiltering: %s\n"
+	       "dropped software events: %u\n"
+	       "sampling rate deviation: %.1f ppm\n"
+	       "software event timing jitter: %.1f us\n"
+	       "software event reception delay: mean %.1f us, max %.1f us\n",
 	       device_type, device_id, sampling_freq,
-	       eeg_nmax, sensor_nmax, trigger_nmax, prefiltering);
+	       eeg_nmax, sensor_nmax, trigger_nmax, info.filtering,
+	       event_tracker_get_ndropped(&evttrk), ppm, jitter_us,
+	       rx_mean_us, rx_max_us);
 	
 	mcp_popup_message(panel, devinfo);	
 }
@@ -633,46 +1679,83 @@ void on_device_info(int id, void* data)
  *              File recording callbacks                                  *
  *                                                                        * 
  **************************************************************************/
+/**
+ * setup_xdf_converted_channel() - configure channel converted by eegview
+ * @file:       BDF/GDF file being set up
+ * @ch:         channel added to @file
+ * @igrp:       index of the float array of the channel
+ * @j:          index of the channel in the array
+ *
+ * The channel is written as digital values already packed in integers of
+ * xdf_width bytes by xdf_conv[@igrp]. The physical range advertised in
+ * the file is the one effectively used by the conversion.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int setup_xdf_converted_channel(struct xdf* file, struct xdfch* ch,
+                                int igrp, int j)
+{
+	const struct acq_chinfo* info = &chinfo[igrp][j];
+	const struct sample_conv* conv = &xdf_conv[igrp];
+	double pmin, pmax;
+	int dtype;
+
+	dtype = (xdf_width == 2) ? XDFINT16 : XDFINT24;
+	pmin = (conv->dmin - (double)conv->offset[j]) / conv->scale[j];
+	pmax = (conv->dmax - (double)conv->offset[j]) / conv->scale[j];
+
+	return xdf_set_chconf(ch,
+	                      XDF_CF_ARRDIGITAL, 1,
+	                      XDF_CF_ARRINDEX, igrp,
+	                      XDF_CF_ARROFFSET, j * xdf_width,
+	                      XDF_CF_STOTYPE, xdf_closest_type(file, dtype),
+	                      XDF_CF_ARRTYPE, dtype,
+	                      XDF_CF_DMAX, (double)conv->dmax,
+	                      XDF_CF_DMIN, (double)conv->dmin,
+	                      XDF_CF_PMAX, pmax,
+	                      XDF_CF_PMIN, pmin,
+	                      XDF_CF_PREFILTERING, info->filtering,
+	                      XDF_CF_TRANSDUCTER, info->transducter,
+	                      XDF_CF_UNIT, info->unit,
+	                      XDF_NOF);
+}
+
+
 static
-int setup_xdf_channel_group(int igrp)
+int setup_xdf_channel_group(struct xdf* file, int igrp)
 {
-	char label[32], transducter[128], unit[16], filtering[128];
-	double mm[2];
+	const struct acq_chinfo* info;
 	unsigned int j;
 	int rv;
-	int isint;
 	int dtype;
 	struct xdfch * ch;
 
 	for (j = 0; j < grp[igrp].nch; j++) {
-		rv = egd_channel_info(dev,
-		                      grp[igrp].sensortype, j,
-		                      EGD_ISINT, &isint,
-		                      EGD_LABEL, label,
-		                      EGD_MM_D, mm,
-		                      EGD_PREFILTERING, filtering,
-		                      EGD_TRANSDUCTER, transducter,
-		                      EGD_UNIT, unit,
-		                      EGD_EOL);
-		if (rv != 0)
-			return -1;
+		info = &chinfo[igrp][j];
 
 		/* Add the channel to the BDF */
-		if ((ch = xdf_add_channel(xdf, label)) == NULL)
+		if ((ch = xdf_add_channel(file, labels[igrp][j])) == NULL)
 			return -1;
 
-		dtype = isint ? XDFINT32 : XDFFLOAT;
+		if (igrp < 2 && xdf_width) {
+			if (setup_xdf_converted_channel(file, ch, igrp, j))
+				return -1;
+			continue;
+		}
+
+		dtype = info->isint ? XDFINT32 : XDFFLOAT;
 		rv = xdf_set_chconf(ch,
 		                    XDF_CF_ARRDIGITAL, 0,
 		                    XDF_CF_ARRINDEX, igrp,
-		                    XDF_CF_ARROFFSET, j * (isint ? sizeof(int32_t) : sizeof(float)),
-		                    XDF_CF_STOTYPE, xdf_closest_type(xdf, dtype),
+		                    XDF_CF_ARROFFSET, j * (info->isint ? sizeof(int32_t) : sizeof(float)),
+		                    XDF_CF_STOTYPE, xdf_closest_type(file, dtype),
 		                    XDF_CF_ARRTYPE, dtype,
-		                    XDF_CF_PMAX, mm[1],
-		                    XDF_CF_PMIN, mm[0],
-		                    XDF_CF_PREFILTERING, filtering,
-		                    XDF_CF_TRANSDUCTER, transducter,
-		                    XDF_CF_UNIT, unit,
+		                    XDF_CF_PMAX, info->mm[1],
+		                    XDF_CF_PMIN, info->mm[0],
+		                    XDF_CF_PREFILTERING, info->filtering,
+		                    XDF_CF_TRANSDUCTER, info->transducter,
+		                    XDF_CF_UNIT, info->unit,
 		                    XDF_NOF);
 		if (rv != 0)
 			return -1;
@@ -682,19 +1765,9 @@ int setup_xdf_channel_group(int igrp)
 }
 
 static
-int create_file(mcpanel* panel)
+struct xdf* open_xdf_file(const char* filename)
 {
 	const char *fileext, *dot;
-	char *filename;
-
-	xdf = NULL;
-
-	filename = mcp_open_filename_dialog(panel,
-	                              "GDF files|*.gdf|*.GDF||BDF files|*.bdf|*.BDF||Any files|*");
-
-	// Check that user hasn't pressed cancel
-	if (filename == NULL)
-		return 0;
 
 	// Create the BDF/GDF file
 	dot = strrchr(filename, '.');
@@ -706,60 +1779,354 @@ int create_file(mcpanel* panel)
 	}
 
 	if (mm_strcasecmp(fileext, "bdf")==0) {
-		xdf = xdf_open(filename, XDF_WRITE, XDF_BDF);
+		return xdf_open(filename, XDF_WRITE, XDF_BDF);
 	} else if (mm_strcasecmp(fileext, "gdf")==0) {
-		xdf = xdf_open(filename, XDF_WRITE, XDF_GDF2);
+		return xdf_open(filename, XDF_WRITE, XDF_GDF2);
 	} else {
-		fprintf(stderr, "File extension should be either BDF or GDF! Defaulting to GDF\n");
-		xdf = xdf_open(filename, XDF_WRITE, XDF_GDF2);
+		fprintf(stderr, "File extension should be either BDF, GDF or "
+		                SPOOL_EXT "! Defaulting to GDF\n");
+		return xdf_open(filename, XDF_WRITE, XDF_GDF2);
 	}
+}
 
-	return 1;
+
+static
+int is_spool_filename(const char* filename)
+{
+	const char* dot = strrchr(filename, '.');
+
+	return dot && dot != filename && !mm_strcasecmp(dot + 1, SPOOL_EXT);
 }
 
+
+/**
+ * create_spool_file() - create compressed spool file
+ * @filename:   path of the file to create
+ * @iseg:       index of the segment recorded in the file
+ * @first:      index in the recording of the first sample of the segment
+ *
+ * Return: the file in case of success, NULL otherwise with errno set
+ */
 static
-int SetupRecording(void *user_data)
+struct spool* create_spool_file(const char* filename, int iseg, int64_t first)
 {
-	mcpanel *panel = user_data;
-	unsigned int j;
-	int fileformat = -1;
-	int fs = egd_get_cap(dev, EGD_CAP_FS, NULL);
+	struct spool_chdesc* chdesc;
+	const struct acq_chinfo* info;
+	struct spool* sp;
+	struct mm_timespec now;
+	double rectime;
+	int nch[3] = {grp[0].nch, grp[1].nch, grp[2].nch};
+	unsigned int i, j, n;
+
+	chdesc = calloc(nch[0] + nch[1] + nch[2] + 1, sizeof(*chdesc));
+	if (!chdesc)
+		return NULL;
 
-	if (!create_file(panel))
-		return 0;
+	for (n = 0, i = 0; i < 3; i++) {
+		for (j = 0; j < grp[i].nch; j++, n++) {
+			info = &chinfo[i][j];
+			strncpy(chdesc[n].label, labels[i][j],
+			        sizeof(chdesc[n].label) - 1);
+			strncpy(chdesc[n].unit, info->unit,
+			        sizeof(chdesc[n].unit) - 1);
+			strncpy(chdesc[n].transducter, info->transducter,
+			        sizeof(chdesc[n].transducter) - 1);
+			strncpy(chdesc[n].filtering, info->filtering,
+			        sizeof(chdesc[n].filtering) - 1);
+			chdesc[n].mm[0] = info->mm[0];
+			chdesc[n].mm[1] = info->mm[1];
+			chdesc[n].isint = info->isint;
+		}
+	}
 
-	if (!xdf)
-		goto abort;
+	if (iseg == 0) {
+		mm_gettime(CLOCK_REALTIME, &now);
+		rectime = now.tv_sec + now.tv_nsec * 1e-9;
+	} else {
+		rectime = rec_start_time + (double)first / recorder.fs;
+	}
+
+	sp = spool_create(filename, recorder.fs, rectime, nch, chdesc);
+	free(chdesc);
+	return sp;
+}
+
+
+/**
+ * create_xdf_file() - create BDF/GDF file and make it ready for recording
+ * @filename:   path of the BDF/GDF file to create
+ * @iseg:       index of the segment recorded in the file
+ * @first:      index in the recording of the first sample of the segment
+ *
+ * When the recording is segmented, the segment index and its first sample
+ * are written in the session description of the file.
+ *
+ * Return: the file in case of success, NULL otherwise with errno set
+ */
+static
+struct xdf* create_xdf_file(const char* filename, int iseg, int64_t first)
+{
+	struct xdf* file;
+	char desc[128];
+	size_t xdf_strides[3] = {strides[0], strides[1], strides[2]};
+	unsigned int j;
+	int fs = recorder.fs;
+
+	file = open_xdf_file(filename);
+	if (!file)
+		return NULL;
 
 	// Configuration file genral header
-	xdf_set_conf(xdf,
+	xdf_set_conf(file,
 	             XDF_F_REC_DURATION, 1.0,
 	             XDF_F_REC_NSAMPLE, fs,
 		     XDF_NOF);
 
+	if (segment_duration || segment_size) {
+		snprintf(desc, sizeof(desc), "segment %i, first sample %lli",
+		         iseg + 1, (long long)first);
+		xdf_set_conf(file, XDF_F_SESS_DESC, desc, XDF_NOF);
+		if (iseg > 0)
+			xdf_set_conf(file, XDF_F_RECTIME,
+			             rec_start_time + (double)first / fs,
+			             XDF_NOF);
+	}
+
 	// Set up the channels
 	for (j=0; j<3; j++)	
-		if (setup_xdf_channel_group(j))
+		if (setup_xdf_channel_group(file, j))
 			goto abort;
 
 	// Make the file ready for recording
-	xdf_define_arrays(xdf, 3, strides);
-	if (xdf_prepare_transfer(xdf))
+	if (xdf_width) {
+		xdf_strides[0] = grp[0].nch * xdf_width;
+		xdf_strides[1] = grp[1].nch * xdf_width;
+	}
+	xdf_define_arrays(file, 3, xdf_strides);
+	if (xdf_prepare_transfer(file))
 		goto abort;
 
+	return file;
+
+abort:
+	xdf_close(file);
+	return NULL;
+}
+
+
+/**
+ * create_recording_file() - create file and make it ready for recording
+ * @file:       pointer receiving the created file
+ * @filename:   path of the file to create
+ * @iseg:       index of the segment recorded in the file
+ * @first:      index in the recording of the first sample of the segment
+ * @data:       unused
+ *
+ * The format of the file is selected by the extension of @filename: BDF,
+ * GDF or compressed spool (SPOOL_EXT). The start time of the segments
+ * following the first one is derived from the start time of the first one.
+ * This is called by the writer thread for the segments following the first
+ * one.
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+static
+int create_recording_file(struct rec_file* file, const char* filename,
+                          int iseg, int64_t first, void* data)
+{
+	(void)data;
+
+	if (chinfo_error) {
+		errno = chinfo_error;
+		return -1;
+	}
+
+	*file = (struct rec_file) {.xdf = NULL};
+	if (is_spool_filename(filename))
+		file->spool = create_spool_file(filename, iseg, first);
+	else
+		file->xdf = create_xdf_file(filename, iseg, first);
+
+	return (file->xdf || file->spool) ? 0 : -1;
+}
+
+
+/**
+ * get_segment_ns() - get number of samples of a recording segment
+ * @fs:         sampling frequency
+ * @fileformat: format of the recording file (-1 for spool files)
+ *
+ * The segment length is derived from --segment-duration and
+ * --segment-size (whichever is the most restrictive) and rounded down to a
+ * whole number of records (1 second) so that no segment is padded.
+ *
+ * Return: number of samples per segment, 0 if recording is not segmented
+ */
+static
+int64_t get_segment_ns(int fs, int fileformat)
+{
+	int64_t ns, ns_size;
+	int nch, sample_size;
+
+	if (!segment_duration && !segment_size)
+		return 0;
+
+	ns = INT64_MAX;
+	if (segment_duration)
+		ns = (int64_t)segment_duration * fs;
+
+	// Approximate the size of a sample from its storage (spool files
+	// are assumed not compressed)
+	if (segment_size) {
+		nch = grp[0].nch + grp[1].nch;
+		sample_size = nch * (fileformat == XDF_BDF ? 3 : 4);
+		if (xdf_width)
+			sample_size = nch * xdf_width;
+		sample_size += grp[2].nch * (fileformat == XDF_BDF ? 3 : 4);
+		ns_size = (int64_t)segment_size * 1024 * 1024
+		          / (sample_size ? sample_size : 1);
+		if (ns_size < ns)
+			ns = ns_size;
+	}
+
+	ns -= ns % fs;
+	return (ns < fs) ? fs : ns;
+}
+
+
+/**
+ * setup_storage() - select storage of float channels in recorded file
+ * @filename:   path of the BDF, GDF or spool file about to be created
+ *
+ * BDF files can only store 24 bit integers: their float channels are
+ * converted by the writer thread unless --storage=float is given, in which
+ * case xdffileio converts them. GDF files keep float storage unless
+ * --storage requests an integer type. Spool files are never converted.
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+static
+int setup_storage(const char* filename)
+{
+	const char* dot = strrchr(filename, '.');
+	int i, j, width;
+
+	free_xdf_conv();
+	if (is_spool_filename(filename) || chinfo_error)
+		return 0;
+
+	width = storage_width;
+	if (width < 0)
+		width = (dot && !mm_strcasecmp(dot + 1, "bdf")) ? 3 : 0;
+
+	if (!width)
+		return 0;
+
+	for (i = 0; i < 2; i++) {
+		if (sample_conv_init(&xdf_conv[i], grp[i].nch, width)) {
+			free_xdf_conv();
+			return -1;
+		}
+
+		for (j = 0; j < (int)grp[i].nch; j++) {
+			if (sample_conv_set_range(&xdf_conv[i], j,
+			                          chinfo[i][j].mm[0],
+			                          chinfo[i][j].mm[1]))
+				mm_log_warn("Channel %s has no valid range: "
+				            "stored unscaled", labels[i][j]);
+		}
+	}
+
+	xdf_width = width;
+	mm_log_info("Float channels stored as int%i (%s conversion)",
+	            width * 8, sample_conv_get_impl_name(xdf_conv[0].impl));
+	return 0;
+}
+
+
+/**
+ * setup_recording_file() - create file and make it ready for recording
+ * @filename:   path of the BDF, GDF or spool file to create
+ *
+ * If the recording is segmented, @filename is the first segment.
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set accordingly
+ */
+static
+int setup_recording_file(const char* filename)
+{
+	int fileformat = -1;
+	int fs = acq_source_get_fs(dev);
+	struct rec_file file;
+	struct rec_segment_cfg seg = {
+		.strides = {strides[0], strides[1], strides[2]},
+		.open = create_recording_file,
+	};
+
+	if (setup_storage(filename)
+	    || create_recording_file(&file, filename, 0, 0, NULL))
+		return -1;
+
+	if (xdf_width) {
+		seg.conv[0] = &xdf_conv[0];
+		seg.conv[1] = &xdf_conv[1];
+	}
+
 	//Store file type for later use
-	xdf_get_conf(xdf, XDF_F_FILEFMT, &fileformat, XDF_NOF);
-	skip_event_recording = (fileformat != XDF_GDF2);
+	if (file.xdf) {
+		xdf_get_conf(file.xdf, XDF_F_FILEFMT, &fileformat, XDF_NOF);
+		xdf_get_conf(file.xdf, XDF_F_RECTIME, &rec_start_time, XDF_NOF);
+	} else {
+		rec_start_time = file.spool->hdr.rectime;
+	}
+
+	seg.ns = get_segment_ns(fs, fileformat);
+	if (seg.ns)
+		mm_log_info("Recording split in segments of %lli seconds",
+		            (long long)(seg.ns / fs));
+
+	if (recorder_set_segmentation(&recorder, &seg)) {
+		if (file.xdf)
+			xdf_close(file.xdf);
+		else
+			spool_close(file.spool, NULL);
+		mm_unlink(filename);
+		return -1;
+	}
+
+	// The recorder is now in charge of closing the file
+	recorder_set_checkpoint(&recorder, checkpoint_period);
+	recorder_set_file(&recorder, &file, filename,
+	                  file.spool || fileformat == XDF_GDF2);
+	file_set = 1;
 	reset_record_counter = 1;
-	return 1;
-	
-abort:
-	sprintf(bdffile_message,"XDF Error: %s",strerror(errno));
-	mcp_popup_message(panel, bdffile_message);
-	xdf_close(xdf);
 	return 0;
 }
 
+
+static
+int SetupRecording(void *user_data)
+{
+	mcpanel *panel = user_data;
+	char *filename;
+
+	filename = mcp_open_filename_dialog(panel,
+	                              "GDF files|*.gdf|*.GDF||BDF files|*.bdf|*.BDF||"
+	                              "Spool files|*." SPOOL_EXT "||Any files|*");
+
+	// Check that user hasn't pressed cancel
+	if (filename == NULL)
+		return 0;
+
+	if (setup_recording_file(filename)) {
+		sprintf(bdffile_message,"XDF Error: %s",strerror(errno));
+		mcp_popup_message(panel, bdffile_message);
+		return 0;
+	}
+
+	return 1;
+}
+
 static
 int StopRecording(void* user_data)
 {
@@ -769,9 +2136,16 @@ int StopRecording(void* user_data)
 	record_file = 0;
 	pthread_mutex_unlock(&sync_mtx);
 	
+	// Once file_mtx is obtained, acquisition thread does not queue
+	// any more block. Wait for the pending ones to be written.
 	pthread_mutex_lock(&file_mtx);
-	xdf_close(xdf);
-	xdf = NULL;
+	if (file_set) {
+		recorder_flush(&recorder);
+		mm_log_info("recording buffer high-water mark: %i/%i blocks",
+		            recorder_get_highwater(&recorder), recorder.nblock);
+		recorder_set_file(&recorder, NULL, NULL, 0);
+	}
+	file_set = 0;
 	pthread_mutex_unlock(&file_mtx);
 
 	return 1;
@@ -816,61 +2190,291 @@ static void print_version(void)
 	       xdf_get_string());
 }
 
+static int parse_unselected_channels(char const * list)
+{
+	if (label_set_init_csv(&unselected_set, list))
+		return -1;
+
+	unselected_found = calloc(unselected_set.nlabel + 1,
+	                          sizeof(*unselected_found));
+	if (!unselected_found) {
+		label_set_deinit(&unselected_set);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void free_unselected_channels(void)
+{
+	label_set_deinit(&unselected_set);
+	free(unselected_found);
+	unselected_found = NULL;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Headless recording                                        *
+ *                                                                        *
+ **************************************************************************/
+/**
+ * is_headless_requested() - check for headless mode before parsing options
+ * @argc:       number of arguments in @argv
+ * @argv:       command line arguments
+ *
+ * Return: 1 if --headless is found in command line, 0 otherwise
+ */
 static
-char * memdup(char const * s, size_t len)
+int is_headless_requested(int argc, char* argv[])
 {
-	char * copy = (char *) malloc(len + 1);
-	if (copy == NULL)
-		return NULL;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--") == 0)
+			break;
+
+		if (strcmp(argv[i], "--headless") == 0)
+			return 1;
+	}
+
+	return 0;
+}
 
-	memcpy(copy, s, len);
-	copy[len] = '\0';
 
-	return copy;
+static
+void on_quit_signal(int signum)
+{
+	(void)signum;
+	quit_requested = 1;
 }
 
-static char ** parse_unselected_channels(char const * list)
+
+/**
+ * run_headless() - record acquisition in file without any GUI
+ *
+ * The device is connected and its data are recorded in the file specified
+ * by --output. The recording stops when the duration specified by
+ * --duration has been recorded, when SIGINT or SIGTERM is received or
+ * when the acquisition fails.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int run_headless(void)
 {
-	int n, i;
-	char const * s = list;
-	char const * prev;
+	int retval, done;
 
-	n = 0;
-	while ((s = strchr(s, ',')) != NULL) {
-		n++;
-		s++;
+	if (!output_filename) {
+		fprintf(stderr, "--output must be specified in headless mode\n");
+		return -1;
 	}
-	n++;
-	unselected_labels = malloc((n + 1) * sizeof(*unselected_labels));
-	unselected_found = calloc(n, sizeof(*unselected_found));
 
-	prev = list;
-	for (i = 0 ; i < n ; i++) {
-		s = strchr(prev, ',');
-		if (s == NULL)
-			s = prev + strlen(prev);
-		unselected_labels[i] = memdup(prev, s - prev);
+	signal(SIGINT, on_quit_signal);
+	signal(SIGTERM, on_quit_signal);
+
+	retval = Connect(NULL);
+	if (retval) {
+		mm_log_error("Cannot connect device: %s", get_acq_msg(retval));
+		return -1;
+	}
 
-		prev = s + 1;
+	if (setup_recording_file(output_filename)) {
+		mm_log_error("XDF Error: %s", strerror(errno));
+		Disconnect(NULL);
+		return -1;
 	}
-	unselected_labels[n] = NULL;
 
-	return unselected_labels;
+	rec_nsmax = rec_duration * acq_source_get_fs(dev);
+	ToggleRecording(1, NULL);
+	mm_log_info("Recording in %s", output_filename);
+
+	// Wait for the acquisition thread to finish or to be interrupted
+	do {
+		mm_relative_sleep_ms(100);
+		pthread_mutex_lock(&sync_mtx);
+		done = acq_done;
+		pthread_mutex_unlock(&sync_mtx);
+	} while (!done && !quit_requested);
+
+	Disconnect(NULL);
+	mm_log_info("Recording stopped");
+
+	return 0;
 }
 
-static void free_unselected_channels(void)
+
+/**
+ * bench_report() - print results of benchmark
+ * @b:          benchmark measures
+ * @fs:         sampling frequency of acquisition
+ */
+static
+void bench_report(const struct bench_stats* b, int fs)
+{
+	double elapsed, rate;
+	int nchtot = grp[0].nch + grp[1].nch + grp[2].nch;
+
+	elapsed = (b->last_ts - b->first_ts) * 1e-9;
+	rate = (elapsed > 0) ? (b->ns - b->ns_first) / elapsed : 0.0;
+
+	printf("benchmark: %u+%u+%u channels at %i Hz, blocks of %i samples\n",
+	       grp[0].nch, grp[1].nch, grp[2].nch, fs, block_ns);
+	printf("  sustained rate:  %.0f samples/s (%.2f Msamples/s over all "
+	       "channels, %.3fx real time)\n",
+	       rate, rate * nchtot * 1e-6, rate / fs);
+	printf("  block latency:   p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, "
+	       "p99.9 %.3f ms, max %.3f ms (%llu blocks)\n",
+	       lat_hist_percentile(&b->latency, 50.0) * 1e-6,
+	       lat_hist_percentile(&b->latency, 90.0) * 1e-6,
+	       lat_hist_percentile(&b->latency, 99.0) * 1e-6,
+	       lat_hist_percentile(&b->latency, 99.9) * 1e-6,
+	       b->latency.max * 1e-6,
+	       (unsigned long long)b->latency.count);
+	if (!b->has_status)
+		printf("  (latency measured from the return of the device "
+		       "read, overruns not reported by the device)\n");
+	else
+		printf("  overruns:        %u (%lli samples lost)\n",
+		       b->noverrun, (long long)b->nlost);
+}
+
+
+/**
+ * create_bench_dir() - create private directory for benchmark recording
+ * @dir:        buffer receiving the path of the directory
+ * @dirlen:     size of @dir
+ * @file:       buffer receiving the path of the recording in @dir
+ * @filelen:    size of @file
+ *
+ * The directory is created with a unique name in $TMPDIR (or /tmp), so that
+ * no file of the user can be overwritten or removed by the benchmark.
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+static
+int create_bench_dir(char* dir, size_t dirlen, char* file, size_t filelen)
 {
-	char ** c;
+	const char* tmpdir = getenv("TMPDIR");
+
+	if (!tmpdir || !*tmpdir)
+		tmpdir = "/tmp";
 
-	if (unselected_labels != NULL) {
-		for (c = unselected_labels ; *c != NULL ; c++) {
-			free(*c);
+	if ((size_t)snprintf(dir, dirlen, "%s/eegview-bench-XXXXXX", tmpdir)
+	        >= dirlen) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (!mkdtemp(dir))
+		return -1;
+
+	snprintf(file, filelen, "%s/benchmark.gdf", dir);
+	return 0;
+}
+
+
+/**
+ * run_benchmark() - measure throughput and latency of acquisition loop
+ * @panel:      mcpanel instance displaying the signals (NULL if headless)
+ *
+ * The acquisition loop runs as in normal use for the duration specified
+ * by --benchmark: the data is recorded in the file specified by --output
+ * (in a private temporary directory if not specified), streamed and sent
+ * to the panel. The panel is not shown, but its main loop is iterated
+ * without blocking so that the display updates queued by the acquisition
+ * thread are consumed as in normal use, without being rendered.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int run_benchmark(mcpanel* panel)
+{
+	const char* filename = output_filename;
+	char tmpdir[256], tmpfile[320];
+	int retval, done, fs, rv = -1;
+	int64_t end_ts;
+
+	if (!filename) {
+		if (create_bench_dir(tmpdir, sizeof(tmpdir),
+		                     tmpfile, sizeof(tmpfile))) {
+			mm_log_error("Cannot create temporary directory: %s",
+			             strerror(errno));
+			return -1;
 		}
-		free(unselected_labels);
-		free(unselected_found);
-		unselected_labels = NULL;
-		unselected_found = NULL;
+		filename = tmpfile;
+	}
+
+	signal(SIGINT, on_quit_signal);
+	signal(SIGTERM, on_quit_signal);
+
+	lat_hist_reset(&bench.latency);
+	retval = Connect(panel);
+	if (retval) {
+		mm_log_error("Cannot connect device: %s", get_acq_msg(retval));
+		goto exit;
+	}
+
+	if (setup_recording_file(filename)) {
+		mm_log_error("XDF Error: %s", strerror(errno));
+		Disconnect(panel);
+		goto exit;
+	}
+
+	fs = acq_source_get_fs(dev);
+	ToggleRecording(1, NULL);
+	mm_log_info("Benchmark running for %i seconds", bench_duration);
+
+	end_ts = get_time_ns() + (int64_t)bench_duration * 1000000000;
+	do {
+		if (panel)
+			mcp_run(panel, 1);
+
+		mm_relative_sleep_ms(20);
+		pthread_mutex_lock(&sync_mtx);
+		done = acq_done;
+		pthread_mutex_unlock(&sync_mtx);
+	} while (!done && !quit_requested && get_time_ns() < end_ts);
+
+	Disconnect(panel);
+	if (panel)
+		mcp_run(panel, 1);
+
+	bench_report(&bench, fs);
+	rv = 0;
+
+exit:
+	if (!output_filename) {
+		mm_unlink(tmpfile);
+		if (remove(tmpdir))
+			mm_log_warn("Cannot remove %s: %s",
+			            tmpdir, strerror(errno));
 	}
+
+	return rv;
+}
+
+
+/**
+ * parse_storage() - interpret value of --storage
+ * @str:        float, int16 or int24
+ *
+ * Return: size of the integers storing the float channels (0 for float),
+ * -1 if @str is invalid
+ */
+static
+int parse_storage(const char* str)
+{
+	if (!mm_strcasecmp(str, "float"))
+		return 0;
+
+	if (!mm_strcasecmp(str, "int16"))
+		return 2;
+
+	if (!mm_strcasecmp(str, "int24"))
+		return 3;
+
+	return -1;
 }
 
 
@@ -905,16 +2509,28 @@ int main(int argc, char* argv[])
 
 	/* Process command line options */
 
-	/* 1st process GTK+ options */
-	mcp_init_lib(&argc, &argv);
+	/* 1st process GTK+ options (GUI must not be touched in headless) */
+	if (!is_headless_requested(argc, argv))
+		mcp_init_lib(&argc, &argv);
 	/* read eegview command line options */
 	retval = mm_arg_parse(&parser, argc, (char**)argv);
 	if (retval < 0)
 		return retval;
 
+	if (storage_str) {
+		storage_width = parse_storage(storage_str);
+		if (storage_width < 0) {
+			fprintf(stderr, "Invalid storage: %s\n", storage_str);
+			return EXIT_FAILURE;
+		}
+	}
+
+	PROF_INIT();
+
 	/* transform unselected channels csv input into a table */
-	if (unselected_labels_csv != NULL)
-		unselected_labels = parse_unselected_channels(unselected_labels_csv);
+	if (unselected_labels_csv != NULL
+	    && parse_unselected_channels(unselected_labels_csv))
+		mm_log_warn("Cannot allocate unselected channels");
 
 	/* handle non-command options */
 	if (version) {
@@ -922,6 +2538,31 @@ int main(int argc, char* argv[])
 		goto exit;
 	}
 
+	settings_load(PACKAGE_NAME);
+
+	if (bench_duration > 0) {
+		if (!headless)
+			panel = mcp_create(uifilename, &cb, NTAB, tabconf);
+
+		if ((headless || panel) && !run_benchmark(panel))
+			retcode = EXIT_SUCCESS;
+
+		if (panel)
+			mcp_destroy(panel);
+
+		free_unselected_channels();
+		settings_free();
+		goto exit;
+	}
+
+	if (headless) {
+		if (!run_headless())
+			retcode = EXIT_SUCCESS;
+		free_unselected_channels();
+		settings_free();
+		goto exit;
+	}
+
 	/* open GUI and run eegview */
 	panel = mcp_create(uifilename, &cb, NTAB, tabconf);
 	if (!panel) {
@@ -937,9 +2578,11 @@ int main(int argc, char* argv[])
 
 	mcp_destroy(panel);
 	free_unselected_channels();
+	settings_free();
 	retcode = EXIT_SUCCESS;
 
 exit:
+	PROF_DEINIT();
 	return retcode;
 }
 
@@ -18,110 +18,516 @@
 # include <config.h>
 #endif
 
+#include <errno.h>
+#include <math.h>
 #include <mmlog.h>
 #include <mmsysio.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "eegview-events.h"
+#include "eegview-shm.h"
 #include "event-tracker.h"
+#include "net-utils.h"
+#include "profiler.h"
+#include "time-utils.h"
 #include "mcpanel.h"
 #include "mmpredefs.h"
 #include "mmtime.h"
 
-#define ACCEPT_TIMEOUT  500 //in ms
+// Number of events in shared memory ring (must be a power of 2)
+#define SHM_NSLOT       1024
+
+// Duration (in s) of the acquisition used to fit the clock model
+#define CLOCK_WINDOW_DURATION   30
+#define CLIENT_BUFSIZE  4096
+
+enum client_mode {
+	CLIENT_UNKNOWN,
+	CLIENT_LEGACY,
+	CLIENT_FRAMED,
+};
+#define QUEUE_MASK      (EVENT_QUEUE_SIZE - 1)
 
 
 /**************************************************************************
  *                                                                        *
- *              Internals of event reception                              *
+ *              Lock-free event queue                                     *
  *                                                                        *
  **************************************************************************/
 static
-int create_listening_socket(int port)
-{
-	int sock;
-	struct addrinfo *rp, *res = NULL;
-	char service[16];
-	int reuse = -1;
-	struct addrinfo hints = {
-		.ai_family = AF_INET,
-		.ai_socktype = SOCK_STREAM,
-		.ai_flags = AI_PASSIVE,
-	};
+void evt_queue_init(struct event_tracker* trk)
+{
+	unsigned int i;
+
+	atomic_init(&trk->queue_head, 0);
+	atomic_init(&trk->ndropped, 0);
+	atomic_init(&trk->rx_nkts, 0);
+	atomic_init(&trk->rx_delay_sum, 0);
+	atomic_init(&trk->rx_delay_max, 0);
+	trk->queue_tail = 0;
+	for (i = 0; i < EVENT_QUEUE_SIZE; i++)
+		atomic_init(&trk->queue[i].seq, i);
+}
+
+
+/**
+ * evt_queue_push() - add event in the queue
+ * @trk:        initialized event tracker
+ * @evt:        event to add
+ * @source:     identifier of the connection which has sent @evt
+ * @duration:   duration of @evt in seconds
+ *
+ * This function can be called concurrently by several threads. A slot is
+ * reserved by advancing @trk->queue_head, then its sequence number is set
+ * to signal the consumer that the slot is ready to be read.
+ *
+ * Return: 0 in case of success, -1 if the queue is full
+ */
+static
+int evt_queue_push(struct event_tracker* trk, const struct mcp_event* evt,
+                   unsigned int source, float duration)
+{
+	struct evt_slot* slot;
+	unsigned int pos, seq;
+	int diff;
+
+	pos = atomic_load_explicit(&trk->queue_head, memory_order_relaxed);
+	while (1) {
+		slot = &trk->queue[pos & QUEUE_MASK];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		diff = (int)(seq - pos);
+
+		// Slot is free, try to reserve it
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&trk->queue_head,
+			                                &pos, pos + 1,
+			                                memory_order_relaxed,
+			                                memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			// Slot has not been consumed yet: queue is full
+			return -1;
+		} else {
+			// Another producer has taken the slot
+			pos = atomic_load_explicit(&trk->queue_head,
+			                           memory_order_relaxed);
+		}
+	}
+
+	slot->evt = *evt;
+	slot->source = source;
+	slot->duration = duration;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	return 0;
+}
+
 
-	// Create server socket
-	sock = mm_socket(AF_INET, SOCK_STREAM, 0);
-	if (sock < 0)
+/**
+ * evt_queue_pop() - get the oldest event of the queue
+ * @trk:        initialized event tracker
+ * @evt:        pointer receiving the event data
+ * @source:     pointer receiving the identifier of event connection
+ * @duration:   pointer receiving the duration of event
+ *
+ * This function must be called by only one thread (the consumer).
+ *
+ * Return: 0 if an event has been retrieved, -1 if the queue is empty
+ */
+static
+int evt_queue_pop(struct event_tracker* trk, struct mcp_event* evt,
+                  unsigned int* source, float* duration)
+{
+	struct evt_slot* slot;
+	unsigned int pos, seq;
+
+	pos = trk->queue_tail;
+	slot = &trk->queue[pos & QUEUE_MASK];
+	seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+	if ((int)(seq - (pos + 1)) < 0)
 		return -1;
 
-	if (mm_setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1)
-		goto error;
+	*evt = slot->evt;
+	*source = slot->source;
+	*duration = slot->duration;
+	atomic_store_explicit(&slot->seq, pos + EVENT_QUEUE_SIZE,
+	                      memory_order_release);
+	trk->queue_tail = pos + 1;
+	return 0;
+}
+
+
+/**
+ * get_clock_fit() - get consistent snapshot of the clock model
+ * @trk:        initialized event tracker
+ * @fit:        pointer receiving the fitted clock relation
+ */
+static
+void get_clock_fit(struct event_tracker* trk, struct clock_fit* fit)
+{
+	unsigned int seq0, seq1;
+
+	do {
+		seq0 = atomic_load_explicit(&trk->fit_seq, memory_order_acquire);
+		fit->ref_ns = atomic_load_explicit(&trk->fit_ref_ns,
+		                                   memory_order_relaxed);
+		fit->ref_pos = atomic_load_explicit(&trk->fit_ref_pos,
+		                                    memory_order_relaxed);
+		fit->period_ns = atomic_load_explicit(&trk->fit_period_ns,
+		                                      memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		seq1 = atomic_load_explicit(&trk->fit_seq, memory_order_relaxed);
+	} while (seq0 != seq1 || (seq0 & 1));
+}
+
+
+/**
+ * publish_clock_fit() - make the clock model visible to event threads
+ * @trk:        initialized event tracker
+ *
+ * The update is done under sequence lock so that event threads never
+ * observe a half-updated model, without blocking the caller.
+ */
+static
+void publish_clock_fit(struct event_tracker* trk)
+{
+	const struct clock_fit* fit = &trk->clock.fit;
+	unsigned int seq;
+
+	seq = atomic_load_explicit(&trk->fit_seq, memory_order_relaxed);
+	atomic_store_explicit(&trk->fit_seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&trk->fit_ref_ns, fit->ref_ns,
+	                      memory_order_relaxed);
+	atomic_store_explicit(&trk->fit_ref_pos, fit->ref_pos,
+	                      memory_order_relaxed);
+	atomic_store_explicit(&trk->fit_period_ns, fit->period_ns,
+	                      memory_order_relaxed);
+	atomic_store_explicit(&trk->fit_seq, seq + 2, memory_order_release);
+
+	atomic_store_explicit(&trk->jitter_ns, trk->clock.jitter_ns,
+	                      memory_order_relaxed);
+	atomic_store_explicit(&trk->ppm, trk->clock.ppm,
+	                      memory_order_relaxed);
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Internals of event reception                              *
+ *                                                                        *
+ **************************************************************************/
+/**
+ * struct evt_client - connection of a client sending events
+ * @fd:         socket of the connection
+ * @source:     identifier of the connection attached to its events
+ * @mode:       protocol used by the client (one of CLIENT_* value)
+ * @datagram:   true if @fd is a datagram socket (each datagram is
+ *              processed independently)
+ * @nevent:     number of events received from the connection
+ * @kernel_ts:  true if kernel receive timestamps are enabled on @fd
+ * @nkts:       number of reads timestamped by the kernel
+ * @delay_sum:  sum of delays (in ns) between kernel timestamps and the
+ *              time when data has been handed to the event thread
+ * @delay_max:  maximal delay (in ns) observed
+ * @len:        number of bytes pending in @buf
+ * @buf:        bytes received but not processed yet
+ * @name:       numeric host address of the client
+ */
+struct evt_client {
+	int fd;
+	unsigned int source;
+	int mode;
+	int datagram;
+	unsigned int nevent;
+	int kernel_ts;
+	unsigned int nkts;
+	int64_t delay_sum;
+	int64_t delay_max;
+	size_t len;
+	char buf[CLIENT_BUFSIZE];
+	char name[64];
+};
+
+
+#ifdef SO_TIMESTAMPNS
+
+/**
+ * record_rx_delay() - account delay between kernel and userspace reception
+ * @trk:        initialized event tracker
+ * @client:     client connection from which data has been received
+ * @delay:      delay (in ns) between kernel timestamp and userspace time
+ *
+ * The statistics are kept for @client (logged when it is closed) and for all
+ * clients in @trk, which can be read by any thread while the clients are
+ * connected. Only the event thread updates them.
+ */
+static
+void record_rx_delay(struct event_tracker* trk, struct evt_client* client,
+                     int64_t delay)
+{
+	client->nkts++;
+	client->delay_sum += delay;
+	if (delay > client->delay_max)
+		client->delay_max = delay;
+
+	atomic_fetch_add(&trk->rx_delay_sum, delay);
+	atomic_fetch_add(&trk->rx_nkts, 1);
+	if (delay > atomic_load(&trk->rx_delay_max))
+		atomic_store(&trk->rx_delay_max, delay);
+}
+
 
-	// Construct local address struct
-	snprintf(service, sizeof(service), "%i", port);
-	if (mm_getaddrinfo(NULL, service, &hints, &res))
-		goto error;
+/**
+ * enable_kernel_timestamps() - request receive timestamps on connection
+ * @client:     newly accepted client connection
+ *
+ * If the kernel cannot provide timestamps, the reception time is measured
+ * in userspace once the data has been received.
+ */
+static
+void enable_kernel_timestamps(struct evt_client* client)
+{
+	int one = 1;
+
+	if (mm_setsockopt(client->fd, SOL_SOCKET, SO_TIMESTAMPNS,
+	                  &one, sizeof(one))) {
+		mm_log_warn("Kernel timestamps unavailable for client %s",
+		            client->name);
+		return;
+	}
+
+	client->kernel_ts = 1;
+}
+
+
+/**
+ * client_recv() - receive data from client with its reception time
+ * @trk:        initialized event tracker
+ * @client:     client connection
+ * @buf:        buffer receiving the data
+ * @len:        size of @buf
+ * @ts:         pointer receiving the reception time (monotonic, in ns)
+ *
+ * When the kernel has timestamped the data, its timestamp (taken with the
+ * realtime clock) is converted to monotonic time and used instead of the
+ * time at which the event thread gets the data. The difference between the
+ * two is accounted in the statistics of @client and @trk.
+ *
+ * Return: the number of bytes received, 0 if the peer has closed the
+ * connection, -1 in case of error.
+ */
+static
+ssize_t client_recv(struct event_tracker* trk, struct evt_client* client,
+                    void* buf, size_t len, int64_t* ts)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(struct timespec))];
+		struct cmsghdr align;
+	} ctrl;
+	struct iovec iov = {.iov_base = buf, .iov_len = len};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctrl.buf,
+		.msg_controllen = sizeof(ctrl.buf),
+	};
+	struct cmsghdr* cmsg;
+	struct timespec kts;
+	struct mm_timespec now_rt;
+	int64_t now, kernel_ns, delay;
+	ssize_t rsz;
+
+	if (!client->kernel_ts) {
+		rsz = mm_recv(client->fd, buf, len, 0);
+		*ts = get_time_ns();
+		return rsz;
+	}
 
-	// Loop over the result and try to bind server socket to address
-	for (rp = res; rp != NULL; rp = rp->ai_next) {
-		if (mm_bind(sock, res->ai_addr, res->ai_addrlen) == 0)
+	rsz = mm_recvmsg(client->fd, &msg, 0);
+	now = get_time_ns();
+	*ts = now;
+	if (rsz <= 0)
+		return rsz;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET
+		   || cmsg->cmsg_type != SCM_TIMESTAMPNS)
+			continue;
+
+		// Convert kernel timestamp from realtime to monotonic clock
+		memcpy(&kts, CMSG_DATA(cmsg), sizeof(kts));
+		mm_gettime(CLOCK_REALTIME, &now_rt);
+		kernel_ns = (int64_t)kts.tv_sec * 1000000000 + kts.tv_nsec;
+		delay = (int64_t)now_rt.tv_sec * 1000000000 + now_rt.tv_nsec
+		        - kernel_ns;
+
+		// Ignore timestamp inconsistent with userspace one (clock
+		// stepped in between)
+		if (delay < 0 || delay > 1000000000)
 			break;
+
+		*ts = now - delay;
+		record_rx_delay(trk, client, delay);
+		break;
 	}
-	mm_freeaddrinfo(res);
 
-	// Listen for incoming clients (if sock has been bound)
-	if (  rp == NULL
-	   || mm_listen(sock, 1))
-		goto error;
+	return rsz;
+}
+
+#else /* SO_TIMESTAMPNS */
+
+static
+void enable_kernel_timestamps(struct evt_client* client)
+{
+	(void)client;
+}
+
+
+static
+ssize_t client_recv(struct event_tracker* trk, struct evt_client* client,
+                    void* buf, size_t len, int64_t* ts)
+{
+	ssize_t rsz;
 
-	return sock;
+	(void)trk;
 
-error:
-	mm_close(sock);
-	return -1;
+	rsz = mm_recv(client->fd, buf, len, 0);
+	*ts = get_time_ns();
+	return rsz;
 }
 
+#endif /* SO_TIMESTAMPNS */
+
 
 /**
- * event_tracker_accept_client() - wait for next client connection
+ * event_tracker_grow_clients() - enlarge client array and poll set
+ * @trk:        event tracker
+ *
+ * The capacity of @trk->clients and @trk->pfds is doubled, so that the poll
+ * set does not need to be rebuilt at each iteration of the event thread.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int event_tracker_grow_clients(struct event_tracker* trk)
+{
+	struct evt_client* clients;
+	struct mm_pollfd* pfds;
+	int maxclient;
+
+	maxclient = trk->maxclient ? 2*trk->maxclient : 4;
+
+	clients = realloc(trk->clients, maxclient*sizeof(*clients));
+	if (!clients)
+		return -1;
+	trk->clients = clients;
+
+	pfds = realloc(trk->pfds, (maxclient+2)*sizeof(*pfds));
+	if (!pfds)
+		return -1;
+	trk->pfds = pfds;
+
+	trk->maxclient = maxclient;
+	return 0;
+}
+
+
+/**
+ * event_tracker_add_client() - add socket to the set of served clients
  * @trk:        initialized event tracker
+ * @fd:         socket to add
+ * @datagram:   true if @fd is a datagram socket
  *
- * Wait for incoming client connection. Test regularly that event thread
- * has not been requested to quit. If one client is accepted, store it in
- * @trk for future reference
+ * A new source identifier is associated to @fd and @fd is added to the poll
+ * set of the event thread.
  *
- * Return: 0 if the connection has been accepted, 1 is event thread has
- * been requested to quit, -1 in case of error.
+ * Return: pointer to the new client in case of success, NULL otherwise. In
+ * case of failure, @fd is closed.
  */
 static
-int event_tracker_accept_client(struct event_tracker* trk)
+struct evt_client* event_tracker_add_client(struct event_tracker* trk,
+                                            int fd, int datagram)
 {
-	struct sockaddr_in client_address;
-	struct sockaddr* addr;
-	socklen_t addr_len;
-	char ip4[16];
-	int quit, client_socket, n_fd_event;
-	struct mm_pollfd pfd = {.fd = trk->server_socket, .events = POLLIN};
+	struct evt_client* client;
 
-	// Wait for incoming connection
-	while (1) {
-		n_fd_event = mm_poll(&pfd, 1, ACCEPT_TIMEOUT);
-		if (n_fd_event < 0)
-			return -1;
+	if (trk->nclient == trk->maxclient
+	   && event_tracker_grow_clients(trk)) {
+		mm_close(fd);
+		return NULL;
+	}
 
-		// If there is a read event on fd, it means there is a
-		// connection to accept
-		if (n_fd_event >= 1)
-			break;
+	trk->pfds[trk->nclient+2] = (struct mm_pollfd) {
+		.fd = fd,
+		.events = POLLIN,
+	};
+
+	client = &trk->clients[trk->nclient++];
+	*client = (struct evt_client) {
+		.fd = fd,
+		.source = trk->next_source++,
+		.datagram = datagram,
+	};
+
+	return client;
+}
+
+
+/**
+ * event_tracker_add_datagram() - receive events on a datagram socket
+ * @trk:        event tracker being initialized
+ * @sock:       bound datagram socket (can be -1 if its creation failed)
+ * @name:       description of the socket
+ *
+ * All datagrams received on @sock share the same source identifier. A
+ * failure is reported but does not prevent the other transports to be used.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int event_tracker_add_datagram(struct event_tracker* trk, int sock,
+                               const char* name)
+{
+	struct evt_client* client = NULL;
+
+	if (sock >= 0)
+		client = event_tracker_add_client(trk, sock, 1);
 
-		pthread_mutex_lock(&trk->mtx);
-		quit = trk->quit_loop;
-		pthread_mutex_unlock(&trk->mtx);
-		if (quit)
-			return 1;
+	if (!client) {
+		mm_log_error("Cannot receive events on %s: %s",
+		             name, strerror(errno));
+		return -1;
 	}
 
+	snprintf(client->name, sizeof(client->name), "%s", name);
+	enable_kernel_timestamps(client);
+	mm_log_info("Receiving events on %s (source %u)",
+	            client->name, client->source);
+	return 0;
+}
+
+
+/**
+ * event_tracker_accept_client() - accept incoming client connection
+ * @trk:        initialized event tracker
+ *
+ * Accept the pending connection on the server socket and add it to the
+ * set of clients served by the event thread.
+ *
+ * Return: 0 if the connection has been accepted, -1 in case of error.
+ */
+static
+int event_tracker_accept_client(struct event_tracker* trk)
+{
+	struct sockaddr_storage client_address;
+	struct sockaddr* addr;
+	struct evt_client* client;
+	socklen_t addr_len;
+	int client_socket;
+
 	// Accept incoming connection
 	addr_len = sizeof(client_address);
 	addr = (struct sockaddr*) &client_address;
@@ -129,115 +535,301 @@ int event_tracker_accept_client(struct event_tracker* trk)
 	if (client_socket < 0)
 		return -1;
 
-	mm_getnameinfo(addr, addr_len, ip4, sizeof(ip4), NULL, 0, NI_NUMERICHOST);
-	mm_log_info("Accepted client %s!", ip4);
+	client = event_tracker_add_client(trk, client_socket, 0);
+	if (!client)
+		return -1;
 
-	// Keep client socket if we are not exiting the event thread
-	pthread_mutex_lock(&trk->mtx);
-	if (trk->quit_loop)
-		mm_close(client_socket);
-	else
-		trk->client_socket = client_socket;
-	pthread_mutex_unlock(&trk->mtx);
+	mm_getnameinfo(addr, addr_len, client->name, sizeof(client->name),
+	               NULL, 0, NI_NUMERICHOST);
+	mm_log_info("Accepted client %s! (source %u)",
+	            client->name, client->source);
+
+	enable_kernel_timestamps(client);
 
 	return 0;
 }
 
 
 /**
- * event_tracker_finish_client() - close current client connection
+ * event_tracker_finish_client() - close a client connection
  * @trk:        initialized event tracker
- *
- * Return: 1 if event thread has been requested to quit, 0 otherwise
+ * @index:      index of the client in @trk->clients
  */
 static
-int event_tracker_finish_client(struct event_tracker* trk)
+void event_tracker_finish_client(struct event_tracker* trk, int index)
 {
-	int quit;
+	struct evt_client* client = &trk->clients[index];
+
+	mm_log_info("%s %s (source %u, %u events received)",
+	            client->datagram ? "Closed" : "Client disconnected:",
+	            client->name, client->source, client->nevent);
+	if (client->nkts)
+		mm_log_info("Client %s reception delay: mean %.1f us, max %.1f us",
+		            client->name,
+		            client->delay_sum * 1e-3 / client->nkts,
+		            client->delay_max * 1e-3);
+
+	mm_close(client->fd);
+
+	// Keep the array and the poll set packed
+	trk->nclient--;
+	if (index != trk->nclient) {
+		*client = trk->clients[trk->nclient];
+		trk->pfds[index+2] = trk->pfds[trk->nclient+2];
+	}
+}
 
-	pthread_mutex_lock(&trk->mtx);
 
-	mm_close(trk->client_socket);
-	trk->client_socket = -1;
+/**
+ * event_tracker_add_event() - add event to store in tracker
+ * @trk:        initialized event tracker
+ * @evttype:    event code of the software event
+ * @source:     identifier of the connection which has sent the event
+ * @ts:         monotonic time (in ns) at which the event occurred
+ * @duration:   duration of the event in seconds
+ *
+ * This function adds a new event to the event queue associated to code
+ * @evttype. The position of event in the acquisition data stream is
+ * estimated from monotonic time @ts using the clock model fitted on the
+ * successive calls to event_tracker_update_ns_read(). If the queue is full,
+ * the event is dropped and accounted in @trk->ndropped.
+ */
+static
+void event_tracker_add_event(struct event_tracker* trk, uint32_t evttype,
+                             unsigned int source, int64_t ts, float duration)
+{
+	struct mcp_event evt;
+	struct clock_fit fit;
+	unsigned int ndropped;
+
+	get_clock_fit(trk, &fit);
+	evt.pos = lround(clock_fit_get_pos(&fit, ts));
+	evt.type = evttype;
+
+	if (evt_queue_push(trk, &evt, source, duration)) {
+		// Report drops without flooding the log
+		ndropped = atomic_fetch_add(&trk->ndropped, 1) + 1;
+		if ((ndropped & (ndropped - 1)) == 0)
+			mm_log_warn("Event queue full: %u events dropped so far",
+			            ndropped);
+	}
+}
 
-	quit = trk->quit_loop;
 
-	pthread_mutex_unlock(&trk->mtx);
+/**
+ * parse_legacy_events() - process events sent in legacy mode
+ * @trk:        initialized event tracker
+ * @client:     client connection in legacy mode
+ * @start:      offset in @client->buf of the data to process
+ * @ts:         monotonic time (in ns) at which the data has been received
+ *
+ * Return: the offset in @client->buf of the first unprocessed byte
+ */
+static
+size_t parse_legacy_events(struct event_tracker* trk,
+                           struct evt_client* client, size_t start, int64_t ts)
+{
+	uint32_t evttype;
+	size_t i;
 
-	mm_log_info("Client disconnected");
+	for (i = start; i + sizeof(evttype) <= client->len; i += sizeof(evttype)) {
+		memcpy(&evttype, client->buf + i, sizeof(evttype));
+		event_tracker_add_event(trk, evttype, client->source, ts, 0.0f);
+		client->nevent++;
+	}
 
-	return quit;
+	return i;
 }
 
 
 /**
- * event_tracker_add_event() - add event to store in tracker
+ * parse_framed_events() - process records sent in framed mode
  * @trk:        initialized event tracker
- * @evttype:    event code of the software event
+ * @client:     client connection in framed mode
+ * @start:      offset in @client->buf of the data to process
+ * @ts:         monotonic time (in ns) at which the data has been received
  *
- * This function adds a new event to the event stack to write associated to code
- * @evttype. The estimation of position of event in the acquisition data stream
- * is based of wallclock time when this function is called and when was the
- * wallclock when the last call to event_tracker_update_ns_read() happened.
+ * Return: the offset in @client->buf of the first unprocessed byte, -1 if
+ * a malformed record has been received.
+ */
+static
+ssize_t parse_framed_events(struct event_tracker* trk,
+                            struct evt_client* client, size_t start, int64_t ts)
+{
+	struct eegview_evt_record rec;
+	uint16_t size;
+	size_t i;
+	int64_t evt_ts;
+	float duration;
+
+	i = start;
+	while (client->len - i >= sizeof(size)) {
+		memcpy(&size, client->buf + i, sizeof(size));
+		if (size < sizeof(rec) || size > sizeof(client->buf)) {
+			mm_log_warn("Client %s sent invalid record size %u",
+			            client->name, size);
+			return -1;
+		}
+
+		// Wait for the rest of the record
+		if (client->len - i < size)
+			break;
+
+		// Bytes beyond the known part of the record are ignored
+		memcpy(&rec, client->buf + i, sizeof(rec));
+		evt_ts = (rec.flags & EEGVIEW_EVT_TIMESTAMP) ? rec.timestamp : ts;
+		duration = (rec.flags & EEGVIEW_EVT_DURATION) ? rec.duration : 0.0f;
+		event_tracker_add_event(trk, rec.code, client->source,
+		                        evt_ts, duration);
+		client->nevent++;
+		i += size;
+	}
+
+	return i;
+}
+
+
+/**
+ * is_framed_start() - test whether data starts as framed mode
+ * @hello:      first bytes received from the client
+ * @rec:        bytes following @hello
  *
- * Return: 1 if event thread has been requested to quit, 0 otherwise
+ * The reserved fields must be 0 and the record header must be consistent.
+ * Records of protocol versions newer than EEGVIEW_EVT_VERSION may use flags
+ * unknown to this version, hence only their size is checked.
+ *
+ * Return: 1 if @hello is a valid header of framed mode followed by a valid
+ * record, 0 otherwise
  */
 static
-int event_tracker_add_event(struct event_tracker* trk, uint32_t evttype)
+int is_framed_start(const struct eegview_evt_hello* hello,
+                    const struct eegview_evt_record* rec)
 {
-	struct event_stack* evtstack;
-	struct mcp_event* evt;
-	int64_t dt;
-	int quit, pos;
-	struct mm_timespec ts;
+	const unsigned int known_flags = EEGVIEW_EVT_TIMESTAMP
+	                                 | EEGVIEW_EVT_DURATION;
 
-	mm_gettime(CLOCK_REALTIME, &ts);
+	if (hello->magic != EEGVIEW_EVT_MAGIC
+	   || hello->version < 1
+	   || hello->reserved != 0)
+		return 0;
 
-	pthread_mutex_lock(&trk->mtx);
+	if (rec->size < sizeof(*rec) || rec->size > CLIENT_BUFSIZE)
+		return 0;
+
+	if (hello->version > EEGVIEW_EVT_VERSION)
+		return 1;
+
+	return !(rec->flags & ~known_flags) && rec->reserved == 0;
+}
 
-	// Compute number of sample passed being acquired given ts relative to
-	// last update
-	dt = mm_timediff_ns(&ts, &trk->last_read_ts);
-	pos = dt * 1e-9f * trk->fs;
-	pos += trk->last_total_read;
-
-	// Get event struct for storing (from event stack used for writing)
-	// and store event info in it. If the event stack is full, just drop
-	// the software event
-	evtstack = trk->stacks + trk->stack_idx;
-	if (evtstack->nevent < NEVENT_MAX) {
-		evt = &evtstack->events[evtstack->nevent++];
-		evt->pos = pos;
-		evt->type = evttype;
+
+/**
+ * parse_client_mode() - determine protocol used by new client
+ * @client:     client connection whose mode is not known yet
+ *
+ * A client in framed mode starts with a struct eegview_evt_hello. Since a
+ * legacy client may send an event whose code is EEGVIEW_EVT_MAGIC, the
+ * framed mode is selected only once the header and the first record have
+ * been received and are valid. Any other data means that the client is
+ * using legacy mode.
+ *
+ * Return: the number of bytes of @client->buf that have been consumed
+ */
+static
+ssize_t parse_client_mode(struct evt_client* client)
+{
+	struct eegview_evt_hello hello;
+	struct eegview_evt_record rec;
+	uint32_t magic;
+	int framed;
+
+	if (client->len < sizeof(magic))
+		return 0;
+
+	memcpy(&magic, client->buf, sizeof(magic));
+	framed = (magic == EEGVIEW_EVT_MAGIC);
+
+	if (framed && client->len < sizeof(hello) + sizeof(rec)) {
+		// A datagram will not be completed later
+		if (!client->datagram)
+			return 0;
+
+		framed = 0;
 	}
 
-	quit = trk->quit_loop;
-	pthread_mutex_unlock(&trk->mtx);
+	if (framed) {
+		memcpy(&hello, client->buf, sizeof(hello));
+		memcpy(&rec, client->buf + sizeof(hello), sizeof(rec));
+		framed = is_framed_start(&hello, &rec);
+	}
+
+	if (!framed) {
+		if (!client->datagram)
+			mm_log_info("Client %s uses legacy protocol",
+			            client->name);
+		client->mode = CLIENT_LEGACY;
+		return 0;
+	}
 
-	return quit;
+	if (!client->datagram)
+		mm_log_info("Client %s uses framed protocol (version %u)",
+		            client->name, hello.version);
+	client->mode = CLIENT_FRAMED;
+	return sizeof(hello);
 }
 
 
 /**
- * event_tracker_handle_client_connection() - store event coming for client
- * @trk:        initialized event tracker with established client
+ * event_tracker_read_client() - store events received from a client
+ * @trk:        initialized event tracker
+ * @client:     client connection ready to be read
+ *
+ * Read all the data available on @client connection at once and add an
+ * event for each complete event code or record received. Incomplete data is
+ * kept until the next call. If @client is a datagram socket, one datagram
+ * is read and processed independently of the previous ones.
+ *
+ * Return: 0 if the connection is still valid, -1 if it has been closed by
+ * peer, in case of error or if the client does not follow the protocol.
+ * Datagram sockets are never reported as closed.
  */
 static
-void event_tracker_handle_client_connection(struct event_tracker* trk)
+int event_tracker_read_client(struct event_tracker* trk,
+                              struct evt_client* client)
 {
-	uint32_t evttype;
-	ssize_t rsz;
-	int quit, sock;
-
-	sock = trk->client_socket;
-	quit = 0;
-	while (!quit) {
-		rsz = mm_recv(sock, &evttype, sizeof(evttype), 0);
-		if (rsz <= 0)
-			break;
+	ssize_t rsz, i;
+	int64_t ts;
 
-		quit = event_tracker_add_event(trk, evttype);
+	if (client->datagram) {
+		client->len = 0;
+		client->mode = CLIENT_UNKNOWN;
 	}
+
+	// All events received at once share the same reception time
+	rsz = client_recv(trk, client, client->buf + client->len,
+	                  sizeof(client->buf) - client->len, &ts);
+	if (rsz <= 0)
+		return client->datagram ? 0 : -1;
+
+	client->len += rsz;
+
+	i = 0;
+	if (client->mode == CLIENT_UNKNOWN)
+		i = parse_client_mode(client);
+
+	if (client->mode == CLIENT_FRAMED && i >= 0)
+		i = parse_framed_events(trk, client, i, ts);
+	else if (client->mode == CLIENT_LEGACY)
+		i = parse_legacy_events(trk, client, i, ts);
+
+	if (i < 0)
+		return client->datagram ? 0 : -1;
+
+	// Keep incomplete data for next call
+	client->len -= i;
+	memmove(client->buf, client->buf + i, client->len);
+
+	return 0;
 }
 
 
@@ -245,20 +837,200 @@ static
 void* event_thread(void* arg)
 {
 	struct event_tracker* trk = arg;
-	int quit = 0;
+	struct mm_pollfd* pfds;
+	char dummy;
+	int i, quit, nfds;
 
-	while (!quit) {
-		quit = event_tracker_accept_client(trk);
-		if (quit)
-			break;
+	// Watch for wakeup, incoming connection and data from clients. The
+	// entries of the clients are maintained when they are added or
+	// removed.
+	trk->pfds[0] = (struct mm_pollfd){.fd = trk->wakeup_pipe[0], .events = POLLIN};
+	trk->pfds[1] = (struct mm_pollfd){.fd = trk->server_socket, .events = POLLIN};
 
-		event_tracker_handle_client_connection(trk);
-		quit = event_tracker_finish_client(trk);
+	while (1) {
+		pfds = trk->pfds;
+		nfds = trk->nclient + 2;
+		if (mm_poll(pfds, nfds, -1) < 0) {
+			mm_log_error("Event reception failed: %s", strerror(errno));
+			break;
+		}
+
+		if (pfds[0].revents) {
+			mm_read(trk->wakeup_pipe[0], &dummy, 1);
+			pthread_mutex_lock(&trk->mtx);
+			quit = trk->quit_loop;
+			pthread_mutex_unlock(&trk->mtx);
+			if (quit)
+				break;
+		}
+
+		// Process clients from the end so that finishing one does
+		// not change the index of the ones remaining to be processed
+		PROF_START();
+		for (i = nfds-1; i >= 2; i--) {
+			if (!pfds[i].revents)
+				continue;
+
+			if (event_tracker_read_client(trk, &trk->clients[i-2]))
+				event_tracker_finish_client(trk, i-2);
+			PROF_LAP(PROF_EVT_CLIENT);
+		}
+
+		// Accepting a client may move the poll set
+		if (pfds[1].revents && event_tracker_accept_client(trk))
+			mm_log_warn("Cannot accept client: %s", strerror(errno));
 	}
 
 	return NULL;
 }
 
+/**************************************************************************
+ *                                                                        *
+ *              Shared memory event ring                                  *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * create_shm_ring() - create shared memory ring in which clients post events
+ * @trk:        event tracker being initialized
+ * @name:       name of the shared memory object
+ *
+ * A stale object left by a previous run with the same name is replaced.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int create_shm_ring(struct event_tracker* trk, const char* name)
+{
+	struct eegview_shm_ring* ring;
+	size_t size;
+	uint32_t i;
+	int fd;
+
+	size = EEGVIEW_SHM_SIZE(SHM_NSLOT);
+
+	mm_shm_unlink(name);
+	fd = mm_shm_open(name, O_RDWR|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR);
+	if (fd < 0)
+		return -1;
+
+	if (mm_ftruncate(fd, size)) {
+		mm_close(fd);
+		mm_shm_unlink(name);
+		return -1;
+	}
+
+	ring = mm_mapfile(fd, 0, size, MM_MAP_RDWR|MM_MAP_SHARED);
+	mm_close(fd);
+	if (!ring) {
+		mm_shm_unlink(name);
+		return -1;
+	}
+
+	ring->version = EEGVIEW_SHM_VERSION;
+	ring->nslot = SHM_NSLOT;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	for (i = 0; i < SHM_NSLOT; i++)
+		atomic_init(&ring->slots[i].seq, i);
+
+	// Signal clients that the ring is ready
+	atomic_store_explicit(&ring->magic, EEGVIEW_SHM_MAGIC,
+	                      memory_order_release);
+
+	trk->shm = ring;
+	trk->shm_name = name;
+	trk->shm_source = trk->next_source++;
+	return 0;
+}
+
+
+static
+void destroy_shm_ring(struct event_tracker* trk)
+{
+	if (!trk->shm)
+		return;
+
+	mm_log_info("Closed shm:%s (source %u, %u events received)",
+	            trk->shm_name, trk->shm_source, trk->shm_nevent);
+
+	mm_unmap(trk->shm);
+	mm_shm_unlink(trk->shm_name);
+	trk->shm = NULL;
+}
+
+
+/**
+ * shm_ring_pop() - get the oldest event posted in shared memory ring
+ * @trk:        initialized event tracker with shared memory ring
+ * @code:       pointer receiving the event code
+ * @ts:         pointer receiving the event timestamp
+ *
+ * The number of slots is taken from @trk and not from the shared memory so
+ * that a faulty client cannot make eegview access memory beyond the ring.
+ *
+ * Return: 0 if an event has been retrieved, -1 if the ring is empty
+ */
+static
+int shm_ring_pop(struct event_tracker* trk, uint32_t* code, int64_t* ts)
+{
+	struct eegview_shm_ring* ring = trk->shm;
+	struct eegview_shm_slot* slot;
+	uint32_t pos, seq;
+
+	pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	slot = &ring->slots[pos & (SHM_NSLOT - 1)];
+	seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+	if ((int32_t)(seq - (pos + 1)) < 0)
+		return -1;
+
+	*code = slot->code;
+	*ts = slot->timestamp;
+	atomic_store_explicit(&slot->seq, pos + SHM_NSLOT,
+	                      memory_order_release);
+	atomic_store_explicit(&ring->tail, pos + 1, memory_order_relaxed);
+	return 0;
+}
+
+
+/**
+ * pop_shm_events() - move events of shared memory ring into event stack
+ * @trk:        initialized event tracker
+ * @evt_stk:    event stack receiving the events
+ *
+ * The position of the events is computed with the clock model directly
+ * since this is called by the acquisition thread which owns it.
+ */
+static
+void pop_shm_events(struct event_tracker* trk, struct event_stack* evt_stk)
+{
+	int n = evt_stk->nevent;
+	uint32_t code;
+	int64_t ts, now = 0;
+
+	for (; n < NEVENT_MAX; n++) {
+		if (shm_ring_pop(trk, &code, &ts))
+			break;
+
+		// Events without timestamp are dated when collected
+		if (ts == 0) {
+			if (now == 0)
+				now = get_time_ns();
+			ts = now;
+		}
+
+		evt_stk->events[n].type = code;
+		evt_stk->events[n].pos = lround(clock_fit_get_pos(&trk->clock.fit,
+		                                                  ts));
+		evt_stk->sources[n] = trk->shm_source;
+		evt_stk->durations[n] = 0.0f;
+		trk->shm_nevent++;
+	}
+
+	evt_stk->nevent = n;
+}
+
+
 /**************************************************************************
  *                                                                        *
  *                       API of event tracker                             *
@@ -266,29 +1038,58 @@ void* event_thread(void* arg)
  **************************************************************************/
 
 /**
- * event_tracker_swap_eventstack() - get last event stack for reading
+ * event_tracker_pop_events() - get the software events received so far
  * @trk:        initialized event tracker
+ * @evt_stk:    event stack receiving the events
  *
- * Return: the pointer to event stack containing the software event. The
- * content of the pointed data is valid until the next call to
- * event_tracker_swap_eventstack().
+ * This moves the events queued by the reception threads and the events
+ * posted in the shared memory ring into @evt_stk, up to NEVENT_MAX events.
+ * The events in excess remain queued and are returned at the next call.
+ * This function does not take any lock nor make any system call. It must
+ * be called by only one thread (the acquisition thread).
  */
-struct event_stack* event_tracker_swap_eventstack(struct event_tracker* trk)
+void event_tracker_pop_events(struct event_tracker* trk,
+                              struct event_stack* evt_stk)
 {
-	struct event_stack* evt_stk;
+	int n;
 
-	pthread_mutex_lock(&trk->mtx);
+	for (n = 0; n < NEVENT_MAX; n++) {
+		if (evt_queue_pop(trk, &evt_stk->events[n],
+		                  &evt_stk->sources[n], &evt_stk->durations[n]))
+			break;
+	}
 
-	// Get pointer of event stack meant for reading
-	evt_stk = trk->stacks + trk->stack_idx;
+	evt_stk->nevent = n;
 
-	// update stack index and reset the number of event written
-	trk->stack_idx = (trk->stack_idx + 1) % MM_NELEM(trk->stacks);
-	trk->stacks[trk->stack_idx].nevent = 0;
+	if (trk->shm)
+		pop_shm_events(trk, evt_stk);
+}
 
-	pthread_mutex_unlock(&trk->mtx);
 
-	return evt_stk;
+/**
+ * event_tracker_post_event() - add event at known position in tracker
+ * @trk:        initialized event tracker
+ * @evttype:    event code
+ * @pos:        position of the event in the acquisition data stream
+ * @duration:   duration of the event in seconds
+ *
+ * This queues an event whose position is known by the acquisition source
+ * itself (like the events of a replayed file), hence does not need the
+ * clock model. It is accounted to the source EVT_SOURCE_DEVICE. If the
+ * queue is full, the event is dropped and accounted in @trk->ndropped.
+ */
+void event_tracker_post_event(struct event_tracker* trk, uint32_t evttype,
+                              int64_t pos, float duration)
+{
+	struct mcp_event evt = {.pos = pos, .type = evttype};
+	unsigned int ndropped;
+
+	if (evt_queue_push(trk, &evt, EVT_SOURCE_DEVICE, duration)) {
+		ndropped = atomic_fetch_add(&trk->ndropped, 1) + 1;
+		if ((ndropped & (ndropped - 1)) == 0)
+			mm_log_warn("Event queue full: %u events dropped so far",
+			            ndropped);
+	}
 }
 
 
@@ -297,38 +1098,152 @@ struct event_stack* event_tracker_swap_eventstack(struct event_tracker* trk)
  * @trk:        initialized event tracker
  * @total_read: number of sample acquired since beginning of acquisition
  *
+ * The time of the call and @total_read are added to the clock model used
+ * to place the software events. The fit over the last seconds of
+ * acquisition averages out the jitter of the calls and follows the drift of
+ * the device clock relative to the host clock.
+ *
  * NOTE: For better estimation of software event timing, it is better to call
  * this function close to the moment when acquisition function returned
  */
 void event_tracker_update_ns_read(struct event_tracker* trk, int total_read)
 {
-	struct mm_timespec ts;
+	int64_t ts;
 
-	mm_gettime(CLOCK_REALTIME, &ts);
+	ts = get_time_ns();
+	clock_model_update(&trk->clock, total_read, ts);
+	publish_clock_fit(trk);
+}
 
-	pthread_mutex_lock(&trk->mtx);
-	trk->last_total_read = total_read;
-	trk->last_read_ts = ts;
-	pthread_mutex_unlock(&trk->mtx);
+
+/**
+ * event_tracker_get_rx_delay() - get delay of event reception
+ * @trk:        initialized event tracker
+ * @mean_us:    pointer receiving the mean delay (in us)
+ * @max_us:     pointer receiving the maximal delay (in us)
+ *
+ * The delay is the time between the reception of client data by the kernel
+ * and its reading by the event thread, measured over all clients since
+ * @trk has been initialized. This can be called while clients are connected.
+ *
+ * Return: the number of reads timestamped by the kernel, 0 if none (@mean_us
+ * and @max_us are then set to 0).
+ */
+unsigned int event_tracker_get_rx_delay(struct event_tracker* trk,
+                                        double* mean_us, double* max_us)
+{
+	unsigned int nkts;
+
+	nkts = atomic_load(&trk->rx_nkts);
+	*mean_us = nkts ? atomic_load(&trk->rx_delay_sum) * 1e-3 / nkts : 0.0;
+	*max_us = atomic_load(&trk->rx_delay_max) * 1e-3;
+	return nkts;
 }
 
 
-int event_tracker_init(struct event_tracker* trk, float fs, int port)
+/**
+ * event_tracker_get_ndropped() - get number of events dropped
+ * @trk:        initialized event tracker
+ *
+ * Return: the number of events that have been dropped because the event
+ * queue was full.
+ */
+unsigned int event_tracker_get_ndropped(struct event_tracker* trk)
 {
-	*trk = (struct event_tracker) {
-		.client_socket = -1,
-		.server_socket = -1,
-		.fs = fs,
-	};
+	return atomic_load(&trk->ndropped);
+}
+
+
+/**
+ * event_tracker_get_clock_stats() - get quality of the clock model
+ * @trk:        initialized event tracker
+ * @jitter_us:  pointer receiving the RMS of timing residual (in us)
+ * @ppm:        pointer receiving the deviation of the device sampling rate
+ *              from its nominal value (in ppm)
+ */
+void event_tracker_get_clock_stats(struct event_tracker* trk,
+                                   double* jitter_us, double* ppm)
+{
+	*jitter_us = atomic_load(&trk->jitter_ns) * 1e-3;
+	*ppm = atomic_load(&trk->ppm);
+}
+
+
+/**
+ * event_tracker_init() - start reception of software events
+ * @trk:        event tracker to initialize
+ * @fs:         sampling frequency of the acquisition
+ * @ns_block:   number of samples acquired at each update
+ * @cfg:        transports on which the events are received
+ *
+ * The event queue and clock model are always initialized, so that @trk can
+ * be used by the acquisition even if the event server cannot be started.
+ * Failure to create the optional datagram sockets are only reported.
+ *
+ * Return: 0 in case of success, -1 if the event server cannot be started.
+ */
+int event_tracker_init(struct event_tracker* trk, float fs, int ns_block,
+                       const struct event_tracker_cfg* cfg)
+{
+	char name[64];
+
+	trk->server_socket = -1;
+	trk->unix_path = NULL;
+	trk->shm = NULL;
+	trk->shm_nevent = 0;
+	trk->wakeup_pipe[0] = trk->wakeup_pipe[1] = -1;
+	trk->nclient = 0;
+	trk->maxclient = 0;
+	trk->clients = NULL;
+	trk->pfds = NULL;
+	trk->next_source = 1;
+	trk->quit_loop = 0;
+	atomic_init(&trk->fit_seq, 0);
+	clock_model_init(&trk->clock, fs, CLOCK_WINDOW_DURATION * fs / ns_block);
+	trk->clock.fit.ref_ns = get_time_ns();
+	publish_clock_fit(trk);
+	evt_queue_init(trk);
 
 	pthread_mutex_init(&trk->mtx, NULL);
-	trk->server_socket = create_listening_socket(port);
-	if (trk->server_socket == -1) {
+
+	// The shared memory ring does not depend on the event thread
+	if (cfg->shm_name) {
+		if (create_shm_ring(trk, cfg->shm_name))
+			mm_log_error("Cannot create shm:%s: %s",
+			             cfg->shm_name, strerror(errno));
+		else
+			mm_log_info("Receiving events on shm:%s (source %u)",
+			            cfg->shm_name, trk->shm_source);
+	}
+
+	trk->server_socket = create_inet_socket(SOCK_STREAM, cfg->tcp_port);
+	if (trk->server_socket == -1 || event_tracker_grow_clients(trk)) {
+		trk->quit_loop = 1;
+		return -1;
+	}
+
+	if (cfg->udp_port > 0) {
+		snprintf(name, sizeof(name), "udp:%i", cfg->udp_port);
+		event_tracker_add_datagram(trk,
+		                 create_inet_socket(SOCK_DGRAM, cfg->udp_port),
+		                 name);
+	}
+
+	if (cfg->unix_path) {
+		snprintf(name, sizeof(name), "unix:%s", cfg->unix_path);
+		if (!event_tracker_add_datagram(trk,
+		                           create_unix_socket(SOCK_DGRAM,
+		                                              cfg->unix_path),
+		                           name))
+			trk->unix_path = cfg->unix_path;
+	}
+
+	if (mm_pipe(trk->wakeup_pipe)) {
+		trk->wakeup_pipe[0] = trk->wakeup_pipe[1] = -1;
 		trk->quit_loop = 1;
 		return -1;
 	}
 
-	mm_gettime(CLOCK_REALTIME, &trk->last_read_ts);
 	pthread_create(&trk->thread, NULL, event_thread, trk);
 	return 0;
 }
@@ -336,15 +1251,46 @@ int event_tracker_init(struct event_tracker* trk, float fs, int port)
 
 void event_tracker_deinit(struct event_tracker* trk)
 {
+	int started;
+
 	pthread_mutex_lock(&trk->mtx);
+	started = !trk->quit_loop;
 	trk->quit_loop = 1;
-	if (trk->client_socket >= 0)
-		mm_shutdown(trk->client_socket, SHUT_RDWR);
 	pthread_mutex_unlock(&trk->mtx);
 
-	pthread_join(trk->thread, NULL);
+	// Wake up the event thread immediately
+	if (started) {
+		mm_write(trk->wakeup_pipe[1], "q", 1);
+		pthread_join(trk->thread, NULL);
+	}
 	pthread_mutex_destroy(&trk->mtx);
 
+	if (trk->wakeup_pipe[0] != -1) {
+		mm_close(trk->wakeup_pipe[0]);
+		mm_close(trk->wakeup_pipe[1]);
+	}
+
+	while (trk->nclient)
+		event_tracker_finish_client(trk, trk->nclient-1);
+
+	free(trk->clients);
+	free(trk->pfds);
+	trk->clients = NULL;
+	trk->pfds = NULL;
+
+	if (trk->unix_path)
+		mm_unlink(trk->unix_path);
+
+	destroy_shm_ring(trk);
+
+	mm_log_info("Clock model: device rate deviation %.1f ppm, "
+	            "timing jitter %.1f us",
+	            trk->clock.ppm, trk->clock.jitter_ns * 1e-3);
+
+	if (atomic_load(&trk->ndropped))
+		mm_log_warn("%u software events have been dropped",
+		            atomic_load(&trk->ndropped));
+
 	mm_close(trk->server_socket);
 }
 
@@ -19,47 +19,154 @@
 
 #include <mcpanel.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <mmtime.h>
 
-#define NEVENT_MAX      16
+#include "clock-model.h"
 
+// Maximal number of events attached to one block of acquired data. Events
+// in excess are kept in the queue and attached to the next block.
+#define NEVENT_MAX      256
+
+// Capacity of the event queue (must be a power of 2)
+#define EVENT_QUEUE_SIZE        4096
+
+// Source identifier of the events generated by the acquisition source
+// (connections are numbered from 1)
+#define EVT_SOURCE_DEVICE       0
+
+/**
+ * struct event_stack - software events attached to a block of data
+ * @nevent:     number of events in @events
+ * @events:     position and code of events
+ * @sources:    identifier of the connection which has sent each event
+ * @durations:  duration of each event in seconds
+ */
 struct event_stack {
 	int nevent;
 	struct mcp_event events[NEVENT_MAX];
+	unsigned int sources[NEVENT_MAX];
+	float durations[NEVENT_MAX];
+};
+
+/**
+ * struct evt_slot - element of event queue
+ * @seq:        sequence number synchronizing producers and consumer
+ * @evt:        event data
+ * @source:     identifier of the connection which has sent the event
+ * @duration:   duration of the event in seconds
+ */
+struct evt_slot {
+	atomic_uint seq;
+	struct mcp_event evt;
+	unsigned int source;
+	float duration;
+};
+
+struct evt_client;
+struct mm_pollfd;
+struct eegview_shm_ring;
+
+/**
+ * struct event_tracker_cfg - transports on which events are received
+ * @tcp_port:   TCP port accepting client connections
+ * @udp_port:   UDP port receiving datagrams (0 to disable)
+ * @unix_path:  path of Unix datagram socket (NULL to disable)
+ * @shm_name:   name of shared memory event ring (NULL to disable)
+ */
+struct event_tracker_cfg {
+	int tcp_port;
+	int udp_port;
+	const char* unix_path;
+	const char* shm_name;
 };
 
 /**
  * struct event_tracker - data for software trigger reception
  * @thread:             event reception thread
- * @mtx:                mutex protecting the concurrent access to event stacks
- *                      and shared metadata.
+ * @mtx:                mutex protecting the quit flag
  * @server_socket:      server socket listening for connection
- * @client_socket:      socket of the current client connection
- * @last_read_ts:       timestamp when data associated with @last_total_read
- *                      has been acquired
- * @last_total_read:    index of last data acquired (observable from event
- *                      thread)
- * @fs:                 sampling frequency of the acquisition data
- * @stack_idx:          index of the element in @stacks currently used for writing
- * @stacks:             array of two event stack used to transmit the event data
- *                      read from event reception thread in a double buffering scheme
+ * @unix_path:          path of Unix socket to remove at exit (can be NULL)
+ * @shm:                shared memory event ring (can be NULL)
+ * @shm_name:           name of the shared memory object of @shm
+ * @shm_source:         source identifier of events posted in @shm
+ * @shm_nevent:         number of events collected from @shm
+ * @wakeup_pipe:        pipe used to interrupt the event thread
+ * @nclient:            number of elements in @clients
+ * @maxclient:          number of elements allocated in @clients
+ * @clients:            array of client connections and datagram sockets
+ * @pfds:               poll set of event thread: wakeup pipe, server socket
+ *                      then the socket of each element of @clients (sized
+ *                      for @maxclient clients)
+ *                      (event thread only)
+ * @next_source:        identifier of the next accepted connection
+ * @clock:              model relating host time and sample index (updated
+ *                      by acquisition thread only)
+ * @fit_seq:            sequence counter protecting @fit_ref_ns,
+ *                      @fit_ref_pos and @fit_period_ns (odd while being
+ *                      updated)
+ * @fit_ref_ns:         copy of @clock.fit.ref_ns observable by event thread
+ * @fit_ref_pos:        copy of @clock.fit.ref_pos observable by event thread
+ * @fit_period_ns:      copy of @clock.fit.period_ns observable by event
+ *                      thread
+ * @jitter_ns:          copy of @clock.jitter_ns observable by any thread
+ * @ppm:                copy of @clock.ppm observable by any thread
+ * @quit_loop:          true if event thread has been requested to exit
+ * @queue_head:         index of next slot to write in @queue (producers)
+ * @queue_tail:         index of next slot to read in @queue (consumer)
+ * @ndropped:           number of events dropped because @queue was full
+ * @rx_nkts:            number of client reads timestamped by the kernel
+ * @rx_delay_sum:       sum of delays (in ns) between kernel timestamps and
+ *                      reading by the event thread
+ * @rx_delay_max:       maximal delay (in ns) observed
+ * @queue:              multi-producer/single-consumer queue of events
+ *                      transmitted from reception threads to acquisition
  */
 struct event_tracker {
 	pthread_t thread;
 	pthread_mutex_t mtx;
 	int server_socket;
-	int client_socket;
-	struct mm_timespec last_read_ts;
-	int last_total_read;
-	float fs;
-	int stack_idx;
+	const char* unix_path;
+	struct eegview_shm_ring* shm;
+	const char* shm_name;
+	unsigned int shm_source;
+	unsigned int shm_nevent;
+	int wakeup_pipe[2];
+	int nclient;
+	int maxclient;
+	struct evt_client* clients;
+	struct mm_pollfd* pfds;
+	unsigned int next_source;
+	struct clock_model clock;
+	atomic_uint fit_seq;
+	atomic_llong fit_ref_ns;
+	_Atomic double fit_ref_pos;
+	_Atomic double fit_period_ns;
+	_Atomic double jitter_ns;
+	_Atomic double ppm;
 	int quit_loop;
-	struct event_stack stacks[2];
+	atomic_uint queue_head;
+	unsigned int queue_tail;
+	atomic_uint ndropped;
+	atomic_uint rx_nkts;
+	atomic_llong rx_delay_sum;
+	atomic_llong rx_delay_max;
+	struct evt_slot queue[EVENT_QUEUE_SIZE];
 };
 
-int event_tracker_init(struct event_tracker* trk, float fs, int port);
+int event_tracker_init(struct event_tracker* trk, float fs, int ns_block,
+                       const struct event_tracker_cfg* cfg);
 void event_tracker_deinit(struct event_tracker* trk);
-struct event_stack* event_tracker_swap_eventstack(struct event_tracker* trk);
+void event_tracker_pop_events(struct event_tracker* trk,
+                              struct event_stack* evt_stk);
+void event_tracker_post_event(struct event_tracker* trk, uint32_t evttype,
+                              int64_t pos, float duration);
 void event_tracker_update_ns_read(struct event_tracker* trk, int total_read);
+unsigned int event_tracker_get_ndropped(struct event_tracker* trk);
+unsigned int event_tracker_get_rx_delay(struct event_tracker* trk,
+                                        double* mean_us, double* max_us);
+void event_tracker_get_clock_stats(struct event_tracker* trk,
+                                   double* jitter_us, double* ppm);
 
 #endif
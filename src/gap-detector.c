@@ -0,0 +1,322 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <mmlog.h>
+#include <mmtime.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gap-detector.h"
+#include "time-utils.h"
+
+// A read returning in less than this fraction of the block duration found
+// the samples already acquired
+#define FAST_READ_FRACTION      8
+
+// Number of consecutive immediate reads after which the acquisition is
+// considered late
+#define BACKLOG_NFAST           16
+
+// Number of blocks and duration (in ms) of signal waiting in the source
+// buffer after which the acquisition is considered late (the largest)
+#define BACKLOG_NBLOCK          4
+#define BACKLOG_DURATION        100
+
+/**************************************************************************
+ *                                                                        *
+ *                      Internals of gap detector                         *
+ *                                                                        *
+ **************************************************************************/
+/**
+ * report_gap() - account a gap and mark it in the acquired stream
+ * @gd:         gap detector
+ * @trk:        event tracker in which the gap event is posted
+ * @pos:        index of the first sample following the gap
+ * @nlost:      number of samples lost in the gap (0 if unknown)
+ */
+static
+void report_gap(struct gap_detector* gd, struct event_tracker* trk,
+                int64_t pos, int64_t nlost)
+{
+	gd->ngap++;
+	gd->nlost += nlost;
+
+	event_tracker_post_event(trk, GAP_EVTTYPE, pos, nlost / gd->fs);
+
+	// Report gaps without flooding the log
+	if ((gd->ngap & (gd->ngap - 1)) == 0)
+		mm_log_warn("Gap of %lli samples before sample %lli "
+		            "(%u gaps so far)", (long long)nlost,
+		            (long long)pos, gd->ngap);
+}
+
+
+static inline
+int64_t read_counter(const struct gap_detector* gd, const char* sample)
+{
+	float f;
+	int32_t i32;
+
+	if (gd->counter_isfloat) {
+		memcpy(&f, sample, sizeof(f));
+		return (int64_t)f;
+	}
+
+	memcpy(&i32, sample, sizeof(i32));
+	return i32;
+}
+
+
+/**
+ * check_counter() - detect discontinuities of the sample counter channel
+ * @gd:         gap detector whose counter channel is set
+ * @blk:        block of acquired samples
+ * @pos:        index of the first sample of @blk in the acquired stream
+ * @trk:        event tracker in which the gaps are posted
+ *
+ * The counter must increase by 1 at each sample, modulo its wrap-around
+ * value. A counter jumping backward is considered as reset by the device:
+ * the number of lost samples is then unknown.
+ *
+ * Return: number of gaps found in @blk
+ */
+static
+int check_counter(struct gap_detector* gd, const struct sample_block* blk,
+                  int64_t pos, struct event_tracker* trk)
+{
+	const char* sample;
+	int64_t count, delta, nlost;
+	int i, ngap = 0;
+
+	sample = (const char*)blk->data[gd->counter_array] + gd->counter_offset;
+	for (i = 0; i < blk->ns; i++, sample += gd->counter_stride) {
+		count = read_counter(gd, sample);
+		if (gd->has_count) {
+			delta = (count - gd->last_count - 1) % gd->counter_mod;
+			if (delta < 0)
+				delta += gd->counter_mod;
+
+			if (delta) {
+				nlost = (delta < gd->counter_mod / 2) ? delta : 0;
+				report_gap(gd, trk, pos + i, nlost);
+				ngap++;
+			}
+		}
+
+		gd->last_count = count;
+		gd->has_count = 1;
+	}
+
+	return ngap;
+}
+
+
+/**
+ * check_status() - detect losses reported by the acquisition source
+ * @gd:         gap detector of a source reporting its losses
+ * @src:        acquisition source
+ * @pos:        index of the first sample of the last block read
+ * @trk:        event tracker in which the gaps are posted
+ *
+ * The source does not tell where the samples have been lost in the block,
+ * hence the gap is placed at its beginning.
+ *
+ * Return: number of gaps found in the last block read
+ */
+static
+int check_status(struct gap_detector* gd, struct acq_source* src,
+                 int64_t pos, struct event_tracker* trk)
+{
+	struct acq_status status;
+
+	if (acq_source_get_status(src, &status)
+	    || status.nlost == gd->last_nlost)
+		return 0;
+
+	report_gap(gd, trk, pos, status.nlost - gd->last_nlost);
+	gd->last_nlost = status.nlost;
+	return 1;
+}
+
+
+/**
+ * check_backlog() - detect acquisition not keeping up with the source
+ * @gd:         gap detector
+ * @src:        acquisition source
+ * @read_ns:    duration of the last read
+ *
+ * The acquisition is late if the source has several blocks waiting in its
+ * buffer or, for the sources that cannot tell, if the reads keep
+ * returning immediately. It has caught up when a read had to wait for the
+ * samples again.
+ */
+static
+void check_backlog(struct gap_detector* gd, struct acq_source* src,
+                   int64_t read_ns)
+{
+	int64_t block_dur_ns = gd->ns_block * 1e9 / gd->fs;
+	ssize_t avail, max_avail;
+	int fast, late;
+
+	max_avail = BACKLOG_DURATION * gd->fs / 1000;
+	if (max_avail < BACKLOG_NBLOCK * gd->ns_block)
+		max_avail = BACKLOG_NBLOCK * gd->ns_block;
+
+	avail = acq_source_get_available(src);
+	fast = (read_ns < block_dur_ns / FAST_READ_FRACTION);
+	gd->nfast = fast ? gd->nfast + 1 : 0;
+	late = (avail >= max_avail) || gd->nfast >= BACKLOG_NFAST;
+
+	if (late && !gd->backlog) {
+		gd->backlog = 1;
+		gd->backlog_start = get_time_ns();
+		gd->nbacklog++;
+
+		// Report backlogs without flooding the log
+		if (gd->nbacklog & (gd->nbacklog - 1))
+			return;
+
+		if (avail >= 0)
+			mm_log_warn("Acquisition late: %zi samples waiting "
+			            "in device buffer (%u times so far)",
+			            avail, gd->nbacklog);
+		else
+			mm_log_warn("Acquisition late: %i consecutive reads "
+			            "without wait (%u times so far)",
+			            gd->nfast, gd->nbacklog);
+	} else if (gd->backlog && !fast && avail < gd->ns_block) {
+		gd->backlog = 0;
+		if ((gd->nbacklog & (gd->nbacklog - 1)) == 0)
+			mm_log_info("Acquisition caught up after %.3f s",
+			            (get_time_ns() - gd->backlog_start) * 1e-9);
+	}
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      API of gap detector                               *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * gap_detector_init() - initialize detection of gaps of a source
+ * @gd:         gap detector to initialize
+ * @src:        acquisition source, already started
+ * @fs:         sampling frequency
+ * @ns_block:   number of samples requested at each read
+ * @realtime:   true if the source delivers samples at the pace of @fs. If
+ *              false (a file replayed as fast as possible), reads returning
+ *              immediately are expected and the backlog is not checked.
+ *
+ * Without counter channel set by gap_detector_set_counter(), the gaps are
+ * detected from the losses reported by the source if it can tell.
+ */
+void gap_detector_init(struct gap_detector* gd, struct acq_source* src,
+                       float fs, int ns_block, int realtime)
+{
+	struct acq_status status;
+
+	*gd = (struct gap_detector) {
+		.fs = fs,
+		.ns_block = ns_block,
+		.realtime = realtime,
+		.counter_array = -1,
+	};
+
+	if (!acq_source_get_status(src, &status)) {
+		gd->has_status = 1;
+		gd->last_nlost = status.nlost;
+	}
+}
+
+
+/**
+ * gap_detector_set_counter() - use a channel counting samples to find gaps
+ * @gd:         initialized gap detector
+ * @iarray:     index of the acquisition array holding the counter
+ * @offset:     offset in bytes of the counter in a sample of the array
+ * @stride:     size in bytes of one sample of the array
+ * @isfloat:    true if the counter is stored as float, int32 otherwise
+ * @modulus:    value at which the counter wraps around
+ *
+ * When a counter is set, it supersedes the losses reported by the source,
+ * so that a gap is not counted twice.
+ */
+void gap_detector_set_counter(struct gap_detector* gd, int iarray,
+                              size_t offset, size_t stride, int isfloat,
+                              int64_t modulus)
+{
+	gd->counter_array = iarray;
+	gd->counter_offset = offset;
+	gd->counter_stride = stride;
+	gd->counter_isfloat = isfloat;
+	gd->counter_mod = modulus;
+	gd->has_count = 0;
+}
+
+
+/**
+ * gap_detector_check() - check a block of acquired samples
+ * @gd:         initialized gap detector
+ * @src:        acquisition source from which @blk has been read
+ * @blk:        block just read
+ * @pos:        index of the first sample of @blk in the acquired stream
+ * @read_ns:    time spent in acq_source_get_data() to get @blk
+ * @trk:        event tracker in which the gaps are posted
+ *
+ * Each gap found is posted as an event of type GAP_EVTTYPE at the
+ * position of the sample following it, with the duration of the lost
+ * samples. This must be called before the events of @blk are popped from
+ * @trk so that the gap events are attached to @blk.
+ *
+ * Return: number of gaps found in @blk
+ */
+int gap_detector_check(struct gap_detector* gd, struct acq_source* src,
+                       const struct sample_block* blk, int64_t pos,
+                       int64_t read_ns, struct event_tracker* trk)
+{
+	int ngap = 0;
+
+	if (gd->counter_array >= 0)
+		ngap = check_counter(gd, blk, pos, trk);
+	else if (gd->has_status)
+		ngap = check_status(gd, src, pos, trk);
+
+	if (gd->realtime)
+		check_backlog(gd, src, read_ns);
+
+	return ngap;
+}
+
+
+/**
+ * gap_detector_report() - log summary of detected gaps
+ * @gd:         initialized gap detector
+ */
+void gap_detector_report(const struct gap_detector* gd)
+{
+	if (gd->ngap)
+		mm_log_warn("%u gaps detected in acquisition, %lli samples "
+		            "lost", gd->ngap, (long long)gd->nlost);
+
+	if (gd->nbacklog)
+		mm_log_warn("Acquisition has been late %u times",
+		            gd->nbacklog);
+}
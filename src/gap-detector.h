@@ -0,0 +1,83 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef GAP_DETECTOR_H
+#define GAP_DETECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "acq-source.h"
+#include "block-pool.h"
+#include "event-tracker.h"
+
+// Code of the events marking a gap: GDF code of the start of a new segment
+// after a break. The duration of the event is the duration of the gap.
+#define GAP_EVTTYPE     0x7ffe
+
+/**
+ * struct gap_detector - detection of discontinuities of acquired stream
+ * @fs:         sampling frequency
+ * @ns_block:   number of samples requested at each read
+ * @realtime:   true if the source delivers samples at the pace of @fs
+ * @counter_array: index of the array holding the sample counter channel
+ *              (-1 if there is none)
+ * @counter_offset: offset in bytes of the counter in a sample of the array
+ * @counter_stride: size in bytes of one sample of the array
+ * @counter_isfloat: true if the counter is stored as float, int32 otherwise
+ * @counter_mod: value at which the counter wraps around
+ * @has_count:  true if @last_count is set
+ * @last_count: value of the counter in the last sample checked
+ * @has_status: true if the source reports its losses
+ * @last_nlost: losses reported by the source at the last check
+ * @nfast:      number of consecutive reads that have returned immediately
+ * @backlog:    true while the acquisition is late
+ * @backlog_start: time (in ns) at which the current backlog has started
+ * @nbacklog:   number of times the acquisition has been late
+ * @ngap:       number of gaps detected
+ * @nlost:      number of samples lost in the detected gaps
+ */
+struct gap_detector {
+	float fs;
+	int ns_block;
+	int realtime;
+	int counter_array;
+	size_t counter_offset;
+	size_t counter_stride;
+	int counter_isfloat;
+	int64_t counter_mod;
+	int has_count;
+	int64_t last_count;
+	int has_status;
+	int64_t last_nlost;
+	int nfast;
+	int backlog;
+	int64_t backlog_start;
+	unsigned int nbacklog;
+	unsigned int ngap;
+	int64_t nlost;
+};
+
+void gap_detector_init(struct gap_detector* gd, struct acq_source* src,
+                       float fs, int ns_block, int realtime);
+void gap_detector_set_counter(struct gap_detector* gd, int iarray,
+                              size_t offset, size_t stride, int isfloat,
+                              int64_t modulus);
+int gap_detector_check(struct gap_detector* gd, struct acq_source* src,
+                       const struct sample_block* blk, int64_t pos,
+                       int64_t read_ns, struct event_tracker* trk);
+void gap_detector_report(const struct gap_detector* gd);
+
+#endif
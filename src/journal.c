@@ -0,0 +1,167 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <mmsysio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "journal.h"
+
+
+static
+int journal_write(struct journal* jnl, const void* buf, size_t len)
+{
+	ssize_t rsz;
+
+	rsz = mm_write(jnl->fd, buf, len);
+	if (rsz < 0)
+		return -1;
+
+	if ((size_t)rsz != len) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * journal_open() - create journal of a file being recorded
+ * @jnl:        journal to initialize
+ * @datapath:   path of the recorded file (already created)
+ * @fs:         sampling frequency of the recording
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set. In case of
+ * failure, @jnl is left closed.
+ */
+int journal_open(struct journal* jnl, const char* datapath, float fs)
+{
+	struct journal_hdr hdr = {
+		.magic = JOURNAL_MAGIC,
+		.version = JOURNAL_VERSION,
+		.fs = fs,
+	};
+	size_t len;
+
+	*jnl = (struct journal)JOURNAL_INITIALIZER;
+
+	len = strlen(datapath) + sizeof(JOURNAL_SUFFIX);
+	jnl->path = malloc(len);
+	if (!jnl->path)
+		return -1;
+
+	snprintf(jnl->path, len, "%s%s", datapath, JOURNAL_SUFFIX);
+
+	// The recorded file is opened only to be synced
+	jnl->data_fd = mm_open(datapath, O_RDONLY, 0);
+	jnl->fd = mm_open(jnl->path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (jnl->data_fd < 0 || jnl->fd < 0)
+		goto failure;
+
+	if (journal_write(jnl, &hdr, sizeof(hdr)) || mm_fsync(jnl->fd))
+		goto failure;
+
+	return 0;
+
+failure:
+	journal_close(jnl, 1);
+	return -1;
+}
+
+
+/**
+ * journal_close() - close journal
+ * @jnl:        journal initialized with journal_open()
+ * @remove:     true if the journal file must be removed, ie, if the
+ *              recorded file has been closed properly
+ */
+void journal_close(struct journal* jnl, int remove)
+{
+	int errnum = errno;
+
+	if (jnl->fd >= 0)
+		mm_close(jnl->fd);
+
+	if (jnl->data_fd >= 0)
+		mm_close(jnl->data_fd);
+
+	if (remove && jnl->path)
+		mm_unlink(jnl->path);
+
+	free(jnl->path);
+	*jnl = (struct journal)JOURNAL_INITIALIZER;
+	errno = errnum;
+}
+
+
+/**
+ * journal_add_event() - append event to journal
+ * @jnl:        opened journal
+ * @code:       event code
+ * @pos:        position of the event in samples since beginning of file
+ * @duration:   duration of the event in seconds
+ *
+ * The event reaches the disk at the next journal_sync(), but survives a
+ * crash of the process as soon as this function returns.
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+int journal_add_event(struct journal* jnl, uint32_t code, int64_t pos,
+                      float duration)
+{
+	struct journal_rec rec = {
+		.type = JOURNAL_EVENT,
+		.code = code,
+		.value = pos,
+		.duration = duration,
+	};
+
+	if (jnl->fd < 0)
+		return 0;
+
+	return journal_write(jnl, &rec, sizeof(rec));
+}
+
+
+/**
+ * journal_sync() - sync journal and recorded file on disk
+ * @jnl:        opened journal
+ *
+ * Once this returns, the events added to @jnl survive a crash of the
+ * system. The samples of the recorded file are synced only as far as they
+ * have been handed to the system: those still buffered by the recording
+ * library are not covered. The cost of a sync is bounded by the amount of
+ * data written since the previous one, since only that data is dirty.
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+int journal_sync(struct journal* jnl)
+{
+	if (jnl->fd < 0)
+		return 0;
+
+	if (mm_fsync(jnl->data_fd) || mm_fsync(jnl->fd))
+		return -1;
+
+	return 0;
+}
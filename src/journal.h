@@ -0,0 +1,98 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+/*
+ * Recording journal
+ *
+ * While a file is recorded, a sidecar journal (the path of the file with
+ * JOURNAL_SUFFIX appended) keeps what is needed to repair the file if the
+ * recording is interrupted before the file is closed: the events, which
+ * are written in GDF files only when closing. The journal is removed when
+ * the file is closed properly.
+ *
+ * The journal does not tell how many samples have reached the disk, since
+ * the recording library buffers the samples it is given: the data that can
+ * be recovered is the one found in the file.
+ *
+ * It is made of a struct journal_hdr followed by struct journal_rec
+ * appended as the recording progresses, in native byte order. Records of
+ * unknown type must be skipped.
+ */
+
+#define JOURNAL_SUFFIX          ".journal"
+#define JOURNAL_MAGIC           0x4c4e4a45      // "EJNL" in little endian
+#define JOURNAL_VERSION         1
+
+// Types of journal records
+#define JOURNAL_EVENT           1
+
+/**
+ * struct journal_hdr - header of journal
+ * @magic:      JOURNAL_MAGIC
+ * @version:    JOURNAL_VERSION
+ * @reserved:   0
+ * @fs:         sampling frequency of the recording
+ */
+struct journal_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	float fs;
+};
+
+/**
+ * struct journal_rec - record of journal
+ * @type:       JOURNAL_EVENT
+ * @code:       event code
+ * @value:      position of the event in samples since the beginning of the
+ *              file
+ * @duration:   duration of the event in seconds
+ * @reserved:   0
+ */
+struct journal_rec {
+	uint32_t type;
+	uint32_t code;
+	int64_t value;
+	float duration;
+	uint32_t reserved;
+};
+
+/**
+ * struct journal - journal of a file being recorded
+ * @fd:         file descriptor of the journal (-1 if none)
+ * @data_fd:    file descriptor on the recorded file, used to sync the data
+ *              already handed to the system
+ * @path:       path of the journal
+ */
+struct journal {
+	int fd;
+	int data_fd;
+	char* path;
+};
+
+#define JOURNAL_INITIALIZER     {.fd = -1, .data_fd = -1, .path = NULL}
+
+int journal_open(struct journal* jnl, const char* datapath, float fs);
+void journal_close(struct journal* jnl, int remove);
+int journal_add_event(struct journal* jnl, uint32_t code, int64_t pos,
+                      float duration);
+int journal_sync(struct journal* jnl);
+
+#endif
@@ -0,0 +1,168 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "label-set.h"
+
+/**************************************************************************
+ *                                                                        *
+ *                      Internals of label set                            *
+ *                                                                        *
+ **************************************************************************/
+
+// FNV-1a hash of the @len first characters of @str
+static
+uint32_t hash_label(const char* str, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)str[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+
+/**
+ * find_slot() - get slot of a label in hash table
+ * @set:        label set
+ * @label:      label to look up (not necessarily null terminated)
+ * @len:        length of @label
+ *
+ * Return: index of the slot holding @label if in the set, otherwise index
+ * of the empty slot where it would be inserted
+ */
+static
+int find_slot(const struct label_set* set, const char* label, size_t len)
+{
+	unsigned int mask = set->nslot - 1;
+	unsigned int i;
+	const char* slot_label;
+
+	i = hash_label(label, len) & mask;
+	while (set->slots[i] != -1) {
+		slot_label = set->labels[set->slots[i]];
+		if (strlen(slot_label) == len && !memcmp(slot_label, label, len))
+			break;
+
+		i = (i + 1) & mask;
+	}
+
+	return i;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      API of label set                                  *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * label_set_init_csv() - initialize label set from comma separated list
+ * @set:        label set to initialize
+ * @csv:        labels separated by commas
+ *
+ * Labels listed several times are added only once.
+ *
+ * Return: 0 in case of success, -1 otherwise (the set is then empty)
+ */
+int label_set_init_csv(struct label_set* set, const char* csv)
+{
+	const char *label, *end;
+	size_t len;
+	int n, i, islot;
+
+	// Count the labels to size the hash table
+	n = 1;
+	for (end = csv; (end = strchr(end, ',')); end++)
+		n++;
+
+	*set = (struct label_set) {.nslot = 2};
+	while (set->nslot < 2*n)
+		set->nslot *= 2;
+
+	set->labels = malloc(n * sizeof(*set->labels));
+	set->slots = malloc(set->nslot * sizeof(*set->slots));
+	if (!set->labels || !set->slots)
+		goto failure;
+
+	for (i = 0; i < set->nslot; i++)
+		set->slots[i] = -1;
+
+	for (label = csv; label; label = *end ? end + 1 : NULL) {
+		end = strchr(label, ',');
+		if (!end)
+			end = label + strlen(label);
+
+		len = end - label;
+		islot = find_slot(set, label, len);
+		if (set->slots[islot] != -1)
+			continue;
+
+		set->labels[set->nlabel] = malloc(len + 1);
+		if (!set->labels[set->nlabel])
+			goto failure;
+
+		memcpy(set->labels[set->nlabel], label, len);
+		set->labels[set->nlabel][len] = '\0';
+		set->slots[islot] = set->nlabel++;
+	}
+
+	return 0;
+
+failure:
+	label_set_deinit(set);
+	return -1;
+}
+
+
+void label_set_deinit(struct label_set* set)
+{
+	int i;
+
+	for (i = 0; i < set->nlabel; i++)
+		free(set->labels[i]);
+
+	free(set->labels);
+	free(set->slots);
+	*set = (struct label_set) {.nlabel = 0};
+}
+
+
+/**
+ * label_set_find() - look up a label in a set
+ * @set:        label set (initialized or zeroed)
+ * @label:      null terminated label to look for
+ *
+ * Return: index of @label in @set->labels, -1 if not in the set
+ */
+int label_set_find(const struct label_set* set, const char* label)
+{
+	if (!set->nlabel)
+		return -1;
+
+	return set->slots[find_slot(set, label, strlen(label))];
+}
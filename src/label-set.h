@@ -0,0 +1,38 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef LABEL_SET_H
+#define LABEL_SET_H
+
+/**
+ * struct label_set - set of channel labels with constant time lookup
+ * @nlabel:     number of distinct labels in the set
+ * @labels:     labels of the set, in order of insertion
+ * @nslot:      size of @slots (power of 2, at least twice @nlabel)
+ * @slots:      open addressing hash table holding the index in @labels of
+ *              each label (-1 for empty slot)
+ */
+struct label_set {
+	int nlabel;
+	char** labels;
+	int nslot;
+	int* slots;
+};
+
+int label_set_init_csv(struct label_set* set, const char* csv);
+void label_set_deinit(struct label_set* set);
+int label_set_find(const struct label_set* set, const char* label);
+
+#endif
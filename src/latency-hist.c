@@ -0,0 +1,151 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "latency-hist.h"
+
+/**************************************************************************
+ *                                                                        *
+ *                      Internals of latency histogram                    *
+ *                                                                        *
+ **************************************************************************/
+
+// Index of the most significant bit set in @v (which must not be 0)
+static inline
+int msb64(uint64_t v)
+{
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(v);
+#else
+	int n = 0;
+
+	while (v >>= 1)
+		n++;
+	return n;
+#endif
+}
+
+
+/**
+ * get_bucket() - get index of the bucket of a value
+ * @v:          recorded value
+ *
+ * Values below LAT_HIST_NSUB have their own bucket. Above, the bucket is
+ * given by the position of the most significant bit and the
+ * LAT_HIST_SUB_BITS bits following it.
+ *
+ * Return: index of the bucket in struct lat_hist
+ */
+static inline
+int get_bucket(uint64_t v)
+{
+	int e;
+
+	if (v < LAT_HIST_NSUB)
+		return v;
+
+	e = msb64(v);
+	return ((e - LAT_HIST_SUB_BITS + 1) << LAT_HIST_SUB_BITS)
+	       + ((v >> (e - LAT_HIST_SUB_BITS)) & (LAT_HIST_NSUB - 1));
+}
+
+
+// Largest value falling in bucket @index
+static
+int64_t get_bucket_upper(int index)
+{
+	int b = index >> LAT_HIST_SUB_BITS;
+	int sub = index & (LAT_HIST_NSUB - 1);
+
+	if (b == 0)
+		return index;
+
+	return ((int64_t)(LAT_HIST_NSUB + sub + 1) << (b - 1)) - 1;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      API of latency histogram                          *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * lat_hist_reset() - clear all recorded values
+ * @h:          histogram to clear
+ */
+void lat_hist_reset(struct lat_hist* h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+
+/**
+ * lat_hist_add() - record a duration
+ * @h:          initialized histogram
+ * @ns:         duration in nanoseconds (negative values are recorded as 0)
+ */
+void lat_hist_add(struct lat_hist* h, int64_t ns)
+{
+	if (ns < 0)
+		ns = 0;
+
+	h->buckets[get_bucket(ns)]++;
+	h->count++;
+	h->sum += ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+
+/**
+ * lat_hist_percentile() - get percentile of recorded durations
+ * @h:          initialized histogram
+ * @p:          percentile to get (between 0 and 100)
+ *
+ * Return: the upper bound of the bucket containing the percentile
+ * (bounded by the maximum recorded), 0 if no duration has been recorded.
+ */
+int64_t lat_hist_percentile(const struct lat_hist* h, double p)
+{
+	uint64_t rank, acc = 0;
+	int64_t upper;
+	int i;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < LAT_HIST_NBUCKET; i++) {
+		acc += h->buckets[i];
+		if (acc >= rank)
+			break;
+	}
+
+	if (i == LAT_HIST_NBUCKET)
+		return h->max;
+
+	upper = get_bucket_upper(i);
+	return (upper < h->max) ? upper : h->max;
+}
@@ -0,0 +1,49 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdint.h>
+
+// Each power of 2 is split in 2^LAT_HIST_SUB_BITS buckets, hence the
+// relative precision of the recorded values is better than 1/16.
+#define LAT_HIST_SUB_BITS       4
+#define LAT_HIST_NSUB           (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_NBUCKET        ((64 - LAT_HIST_SUB_BITS) * LAT_HIST_NSUB)
+
+/**
+ * struct lat_hist - histogram of durations with logarithmic buckets
+ * @count:      number of recorded values
+ * @sum:        sum of recorded values (in ns)
+ * @max:        maximum recorded value (in ns)
+ * @buckets:    number of values recorded in each bucket
+ *
+ * Like HDR histograms, the buckets cover any duration with a bounded
+ * relative error, in a fixed size structure: recording a value is a few
+ * instructions and never allocates.
+ */
+struct lat_hist {
+	uint64_t count;
+	int64_t sum;
+	int64_t max;
+	uint64_t buckets[LAT_HIST_NBUCKET];
+};
+
+void lat_hist_reset(struct lat_hist* h);
+void lat_hist_add(struct lat_hist* h, int64_t ns);
+int64_t lat_hist_percentile(const struct lat_hist* h, double p);
+
+#endif
@@ -0,0 +1,134 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <mmsysio.h>
+#include <stdio.h>
+#include <string.h>
+#if !defined(_WIN32)
+# include <sys/un.h>
+#endif
+
+#include "net-utils.h"
+
+#define LISTEN_BACKLOG  8
+
+
+/**
+ * create_inet_socket() - create socket bound to local port
+ * @type:       SOCK_STREAM or SOCK_DGRAM
+ * @port:       port to which the socket must be bound
+ *
+ * If @type is SOCK_STREAM, the socket listens for incoming connections.
+ *
+ * Return: the socket in case of success, -1 otherwise
+ */
+int create_inet_socket(int type, int port)
+{
+	int sock;
+	struct addrinfo *rp, *res = NULL;
+	char service[16];
+	int reuse = -1;
+	struct addrinfo hints = {
+		.ai_family = AF_INET,
+		.ai_socktype = type,
+		.ai_flags = AI_PASSIVE,
+	};
+
+	// Create server socket
+	sock = mm_socket(AF_INET, type, 0);
+	if (sock < 0)
+		return -1;
+
+	if (mm_setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1)
+		goto error;
+
+	// Construct local address struct
+	snprintf(service, sizeof(service), "%i", port);
+	if (mm_getaddrinfo(NULL, service, &hints, &res))
+		goto error;
+
+	// Loop over the result and try to bind server socket to address
+	for (rp = res; rp != NULL; rp = rp->ai_next) {
+		if (mm_bind(sock, res->ai_addr, res->ai_addrlen) == 0)
+			break;
+	}
+	mm_freeaddrinfo(res);
+
+	// Listen for incoming clients (if sock has been bound)
+	if (  rp == NULL
+	   || (type == SOCK_STREAM && mm_listen(sock, LISTEN_BACKLOG)))
+		goto error;
+
+	return sock;
+
+error:
+	mm_close(sock);
+	return -1;
+}
+
+
+#if !defined(_WIN32)
+
+/**
+ * create_unix_socket() - create Unix domain socket bound to path
+ * @type:       SOCK_STREAM or SOCK_DGRAM
+ * @path:       path of the socket in the filesystem
+ *
+ * A stale socket left at @path by a previous run is removed. If @type is
+ * SOCK_STREAM, the socket listens for incoming connections.
+ *
+ * Return: the socket in case of success, -1 otherwise
+ */
+int create_unix_socket(int type, const char* path)
+{
+	int sock;
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	sock = mm_socket(AF_UNIX, type, 0);
+	if (sock < 0)
+		return -1;
+
+	mm_unlink(path);
+	if (  mm_bind(sock, (struct sockaddr*)&addr, sizeof(addr))
+	   || (type == SOCK_STREAM && mm_listen(sock, LISTEN_BACKLOG))) {
+		mm_close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+#else /* _WIN32 */
+
+int create_unix_socket(int type, const char* path)
+{
+	(void)type;
+	(void)path;
+	errno = ENOTSUP;
+	return -1;
+}
+
+#endif /* _WIN32 */
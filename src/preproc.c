@@ -0,0 +1,647 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <mmerrno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "preproc.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_KERNELS 1
+# include <immintrin.h>
+#else
+# define HAVE_X86_KERNELS 0
+#endif
+
+/**************************************************************************
+ *                                                                        *
+ *                      Internals of filter design                        *
+ *                                                                        *
+ **************************************************************************/
+
+enum biquad_type {
+	BIQUAD_LOWPASS,
+	BIQUAD_HIGHPASS,
+	BIQUAD_NOTCH,
+};
+
+
+/**
+ * design_biquad() - compute coefficients of a second order section
+ * @bq:         section to set
+ * @type:       response of the section
+ * @freq:       cutoff or center frequency (in Hz)
+ * @q:          quality factor
+ * @fs:         sampling frequency (in Hz)
+ *
+ * The coefficients follow the bilinear transform formulas of the "Audio
+ * EQ cookbook" by R. Bristow-Johnson. They are computed in double
+ * precision before being rounded.
+ */
+static
+void design_biquad(struct biquad* bq, enum biquad_type type,
+                   double freq, double q, double fs)
+{
+	double w0 = 2.0 * M_PI * freq / fs;
+	double cw = cos(w0);
+	double alpha = sin(w0) / (2.0 * q);
+	double a0 = 1.0 + alpha;
+	double b0, b1, b2;
+
+	switch (type) {
+	case BIQUAD_LOWPASS:
+		b0 = (1.0 - cw) / 2.0;
+		b1 = 1.0 - cw;
+		b2 = b0;
+		break;
+
+	case BIQUAD_HIGHPASS:
+		b0 = (1.0 + cw) / 2.0;
+		b1 = -(1.0 + cw);
+		b2 = b0;
+		break;
+
+	default:
+		b0 = 1.0;
+		b1 = -2.0 * cw;
+		b2 = 1.0;
+		break;
+	}
+
+	*bq = (struct biquad) {
+		.b0 = b0 / a0,
+		.b1 = b1 / a0,
+		.b2 = b2 / a0,
+		.a1 = -2.0 * cw / a0,
+		.a2 = (1.0 - alpha) / a0,
+	};
+}
+
+
+/**
+ * add_butterworth() - append 4th order Butterworth filter to the cascade
+ * @pp:         preprocessing being initialized
+ * @type:       BIQUAD_LOWPASS or BIQUAD_HIGHPASS
+ * @cutoff:     cutoff frequency (in Hz)
+ * @fs:         sampling frequency (in Hz)
+ *
+ * The filter is made of 2 sections whose quality factors are given by the
+ * pole pairs of the Butterworth polynomial of order 4.
+ */
+static
+void add_butterworth(struct preproc* pp, enum biquad_type type,
+                     double cutoff, double fs)
+{
+	int k;
+
+	for (k = 0; k < 2; k++)
+		design_biquad(&pp->biquads[pp->nbiquad++], type, cutoff,
+		              1.0 / (2.0 * cos(M_PI * (2*k + 1) / 8.0)), fs);
+}
+
+
+static
+int is_valid_freq(double freq, float fs)
+{
+	return freq >= 0.0 && freq < fs / 2.0f;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      Internals of processing kernels                   *
+ *                                                                        *
+ **************************************************************************/
+
+/*
+ * The filters are computed in transposed direct form II. For each section,
+ * with x the input and y the output:
+ *      y = b0*x + z1
+ *      z1 = b1*x - a1*y + z2
+ *      z2 = b2*x - a2*y
+ *
+ * All kernels process the samples of a group of adjacent channels through
+ * the whole cascade before moving to the next ones, so that the delay
+ * elements remain in registers along the block. The SIMD kernels handle 2
+ * vectors of channels at once, whose recursions are independent: this
+ * hides the latency of the chain of operations linking 2 samples.
+ *
+ * The common average is accumulated in double precision in 4 partial sums,
+ * channel c going to sum c%4, then the sums are combined pairwise and the
+ * remaining channels are added in order. All kernels follow this order and
+ * FMA is not used (like in sample-conv.c), so that all implementations
+ * produce the same values, with or without common average.
+ */
+
+static
+void compute_mean_scalar(struct preproc* pp, int ns, const float* in)
+{
+	const float* x;
+	const double* w = pp->car_weight;
+	double sum, part[4];
+	int i, c, j;
+
+	for (i = 0; i < ns; i++) {
+		x = in + i * pp->nch;
+		part[0] = part[1] = part[2] = part[3] = 0.0;
+		for (c = 0; c + 4 <= pp->nch; c += 4)
+			for (j = 0; j < 4; j++)
+				part[j] += w[c+j] * x[c+j];
+
+		sum = (part[0] + part[1]) + (part[2] + part[3]);
+		for (; c < pp->nch; c++)
+			sum += w[c] * x[c];
+
+		pp->mean[i] = sum * pp->car_norm;
+	}
+}
+
+
+// Filter channels from @c0 to the last one
+static
+void filter_scalar(struct preproc* pp, int c0, int ns,
+                   const float* in, float* out)
+{
+	const struct biquad* bq;
+	double x, y, z1[PREPROC_MAX_BIQUAD], z2[PREPROC_MAX_BIQUAD];
+	int i, c, k, nch = pp->nch;
+
+	for (c = c0; c < nch; c++) {
+		for (k = 0; k < pp->nbiquad; k++) {
+			z1[k] = pp->state[(2*k)*nch + c];
+			z2[k] = pp->state[(2*k+1)*nch + c];
+		}
+
+		for (i = 0; i < ns; i++) {
+			x = in[i*nch + c];
+			if (pp->car)
+				x = x - pp->mean[i];
+
+			for (k = 0; k < pp->nbiquad; k++) {
+				bq = &pp->biquads[k];
+				y = bq->b0 * x + z1[k];
+				z1[k] = (bq->b1 * x - bq->a1 * y) + z2[k];
+				z2[k] = bq->b2 * x - bq->a2 * y;
+				x = y;
+			}
+
+			out[i*nch + c] = x;
+		}
+
+		for (k = 0; k < pp->nbiquad; k++) {
+			pp->state[(2*k)*nch + c] = z1[k];
+			pp->state[(2*k+1)*nch + c] = z2[k];
+		}
+	}
+}
+
+
+static
+void process_scalar(struct preproc* pp, int ns, const float* in, float* out)
+{
+	if (pp->car)
+		compute_mean_scalar(pp, ns, in);
+
+	filter_scalar(pp, 0, ns, in, out);
+}
+
+
+#if HAVE_X86_KERNELS
+
+static
+int cpu_supports(enum preproc_impl impl)
+{
+	__builtin_cpu_init();
+
+	switch (impl) {
+	case PREPROC_SCALAR: return 1;
+	case PREPROC_SSE2: return __builtin_cpu_supports("sse2");
+	case PREPROC_AVX: return __builtin_cpu_supports("avx");
+	default: return 0;
+	}
+}
+
+
+__attribute__((target("sse2")))
+static
+void process_sse2(struct preproc* pp, int ns, const float* in, float* out)
+{
+	__m128d b0[PREPROC_MAX_BIQUAD], b1[PREPROC_MAX_BIQUAD];
+	__m128d b2[PREPROC_MAX_BIQUAD], a1[PREPROC_MAX_BIQUAD];
+	__m128d a2[PREPROC_MAX_BIQUAD];
+	__m128d z1l[PREPROC_MAX_BIQUAD], z2l[PREPROC_MAX_BIQUAD];
+	__m128d z1h[PREPROC_MAX_BIQUAD], z2h[PREPROC_MAX_BIQUAD];
+	__m128d xl, xh, yl, yh, accl, acch, mean;
+	__m128 v;
+	double* st;
+	double sum, part[4];
+	int i, c, k, nch = pp->nch, nbiquad = pp->nbiquad;
+
+	if (pp->car) {
+		for (i = 0; i < ns; i++) {
+			// Partial sums of channels c%4 == 0, 1 in accl and
+			// c%4 == 2, 3 in acch
+			accl = acch = _mm_setzero_pd();
+			for (c = 0; c + 4 <= nch; c += 4) {
+				v = _mm_loadu_ps(in + i*nch + c);
+				xl = _mm_cvtps_pd(v);
+				xh = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+				xl = _mm_mul_pd(xl, _mm_loadu_pd(pp->car_weight + c));
+				xh = _mm_mul_pd(xh,
+				                _mm_loadu_pd(pp->car_weight + c + 2));
+				accl = _mm_add_pd(accl, xl);
+				acch = _mm_add_pd(acch, xh);
+			}
+
+			_mm_storeu_pd(part, accl);
+			_mm_storeu_pd(part + 2, acch);
+			sum = (part[0] + part[1]) + (part[2] + part[3]);
+			for (; c < nch; c++)
+				sum += pp->car_weight[c] * in[i*nch + c];
+
+			pp->mean[i] = sum * pp->car_norm;
+		}
+	}
+
+	for (k = 0; k < nbiquad; k++) {
+		b0[k] = _mm_set1_pd(pp->biquads[k].b0);
+		b1[k] = _mm_set1_pd(pp->biquads[k].b1);
+		b2[k] = _mm_set1_pd(pp->biquads[k].b2);
+		a1[k] = _mm_set1_pd(pp->biquads[k].a1);
+		a2[k] = _mm_set1_pd(pp->biquads[k].a2);
+	}
+
+	for (c = 0; c + 4 <= nch; c += 4) {
+		for (k = 0; k < nbiquad; k++) {
+			st = pp->state + c;
+			z1l[k] = _mm_loadu_pd(st + (2*k)*nch);
+			z1h[k] = _mm_loadu_pd(st + (2*k)*nch + 2);
+			z2l[k] = _mm_loadu_pd(st + (2*k+1)*nch);
+			z2h[k] = _mm_loadu_pd(st + (2*k+1)*nch + 2);
+		}
+
+		for (i = 0; i < ns; i++) {
+			v = _mm_loadu_ps(in + i*nch + c);
+			xl = _mm_cvtps_pd(v);
+			xh = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+			if (pp->car) {
+				mean = _mm_set1_pd(pp->mean[i]);
+				xl = _mm_sub_pd(xl, mean);
+				xh = _mm_sub_pd(xh, mean);
+			}
+
+			for (k = 0; k < nbiquad; k++) {
+				yl = _mm_add_pd(_mm_mul_pd(b0[k], xl), z1l[k]);
+				yh = _mm_add_pd(_mm_mul_pd(b0[k], xh), z1h[k]);
+				z1l[k] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1[k], xl),
+				                               _mm_mul_pd(a1[k], yl)),
+				                    z2l[k]);
+				z1h[k] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1[k], xh),
+				                               _mm_mul_pd(a1[k], yh)),
+				                    z2h[k]);
+				z2l[k] = _mm_sub_pd(_mm_mul_pd(b2[k], xl),
+				                    _mm_mul_pd(a2[k], yl));
+				z2h[k] = _mm_sub_pd(_mm_mul_pd(b2[k], xh),
+				                    _mm_mul_pd(a2[k], yh));
+				xl = yl;
+				xh = yh;
+			}
+
+			v = _mm_movelh_ps(_mm_cvtpd_ps(xl), _mm_cvtpd_ps(xh));
+			_mm_storeu_ps(out + i*nch + c, v);
+		}
+
+		for (k = 0; k < nbiquad; k++) {
+			st = pp->state + c;
+			_mm_storeu_pd(st + (2*k)*nch, z1l[k]);
+			_mm_storeu_pd(st + (2*k)*nch + 2, z1h[k]);
+			_mm_storeu_pd(st + (2*k+1)*nch, z2l[k]);
+			_mm_storeu_pd(st + (2*k+1)*nch + 2, z2h[k]);
+		}
+	}
+
+	filter_scalar(pp, c, ns, in, out);
+}
+
+
+__attribute__((target("avx")))
+static
+void process_avx(struct preproc* pp, int ns, const float* in, float* out)
+{
+	__m256d b0[PREPROC_MAX_BIQUAD], b1[PREPROC_MAX_BIQUAD];
+	__m256d b2[PREPROC_MAX_BIQUAD], a1[PREPROC_MAX_BIQUAD];
+	__m256d a2[PREPROC_MAX_BIQUAD];
+	__m256d z1l[PREPROC_MAX_BIQUAD], z2l[PREPROC_MAX_BIQUAD];
+	__m256d z1h[PREPROC_MAX_BIQUAD], z2h[PREPROC_MAX_BIQUAD];
+	__m256d xl, xh, yl, yh, acc, mean;
+	__m256 v;
+	double* st;
+	double sum, part[4];
+	int i, c, k, nch = pp->nch, nbiquad = pp->nbiquad;
+
+	if (pp->car) {
+		for (i = 0; i < ns; i++) {
+			// Partial sum of channels c%4 == j in lane j
+			acc = _mm256_setzero_pd();
+			for (c = 0; c + 4 <= nch; c += 4) {
+				xl = _mm256_cvtps_pd(_mm_loadu_ps(in + i*nch + c));
+				xl = _mm256_mul_pd(xl,
+				                   _mm256_loadu_pd(pp->car_weight + c));
+				acc = _mm256_add_pd(acc, xl);
+			}
+
+			_mm256_storeu_pd(part, acc);
+			sum = (part[0] + part[1]) + (part[2] + part[3]);
+			for (; c < nch; c++)
+				sum += pp->car_weight[c] * in[i*nch + c];
+
+			pp->mean[i] = sum * pp->car_norm;
+		}
+	}
+
+	for (k = 0; k < nbiquad; k++) {
+		b0[k] = _mm256_set1_pd(pp->biquads[k].b0);
+		b1[k] = _mm256_set1_pd(pp->biquads[k].b1);
+		b2[k] = _mm256_set1_pd(pp->biquads[k].b2);
+		a1[k] = _mm256_set1_pd(pp->biquads[k].a1);
+		a2[k] = _mm256_set1_pd(pp->biquads[k].a2);
+	}
+
+	for (c = 0; c + 8 <= nch; c += 8) {
+		for (k = 0; k < nbiquad; k++) {
+			st = pp->state + c;
+			z1l[k] = _mm256_loadu_pd(st + (2*k)*nch);
+			z1h[k] = _mm256_loadu_pd(st + (2*k)*nch + 4);
+			z2l[k] = _mm256_loadu_pd(st + (2*k+1)*nch);
+			z2h[k] = _mm256_loadu_pd(st + (2*k+1)*nch + 4);
+		}
+
+		for (i = 0; i < ns; i++) {
+			v = _mm256_loadu_ps(in + i*nch + c);
+			xl = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+			xh = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+			if (pp->car) {
+				mean = _mm256_set1_pd(pp->mean[i]);
+				xl = _mm256_sub_pd(xl, mean);
+				xh = _mm256_sub_pd(xh, mean);
+			}
+
+			for (k = 0; k < nbiquad; k++) {
+				yl = _mm256_add_pd(_mm256_mul_pd(b0[k], xl), z1l[k]);
+				yh = _mm256_add_pd(_mm256_mul_pd(b0[k], xh), z1h[k]);
+				z1l[k] = _mm256_add_pd(
+				           _mm256_sub_pd(_mm256_mul_pd(b1[k], xl),
+				                         _mm256_mul_pd(a1[k], yl)),
+				           z2l[k]);
+				z1h[k] = _mm256_add_pd(
+				           _mm256_sub_pd(_mm256_mul_pd(b1[k], xh),
+				                         _mm256_mul_pd(a1[k], yh)),
+				           z2h[k]);
+				z2l[k] = _mm256_sub_pd(_mm256_mul_pd(b2[k], xl),
+				                       _mm256_mul_pd(a2[k], yl));
+				z2h[k] = _mm256_sub_pd(_mm256_mul_pd(b2[k], xh),
+				                       _mm256_mul_pd(a2[k], yh));
+				xl = yl;
+				xh = yh;
+			}
+
+			v = _mm256_insertf128_ps(
+			      _mm256_castps128_ps256(_mm256_cvtpd_ps(xl)),
+			      _mm256_cvtpd_ps(xh), 1);
+			_mm256_storeu_ps(out + i*nch + c, v);
+		}
+
+		for (k = 0; k < nbiquad; k++) {
+			st = pp->state + c;
+			_mm256_storeu_pd(st + (2*k)*nch, z1l[k]);
+			_mm256_storeu_pd(st + (2*k)*nch + 4, z1h[k]);
+			_mm256_storeu_pd(st + (2*k+1)*nch, z2l[k]);
+			_mm256_storeu_pd(st + (2*k+1)*nch + 4, z2h[k]);
+		}
+	}
+
+	filter_scalar(pp, c, ns, in, out);
+}
+
+#else /* HAVE_X86_KERNELS */
+
+static
+int cpu_supports(enum preproc_impl impl)
+{
+	return (impl == PREPROC_SCALAR);
+}
+
+#define process_sse2    process_scalar
+#define process_avx     process_scalar
+
+#endif /* HAVE_X86_KERNELS */
+
+
+static const char* const impl_names[PREPROC_NIMPL] = {
+	[PREPROC_SCALAR] = "scalar",
+	[PREPROC_SSE2] = "sse2",
+	[PREPROC_AVX] = "avx",
+};
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      API of preprocessing                              *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * preproc_init() - initialize filter bank and re-referencing
+ * @pp:         preprocessing to initialize
+ * @nch:        number of channels
+ * @ns_max:     maximal number of samples that will be processed at once
+ * @fs:         sampling frequency
+ * @cfg:        filters and reference to apply
+ *
+ * The common average is initially computed over all channels. The fastest
+ * implementation supported by the CPU is selected.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ */
+int preproc_init(struct preproc* pp, int nch, int ns_max, float fs,
+                 const struct preproc_cfg* cfg)
+{
+	int i, impl;
+
+	*pp = (struct preproc) {
+		.nch = nch,
+		.ns_max = ns_max,
+		.car = cfg->car,
+		.car_norm = nch ? 1.0 / nch : 0.0,
+	};
+
+	if (!is_valid_freq(cfg->notch, fs)
+	    || !is_valid_freq(cfg->hp_cutoff, fs)
+	    || !is_valid_freq(cfg->lp_cutoff, fs)
+	    || (cfg->notch > 0.0 && cfg->notch_q <= 0.0))
+		return mm_raise_error(EINVAL, "filter frequencies must be "
+		                      "below %g Hz", fs / 2.0f);
+
+	if (cfg->notch > 0.0)
+		design_biquad(&pp->biquads[pp->nbiquad++], BIQUAD_NOTCH,
+		              cfg->notch, cfg->notch_q, fs);
+
+	if (cfg->hp_cutoff > 0.0)
+		add_butterworth(pp, BIQUAD_HIGHPASS, cfg->hp_cutoff, fs);
+
+	if (cfg->lp_cutoff > 0.0)
+		add_butterworth(pp, BIQUAD_LOWPASS, cfg->lp_cutoff, fs);
+
+	pp->state = calloc(2 * pp->nbiquad * nch + 1, sizeof(*pp->state));
+	pp->car_weight = malloc((nch + 1) * sizeof(*pp->car_weight));
+	pp->mean = malloc((ns_max + 1) * sizeof(*pp->mean));
+	if (!pp->state || !pp->car_weight || !pp->mean) {
+		preproc_deinit(pp);
+		return mm_raise_from_errno("cannot allocate preprocessing");
+	}
+
+	for (i = 0; i < nch; i++)
+		pp->car_weight[i] = 1.0;
+
+	for (impl = PREPROC_NIMPL-1; impl > PREPROC_SCALAR; impl--)
+		if (cpu_supports(impl))
+			break;
+
+	pp->impl = impl;
+	return 0;
+}
+
+
+/**
+ * preproc_deinit() - free resources of preprocessing
+ * @pp:         preprocessing initialized with preproc_init()
+ */
+void preproc_deinit(struct preproc* pp)
+{
+	free(pp->state);
+	free(pp->car_weight);
+	free(pp->mean);
+	pp->state = NULL;
+	pp->car_weight = NULL;
+	pp->mean = NULL;
+}
+
+
+/**
+ * preproc_exclude_from_average() - do not account channel in the reference
+ * @pp:         initialized preprocessing
+ * @ich:        index of the channel
+ *
+ * The channel is still re-referenced, but does not contribute to the
+ * common average. This is meant for bad or unselected channels.
+ */
+void preproc_exclude_from_average(struct preproc* pp, int ich)
+{
+	int i, n;
+
+	pp->car_weight[ich] = 0.0;
+
+	n = 0;
+	for (i = 0; i < pp->nch; i++)
+		n += (pp->car_weight[i] != 0.0);
+
+	pp->car_norm = n ? 1.0 / n : 0.0;
+}
+
+
+/**
+ * preproc_reset() - clear memory of the filters
+ * @pp:         initialized preprocessing
+ *
+ * The next block is processed as if it was the first one.
+ */
+void preproc_reset(struct preproc* pp)
+{
+	memset(pp->state, 0, 2 * pp->nbiquad * pp->nch * sizeof(*pp->state));
+}
+
+
+/**
+ * preproc_set_impl() - force implementation of the kernels
+ * @pp:         initialized preprocessing
+ * @impl:       implementation to use
+ *
+ * This is meant to compare the speed of the implementations.
+ *
+ * Return: 0 in case of success, -1 if @impl is not supported by the CPU
+ * (errno is then set to ENOTSUP)
+ */
+int preproc_set_impl(struct preproc* pp, enum preproc_impl impl)
+{
+	if (impl < 0 || impl >= PREPROC_NIMPL || !cpu_supports(impl)) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	pp->impl = impl;
+	return 0;
+}
+
+
+/**
+ * preproc_get_impl_name() - get name of a kernel implementation
+ * @impl:       implementation
+ *
+ * Return: name of @impl, NULL if invalid
+ */
+const char* preproc_get_impl_name(enum preproc_impl impl)
+{
+	if (impl < 0 || impl >= PREPROC_NIMPL)
+		return NULL;
+
+	return impl_names[impl];
+}
+
+
+/**
+ * preproc_process() - filter and re-reference a block of samples
+ * @pp:         initialized preprocessing
+ * @ns:         number of samples in @in (at most @pp->ns_max)
+ * @in:         input samples with channels interleaved
+ * @out:        output samples with channels interleaved (can be @in)
+ *
+ * The channels are first re-referenced to their common average if
+ * enabled, then go through the filter cascade. The state of the filters is
+ * kept between calls, so the successive blocks are processed as a
+ * continuous stream.
+ */
+void preproc_process(struct preproc* pp, int ns, const float* in, float* out)
+{
+	switch (pp->impl) {
+	case PREPROC_AVX:
+		process_avx(pp, ns, in, out);
+		break;
+
+	case PREPROC_SSE2:
+		process_sse2(pp, ns, in, out);
+		break;
+
+	default:
+		process_scalar(pp, ns, in, out);
+		break;
+	}
+}
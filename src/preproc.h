@@ -0,0 +1,109 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PREPROC_H
+#define PREPROC_H
+
+// Maximal number of second order sections in the filter cascade
+#define PREPROC_MAX_BIQUAD      8
+
+/**
+ * enum preproc_impl - implementations of the processing kernels
+ * @PREPROC_SCALAR:     portable C implementation
+ * @PREPROC_SSE2:       x86 SSE2 implementation (2×2 channels at once)
+ * @PREPROC_AVX:        x86 AVX implementation (2×4 channels at once)
+ * @PREPROC_NIMPL:      number of implementations
+ */
+enum preproc_impl {
+	PREPROC_SCALAR,
+	PREPROC_SSE2,
+	PREPROC_AVX,
+	PREPROC_NIMPL,
+};
+
+/**
+ * struct preproc_cfg - processing applied to a multichannel signal
+ * @notch:      frequency of the notch filter (0 to disable)
+ * @notch_q:    quality factor of the notch filter
+ * @hp_cutoff:  cutoff frequency of the high-pass filter (0 to disable)
+ * @lp_cutoff:  cutoff frequency of the low-pass filter (0 to disable)
+ * @car:        true to re-reference channels to their common average
+ *
+ * The high-pass and low-pass filters are 4th order Butterworth filters,
+ * together forming a band-pass filter if both are enabled.
+ */
+struct preproc_cfg {
+	double notch;
+	double notch_q;
+	double hp_cutoff;
+	double lp_cutoff;
+	int car;
+};
+
+/**
+ * struct biquad - coefficients of a second order section
+ * @b0, @b1, @b2:       numerator coefficients
+ * @a1, @a2:            denominator coefficients (a0 normalized to 1)
+ *
+ * Filters are computed in double precision: with float, the rounding
+ * errors of a high-pass section of low cutoff grow to a fraction of
+ * microvolt on EEG channels with large DC offsets.
+ */
+struct biquad {
+	double b0, b1, b2;
+	double a1, a2;
+};
+
+/**
+ * struct preproc - filter bank and re-referencing of multichannel signal
+ * @nch:        number of channels
+ * @ns_max:     maximal number of samples processed at once
+ * @nbiquad:    number of second order sections in @biquads
+ * @biquads:    cascade of sections applied to each channel
+ * @state:      2 delay elements of each section, for each channel. The
+ *              delay j of section k of channel ch is at index
+ *              (2*k + j) * @nch + ch, so that channels are contiguous.
+ * @car:        true if channels are re-referenced to their common average
+ * @car_weight: weight of each channel in the average (0 if excluded)
+ * @car_norm:   inverse of the number of channels in the average
+ * @mean:       common average of each sample of the block being processed,
+ *              accumulated and subtracted in double precision: the sum of
+ *              channels with large DC offsets would lose microvolts in
+ *              float
+ * @impl:       implementation of the kernels used
+ */
+struct preproc {
+	int nch;
+	int ns_max;
+	int nbiquad;
+	struct biquad biquads[PREPROC_MAX_BIQUAD];
+	double* state;
+	int car;
+	double* car_weight;
+	double car_norm;
+	double* mean;
+	enum preproc_impl impl;
+};
+
+int preproc_init(struct preproc* pp, int nch, int ns_max, float fs,
+                 const struct preproc_cfg* cfg);
+void preproc_deinit(struct preproc* pp);
+void preproc_exclude_from_average(struct preproc* pp, int ich);
+void preproc_reset(struct preproc* pp);
+int preproc_set_impl(struct preproc* pp, enum preproc_impl impl);
+const char* preproc_get_impl_name(enum preproc_impl impl);
+void preproc_process(struct preproc* pp, int ns, const float* in, float* out);
+
+#endif
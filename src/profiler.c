@@ -0,0 +1,274 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <mmlog.h>
+#include <mmsysio.h>
+#include <mmtime.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "latency-hist.h"
+#include "profiler.h"
+#include "time-utils.h"
+
+/**************************************************************************
+ *                                                                        *
+ *                      Internals of profiler                             *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * struct prof_data - measures of a stage
+ * @mtx:        lock protecting @hist (never contended except during dump)
+ * @hist:       histogram of the durations of the stage
+ *
+ * Each stage is measured by a single thread, hence the lock is only there
+ * to let the dump take a consistent snapshot of the histogram.
+ */
+struct prof_data {
+	pthread_mutex_t mtx;
+	struct lat_hist hist;
+};
+
+static const char* const stage_names[PROF_NSTAGE] = {
+	[PROF_ACQ_GET_DATA] = "acq get data",
+	[PROF_ACQ_EVENTS] = "acq events",
+	[PROF_ACQ_PREPROC] = "acq preproc",
+	[PROF_ACQ_STREAM] = "acq stream",
+	[PROF_ACQ_RECORD] = "acq record",
+	[PROF_ACQ_DISPLAY] = "acq display",
+	[PROF_ACQ_INTERVAL] = "acq interval",
+	[PROF_REC_WRITE] = "rec write",
+	[PROF_REC_EVENT] = "rec event",
+	[PROF_EVT_CLIENT] = "evt client",
+};
+
+static struct prof_data stages[PROF_NSTAGE];
+
+// Timestamp of the last stage boundary crossed by the calling thread
+static _Thread_local int64_t lap_ts;
+
+// Completion time of the previous block (only used by acquisition thread)
+static int64_t last_block_ts;
+
+static int dump_pipe[2] = {-1, -1};
+static pthread_t dump_thid;
+
+
+static
+void add_measure(enum prof_stage stage, int64_t ns)
+{
+	struct prof_data* data = &stages[stage];
+
+	pthread_mutex_lock(&data->mtx);
+	lat_hist_add(&data->hist, ns);
+	pthread_mutex_unlock(&data->mtx);
+}
+
+
+#ifdef SIGUSR1
+static
+void on_dump_signal(int signum)
+{
+	int prev_errno = errno;
+
+	(void)signum;
+
+	// Only async-signal-safe calls here: the dump is done by dump thread
+	mm_write(dump_pipe[1], "d", 1);
+	errno = prev_errno;
+}
+#endif
+
+
+static
+void* dump_thread(void* arg)
+{
+	char cmd;
+
+	(void)arg;
+
+	while (mm_read(dump_pipe[0], &cmd, 1) == 1 && cmd != 'q')
+		prof_dump();
+
+	return NULL;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      API of profiler                                   *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * prof_init() - initialize profiler and install dump on SIGUSR1
+ *
+ * If the dump on signal cannot be set up, the measures are still taken
+ * and can be dumped with prof_dump().
+ */
+void prof_init(void)
+{
+	int i;
+
+	for (i = 0; i < PROF_NSTAGE; i++) {
+		pthread_mutex_init(&stages[i].mtx, NULL);
+		lat_hist_reset(&stages[i].hist);
+	}
+	last_block_ts = 0;
+
+#ifdef SIGUSR1
+	if (mm_pipe(dump_pipe)) {
+		dump_pipe[0] = dump_pipe[1] = -1;
+		mm_log_warn("Cannot set up profile dump on SIGUSR1");
+		return;
+	}
+
+	pthread_create(&dump_thid, NULL, dump_thread, NULL);
+	signal(SIGUSR1, on_dump_signal);
+#endif
+}
+
+
+void prof_deinit(void)
+{
+	int i;
+
+	if (dump_pipe[0] != -1) {
+#ifdef SIGUSR1
+		signal(SIGUSR1, SIG_DFL);
+#endif
+		mm_write(dump_pipe[1], "q", 1);
+		pthread_join(dump_thid, NULL);
+		mm_close(dump_pipe[0]);
+		mm_close(dump_pipe[1]);
+		dump_pipe[0] = dump_pipe[1] = -1;
+	}
+
+	for (i = 0; i < PROF_NSTAGE; i++)
+		pthread_mutex_destroy(&stages[i].mtx);
+}
+
+
+/**
+ * prof_reset() - clear measures of all stages
+ *
+ * This must be called when the acquisition thread is not running.
+ */
+void prof_reset(void)
+{
+	int i;
+
+	for (i = 0; i < PROF_NSTAGE; i++) {
+		pthread_mutex_lock(&stages[i].mtx);
+		lat_hist_reset(&stages[i].hist);
+		pthread_mutex_unlock(&stages[i].mtx);
+	}
+	last_block_ts = 0;
+}
+
+
+/**
+ * prof_dump() - log the measures of all stages
+ *
+ * For each stage measured at least once, the number of measures, the mean,
+ * median, 99th, 99.9th percentiles and maximum are reported. The rate of
+ * blocks processed by the acquisition thread and the longest interval
+ * between 2 blocks (max stall) are reported as well.
+ */
+void prof_dump(void)
+{
+	struct lat_hist hist;
+	double mean;
+	int i;
+
+	for (i = 0; i < PROF_NSTAGE; i++) {
+		pthread_mutex_lock(&stages[i].mtx);
+		memcpy(&hist, &stages[i].hist, sizeof(hist));
+		pthread_mutex_unlock(&stages[i].mtx);
+
+		if (!hist.count)
+			continue;
+
+		if (i == PROF_ACQ_INTERVAL) {
+			mm_log_info("profile: %.1f blocks/s, max stall %.3f ms",
+			            hist.sum ? hist.count / (hist.sum * 1e-9) : 0.0,
+			            hist.max * 1e-6);
+		}
+
+		mean = (double)hist.sum / hist.count;
+		mm_log_info("profile: %-12s n=%llu mean %.1f us, p50 %.1f us, "
+		            "p99 %.1f us, p99.9 %.1f us, max %.1f us",
+		            stage_names[i], (unsigned long long)hist.count,
+		            mean * 1e-3,
+		            lat_hist_percentile(&hist, 50.0) * 1e-3,
+		            lat_hist_percentile(&hist, 99.0) * 1e-3,
+		            lat_hist_percentile(&hist, 99.9) * 1e-3,
+		            hist.max * 1e-3);
+	}
+}
+
+
+/**
+ * prof_start() - mark the beginning of a sequence of stages
+ *
+ * The time of the call is the start of the stage measured by the next call
+ * to prof_lap() in the same thread.
+ */
+void prof_start(void)
+{
+	lap_ts = get_time_ns();
+}
+
+
+/**
+ * prof_lap() - mark the end of a stage
+ * @stage:      stage ending
+ *
+ * The duration since the last call to prof_start() or prof_lap() in the
+ * calling thread is recorded for @stage, and the next stage starts now.
+ * Only one clock reading is required per stage boundary.
+ */
+void prof_lap(enum prof_stage stage)
+{
+	int64_t now = get_time_ns();
+
+	add_measure(stage, now - lap_ts);
+	lap_ts = now;
+}
+
+
+/**
+ * prof_block_done() - mark the completion of a block in acquisition thread
+ *
+ * The interval since the previous completed block is recorded in
+ * %PROF_ACQ_INTERVAL, from which the block rate and max stall are derived.
+ */
+void prof_block_done(void)
+{
+	int64_t now = get_time_ns();
+
+	if (last_block_ts)
+		add_measure(PROF_ACQ_INTERVAL, now - last_block_ts);
+
+	last_block_ts = now;
+}
@@ -0,0 +1,82 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+/**
+ * enum prof_stage - measured stages of the processing threads
+ * @PROF_ACQ_GET_DATA:  reading of a block from the acquisition source
+ * @PROF_ACQ_EVENTS:    retrieval of the events received during the block
+ * @PROF_ACQ_PREPROC:   filtering and re-referencing of the block
+ * @PROF_ACQ_STREAM:    push of the block to the live stream subscribers
+ * @PROF_ACQ_RECORD:    queuing of the block for writing on file
+ * @PROF_ACQ_DISPLAY:   transmission of the block to the panel
+ * @PROF_ACQ_INTERVAL:  time elapsed between 2 completed blocks
+ * @PROF_REC_WRITE:     writing of the samples of a block on file
+ * @PROF_REC_EVENT:     writing of the events of a block on file
+ * @PROF_EVT_CLIENT:    processing of the data received from an event client
+ * @PROF_NSTAGE:        number of stages
+ */
+enum prof_stage {
+	PROF_ACQ_GET_DATA,
+	PROF_ACQ_EVENTS,
+	PROF_ACQ_PREPROC,
+	PROF_ACQ_STREAM,
+	PROF_ACQ_RECORD,
+	PROF_ACQ_DISPLAY,
+	PROF_ACQ_INTERVAL,
+	PROF_REC_WRITE,
+	PROF_REC_EVENT,
+	PROF_EVT_CLIENT,
+	PROF_NSTAGE,
+};
+
+void prof_init(void);
+void prof_deinit(void);
+void prof_reset(void);
+void prof_dump(void);
+void prof_start(void);
+void prof_lap(enum prof_stage stage);
+void prof_block_done(void);
+
+// The instrumentation of the processing threads goes through the following
+// macros, so that it is only compiled in when configured with profiling
+#if ENABLE_PROFILING
+
+#define PROF_INIT()             prof_init()
+#define PROF_DEINIT()           prof_deinit()
+#define PROF_RESET()            prof_reset()
+#define PROF_DUMP()             prof_dump()
+#define PROF_START()            prof_start()
+#define PROF_LAP(stage)         prof_lap(stage)
+#define PROF_BLOCK_DONE()       prof_block_done()
+
+#else /* ENABLE_PROFILING */
+
+// When profiling is compiled out, the instrumentation costs nothing
+#define PROF_INIT()             ((void)0)
+#define PROF_DEINIT()           ((void)0)
+#define PROF_RESET()            ((void)0)
+#define PROF_DUMP()             ((void)0)
+#define PROF_START()            ((void)0)
+#define PROF_LAP(stage)         ((void)0)
+#define PROF_BLOCK_DONE()       ((void)0)
+
+#endif /* ENABLE_PROFILING */
+
+#endif
@@ -0,0 +1,1002 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <mmerrno.h>
+#include <mmlog.h>
+#include <mmsysio.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xdfio.h>
+
+#include "journal.h"
+#include "profiler.h"
+#include "recorder.h"
+#include "spool.h"
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Internals of writer thread                                *
+ *                                                                        *
+ **************************************************************************/
+// Initial capacity of the event type cache (power of 2)
+#define EVTTYPE_CACHE_BITS      6
+#define EVTTYPE_CACHE_SIZE      (1 << EVTTYPE_CACHE_BITS)
+
+// Fibonacci hashing: the top bits of the product depend on all the bits
+// of @code, so codes differing only in their high bits do not collide.
+// @shift is 32 - log2(capacity of the table).
+static
+unsigned int hash_code(uint32_t code, int shift)
+{
+	return (uint32_t)(code * 2654435761u) >> shift;
+}
+
+
+/**
+ * evttype_cache_reset() - forget all cached event types
+ * @rec:        initialized recorder
+ */
+static
+void evttype_cache_reset(struct recorder* rec)
+{
+	int i;
+
+	for (i = 0; i < rec->ncache; i++)
+		rec->cache[i].evttype = -1;
+
+	rec->ncached = 0;
+}
+
+
+/**
+ * evttype_cache_grow() - double capacity of event type cache
+ * @rec:        initialized recorder
+ *
+ * Return: 0 in case of success, -1 if the new table cannot be allocated.
+ * In case of failure, the current table is kept.
+ */
+static
+int evttype_cache_grow(struct recorder* rec)
+{
+	struct evttype_entry* entries;
+	int i, n, ncache, shift;
+	unsigned int h;
+
+	ncache = rec->ncache ? 2*rec->ncache : EVTTYPE_CACHE_SIZE;
+	shift = rec->ncache ? rec->cache_shift - 1 : 32 - EVTTYPE_CACHE_BITS;
+	entries = malloc(ncache * sizeof(*entries));
+	if (!entries)
+		return -1;
+
+	for (i = 0; i < ncache; i++)
+		entries[i].evttype = -1;
+
+	// Rehash the entries of the previous table
+	for (n = 0; n < rec->ncache; n++) {
+		if (rec->cache[n].evttype == -1)
+			continue;
+
+		h = hash_code(rec->cache[n].code, shift);
+		while (entries[h].evttype != -1)
+			h = (h + 1) & (ncache - 1);
+
+		entries[h] = rec->cache[n];
+	}
+
+	free(rec->cache);
+	rec->cache = entries;
+	rec->ncache = ncache;
+	rec->cache_shift = shift;
+	return 0;
+}
+
+
+/**
+ * get_evttype() - get xdf event type associated with event code
+ * @rec:        initialized recorder
+ * @code:       event code
+ *
+ * The event type is looked up in the cache of @rec and registered in the
+ * file with xdf_add_evttype() only the first time @code is met. If the
+ * cache cannot grow, the lookup falls back to xdf_add_evttype().
+ *
+ * Return: the event type in case of success, -1 otherwise
+ */
+static
+int get_evttype(struct recorder* rec, uint32_t code)
+{
+	unsigned int h;
+	int evttype;
+
+	// Keep the load factor below 1/2 to keep probe sequences short
+	if (2*(rec->ncached+1) > rec->ncache && evttype_cache_grow(rec))
+		return xdf_add_evttype(rec->file.xdf, code, NULL);
+
+	h = hash_code(code, rec->cache_shift);
+	while (rec->cache[h].evttype != -1) {
+		if (rec->cache[h].code == code)
+			return rec->cache[h].evttype;
+
+		h = (h + 1) & (rec->ncache - 1);
+	}
+
+	evttype = xdf_add_evttype(rec->file.xdf, code, NULL);
+	if (evttype == -1)
+		return -1;
+
+	rec->cache[h].code = code;
+	rec->cache[h].evttype = evttype;
+	rec->ncached++;
+	return evttype;
+}
+
+
+/**
+ * record_event() - add events to recorded file
+ * @rec:        initialized recorder
+ * @evt_stk:    stack of event to store in file
+ * @diff_idx:   index of acquired sample when recording started
+ * @lo:         first position in the recording of the events to store
+ * @hi:         end of the range of positions of the events to store
+ *
+ * Only the events located in [@lo, @hi[ are stored. Their onset is
+ * expressed relatively to the beginning of the current segment.
+ */
+static
+int record_event(struct recorder* rec, const struct event_stack* evt_stk,
+                 int diff_idx, int64_t lo, int64_t hi)
+{
+	int e, evttype;
+	int64_t pos;
+	double onset;
+
+	if (!rec->record_evt)
+		return 0;
+
+	for (e = 0; e < evt_stk->nevent; e++) {
+		pos = evt_stk->events[e].pos - diff_idx;
+		if (pos < lo || pos >= hi)
+			continue;
+
+		// Spool files are written by chunks, they need no journal
+		if (rec->file.spool) {
+			if (spool_add_event(rec->file.spool,
+			                    evt_stk->events[e].type,
+			                    pos - rec->seg_first,
+			                    evt_stk->durations[e])) {
+				mm_raise_from_errno("spool_add_event() failed");
+				return -1;
+			}
+			continue;
+		}
+
+		// Get XDF event type
+		evttype = get_evttype(rec, evt_stk->events[e].type);
+		if (evttype == -1) {
+			mm_raise_from_errno("xdf_add_evttype() failed");
+			return -1;
+		}
+
+		// Compute onset in floating point (in seconds) since
+		// beginning of segment
+		onset = (pos - rec->seg_first) / rec->fs;
+		if (xdf_add_event(rec->file.xdf, evttype, onset,
+		                  evt_stk->durations[e])) {
+			mm_raise_from_errno("xdf_add_event(..., %d, ...) failed", evttype);
+			return -1;
+		}
+
+		// GDF events are written only at close: keep them in journal
+		journal_add_event(&rec->jnl, evt_stk->events[e].type,
+		                  pos - rec->seg_first, evt_stk->durations[e]);
+	}
+	return 0;
+}
+
+
+static
+int is_segmented(const struct recorder* rec)
+{
+	return rec->path && rec->seg.ns > 0;
+}
+
+
+static
+int is_file_set(const struct rec_file* file)
+{
+	return file->xdf || file->spool;
+}
+
+
+/**
+ * rec_file_close() - close recorded file of any format
+ * @file:       file to close (left unset)
+ * @fs:         sampling frequency, used to report the compression cost
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+static
+int rec_file_close(struct rec_file* file, float fs)
+{
+	struct spool_stats stats;
+	int rv = 0;
+
+	if (file->xdf)
+		rv = xdf_close(file->xdf);
+
+	if (file->spool) {
+		rv = spool_close(file->spool, &stats);
+		if (!rv && stats.size && stats.ns)
+			mm_log_info("Spool compression ratio: %.2f, "
+			            "%.2f CPU ms per second of signal",
+			            (double)stats.raw_size / stats.size,
+			            stats.cpu_ns * 1e-6 * fs / stats.ns);
+	}
+
+	*file = (struct rec_file) {.xdf = NULL};
+	return rv;
+}
+
+
+/**
+ * open_journal() - start journal of current file if checkpoints are enabled
+ * @rec:        initialized recorder
+ * @path:       path of the current file
+ */
+static
+void open_journal(struct recorder* rec, const char* path)
+{
+	rec->last_ckpt = 0;
+	if (!rec->ckpt_ns || !path || !rec->file.xdf)
+		return;
+
+	if (journal_open(&rec->jnl, path, rec->fs))
+		mm_log_warn("Cannot create journal of %s: %s",
+		            path, strerror(errno));
+}
+
+
+/**
+ * close_file() - close current file and its journal
+ * @rec:        initialized recorder
+ *
+ * The journal is removed only if the file has been closed properly.
+ */
+static
+void close_file(struct recorder* rec)
+{
+	int failed;
+
+	if (!is_file_set(&rec->file))
+		return;
+
+	failed = rec_file_close(&rec->file, rec->fs);
+	if (failed)
+		mm_log_error("Cannot close segment %i: %s",
+		             rec->iseg + 1, strerror(errno));
+
+	journal_close(&rec->jnl, !failed);
+}
+
+
+/**
+ * checkpoint() - sync journal and current file if checkpoint period elapsed
+ * @rec:        initialized recorder
+ *
+ * If the sync fails, the journal is dropped since it cannot be trusted
+ * anymore. The recording goes on without checkpoints.
+ */
+static
+void checkpoint(struct recorder* rec)
+{
+	if (rec->jnl.fd < 0 || rec->nwritten - rec->last_ckpt < rec->ckpt_ns)
+		return;
+
+	if (journal_sync(&rec->jnl)) {
+		mm_log_error("Checkpoint failed, recording continues without "
+		             "journal: %s", strerror(errno));
+		journal_close(&rec->jnl, 1);
+		return;
+	}
+
+	rec->last_ckpt = rec->nwritten;
+}
+
+
+/**
+ * get_segment_path() - get path of the file of a segment
+ * @rec:        initialized recorder
+ * @iseg:       index of the segment
+ * @path:       buffer receiving the path
+ * @len:        size of @path
+ *
+ * The first segment is written in the file set with recorder_set_file().
+ * The following ones are named after it with the segment number appended
+ * to its basename: rec.gdf, rec-002.gdf, rec-003.gdf...
+ */
+static
+void get_segment_path(const struct recorder* rec, int iseg,
+                      char* path, size_t len)
+{
+	const char *ext, *sep;
+	int stemlen;
+
+	ext = strrchr(rec->path, '.');
+	sep = strrchr(rec->path, '/');
+	if (!ext || ext == rec->path || (sep && ext < sep))
+		ext = rec->path + strlen(rec->path);
+
+	stemlen = ext - rec->path;
+	if (iseg == 0)
+		snprintf(path, len, "%s", rec->path);
+	else
+		snprintf(path, len, "%.*s-%03i%s",
+		         stemlen, rec->path, iseg + 1, ext);
+}
+
+
+/**
+ * open_next_segment() - create file of the segment following current one
+ * @rec:        initialized recorder with segmentation enabled
+ * @file:       pointer receiving the file ready for transfer
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int open_next_segment(struct recorder* rec, struct rec_file* file)
+{
+	char path[1024];
+
+	get_segment_path(rec, rec->iseg + 1, path, sizeof(path));
+	if (rec->seg.open(file, path, rec->iseg + 1,
+	                  rec->seg_first + rec->seg.ns, rec->seg.data)) {
+		mm_log_warn("Cannot create segment %s: %s",
+		            path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * prepare_next_segment() - create file of next segment in advance
+ * @rec:        initialized recorder
+ *
+ * This is done by the writer thread while the current segment is being
+ * written, so that switching to the next segment is only a matter of
+ * closing the current file. If the preparation fails, it is retried only
+ * when the switch occurs.
+ */
+static
+void prepare_next_segment(struct recorder* rec)
+{
+	if (!is_segmented(rec) || is_file_set(&rec->next) || rec->next_failed)
+		return;
+
+	if (open_next_segment(rec, &rec->next))
+		rec->next_failed = 1;
+}
+
+
+/**
+ * switch_segment() - continue recording in the file of the next segment
+ * @rec:        initialized recorder whose current segment is full
+ *
+ * Return: 0 in case of success, -1 otherwise with error state of @rec set
+ */
+static
+int switch_segment(struct recorder* rec)
+{
+	char path[1024];
+
+	if (!is_file_set(&rec->next) && open_next_segment(rec, &rec->next)) {
+		atomic_store(&rec->error, errno);
+		return -1;
+	}
+
+	close_file(rec);
+
+	rec->file = rec->next;
+	rec->next = (struct rec_file) {.xdf = NULL};
+	rec->next_failed = 0;
+	rec->iseg++;
+	rec->seg_first += rec->nwritten;
+	rec->nwritten = 0;
+
+	// Event types are registered per file
+	evttype_cache_reset(rec);
+
+	get_segment_path(rec, rec->iseg, path, sizeof(path));
+	open_journal(rec, path);
+	mm_log_info("Recording continues in %s", path);
+	return 0;
+}
+
+
+/**
+ * close_segments() - close current file and discard prepared segment
+ * @rec:        initialized recorder
+ */
+static
+void close_segments(struct recorder* rec)
+{
+	char path[1024];
+
+	if (is_file_set(&rec->next)) {
+		rec_file_close(&rec->next, rec->fs);
+
+		// The prepared segment has never been used
+		get_segment_path(rec, rec->iseg + 1, path, sizeof(path));
+		mm_unlink(path);
+	}
+
+	close_file(rec);
+	free(rec->path);
+	rec->path = NULL;
+}
+
+
+/**
+ * write_samples() - write part of a block in current file
+ * @rec:        initialized recorder
+ * @blk:        block holding the samples
+ * @start:      index in @blk of the first sample to write
+ * @ns:         number of samples to write
+ *
+ * Return: 0 in case of success, -1 otherwise with error state of @rec set
+ */
+static
+int write_samples(struct recorder* rec, const struct sample_block* blk,
+                  int start, int ns)
+{
+	const size_t* strides = rec->seg.strides;
+	const struct sample_conv* conv;
+	const char* data[3];
+	int i, rv;
+
+	if (ns == 0)
+		return 0;
+
+	for (i = 0; i < 3; i++)
+		data[i] = (const char*)blk->data[i] + start*strides[i];
+
+	if (rec->file.spool) {
+		rv = spool_write(rec->file.spool, ns, data[0], data[1], data[2]);
+	} else {
+		// Convert float arrays here rather than letting xdffileio
+		// do it sample by sample
+		for (i = 0; i < 3; i++) {
+			conv = rec->seg.conv[i];
+			if (!conv)
+				continue;
+
+			sample_conv_run(conv, ns, (const float*)data[i],
+			                strides[i], rec->conv_buf[i],
+			                conv->nch * conv->width);
+			data[i] = rec->conv_buf[i];
+		}
+
+		rv = xdf_write(rec->file.xdf, ns, data[0], data[1], data[2]);
+	}
+
+	if (rv < 0) {
+		atomic_store(&rec->error, errno);
+		return -1;
+	}
+
+	rec->nwritten += ns;
+	return 0;
+}
+
+
+/**
+ * recorder_write_block() - write a queued block in file
+ * @rec:        initialized recorder
+ * @entry:      queued block to write
+ *
+ * If the current segment gets full, the block is split: the samples that
+ * do not fit are written in the next segment, and so are the events
+ * located after the split. Once a failure has been reported, the
+ * subsequent blocks are discarded until a new file is set with
+ * recorder_set_file(). In any case, the reference of the block is released.
+ */
+static
+void recorder_write_block(struct recorder* rec, const struct rec_entry* entry)
+{
+	struct sample_block* blk = entry->blk;
+	int ns, done;
+	int64_t lo;
+
+	if (atomic_load(&rec->error))
+		goto exit;
+
+	lo = INT64_MIN;
+	done = 0;
+	PROF_START();
+	while (1) {
+		ns = entry->ns - done;
+		if (is_segmented(rec) && ns > rec->seg.ns - rec->nwritten)
+			ns = rec->seg.ns - rec->nwritten;
+
+		if (write_samples(rec, blk, done, ns))
+			goto exit;
+		PROF_LAP(PROF_REC_WRITE);
+
+		done += ns;
+		if (done == entry->ns)
+			break;
+
+		// Current segment is full: store its events before switching
+		record_event(rec, &blk->evt, entry->rec_start,
+		             lo, rec->seg_first + rec->nwritten);
+		PROF_LAP(PROF_REC_EVENT);
+		lo = rec->seg_first + rec->nwritten;
+		if (switch_segment(rec))
+			goto exit;
+		PROF_START();
+	}
+
+	record_event(rec, &blk->evt, entry->rec_start, lo, INT64_MAX);
+	PROF_LAP(PROF_REC_EVENT);
+	checkpoint(rec);
+	prepare_next_segment(rec);
+
+exit:
+	sample_block_unref(blk);
+}
+
+
+static
+void* writer_thread(void* arg)
+{
+	struct recorder* rec = arg;
+	unsigned int tail, head;
+
+	tail = atomic_load_explicit(&rec->tail, memory_order_relaxed);
+
+	pthread_mutex_lock(&rec->mtx);
+	while (1) {
+		head = atomic_load_explicit(&rec->head, memory_order_acquire);
+		if (head == tail) {
+			if (rec->quit)
+				break;
+
+			pthread_cond_wait(&rec->data_cond, &rec->mtx);
+			continue;
+		}
+		pthread_mutex_unlock(&rec->mtx);
+
+		// Write all pending blocks without holding the lock, so that
+		// the acquisition thread is never delayed by file I/O
+		for (; tail != head; tail++) {
+			recorder_write_block(rec, &rec->ring[tail % rec->nblock]);
+			atomic_store_explicit(&rec->tail, tail + 1,
+			                      memory_order_release);
+		}
+
+		pthread_mutex_lock(&rec->mtx);
+		pthread_cond_broadcast(&rec->drain_cond);
+	}
+	pthread_mutex_unlock(&rec->mtx);
+
+	return NULL;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                       API of recorder                                  *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * recorder_init() - allocate ring of blocks and start writer thread
+ * @rec:        recorder to initialize
+ * @fs:         sampling frequency of acquisition
+ * @ns_max:     maximal number of samples that will be pushed at once
+ * @duration:   amount of signal (in seconds) that can be buffered
+ * @history:    amount of signal (in seconds) kept while not recording, to
+ *              be written at the beginning of the next recording
+ *
+ * The number of blocks that can be queued is stored in @rec->nblock and
+ * the number of blocks kept in history in @rec->nhist. The pool providing
+ * the blocks must be able to supply at least that many blocks in addition
+ * to the ones used by the other consumers.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ */
+int recorder_init(struct recorder* rec, float fs, int ns_max, float duration,
+                  float history)
+{
+	int nblock, nhist;
+
+	// Keep an extra block so that the history spans at least the
+	// requested duration whatever the alignment of blocks
+	nhist = 0;
+	if (history > 0)
+		nhist = ((int)(history * fs) + ns_max - 1) / ns_max + 1;
+
+	// The ring must be able to receive the whole history at once
+	nblock = ((int)(duration * fs) + ns_max - 1) / ns_max + nhist;
+	if (nblock < 2)
+		nblock = 2;
+
+	*rec = (struct recorder) {
+		.fs = fs,
+		.ns_max = ns_max,
+		.nblock = nblock,
+		.nhist = nhist,
+		.jnl = JOURNAL_INITIALIZER,
+	};
+
+	rec->ring = calloc(nblock, sizeof(*rec->ring));
+	rec->hist = calloc(nhist + 1, sizeof(*rec->hist));
+	if (!rec->ring || !rec->hist) {
+		free(rec->ring);
+		free(rec->hist);
+		rec->ring = NULL;
+		rec->hist = NULL;
+		return mm_raise_from_errno("cannot allocate recording buffer");
+	}
+
+	pthread_mutex_init(&rec->mtx, NULL);
+	pthread_cond_init(&rec->data_cond, NULL);
+	pthread_cond_init(&rec->drain_cond, NULL);
+	if (pthread_create(&rec->thread, NULL, writer_thread, rec)) {
+		mm_raise_error(errno, "cannot create writer thread");
+		pthread_cond_destroy(&rec->drain_cond);
+		pthread_cond_destroy(&rec->data_cond);
+		pthread_mutex_destroy(&rec->mtx);
+		free(rec->ring);
+		free(rec->hist);
+		rec->ring = NULL;
+		rec->hist = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * recorder_deinit() - stop writer thread and free resources
+ * @rec:        initialized recorder
+ *
+ * Pending blocks are written before the writer thread exits.
+ */
+void recorder_deinit(struct recorder* rec)
+{
+	int i;
+
+	if (!rec->ring)
+		return;
+
+	pthread_mutex_lock(&rec->mtx);
+	rec->quit = 1;
+	pthread_cond_signal(&rec->data_cond);
+	pthread_mutex_unlock(&rec->mtx);
+
+	pthread_join(rec->thread, NULL);
+	pthread_cond_destroy(&rec->drain_cond);
+	pthread_cond_destroy(&rec->data_cond);
+	pthread_mutex_destroy(&rec->mtx);
+
+	close_segments(rec);
+	recorder_clear_history(rec);
+	free(rec->hist);
+	rec->hist = NULL;
+	free(rec->ring);
+	rec->ring = NULL;
+	free(rec->cache);
+	rec->cache = NULL;
+	rec->ncache = 0;
+	for (i = 0; i < 3; i++) {
+		free(rec->conv_buf[i]);
+		rec->conv_buf[i] = NULL;
+	}
+}
+
+
+/**
+ * recorder_set_segmentation() - configure segmented recording
+ * @rec:        initialized recorder
+ * @cfg:        configuration of segments (@cfg->ns = 0 to disable)
+ *
+ * When enabled, the recording is split in files of @cfg->ns samples each.
+ * The file of the next segment is created in advance by the writer thread
+ * so that the switch happens between two samples without delaying the
+ * writing. This takes effect at the next call to recorder_set_file().
+ *
+ * The conversions referenced in @cfg must remain valid as long as files
+ * are recorded with this configuration.
+ *
+ * Return: 0 in case of success, -1 if the buffers of conversion cannot be
+ * allocated (the configuration is then left unchanged)
+ */
+int recorder_set_segmentation(struct recorder* rec,
+                              const struct rec_segment_cfg* cfg)
+{
+	const struct sample_conv* conv;
+	void* buf[3] = {NULL, NULL, NULL};
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		conv = cfg->conv[i];
+		if (!conv)
+			continue;
+
+		buf[i] = malloc((size_t)rec->ns_max * conv->nch * conv->width
+		                + 1);
+		if (!buf[i])
+			goto error;
+	}
+
+	for (i = 0; i < 3; i++) {
+		free(rec->conv_buf[i]);
+		rec->conv_buf[i] = buf[i];
+	}
+
+	rec->seg = *cfg;
+	return 0;
+
+error:
+	for (i = 0; i < 3; i++)
+		free(buf[i]);
+
+	return mm_raise_from_errno("cannot allocate conversion buffers");
+}
+
+
+/**
+ * recorder_set_checkpoint() - configure periodic checkpoints of recording
+ * @rec:        initialized recorder
+ * @period:     amount of recorded signal (in seconds) between two
+ *              checkpoints, 0 to disable checkpoints
+ *
+ * When enabled, a journal of the events is kept along each recorded file,
+ * and both are synced on disk every @period seconds of signal, from the
+ * writer thread. The journal allows to repair the file with eegview-recover
+ * if the recording is interrupted: the journaled events are restored, along
+ * with the samples found in the file. Spool files are not journaled since they
+ * stay readable up to their last complete chunk. This takes effect at the
+ * next call to recorder_set_file().
+ */
+void recorder_set_checkpoint(struct recorder* rec, float period)
+{
+	rec->ckpt_ns = (period > 0) ? (int64_t)(period * rec->fs) : 0;
+	if (period > 0 && rec->ckpt_ns < 1)
+		rec->ckpt_ns = 1;
+}
+
+
+/**
+ * recorder_set_file() - set file in which subsequent blocks are written
+ * @rec:        initialized recorder
+ * @file:       file opened for writing (NULL to only close the current one)
+ * @path:       path of @file, used to name the next segments (can be NULL)
+ * @record_evt: true if software events must be recorded in @file
+ *
+ * The recorder takes the ownership of @file: the file previously set as
+ * well as all the segments created by the recorder are closed. If
+ * segmentation is enabled and @path is not NULL, @file is the first
+ * segment. Likewise @path is needed for checkpoints of BDF/GDF files.
+ *
+ * This resets the error state, the high-water mark and the event type cache
+ * of @rec. This must be called when no block is pending, ie, after
+ * recorder_flush().
+ */
+void recorder_set_file(struct recorder* rec, const struct rec_file* file,
+                       const char* path, int record_evt)
+{
+	close_segments(rec);
+
+	if (file)
+		rec->file = *file;
+
+	rec->record_evt = record_evt;
+	rec->iseg = 0;
+	rec->seg_first = 0;
+	rec->nwritten = 0;
+	rec->next_failed = 0;
+	if (file && path) {
+		rec->path = strdup(path);
+		if (!rec->path)
+			mm_log_warn("Recording cannot be segmented nor journaled");
+	}
+
+	if (file)
+		open_journal(rec, rec->path);
+
+	evttype_cache_reset(rec);
+	rec->highwater = 0;
+	atomic_store(&rec->error, 0);
+}
+
+
+/**
+ * recorder_push() - queue block of data for writing in file
+ * @rec:        initialized recorder
+ * @blk:        block of acquired data
+ * @ns:         number of samples of @blk to write (at most @blk->ns)
+ * @rec_start:  index of acquired sample when recording started
+ *
+ * On success, the recorder holds a reference on @blk until it is written.
+ * This function never blocks: if the ring is full, the writer thread is not
+ * keeping up and the error state of @rec is set to ENOBUFS.
+ *
+ * Return: 0 in case of success, -1 if the ring is full.
+ */
+int recorder_push(struct recorder* rec, struct sample_block* blk,
+                  int ns, int rec_start)
+{
+	struct rec_entry* entry;
+	unsigned int head, tail;
+	int npending;
+
+	head = atomic_load_explicit(&rec->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&rec->tail, memory_order_acquire);
+	npending = head - tail;
+	if (npending >= rec->nblock) {
+		atomic_store(&rec->error, ENOBUFS);
+		return -1;
+	}
+
+	// Fill the next free entry of the ring
+	sample_block_ref(blk);
+	entry = &rec->ring[head % rec->nblock];
+	entry->blk = blk;
+	entry->ns = ns;
+	entry->rec_start = rec_start;
+
+	atomic_store_explicit(&rec->head, head + 1, memory_order_release);
+	if (npending + 1 > rec->highwater)
+		rec->highwater = npending + 1;
+
+	pthread_mutex_lock(&rec->mtx);
+	pthread_cond_signal(&rec->data_cond);
+	pthread_mutex_unlock(&rec->mtx);
+
+	return 0;
+}
+
+
+/**
+ * recorder_flush() - wait for all queued blocks to be written
+ * @rec:        initialized recorder
+ */
+void recorder_flush(struct recorder* rec)
+{
+	pthread_mutex_lock(&rec->mtx);
+	while (atomic_load(&rec->tail) != atomic_load(&rec->head))
+		pthread_cond_wait(&rec->drain_cond, &rec->mtx);
+	pthread_mutex_unlock(&rec->mtx);
+}
+
+
+/**
+ * recorder_get_error() - get error state of recorder
+ * @rec:        initialized recorder
+ *
+ * Return: 0 if no error occurred since last call to recorder_set_file(),
+ * errno value of the failure otherwise.
+ */
+int recorder_get_error(struct recorder* rec)
+{
+	return atomic_load(&rec->error);
+}
+
+
+/**
+ * recorder_get_highwater() - get high-water mark of the ring
+ * @rec:        initialized recorder
+ *
+ * This must not be called concurrently with recorder_push().
+ *
+ * Return: the maximal number of blocks that have been pending in the ring
+ * since last call to recorder_set_file().
+ */
+int recorder_get_highwater(const struct recorder* rec)
+{
+	return rec->highwater;
+}
+
+
+/**
+ * recorder_keep_history() - keep acquired block in history
+ * @rec:        initialized recorder
+ * @blk:        block of acquired data not being recorded
+ *
+ * This must be called by the acquisition thread with every block acquired
+ * while not recording, so that the history holds the last contiguous
+ * samples. The oldest block is released when the history is full. Nothing
+ * is done if @rec has been initialized without history.
+ */
+void recorder_keep_history(struct recorder* rec, struct sample_block* blk)
+{
+	struct sample_block* oldest;
+	int last;
+
+	if (!rec->nhist)
+		return;
+
+	if (rec->hist_len == rec->nhist) {
+		oldest = rec->hist[rec->hist_first];
+		rec->hist_ns -= oldest->ns;
+		sample_block_unref(oldest);
+		rec->hist_first = (rec->hist_first + 1) % rec->nhist;
+		rec->hist_len--;
+	}
+
+	sample_block_ref(blk);
+	last = (rec->hist_first + rec->hist_len) % rec->nhist;
+	rec->hist[last] = blk;
+	rec->hist_len++;
+	rec->hist_ns += blk->ns;
+}
+
+
+/**
+ * recorder_push_history() - queue history for writing in file
+ * @rec:        initialized recorder
+ * @ns_read:    number of samples acquired so far
+ *
+ * This is called by the acquisition thread when a recording starts, so
+ * that the file begins with the samples acquired just before. The history
+ * is emptied.
+ *
+ * Return: the index of the first acquired sample queued, ie, the index at
+ * which the recording starts (@ns_read if the history is empty).
+ */
+int recorder_push_history(struct recorder* rec, int ns_read)
+{
+	struct sample_block* blk;
+	int i, rec_start;
+
+	rec_start = ns_read - rec->hist_ns;
+	for (i = 0; i < rec->hist_len; i++) {
+		blk = rec->hist[(rec->hist_first + i) % rec->nhist];
+		recorder_push(rec, blk, blk->ns, rec_start);
+	}
+
+	recorder_clear_history(rec);
+	return rec_start;
+}
+
+
+/**
+ * recorder_clear_history() - release blocks kept in history
+ * @rec:        initialized recorder
+ */
+void recorder_clear_history(struct recorder* rec)
+{
+	int i;
+
+	for (i = 0; i < rec->hist_len; i++)
+		sample_block_unref(rec->hist[(rec->hist_first + i) % rec->nhist]);
+
+	rec->hist_len = 0;
+	rec->hist_first = 0;
+	rec->hist_ns = 0;
+}
@@ -0,0 +1,189 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <xdfio.h>
+
+#include "block-pool.h"
+#include "journal.h"
+#include "sample-conv.h"
+#include "spool.h"
+
+/**
+ * struct rec_entry - block of data queued for writing in file
+ * @blk:        sample block referenced by the recorder
+ * @ns:         number of samples of @blk to write
+ * @rec_start:  index of acquired sample when recording started
+ */
+struct rec_entry {
+	struct sample_block* blk;
+	int ns;
+	int rec_start;
+};
+
+/**
+ * struct evttype_entry - element of event type cache
+ * @code:       event code
+ * @evttype:    xdf event type associated with @code, -1 if entry is unused
+ */
+struct evttype_entry {
+	uint32_t code;
+	int evttype;
+};
+
+/**
+ * struct rec_file - file in which samples are recorded
+ * @xdf:        BDF/GDF file ready for transfer (NULL if @spool is used)
+ * @spool:      compressed spool file (NULL if @xdf is used)
+ */
+struct rec_file {
+	struct xdf* xdf;
+	struct spool* spool;
+};
+
+/**
+ * typedef recorder_open_fn - create file of a recording segment
+ * @file:       pointer receiving the created file
+ * @path:       path of the file to create
+ * @iseg:       index of the segment (0 for the first one)
+ * @first:      index in the recording of the first sample of the segment
+ * @data:       pointer set in struct rec_segment_cfg
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+typedef int (*recorder_open_fn)(struct rec_file* file, const char* path,
+                                int iseg, int64_t first, void* data);
+
+/**
+ * struct rec_segment_cfg - configuration of segmented recording
+ * @ns:         number of samples per segment (0 to disable segmentation)
+ * @strides:    size of one sample in each array of the blocks
+ * @conv:       conversion of the float arrays into packed integers before
+ *              being written in BDF/GDF files (NULL to write an array as
+ *              it is acquired). Spool files are never converted.
+ * @open:       function creating the file of a segment
+ * @data:       pointer passed to @open
+ */
+struct rec_segment_cfg {
+	int64_t ns;
+	size_t strides[3];
+	const struct sample_conv* conv[3];
+	recorder_open_fn open;
+	void* data;
+};
+
+/**
+ * struct recorder - writer thread fed by the acquisition thread
+ * @thread:     file writing thread
+ * @mtx:        mutex used only to sleep/wake up on @data_cond and @drain_cond
+ * @data_cond:  signaled when a block has been queued or when quitting
+ * @drain_cond: signaled when the writer thread has consumed blocks
+ * @file:       file in which the blocks are written
+ * @fs:         sampling frequency of acquisition
+ * @ns_max:     maximal number of samples pushed at once
+ * @record_evt: true if software events must be written in @file
+ * @seg:        configuration of segmented recording
+ * @conv_buf:   buffers receiving the arrays converted by @seg.conv
+ * @path:       path of the first file (NULL if unknown)
+ * @iseg:       index of the segment being written in @file
+ * @seg_first:  index in the recording of the first sample of @file
+ * @nwritten:   number of samples written in @file
+ * @next:       file of the next segment prepared in advance (can be unset)
+ * @next_failed: true if the preparation of @next has failed
+ * @ckpt_ns:    number of samples between checkpoints (0 if disabled)
+ * @last_ckpt:  value of @nwritten at last checkpoint
+ * @jnl:        journal of @file (closed if checkpoints are disabled or if
+ *              @file is a spool file)
+ * @ncache:     capacity of @cache (power of 2, 0 if not allocated)
+ * @cache_shift: 32 - log2(@ncache), shift of the hash of event codes
+ * @ncached:    number of used entries in @cache
+ * @cache:      hash table associating event codes to xdf event types of
+ *              @file (open addressing with linear probing)
+ * @nblock:     capacity of the ring of blocks
+ * @ring:       ring of queued blocks
+ * @head:       number of blocks pushed so far (written only by producer)
+ * @tail:       number of blocks written so far (written only by writer)
+ * @error:      errno value of the first failure, 0 if none
+ * @highwater:  maximal number of blocks observed pending in the ring
+ * @quit:       true if the writer thread has been requested to exit
+ * @nhist:      capacity of @hist (0 if no history is kept)
+ * @hist_len:   number of blocks in @hist
+ * @hist_first: index in @hist of the oldest block
+ * @hist_ns:    number of samples in @hist
+ * @hist:       last blocks acquired while not recording (acquisition
+ *              thread only)
+ */
+struct recorder {
+	pthread_t thread;
+	pthread_mutex_t mtx;
+	pthread_cond_t data_cond;
+	pthread_cond_t drain_cond;
+	struct rec_file file;
+	float fs;
+	int ns_max;
+	int record_evt;
+	struct rec_segment_cfg seg;
+	void* conv_buf[3];
+	char* path;
+	int iseg;
+	int64_t seg_first;
+	int64_t nwritten;
+	struct rec_file next;
+	int next_failed;
+	int64_t ckpt_ns;
+	int64_t last_ckpt;
+	struct journal jnl;
+	int ncache;
+	int cache_shift;
+	int ncached;
+	struct evttype_entry* cache;
+	int nblock;
+	struct rec_entry* ring;
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_int error;
+	int highwater;
+	int quit;
+	int nhist;
+	int hist_len;
+	int hist_first;
+	int hist_ns;
+	struct sample_block** hist;
+};
+
+int recorder_init(struct recorder* rec, float fs, int ns_max, float duration,
+                  float history);
+void recorder_deinit(struct recorder* rec);
+int recorder_set_segmentation(struct recorder* rec,
+                              const struct rec_segment_cfg* cfg);
+void recorder_set_checkpoint(struct recorder* rec, float period);
+void recorder_set_file(struct recorder* rec, const struct rec_file* file,
+                       const char* path, int record_evt);
+int recorder_push(struct recorder* rec, struct sample_block* blk,
+                  int ns, int rec_start);
+void recorder_flush(struct recorder* rec);
+void recorder_keep_history(struct recorder* rec, struct sample_block* blk);
+int recorder_push_history(struct recorder* rec, int ns_read);
+void recorder_clear_history(struct recorder* rec);
+int recorder_get_error(struct recorder* rec);
+int recorder_get_highwater(const struct recorder* rec);
+
+#endif
@@ -0,0 +1,960 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <eegdev.h>
+#include <errno.h>
+#include <math.h>
+#include <mmlib.h>
+#include <mmlog.h>
+#include <mmsysio.h>
+#include <mmtime.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "replay.h"
+
+#define FIXED_HDR_SIZE  256
+#define NSTYPE          3
+
+// Pseudo GDF type of BDF samples (int24)
+#define BDF_TYPE        279
+
+/**
+ * struct replay_channel - channel of replayed file
+ * @stype:      sensor type to which the channel is assigned
+ * @type:       GDF data type of the samples
+ * @size:       size in bytes of a sample
+ * @offset:     offset of the samples of the channel in a record
+ * @scale:      factor converting digital values into physical values
+ * @phys_offset: physical value of the digital value 0
+ * @info:       properties of the channel
+ */
+struct replay_channel {
+	int stype;
+	int type;
+	int size;
+	int64_t offset;
+	double scale;
+	double phys_offset;
+	struct acq_chinfo info;
+};
+
+/**
+ * struct replay_event - event of the GDF event table
+ * @pos:        position in samples (0-based)
+ * @code:       event code
+ * @duration:   duration in seconds
+ */
+struct replay_event {
+	int64_t pos;
+	uint32_t code;
+	float duration;
+};
+
+/**
+ * struct replay - acquisition source reading a BDF or GDF file
+ * @src:        acquisition source interface
+ * @path:       path of the replayed file
+ * @map:        mapping of the whole file
+ * @size:       size of the file
+ * @nch:        number of channels in the file
+ * @channels:   channels of the file
+ * @nch_stype:  number of channels assigned to each sensor type
+ * @chmap:      indices in @channels of the channels of each sensor type
+ * @hdrlen:     size of the header
+ * @recsize:    size of a data record
+ * @spr:        number of samples per record
+ * @ns:         number of samples in the file
+ * @fs:         sampling frequency
+ * @speed:      replay speed relative to real time (0 for no pacing)
+ * @nevent:     number of events in @events
+ * @events:     events of the file sorted by position
+ * @next_event: index in @events of the next event to re-emit
+ * @trk:        event tracker receiving the events (can be NULL)
+ * @ngrp:       number of groups in @grp
+ * @grp:        groups of channels setup for acquisition
+ * @strides:    size of one sample in each acquisition array
+ * @tmp:        buffer of digital values of a channel in a record
+ * @pos:        index of the next sample to deliver
+ * @start:      time at which the acquisition started
+ */
+struct replay {
+	struct acq_source src;
+	char* path;
+	void* map;
+	size_t size;
+	int nch;
+	struct replay_channel* channels;
+	int nch_stype[NSTYPE];
+	int* chmap[NSTYPE];
+	int64_t hdrlen;
+	int64_t recsize;
+	int spr;
+	int64_t ns;
+	int fs;
+	double speed;
+	int nevent;
+	struct replay_event* events;
+	int next_event;
+	struct event_tracker* trk;
+	unsigned int ngrp;
+	struct grpconf* grp;
+	size_t strides[3];
+	double* tmp;
+	int64_t pos;
+	struct mm_timespec start;
+};
+
+#define get_replay(src) ((struct replay*)(src))
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      Header parsing                                    *
+ *                                                                        *
+ **************************************************************************/
+static
+uint64_t get_le(const unsigned char* buf, int len)
+{
+	uint64_t val = 0;
+	int i;
+
+	for (i = len-1; i >= 0; i--)
+		val = (val << 8) | buf[i];
+
+	return val;
+}
+
+
+static
+double get_le_double(const unsigned char* buf)
+{
+	uint64_t bits = get_le(buf, 8);
+	double val;
+
+	memcpy(&val, &bits, sizeof(val));
+	return val;
+}
+
+
+// Copy a space padded field of header into a null terminated string
+static
+void get_str(char* str, size_t maxlen, const unsigned char* buf, int len)
+{
+	if ((size_t)len > maxlen - 1)
+		len = maxlen - 1;
+
+	memcpy(str, buf, len);
+	while (len > 0 && (str[len-1] == ' ' || str[len-1] == '\0'))
+		len--;
+
+	str[len] = '\0';
+}
+
+
+// Parse a number in an ASCII field of BDF header
+static
+double get_ascii(const unsigned char* buf, int len)
+{
+	char str[32];
+
+	memcpy(str, buf, len);
+	str[len] = '\0';
+	return strtod(str, NULL);
+}
+
+
+// Size in bytes of a GDF data type, 0 if unsupported
+static
+int gdf_type_size(uint32_t type)
+{
+	switch (type) {
+	case 1: case 2: return 1;               // int8, uint8
+	case 3: case 4: return 2;               // int16, uint16
+	case 5: case 6: case 16: return 4;      // int32, uint32, float32
+	case 7: case 8: case 17: return 8;      // int64, uint64, float64
+	case 279: case 535: return 3;           // int24, uint24
+	default: return 0;
+	}
+}
+
+
+static
+int gdf_type_isint(uint32_t type)
+{
+	return (type != 16 && type != 17);
+}
+
+
+/**
+ * assign_sensor_type() - choose the sensor type of a replayed channel
+ * @ch:         channel whose properties are set
+ *
+ * Files do not keep the sensor type of their channels: channels labelled
+ * as status or trigger are triggers, those not measuring a voltage are
+ * sensors and the remaining ones are EEG.
+ */
+static
+void assign_sensor_type(struct replay_channel* ch)
+{
+	const char* label = ch->info.label;
+	size_t len = strlen(ch->info.unit);
+
+	if (!strncasecmp(label, "status", 6) || !strncasecmp(label, "trig", 4))
+		ch->stype = EGD_TRIGGER;
+	else if (len == 0 || ch->info.unit[len-1] != 'V')
+		ch->stype = EGD_SENSOR;
+	else
+		ch->stype = EGD_EEG;
+}
+
+
+static
+void set_channel_scaling(struct replay_channel* ch,
+                         double dmin, double dmax)
+{
+	double pmin = ch->info.mm[0];
+	double pmax = ch->info.mm[1];
+
+	if (dmax == dmin || pmax == pmin) {
+		ch->scale = 1.0;
+		ch->phys_offset = 0.0;
+	} else {
+		ch->scale = (pmax - pmin) / (dmax - dmin);
+		ch->phys_offset = pmin - dmin * ch->scale;
+	}
+
+	// Channels whose values are not scaled can be replayed as integer
+	ch->info.isint = gdf_type_isint(ch->type)
+	                 && ch->scale == 1.0 && ch->phys_offset == 0.0;
+}
+
+
+/**
+ * parse_channels() - get properties of channels from header
+ * @rp:         replay whose @map, @nch and @channels are set
+ * @is_gdf:     true for a GDF file, false for a BDF file
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+static
+int parse_channels(struct replay* rp, int is_gdf)
+{
+	const unsigned char* h = (const unsigned char*)rp->map + FIXED_HDR_SIZE;
+	struct replay_channel* ch;
+	int i, n = rp->nch, spr;
+	double dmin, dmax;
+
+	rp->recsize = 0;
+	rp->spr = 0;
+	for (i = 0; i < n; i++) {
+		ch = &rp->channels[i];
+		get_str(ch->info.label, sizeof(ch->info.label), h + 16*i, 16);
+		get_str(ch->info.transducter, sizeof(ch->info.transducter),
+		        h + 16*n + 80*i, 80);
+		if (is_gdf) {
+			get_str(ch->info.unit, sizeof(ch->info.unit),
+			        h + 96*n + 6*i, 6);
+			ch->info.mm[0] = get_le_double(h + 104*n + 8*i);
+			ch->info.mm[1] = get_le_double(h + 112*n + 8*i);
+			dmin = get_le_double(h + 120*n + 8*i);
+			dmax = get_le_double(h + 128*n + 8*i);
+			get_str(ch->info.filtering, sizeof(ch->info.filtering),
+			        h + 136*n + 68*i, 68);
+			spr = get_le(h + 216*n + 4*i, 4);
+			ch->type = get_le(h + 220*n + 4*i, 4);
+		} else {
+			get_str(ch->info.unit, sizeof(ch->info.unit),
+			        h + 96*n + 8*i, 8);
+			ch->info.mm[0] = get_ascii(h + 104*n + 8*i, 8);
+			ch->info.mm[1] = get_ascii(h + 112*n + 8*i, 8);
+			dmin = get_ascii(h + 120*n + 8*i, 8);
+			dmax = get_ascii(h + 128*n + 8*i, 8);
+			get_str(ch->info.filtering, sizeof(ch->info.filtering),
+			        h + 136*n + 80*i, 80);
+			spr = get_ascii(h + 216*n + 8*i, 8);
+			ch->type = BDF_TYPE;
+		}
+
+		ch->size = gdf_type_size(ch->type);
+		if (ch->size == 0 || spr <= 0) {
+			mm_log_error("%s: unsupported channel %s",
+			             rp->path, ch->info.label);
+			errno = ENOTSUP;
+			return -1;
+		}
+
+		// Acquisition has a single sampling rate for all channels
+		if (rp->spr && spr != rp->spr) {
+			mm_log_error("%s: channels have different sampling rates",
+			             rp->path);
+			errno = ENOTSUP;
+			return -1;
+		}
+
+		ch->offset = rp->recsize;
+		rp->recsize += (int64_t)spr * ch->size;
+		rp->spr = spr;
+		set_channel_scaling(ch, dmin, dmax);
+		assign_sensor_type(ch);
+	}
+
+	return 0;
+}
+
+
+static
+int cmp_event(const void* a, const void* b)
+{
+	const struct replay_event* ea = a;
+	const struct replay_event* eb = b;
+
+	if (ea->pos != eb->pos)
+		return ea->pos < eb->pos ? -1 : 1;
+
+	return 0;
+}
+
+
+/**
+ * parse_gdf_events() - load the event table of a GDF file
+ * @rp:         replay whose data layout is known
+ * @nrec:       number of records announced in header
+ *
+ * A file whose recording has been interrupted has no event table. This is
+ * not an error.
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+static
+int parse_gdf_events(struct replay* rp, int64_t nrec)
+{
+	const unsigned char *table, *pos, *typ, *dur;
+	int64_t offset;
+	int i, mode, nevent;
+
+	offset = rp->hdrlen + nrec * rp->recsize;
+	if (nrec < 0 || offset + 8 > (int64_t)rp->size)
+		return 0;
+
+	table = (const unsigned char*)rp->map + offset;
+	mode = table[0];
+	nevent = get_le(table + 1, 3);
+	if ((mode != 1 && mode != 3) || nevent == 0
+	    || offset + 8 + (int64_t)nevent * (mode == 3 ? 12 : 6)
+	       > (int64_t)rp->size)
+		return 0;
+
+	rp->events = calloc(nevent, sizeof(*rp->events));
+	if (!rp->events)
+		return -1;
+
+	pos = table + 8;
+	typ = pos + 4*nevent;
+	dur = typ + 4*nevent;       // after TYP and CHN in mode 3
+	for (i = 0; i < nevent; i++) {
+		// Positions are 1-based in GDF
+		rp->events[i].pos = (int64_t)get_le(pos + 4*i, 4) - 1;
+		rp->events[i].code = get_le(typ + 2*i, 2);
+		if (mode == 3)
+			rp->events[i].duration = get_le(dur + 4*i, 4)
+			                         / (float)rp->fs;
+	}
+
+	qsort(rp->events, nevent, sizeof(*rp->events), cmp_event);
+	rp->nevent = nevent;
+	return 0;
+}
+
+
+/**
+ * parse_file() - get layout, channels and events of the mapped file
+ * @rp:         replay whose @map and @size are set
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+static
+int parse_file(struct replay* rp)
+{
+	const unsigned char* fixed = rp->map;
+	double duration;
+	int64_t nrec, nrec_data;
+	int i, is_gdf, stype;
+
+	if (rp->size < FIXED_HDR_SIZE)
+		goto invalid;
+
+	if (memcmp(fixed, "GDF 2", 5) == 0) {
+		is_gdf = 1;
+		rp->hdrlen = get_le(fixed + 184, 2) * FIXED_HDR_SIZE;
+		nrec = (int64_t)get_le(fixed + 236, 8);
+		duration = get_le(fixed + 244, 4);
+		if (get_le(fixed + 248, 4))
+			duration /= get_le(fixed + 248, 4);
+		rp->nch = get_le(fixed + 252, 2);
+	} else if (fixed[0] == 0xff && memcmp(fixed + 1, "BIOSEMI", 7) == 0) {
+		is_gdf = 0;
+		rp->hdrlen = get_ascii(fixed + 184, 8);
+		nrec = get_ascii(fixed + 236, 8);
+		duration = get_ascii(fixed + 244, 8);
+		rp->nch = get_ascii(fixed + 252, 4);
+	} else {
+		goto invalid;
+	}
+
+	if (rp->nch <= 0
+	    || rp->hdrlen < FIXED_HDR_SIZE * (rp->nch + 1)
+	    || rp->hdrlen > (int64_t)rp->size
+	    || duration <= 0)
+		goto invalid;
+
+	rp->channels = calloc(rp->nch, sizeof(*rp->channels));
+	if (!rp->channels || parse_channels(rp, is_gdf))
+		return -1;
+
+	rp->fs = lround(rp->spr / duration);
+	if (rp->fs <= 0)
+		goto invalid;
+
+	// Replay only the complete records present in file (the header of
+	// an interrupted recording may report no or too many records)
+	nrec_data = (rp->size - rp->hdrlen) / rp->recsize;
+	if (nrec < 0 || nrec > nrec_data)
+		nrec = nrec_data;
+
+	rp->ns = nrec * rp->spr;
+	if (is_gdf && parse_gdf_events(rp, nrec))
+		return -1;
+
+	for (i = 0; i < rp->nch; i++)
+		rp->nch_stype[rp->channels[i].stype]++;
+
+	for (i = 0; i < NSTYPE; i++) {
+		rp->chmap[i] = malloc((rp->nch_stype[i] + 1) * sizeof(int));
+		if (!rp->chmap[i])
+			return -1;
+		rp->nch_stype[i] = 0;
+	}
+
+	for (i = 0; i < rp->nch; i++) {
+		stype = rp->channels[i].stype;
+		rp->chmap[stype][rp->nch_stype[stype]++] = i;
+	}
+
+	rp->tmp = malloc(rp->spr * sizeof(*rp->tmp));
+	if (!rp->tmp)
+		return -1;
+
+	return 0;
+
+invalid:
+	mm_log_error("%s is not a valid GDF 2 or BDF file", rp->path);
+	errno = EILSEQ;
+	return -1;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      Sample conversion                                 *
+ *                                                                        *
+ **************************************************************************/
+/**
+ * read_digital() - get digital values of channel samples in a record
+ * @ch:         channel to read
+ * @src:        pointer to the first sample to read in the record
+ * @ns:         number of samples to read
+ * @dst:        array receiving @ns values
+ */
+static
+void read_digital(const struct replay_channel* ch, const unsigned char* src,
+                  int ns, double* dst)
+{
+	int i;
+	uint32_t u32;
+	uint64_t u64;
+	float f;
+	double d;
+
+	switch (ch->type) {
+	case 1: for (i = 0; i < ns; i++) dst[i] = (int8_t)src[i]; break;
+	case 2: for (i = 0; i < ns; i++) dst[i] = src[i]; break;
+	case 3:
+		for (i = 0; i < ns; i++)
+			dst[i] = (int16_t)get_le(src + 2*i, 2);
+		break;
+	case 4:
+		for (i = 0; i < ns; i++)
+			dst[i] = get_le(src + 2*i, 2);
+		break;
+	case 279:
+		// Sign extend the 24 bits value
+		for (i = 0; i < ns; i++) {
+			u32 = get_le(src + 3*i, 3) << 8;
+			dst[i] = (int32_t)u32 >> 8;
+		}
+		break;
+	case 535:
+		for (i = 0; i < ns; i++)
+			dst[i] = get_le(src + 3*i, 3);
+		break;
+	case 5:
+		for (i = 0; i < ns; i++)
+			dst[i] = (int32_t)get_le(src + 4*i, 4);
+		break;
+	case 6:
+		for (i = 0; i < ns; i++)
+			dst[i] = get_le(src + 4*i, 4);
+		break;
+	case 7:
+		for (i = 0; i < ns; i++)
+			dst[i] = (int64_t)get_le(src + 8*i, 8);
+		break;
+	case 8:
+		for (i = 0; i < ns; i++)
+			dst[i] = get_le(src + 8*i, 8);
+		break;
+	case 16:
+		for (i = 0; i < ns; i++) {
+			u32 = get_le(src + 4*i, 4);
+			memcpy(&f, &u32, sizeof(f));
+			dst[i] = f;
+		}
+		break;
+	case 17:
+		for (i = 0; i < ns; i++) {
+			u64 = get_le(src + 8*i, 8);
+			memcpy(&d, &u64, sizeof(d));
+			dst[i] = d;
+		}
+		break;
+	}
+}
+
+
+/**
+ * write_values() - store physical values in an acquisition array
+ * @ch:         channel of the values
+ * @digital:    digital values
+ * @ns:         number of values
+ * @dst:        location of the first value in the acquisition array
+ * @stride:     size of a sample in the acquisition array
+ * @datatype:   type of the values in the array (EGD_FLOAT...)
+ */
+static
+void write_values(const struct replay_channel* ch, const double* digital,
+                  int ns, char* dst, size_t stride, int datatype)
+{
+	double v;
+	float f;
+	int32_t i32;
+	int i;
+
+	for (i = 0; i < ns; i++, dst += stride) {
+		v = digital[i] * ch->scale + ch->phys_offset;
+		if (datatype == EGD_FLOAT) {
+			f = v;
+			memcpy(dst, &f, sizeof(f));
+		} else if (datatype == EGD_DOUBLE) {
+			memcpy(dst, &v, sizeof(v));
+		} else {
+			i32 = lround(v);
+			memcpy(dst, &i32, sizeof(i32));
+		}
+	}
+}
+
+
+/**
+ * copy_samples() - convert samples of file into acquisition arrays
+ * @rp:         replay source setup for acquisition
+ * @ns:         number of samples to copy from @rp->pos
+ * @arrays:     acquisition arrays
+ */
+static
+void copy_samples(struct replay* rp, int ns, void* arrays[3])
+{
+	const struct replay_channel* ch;
+	const struct grpconf* grp;
+	const unsigned char* rec;
+	char* dst;
+	int64_t pos = rp->pos, irec;
+	unsigned int igrp;
+	int i, n, first, done;
+	size_t elsize;
+
+	for (done = 0; done < ns; done += n, pos += n) {
+		irec = pos / rp->spr;
+		first = pos % rp->spr;
+		n = rp->spr - first;
+		if (n > ns - done)
+			n = ns - done;
+
+		rec = (const unsigned char*)rp->map + rp->hdrlen
+		      + irec * rp->recsize;
+		for (igrp = 0; igrp < rp->ngrp; igrp++) {
+			grp = &rp->grp[igrp];
+			elsize = (grp->datatype == EGD_DOUBLE)
+			         ? sizeof(double) : sizeof(int32_t);
+			for (i = 0; i < (int)grp->nch; i++) {
+				ch = &rp->channels[rp->chmap[grp->sensortype]
+				                            [grp->index + i]];
+				read_digital(ch, rec + ch->offset + first*ch->size,
+				             n, rp->tmp);
+				dst = (char*)arrays[grp->iarray]
+				      + grp->arr_offset + i*elsize
+				      + done*rp->strides[grp->iarray];
+				write_values(ch, rp->tmp, n, dst,
+				             rp->strides[grp->iarray],
+				             grp->datatype);
+			}
+		}
+	}
+}
+
+
+/**
+ * post_events() - re-emit the events of the samples delivered
+ * @rp:         replay source
+ * @end:        index of the sample following the last delivered
+ */
+static
+void post_events(struct replay* rp, int64_t end)
+{
+	const struct replay_event* evt;
+
+	for (; rp->next_event < rp->nevent; rp->next_event++) {
+		evt = &rp->events[rp->next_event];
+		if (evt->pos >= end)
+			break;
+
+		if (rp->trk)
+			event_tracker_post_event(rp->trk, evt->code,
+			                         evt->pos, evt->duration);
+	}
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      Acquisition source operations                     *
+ *                                                                        *
+ **************************************************************************/
+static
+void replay_close(struct acq_source* src)
+{
+	struct replay* rp = get_replay(src);
+	int i;
+
+	if (rp->map)
+		mm_unmap(rp->map);
+
+	for (i = 0; i < NSTYPE; i++)
+		free(rp->chmap[i]);
+
+	free(rp->tmp);
+	free(rp->grp);
+	free(rp->events);
+	free(rp->channels);
+	free(rp->path);
+	free(rp);
+}
+
+
+static
+int replay_get_fs(struct acq_source* src)
+{
+	return get_replay(src)->fs;
+}
+
+
+static
+int replay_get_numch(struct acq_source* src, int stype)
+{
+	if (stype < 0 || stype >= NSTYPE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return get_replay(src)->nch_stype[stype];
+}
+
+
+static
+int replay_get_chinfo(struct acq_source* src, int stype, unsigned int ich,
+                      struct acq_chinfo* info)
+{
+	struct replay* rp = get_replay(src);
+
+	if (stype < 0 || stype >= NSTYPE
+	    || ich >= (unsigned int)rp->nch_stype[stype]) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*info = rp->channels[rp->chmap[stype][ich]].info;
+	return 0;
+}
+
+
+static
+void replay_get_devinfo(struct acq_source* src, const char** type,
+                        const char** model)
+{
+	*type = "replay";
+	*model = get_replay(src)->path;
+}
+
+
+static
+int replay_setup(struct acq_source* src, const size_t strides[3],
+                 unsigned int ngrp, const struct grpconf* grp)
+{
+	struct replay* rp = get_replay(src);
+	struct grpconf* newgrp;
+	unsigned int i;
+
+	for (i = 0; i < ngrp; i++) {
+		if (grp[i].sensortype < 0 || grp[i].sensortype >= NSTYPE
+		    || grp[i].iarray >= 3
+		    || grp[i].index + grp[i].nch
+		       > (unsigned int)rp->nch_stype[grp[i].sensortype]
+		    || (grp[i].datatype != EGD_FLOAT
+		        && grp[i].datatype != EGD_DOUBLE
+		        && grp[i].datatype != EGD_INT32)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	newgrp = malloc((ngrp + 1) * sizeof(*newgrp));
+	if (!newgrp)
+		return -1;
+
+	memcpy(newgrp, grp, ngrp * sizeof(*newgrp));
+	free(rp->grp);
+	rp->grp = newgrp;
+	rp->ngrp = ngrp;
+	for (i = 0; i < 3; i++)
+		rp->strides[i] = strides[i];
+
+	return 0;
+}
+
+
+static
+int replay_start(struct acq_source* src)
+{
+	struct replay* rp = get_replay(src);
+
+	rp->pos = 0;
+	rp->next_event = 0;
+	mm_gettime(CLOCK_MONOTONIC, &rp->start);
+	return 0;
+}
+
+
+static
+int replay_stop(struct acq_source* src)
+{
+	struct replay* rp = get_replay(src);
+	struct mm_timespec now;
+	double elapsed;
+
+	mm_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = mm_timediff_ns(&now, &rp->start) * 1e-9;
+	if (elapsed > 0 && rp->pos)
+		mm_log_info("Replayed %lli samples in %.2f s "
+		            "(%.0f samples/s, %.1fx real time)",
+		            (long long)rp->pos, elapsed, rp->pos / elapsed,
+		            rp->pos / (elapsed * rp->fs));
+
+	return 0;
+}
+
+
+/**
+ * replay_get_data() - deliver the next samples of the replayed file
+ * @src:        replay source
+ * @ns:         number of samples requested
+ * @eeg:        array of the first group
+ * @sensor:     array of the second group
+ * @trigger:    array of the third group
+ *
+ * Samples are delivered when they would have been acquired at the replay
+ * speed: the call sleeps until the time at which the last sample would
+ * have been available since the start of the replay. Sleeping to absolute
+ * deadlines prevents the drift that the processing of the blocks would
+ * cause with relative sleeps.
+ *
+ * Return: @ns, less at the end of file, or -1 with errno set to ENODATA
+ * once the whole file has been replayed.
+ */
+static
+ssize_t replay_get_data(struct acq_source* src, size_t ns,
+                        void* eeg, void* sensor, void* trigger)
+{
+	struct replay* rp = get_replay(src);
+	void* arrays[3] = {eeg, sensor, trigger};
+	struct mm_timespec deadline;
+
+	if (rp->pos >= rp->ns) {
+		errno = ENODATA;
+		return -1;
+	}
+
+	if ((int64_t)ns > rp->ns - rp->pos)
+		ns = rp->ns - rp->pos;
+
+	if (rp->speed > 0) {
+		deadline = rp->start;
+		mm_timeadd_ns(&deadline, llround((rp->pos + ns) * 1e9
+		                                 / (rp->fs * rp->speed)));
+		mm_nanosleep(CLOCK_MONOTONIC, &deadline);
+	}
+
+	copy_samples(rp, ns, arrays);
+	rp->pos += ns;
+	post_events(rp, rp->pos);
+
+	return ns;
+}
+
+
+/**
+ * replay_get_status() - get timing of the last delivered samples
+ * @src:        replay source
+ * @status:     pointer receiving the status
+ *
+ * A replay never loses samples. The acquisition time of the samples is
+ * the one at which they are delivered at the replay speed, hence is
+ * unknown if the replay is not paced.
+ *
+ * Return: 0 if the replay is paced, -1 with errno set to ENOTSUP otherwise
+ */
+static
+int replay_get_status(struct acq_source* src, struct acq_status* status)
+{
+	struct replay* rp = get_replay(src);
+
+	if (rp->speed <= 0) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	status->last_ts = (int64_t)rp->start.tv_sec * 1000000000
+	                  + rp->start.tv_nsec
+	                  + llround(rp->pos * 1e9 / (rp->fs * rp->speed));
+	status->noverrun = 0;
+	status->nlost = 0;
+	return 0;
+}
+
+
+static const struct acq_source_ops replay_ops = {
+	.close = replay_close,
+	.get_fs = replay_get_fs,
+	.get_numch = replay_get_numch,
+	.get_chinfo = replay_get_chinfo,
+	.get_devinfo = replay_get_devinfo,
+	.setup = replay_setup,
+	.start = replay_start,
+	.stop = replay_stop,
+	.get_data = replay_get_data,
+	.get_status = replay_get_status,
+};
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      API of replay source                              *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * replay_open() - open a recording as acquisition source
+ * @path:       path of a BDF or GDF 2 file
+ * @speed:      replay speed relative to real time, 0 to replay as fast as
+ *              possible
+ * @trk:        event tracker in which the events of the file are posted
+ *              (can be NULL)
+ *
+ * The file is memory mapped and its samples are delivered as if acquired
+ * from a device at @speed times the sampling rate of the file. The events
+ * of a GDF file are posted in @trk at their original position when the
+ * samples that contain them are delivered. Since recordings do not keep
+ * the sensor type of their channels, channels labelled "Status" or
+ * "Trig..." are replayed as triggers, the ones whose unit is not a voltage
+ * as sensors and the remaining ones as EEG.
+ *
+ * Return: the opened source, NULL in case of failure with errno set
+ */
+struct acq_source* replay_open(const char* path, double speed,
+                               struct event_tracker* trk)
+{
+	struct replay* rp;
+	struct mm_stat st;
+	int fd, errnum;
+
+	rp = calloc(1, sizeof(*rp));
+	if (!rp)
+		return NULL;
+
+	rp->src.ops = &replay_ops;
+	rp->speed = speed;
+	rp->trk = trk;
+	rp->path = strdup(path);
+	if (!rp->path)
+		goto failure;
+
+	fd = mm_open(path, O_RDONLY, 0);
+	if (fd < 0)
+		goto failure;
+
+	if (mm_fstat(fd, &st)) {
+		mm_close(fd);
+		goto failure;
+	}
+
+	rp->size = st.size;
+	rp->map = rp->size ? mm_mapfile(fd, 0, rp->size, MM_MAP_READ) : NULL;
+	mm_close(fd);
+	if (!rp->size) {
+		errno = EILSEQ;
+		goto failure;
+	}
+
+	if (!rp->map || parse_file(rp))
+		goto failure;
+
+	mm_log_info("Replaying %s: %i Hz, %i EEG, %i sensor and %i trigger "
+	            "channels, %.1f s, %i events",
+	            path, rp->fs, rp->nch_stype[EGD_EEG],
+	            rp->nch_stype[EGD_SENSOR], rp->nch_stype[EGD_TRIGGER],
+	            (double)rp->ns / rp->fs, rp->nevent);
+	return &rp->src;
+
+failure:
+	errnum = errno;
+	replay_close(&rp->src);
+	errno = errnum;
+	return NULL;
+}
@@ -0,0 +1,432 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample-conv.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_KERNELS 1
+# include <immintrin.h>
+#else
+# define HAVE_X86_KERNELS 0
+#endif
+
+/**************************************************************************
+ *                                                                        *
+ *                      Internals of sample conversion                    *
+ *                                                                        *
+ **************************************************************************/
+
+#define ROW_IN(src, stride, i) \
+	((const float*)((const char*)(src) + (i)*(stride)))
+#define ROW_OUT(dst, stride, i) \
+	((uint8_t*)(dst) + (i)*(stride))
+
+
+// Digital value of @v of channel @c, ie scaled, saturated then rounded to
+// nearest even. The operations are done in the same order and precision
+// as in the vectorised kernels so that all implementations agree.
+static inline
+int32_t conv_value(const struct sample_conv* conv, int c, float v)
+{
+	v = v * conv->scale[c];
+	v = v + conv->offset[c];
+
+	// Written such that NaN saturates to dmin like in the SIMD kernels
+	v = (v > conv->dmin) ? v : conv->dmin;
+	v = (v < conv->dmax) ? v : conv->dmax;
+
+	return (int32_t)lrintf(v);
+}
+
+
+// Convert channels from @c0 to the last one of a sample
+static
+void conv_row_scalar(const struct sample_conv* conv, int c0,
+                     const float* in, uint8_t* out)
+{
+	int32_t d;
+	int c;
+
+	if (conv->width == 2) {
+		for (c = c0; c < conv->nch; c++) {
+			d = conv_value(conv, c, in[c]);
+			out[2*c] = d;
+			out[2*c+1] = d >> 8;
+		}
+	} else {
+		for (c = c0; c < conv->nch; c++) {
+			d = conv_value(conv, c, in[c]);
+			out[3*c] = d;
+			out[3*c+1] = d >> 8;
+			out[3*c+2] = d >> 16;
+		}
+	}
+}
+
+
+static
+void conv_scalar(const struct sample_conv* conv, int ns,
+                 const float* src, size_t src_stride,
+                 void* dst, size_t dst_stride)
+{
+	int i;
+
+	for (i = 0; i < ns; i++)
+		conv_row_scalar(conv, 0, ROW_IN(src, src_stride, i),
+		                ROW_OUT(dst, dst_stride, i));
+}
+
+
+#if HAVE_X86_KERNELS
+
+/*
+ * The x86 kernels are compiled with the target attribute, so they are
+ * available whatever the flags used to build, and are selected at runtime
+ * according to the instruction sets supported by the CPU. FMA is purposely
+ * not used: the scale then offset must be rounded separately to give the
+ * same result as the scalar code.
+ */
+
+static
+int cpu_supports(enum sample_conv_impl impl)
+{
+	__builtin_cpu_init();
+
+	switch (impl) {
+	case SAMPLE_CONV_SCALAR: return 1;
+	case SAMPLE_CONV_SSSE3: return __builtin_cpu_supports("ssse3");
+	case SAMPLE_CONV_AVX2: return __builtin_cpu_supports("avx2");
+	default: return 0;
+	}
+}
+
+
+__attribute__((target("ssse3")))
+static
+void conv_ssse3(const struct sample_conv* conv, int ns,
+                const float* src, size_t src_stride,
+                void* dst, size_t dst_stride)
+{
+	// Keep the 3 low bytes of each 32 bit value, packed in the 12 first
+	const __m128i pack24 = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10,
+	                                     12, 13, 14, -1, -1, -1, -1);
+	const __m128 vmin = _mm_set1_ps(conv->dmin);
+	const __m128 vmax = _mm_set1_ps(conv->dmax);
+	const float* in;
+	uint8_t* out;
+	__m128 x, y;
+	__m128i d, e;
+	int32_t last;
+	int i, c;
+
+	for (i = 0; i < ns; i++) {
+		in = ROW_IN(src, src_stride, i);
+		out = ROW_OUT(dst, dst_stride, i);
+		c = 0;
+
+		if (conv->width == 2) {
+			for (; c + 8 <= conv->nch; c += 8) {
+				x = _mm_loadu_ps(in + c);
+				y = _mm_loadu_ps(in + c + 4);
+				x = _mm_mul_ps(x, _mm_loadu_ps(conv->scale + c));
+				y = _mm_mul_ps(y, _mm_loadu_ps(conv->scale + c + 4));
+				x = _mm_add_ps(x, _mm_loadu_ps(conv->offset + c));
+				y = _mm_add_ps(y, _mm_loadu_ps(conv->offset + c + 4));
+				x = _mm_min_ps(_mm_max_ps(x, vmin), vmax);
+				y = _mm_min_ps(_mm_max_ps(y, vmin), vmax);
+				d = _mm_cvtps_epi32(x);
+				e = _mm_cvtps_epi32(y);
+				d = _mm_packs_epi32(d, e);
+				_mm_storeu_si128((__m128i*)(out + 2*c), d);
+			}
+		} else {
+			for (; c + 4 <= conv->nch; c += 4) {
+				x = _mm_loadu_ps(in + c);
+				x = _mm_mul_ps(x, _mm_loadu_ps(conv->scale + c));
+				x = _mm_add_ps(x, _mm_loadu_ps(conv->offset + c));
+				x = _mm_min_ps(_mm_max_ps(x, vmin), vmax);
+				d = _mm_cvtps_epi32(x);
+				d = _mm_shuffle_epi8(d, pack24);
+
+				// Store exactly 12 bytes to not overflow the row
+				_mm_storel_epi64((__m128i*)(out + 3*c), d);
+				last = _mm_cvtsi128_si32(_mm_srli_si128(d, 8));
+				memcpy(out + 3*c + 8, &last, sizeof(last));
+			}
+		}
+
+		conv_row_scalar(conv, c, in, out);
+	}
+}
+
+
+__attribute__((target("avx2")))
+static
+void conv_avx2(const struct sample_conv* conv, int ns,
+               const float* src, size_t src_stride,
+               void* dst, size_t dst_stride)
+{
+	// Same as in SSSE3 kernel in each 128 bit lane, then the 2×12 bytes
+	// are gathered in the 24 first bytes
+	const __m256i pack24 = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10,
+	                                        12, 13, 14, -1, -1, -1, -1,
+	                                        0, 1, 2, 4, 5, 6, 8, 9, 10,
+	                                        12, 13, 14, -1, -1, -1, -1);
+	const __m256i gather24 = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	const __m256 vmin = _mm256_set1_ps(conv->dmin);
+	const __m256 vmax = _mm256_set1_ps(conv->dmax);
+	const float* in;
+	uint8_t* out;
+	__m256 x, y;
+	__m256i d, e;
+	int i, c;
+
+	for (i = 0; i < ns; i++) {
+		in = ROW_IN(src, src_stride, i);
+		out = ROW_OUT(dst, dst_stride, i);
+		c = 0;
+
+		if (conv->width == 2) {
+			for (; c + 16 <= conv->nch; c += 16) {
+				x = _mm256_loadu_ps(in + c);
+				y = _mm256_loadu_ps(in + c + 8);
+				x = _mm256_mul_ps(x, _mm256_loadu_ps(conv->scale + c));
+				y = _mm256_mul_ps(y, _mm256_loadu_ps(conv->scale + c + 8));
+				x = _mm256_add_ps(x, _mm256_loadu_ps(conv->offset + c));
+				y = _mm256_add_ps(y, _mm256_loadu_ps(conv->offset + c + 8));
+				x = _mm256_min_ps(_mm256_max_ps(x, vmin), vmax);
+				y = _mm256_min_ps(_mm256_max_ps(y, vmin), vmax);
+				d = _mm256_cvtps_epi32(x);
+				e = _mm256_cvtps_epi32(y);
+
+				// packs works per lane: restore channel order
+				d = _mm256_packs_epi32(d, e);
+				d = _mm256_permute4x64_epi64(d, 0xd8);
+				_mm256_storeu_si256((__m256i*)(out + 2*c), d);
+			}
+		} else {
+			for (; c + 8 <= conv->nch; c += 8) {
+				x = _mm256_loadu_ps(in + c);
+				x = _mm256_mul_ps(x, _mm256_loadu_ps(conv->scale + c));
+				x = _mm256_add_ps(x, _mm256_loadu_ps(conv->offset + c));
+				x = _mm256_min_ps(_mm256_max_ps(x, vmin), vmax);
+				d = _mm256_cvtps_epi32(x);
+				d = _mm256_shuffle_epi8(d, pack24);
+				d = _mm256_permutevar8x32_epi32(d, gather24);
+
+				// Store exactly 24 bytes to not overflow the row
+				_mm_storeu_si128((__m128i*)(out + 3*c),
+				                 _mm256_castsi256_si128(d));
+				_mm_storel_epi64((__m128i*)(out + 3*c + 16),
+				                 _mm256_extracti128_si256(d, 1));
+			}
+		}
+
+		conv_row_scalar(conv, c, in, out);
+	}
+}
+
+#else /* HAVE_X86_KERNELS */
+
+static
+int cpu_supports(enum sample_conv_impl impl)
+{
+	return (impl == SAMPLE_CONV_SCALAR);
+}
+
+#define conv_ssse3      conv_scalar
+#define conv_avx2       conv_scalar
+
+#endif /* HAVE_X86_KERNELS */
+
+
+static const char* const impl_names[SAMPLE_CONV_NIMPL] = {
+	[SAMPLE_CONV_SCALAR] = "scalar",
+	[SAMPLE_CONV_SSSE3] = "ssse3",
+	[SAMPLE_CONV_AVX2] = "avx2",
+};
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      API of sample conversion                          *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * sample_conv_init() - initialize a float to integer conversion
+ * @conv:       conversion to initialize
+ * @nch:        number of channels of a sample
+ * @width:      size in bytes of a converted value: 2 for int16, 3 for int24
+ *
+ * The per channel range is initialized to map physical to digital values
+ * with a factor of 1. Use sample_conv_set_range() to calibrate each
+ * channel. The fastest implementation supported by the CPU is selected.
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+int sample_conv_init(struct sample_conv* conv, int nch, int width)
+{
+	int i, impl;
+
+	if (nch < 0 || (width != 2 && width != 3)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*conv = (struct sample_conv) {
+		.nch = nch,
+		.width = width,
+		.dmin = (width == 2) ? INT16_MIN : -(1 << 23),
+		.dmax = (width == 2) ? INT16_MAX : (1 << 23) - 1,
+	};
+
+	// Never allocate 0 bytes: NULL would be taken as failure
+	conv->scale = malloc((nch + 1) * sizeof(*conv->scale));
+	conv->offset = malloc((nch + 1) * sizeof(*conv->offset));
+	if (!conv->scale || !conv->offset) {
+		sample_conv_deinit(conv);
+		return -1;
+	}
+
+	for (i = 0; i < nch; i++) {
+		conv->scale[i] = 1.0f;
+		conv->offset[i] = 0.0f;
+	}
+
+	for (impl = SAMPLE_CONV_NIMPL-1; impl > SAMPLE_CONV_SCALAR; impl--)
+		if (cpu_supports(impl))
+			break;
+
+	conv->impl = impl;
+	return 0;
+}
+
+
+/**
+ * sample_conv_deinit() - cleanup a conversion
+ * @conv:       conversion initialized with sample_conv_init()
+ */
+void sample_conv_deinit(struct sample_conv* conv)
+{
+	free(conv->scale);
+	free(conv->offset);
+	conv->scale = NULL;
+	conv->offset = NULL;
+}
+
+
+/**
+ * sample_conv_set_range() - calibrate conversion of a channel
+ * @conv:       initialized conversion
+ * @ich:        index of the channel
+ * @pmin:       physical value mapped to the minimal digital value
+ * @pmax:       physical value mapped to the maximal digital value
+ *
+ * Return: 0 in case of success, -1 if the range is empty or invalid, in
+ * which case the channel keeps its previous calibration.
+ */
+int sample_conv_set_range(struct sample_conv* conv, int ich,
+                          double pmin, double pmax)
+{
+	double scale;
+
+	if (!(pmax > pmin) || !isfinite(pmax - pmin))
+		return -1;
+
+	scale = ((double)conv->dmax - conv->dmin) / (pmax - pmin);
+	conv->scale[ich] = scale;
+	conv->offset[ich] = conv->dmin - pmin * scale;
+	return 0;
+}
+
+
+/**
+ * sample_conv_set_impl() - force implementation of conversion
+ * @conv:       initialized conversion
+ * @impl:       implementation to use
+ *
+ * All implementations give the same digital values. This is meant to
+ * compare their speed.
+ *
+ * Return: 0 in case of success, -1 if @impl is not supported by the CPU
+ * (errno is then set to ENOTSUP)
+ */
+int sample_conv_set_impl(struct sample_conv* conv,
+                         enum sample_conv_impl impl)
+{
+	if (impl < 0 || impl >= SAMPLE_CONV_NIMPL || !cpu_supports(impl)) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	conv->impl = impl;
+	return 0;
+}
+
+
+/**
+ * sample_conv_get_impl_name() - get name of a conversion implementation
+ * @impl:       implementation
+ *
+ * Return: name of @impl, NULL if invalid
+ */
+const char* sample_conv_get_impl_name(enum sample_conv_impl impl)
+{
+	if (impl < 0 || impl >= SAMPLE_CONV_NIMPL)
+		return NULL;
+
+	return impl_names[impl];
+}
+
+
+/**
+ * sample_conv_run() - convert float samples into packed integers
+ * @conv:       initialized conversion
+ * @ns:         number of samples to convert
+ * @src:        array of @ns samples of @conv->nch float values
+ * @src_stride: size in bytes between 2 consecutive samples in @src
+ * @dst:        array receiving the @ns converted samples
+ * @dst_stride: size in bytes between 2 consecutive samples in @dst (at
+ *              least @conv->nch * @conv->width)
+ */
+void sample_conv_run(const struct sample_conv* conv, int ns,
+                     const float* src, size_t src_stride,
+                     void* dst, size_t dst_stride)
+{
+	switch (conv->impl) {
+	case SAMPLE_CONV_AVX2:
+		conv_avx2(conv, ns, src, src_stride, dst, dst_stride);
+		break;
+
+	case SAMPLE_CONV_SSSE3:
+		conv_ssse3(conv, ns, src, src_stride, dst, dst_stride);
+		break;
+
+	default:
+		conv_scalar(conv, ns, src, src_stride, dst, dst_stride);
+		break;
+	}
+}
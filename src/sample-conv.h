@@ -0,0 +1,70 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SAMPLE_CONV_H
+#define SAMPLE_CONV_H
+
+#include <stddef.h>
+
+/**
+ * enum sample_conv_impl - implementations of the conversion kernels
+ * @SAMPLE_CONV_SCALAR: portable C implementation
+ * @SAMPLE_CONV_SSSE3:  x86 SSSE3 implementation (4 or 8 channels at once)
+ * @SAMPLE_CONV_AVX2:   x86 AVX2 implementation (8 or 16 channels at once)
+ * @SAMPLE_CONV_NIMPL:  number of implementations
+ */
+enum sample_conv_impl {
+	SAMPLE_CONV_SCALAR,
+	SAMPLE_CONV_SSSE3,
+	SAMPLE_CONV_AVX2,
+	SAMPLE_CONV_NIMPL,
+};
+
+/**
+ * struct sample_conv - conversion of float samples into packed integers
+ * @nch:        number of channels of a sample
+ * @width:      size in bytes of a converted value (2 or 3)
+ * @dmin:       minimal digital value
+ * @dmax:       maximal digital value
+ * @scale:      per channel factor from physical to digital value
+ * @offset:     per channel digital value of the physical 0
+ * @impl:       implementation of the conversion used
+ *
+ * The digital value of a physical value v of channel i is
+ * v*@scale[i] + @offset[i] rounded to the nearest integer and saturated
+ * to [@dmin, @dmax]. The converted values are packed little endian.
+ */
+struct sample_conv {
+	int nch;
+	int width;
+	float dmin;
+	float dmax;
+	float* scale;
+	float* offset;
+	enum sample_conv_impl impl;
+};
+
+int sample_conv_init(struct sample_conv* conv, int nch, int width);
+void sample_conv_deinit(struct sample_conv* conv);
+int sample_conv_set_range(struct sample_conv* conv, int ich,
+                          double pmin, double pmax);
+int sample_conv_set_impl(struct sample_conv* conv,
+                         enum sample_conv_impl impl);
+const char* sample_conv_get_impl_name(enum sample_conv_impl impl);
+void sample_conv_run(const struct sample_conv* conv, int ns,
+                     const float* src, size_t src_stride,
+                     void* dst, size_t dst_stride);
+
+#endif
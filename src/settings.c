@@ -0,0 +1,267 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <ctype.h>
+#include <mmlib.h>
+#include <mmlog.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "settings.h"
+
+/*
+ * The settings are read from the same configuration file as the one used by
+ * mcpanel for the panel settings (see data/eegview.conf). mcpanel ignores
+ * the keys it does not know, hence the acquisition settings can live in the
+ * same file.
+ */
+
+struct setting {
+	char* group;
+	char* key;
+	char* value;
+};
+
+static struct setting* settings = NULL;
+static int num_settings = 0;
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Configuration file parsing                                *
+ *                                                                        *
+ **************************************************************************/
+static
+char* strip(char* str)
+{
+	char* end;
+
+	while (isspace((unsigned char)*str))
+		str++;
+
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+		end--;
+
+	*end = '\0';
+	return str;
+}
+
+
+static
+int add_setting(const char* group, const char* key, const char* value)
+{
+	struct setting* new_settings;
+	struct setting* s;
+
+	new_settings = realloc(settings, (num_settings+1)*sizeof(*settings));
+	if (!new_settings)
+		return -1;
+
+	settings = new_settings;
+	s = &settings[num_settings++];
+	s->group = strdup(group);
+	s->key = strdup(key);
+	s->value = strdup(value);
+
+	return 0;
+}
+
+
+static
+int parse_conffile(FILE* fp)
+{
+	char line[512], group[128] = "";
+	char *str, *end, *value;
+	int lineno = 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		str = strip(line);
+
+		// Skip empty lines and comments
+		if (*str == '\0' || *str == '#')
+			continue;
+
+		// Group header
+		if (*str == '[') {
+			end = strchr(str, ']');
+			if (!end) {
+				mm_log_warn("Malformed group at line %i", lineno);
+				continue;
+			}
+			*end = '\0';
+			snprintf(group, sizeof(group), "%s", strip(str+1));
+			continue;
+		}
+
+		// key = value
+		value = strchr(str, '=');
+		if (!value) {
+			mm_log_warn("Malformed setting at line %i", lineno);
+			continue;
+		}
+		*value++ = '\0';
+
+		if (add_setting(group, strip(str), strip(value)))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                       API of settings                                  *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * settings_load() - read settings from configuration file
+ * @confname:   basename of the configuration file (without .conf)
+ *
+ * The file is searched in the folder pointed by $XDG_CONFIG_HOME or in
+ * $HOME/.config if XDG_CONFIG_HOME is unset. A missing file is not an
+ * error.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+int settings_load(const char* confname)
+{
+	char path[512];
+	const char* dir;
+	FILE* fp;
+	int rv;
+
+	dir = getenv("XDG_CONFIG_HOME");
+	if (dir)
+		snprintf(path, sizeof(path), "%s/%s.conf", dir, confname);
+	else if ((dir = getenv("HOME")))
+		snprintf(path, sizeof(path), "%s/.config/%s.conf", dir, confname);
+	else
+		return 0;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+
+	rv = parse_conffile(fp);
+	fclose(fp);
+
+	return rv;
+}
+
+
+/**
+ * settings_free() - free resources associated with loaded settings
+ */
+void settings_free(void)
+{
+	int i;
+
+	for (i = 0; i < num_settings; i++) {
+		free(settings[i].group);
+		free(settings[i].key);
+		free(settings[i].value);
+	}
+
+	free(settings);
+	settings = NULL;
+	num_settings = 0;
+}
+
+
+/**
+ * settings_get() - get value of a setting
+ * @group:      name of the group (without brackets)
+ * @key:        key of the setting in @group
+ *
+ * Return: the string value of the setting if found, NULL otherwise. If the
+ * key is set several time, the last occurrence is returned.
+ */
+const char* settings_get(const char* group, const char* key)
+{
+	int i;
+
+	for (i = num_settings-1; i >= 0; i--) {
+		if (  strcmp(settings[i].group, group) == 0
+		   && strcmp(settings[i].key, key) == 0)
+			return settings[i].value;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * settings_get_bool() - get value of a boolean setting
+ * @group:      name of the group (without brackets)
+ * @key:        key of the setting in @group
+ * @defval:     value returned if setting is not found or invalid
+ *
+ * Return: the value of the setting if found, @defval otherwise
+ */
+int settings_get_bool(const char* group, const char* key, int defval)
+{
+	const char* value = settings_get(group, key);
+
+	if (!value)
+		return defval;
+
+	if (  mm_strcasecmp(value, "true") == 0
+	   || strcmp(value, "1") == 0)
+		return 1;
+
+	if (  mm_strcasecmp(value, "false") == 0
+	   || strcmp(value, "0") == 0)
+		return 0;
+
+	mm_log_warn("Invalid boolean value for [%s] %s: %s", group, key, value);
+	return defval;
+}
+
+
+/**
+ * settings_get_double() - get value of a numeric setting
+ * @group:      name of the group (without brackets)
+ * @key:        key of the setting in @group
+ * @defval:     value returned if setting is not found or invalid
+ *
+ * Return: the value of the setting if found, @defval otherwise
+ */
+double settings_get_double(const char* group, const char* key, double defval)
+{
+	const char* value = settings_get(group, key);
+	char* end;
+	double res;
+
+	if (!value)
+		return defval;
+
+	res = strtod(value, &end);
+	if (end == value || *end != '\0') {
+		mm_log_warn("Invalid numeric value for [%s] %s: %s",
+		            group, key, value);
+		return defval;
+	}
+
+	return res;
+}
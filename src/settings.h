@@ -0,0 +1,25 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+int settings_load(const char* confname);
+void settings_free(void);
+const char* settings_get(const char* group, const char* key);
+int settings_get_bool(const char* group, const char* key, int defval);
+double settings_get_double(const char* group, const char* key, double defval);
+
+#endif
@@ -0,0 +1,1130 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <mmsysio.h>
+#include <mmtime.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spool.h"
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Internals of spool codec                                  *
+ *                                                                        *
+ **************************************************************************/
+// Quotient from which a residual is stored verbatim after the unary escape
+#define RICE_ESCAPE             24
+// Number of bits used to store the Rice parameter of a channel
+#define RICE_KBITS              5
+// Range of exponents of the integer scaling of float channels
+#define SCALE_MIN               -32
+#define SCALE_MAX               30
+#define SCALE_BITS              6
+#define SCALE_NONE              (SCALE_MAX + 1)
+
+/**
+ * struct bitwriter - LSB-first bit stream being written
+ * @buf:        output buffer (large enough for the whole stream)
+ * @len:        number of bytes written in @buf
+ * @acc:        bits not yet flushed in @buf
+ * @nbits:      number of bits in @acc (less than 8 between calls)
+ */
+struct bitwriter {
+	uint8_t* buf;
+	size_t len;
+	uint64_t acc;
+	int nbits;
+};
+
+/**
+ * struct bitreader - LSB-first bit stream being read
+ * @buf:        input buffer
+ * @len:        size of @buf
+ * @pos:        number of bytes of @buf loaded so far
+ * @acc:        bits loaded and not consumed yet
+ * @nbits:      number of bits in @acc
+ */
+struct bitreader {
+	const uint8_t* buf;
+	size_t len;
+	size_t pos;
+	uint64_t acc;
+	int nbits;
+};
+
+
+static inline
+void bw_put(struct bitwriter* bw, uint32_t val, int n)
+{
+	bw->acc |= (uint64_t)val << bw->nbits;
+	bw->nbits += n;
+	while (bw->nbits >= 8) {
+		bw->buf[bw->len++] = bw->acc & 0xff;
+		bw->acc >>= 8;
+		bw->nbits -= 8;
+	}
+}
+
+
+static
+void bw_flush(struct bitwriter* bw)
+{
+	if (bw->nbits)
+		bw_put(bw, 0, 8 - bw->nbits);
+}
+
+
+static inline
+void br_refill(struct bitreader* br)
+{
+	while (br->nbits <= 56 && br->pos < br->len) {
+		br->acc |= (uint64_t)br->buf[br->pos++] << br->nbits;
+		br->nbits += 8;
+	}
+}
+
+
+static inline
+int br_get(struct bitreader* br, int n, uint32_t* val)
+{
+	if (br->nbits < n) {
+		br_refill(br);
+		if (br->nbits < n)
+			return -1;
+	}
+
+	*val = br->acc & (((uint64_t)1 << n) - 1);
+	br->acc >>= n;
+	br->nbits -= n;
+	return 0;
+}
+
+
+static inline
+int ctz64(uint64_t v)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(v);
+#else
+	int n = 0;
+
+	while (!(v & 1)) {
+		v >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+
+/**
+ * get_int_scale() - find power of 2 turning float samples into integers
+ * @src:        first sample of the channel
+ * @stride:     number of words between 2 samples of the channel
+ * @ns:         number of samples
+ *
+ * Samples produced by amplifiers are usually integers multiplied by a
+ * constant resolution. When this resolution is a power of 2, the samples
+ * are exactly integers once scaled, and their deltas are much smaller than
+ * the deltas of their bit patterns.
+ *
+ * Return: the exponent e such that every sample multiplied by 2^e is an
+ * int32, SCALE_NONE if there is none in the supported range.
+ */
+static
+int get_int_scale(const uint32_t* src, int stride, int ns)
+{
+	uint32_t w;
+	int i, exp, tz, ei, emax, span;
+
+	emax = SCALE_MIN;
+	span = 0;
+	for (i = 0; i < ns; i++) {
+		w = src[i*stride];
+		if (!(w & 0x7fffffffu)) {
+			// -0.0 would lose its sign
+			if (w)
+				return SCALE_NONE;
+
+			continue;
+		}
+
+		// Denormal, infinite or NaN
+		exp = (w >> 23) & 0xff;
+		if (exp == 0 || exp == 0xff)
+			return SCALE_NONE;
+
+		// Sample is an odd integer of 24-tz bits times 2^-ei
+		tz = ctz64((w & 0x7fffffu) | 0x800000u);
+		ei = 150 - exp - tz;
+		if (ei > emax)
+			emax = ei;
+
+		if (24 - tz - ei > span)
+			span = 24 - tz - ei;
+	}
+
+	if (emax > SCALE_MAX || span + emax > 31)
+		return SCALE_NONE;
+
+	return emax;
+}
+
+
+static inline
+uint32_t float_to_scaled(uint32_t w, int e)
+{
+	uint32_t m, n;
+	int shift;
+
+	if (!(w & 0x7fffffffu))
+		return 0;
+
+	m = (w & 0x7fffffu) | 0x800000u;
+	shift = e - 150 + (int)((w >> 23) & 0xff);
+	n = (shift >= 0) ? m << shift : m >> -shift;
+	return (w & 0x80000000u) ? 0u - n : n;
+}
+
+
+static inline
+uint32_t scaled_to_float(uint32_t n, float scale)
+{
+	union {
+		float f;
+		uint32_t u;
+	} v = {.f = (int32_t)n * scale};
+
+	return v.u;
+}
+
+
+/*
+ * Map the bits of a float to an unsigned integer of same ordering, so that
+ * close values (even of opposite signs) have close mappings
+ */
+static inline
+uint32_t ordered_bits(uint32_t w)
+{
+	return (w & 0x80000000u) ? ~w : (w | 0x80000000u);
+}
+
+
+static inline
+uint32_t float_bits(uint32_t o)
+{
+	return (o & 0x80000000u) ? (o & 0x7fffffffu) : ~o;
+}
+
+
+// Interleave positive and negative residuals: 0, -1, 1, -2, 2...
+static inline
+uint32_t zigzag(uint32_t d)
+{
+	return (d << 1) ^ (0u - (d >> 31));
+}
+
+
+static inline
+uint32_t unzigzag(uint32_t z)
+{
+	return (z >> 1) ^ (0u - (z & 1));
+}
+
+
+/**
+ * encode_channel() - delta and Rice encode the samples of a channel
+ * @bw:         bit stream receiving the encoded channel
+ * @src:        first sample of the channel
+ * @stride:     number of words between 2 samples of the channel
+ * @ns:         number of samples
+ * @isfloat:    true if the samples are float, false if int32
+ * @res:        scratch buffer of @ns words
+ *
+ * Float samples are converted to integers if possible (see
+ * get_int_scale()), otherwise their bit patterns are mapped to ordered
+ * integers. The conversion mode and the Rice parameter, chosen from the
+ * mean residual of the channel, are stored before the codes.
+ */
+static
+void encode_channel(struct bitwriter* bw, const uint32_t* src, int stride,
+                    int ns, int isfloat, uint32_t* res)
+{
+	uint32_t prev, cur, u, q;
+	uint64_t sum, mean;
+	int i, k, e;
+
+	e = isfloat ? get_int_scale(src, stride, ns) : SCALE_NONE;
+
+	prev = 0;
+	sum = 0;
+	for (i = 0; i < ns; i++) {
+		cur = src[i*stride];
+		if (e != SCALE_NONE)
+			cur = float_to_scaled(cur, e);
+		else if (isfloat)
+			cur = ordered_bits(cur);
+
+		res[i] = zigzag(cur - prev);
+		sum += res[i];
+		prev = cur;
+	}
+
+	mean = ns ? sum / ns : 0;
+	for (k = 0; k < 31 && ((uint64_t)2 << k) <= mean; k++)
+		;
+
+	bw_put(bw, e - SCALE_MIN, SCALE_BITS);
+	bw_put(bw, k, RICE_KBITS);
+	for (i = 0; i < ns; i++) {
+		u = res[i];
+		q = u >> k;
+		if (q < RICE_ESCAPE) {
+			// q ones terminated by a zero, then the k low bits
+			bw_put(bw, (1u << q) - 1, q + 1);
+			bw_put(bw, u & ((1u << k) - 1), k);
+		} else {
+			bw_put(bw, (1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+			bw_put(bw, u, 32);
+		}
+	}
+}
+
+
+static inline
+int read_code(struct bitreader* br, int k, uint32_t* u)
+{
+	uint32_t low;
+	int q;
+
+	br_refill(br);
+
+	// Bits not loaded are 0, hence a truncated run is detected below
+	q = ctz64(~br->acc | ((uint64_t)1 << RICE_ESCAPE));
+	if (q == RICE_ESCAPE) {
+		if (br->nbits < RICE_ESCAPE)
+			return -1;
+
+		br->acc >>= RICE_ESCAPE;
+		br->nbits -= RICE_ESCAPE;
+		return br_get(br, 32, u);
+	}
+
+	if (br->nbits < q + 1)
+		return -1;
+
+	br->acc >>= q + 1;
+	br->nbits -= q + 1;
+	if (br_get(br, k, &low))
+		return -1;
+
+	*u = ((uint32_t)q << k) | low;
+	return 0;
+}
+
+
+/**
+ * decode_channel() - decode the samples of a channel
+ * @br:         bit stream positioned at the channel
+ * @dst:        location of first sample of the channel
+ * @stride:     number of words between 2 samples of the channel
+ * @ns:         number of samples
+ * @isfloat:    true if the samples are float, false if int32
+ *
+ * Return: 0 in case of success, -1 if the stream is corrupted
+ */
+static
+int decode_channel(struct bitreader* br, uint32_t* dst, int stride,
+                   int ns, int isfloat)
+{
+	union {
+		float f;
+		uint32_t u;
+	} scale;
+	uint32_t k, u, cur, e;
+	int i;
+
+	if (br_get(br, SCALE_BITS, &e) || br_get(br, RICE_KBITS, &k))
+		return -1;
+
+	// scale = 2^-e, built from its bit pattern
+	e += SCALE_MIN;
+	scale.u = (uint32_t)(127 - (int)e) << 23;
+
+	cur = 0;
+	for (i = 0; i < ns; i++) {
+		if (read_code(br, k, &u))
+			return -1;
+
+		cur += unzigzag(u);
+		if ((int)e != SCALE_NONE)
+			dst[i*stride] = scaled_to_float(cur, scale.f);
+		else
+			dst[i*stride] = isfloat ? float_bits(cur) : cur;
+	}
+
+	return 0;
+}
+
+
+/**
+ * get_max_payload() - get upper bound of compressed size of a chunk
+ * @hdr:        header of spool file
+ *
+ * Return: maximal size in bytes, including padding
+ */
+static
+size_t get_max_payload(const struct spool_hdr* hdr)
+{
+	size_t nch = hdr->nch[0] + hdr->nch[1] + hdr->nch[2];
+	size_t nbits = nch * (SCALE_BITS + RICE_KBITS
+	                      + hdr->chunk_ns * (RICE_ESCAPE + 32));
+
+	return (nbits + 7) / 8 + 8;
+}
+
+
+/**
+ * compress_chunk() - encode samples of all channels of a chunk
+ * @hdr:        header of spool file
+ * @ns:         number of samples in chunk
+ * @raw:        samples of the 3 arrays of the chunk
+ * @out:        buffer of get_max_payload() bytes receiving the stream
+ * @res:        scratch buffer of @hdr->chunk_ns words
+ *
+ * Return: size of compressed stream
+ */
+static
+size_t compress_chunk(const struct spool_hdr* hdr, int ns, void* raw[3],
+                      uint8_t* out, uint32_t* res)
+{
+	struct bitwriter bw = {.buf = out};
+	const uint32_t* src;
+	int i, ch, nch;
+
+	for (i = 0; i < 3; i++) {
+		src = raw[i];
+		nch = hdr->nch[i];
+		for (ch = 0; ch < nch; ch++)
+			encode_channel(&bw, src + ch, nch, ns, i != 2, res);
+	}
+
+	bw_flush(&bw);
+	return bw.len;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Internals of spool writer                                 *
+ *                                                                        *
+ **************************************************************************/
+// Number of threads compressing chunks
+#define SPOOL_NWORKER           2
+// Duration (in seconds) of signal in a chunk
+#define SPOOL_CHUNK_DURATION    0.25
+#define SPOOL_CHUNK_NS_MIN      64
+
+// States of a chunk slot
+#define SLOT_FILLING            0
+#define SLOT_SUBMITTED          1
+#define SLOT_COMPRESSED         2
+
+/**
+ * struct spool_slot - chunk being filled, compressed or written
+ * @state:      SLOT_FILLING, SLOT_SUBMITTED or SLOT_COMPRESSED
+ * @ns:         number of samples in the chunk
+ * @first:      index in the file of the first sample of the chunk
+ * @raw:        samples of the 3 arrays of the chunk
+ * @res:        scratch buffer used by the compression
+ * @nevent:     number of events of the chunk
+ * @max_event:  capacity of @events
+ * @events:     events added while the chunk was filled
+ * @out:        compressed samples
+ * @size:       size of compressed samples
+ */
+struct spool_slot {
+	int state;
+	int ns;
+	int64_t first;
+	void* raw[3];
+	uint32_t* res;
+	int nevent;
+	int max_event;
+	struct spool_event* events;
+	uint8_t* out;
+	size_t size;
+};
+
+
+static
+int write_all(int fd, const void* buf, size_t len)
+{
+	ssize_t rsz;
+
+	rsz = mm_write(fd, buf, len);
+	if (rsz < 0)
+		return -1;
+
+	if ((size_t)rsz != len) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * write_chunk() - write compressed chunk at end of file
+ * @sp:         spool file
+ * @slot:       compressed chunk
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+static
+int write_chunk(struct spool* sp, const struct spool_slot* slot)
+{
+	size_t padded = (slot->size + 7) & ~(size_t)7;
+	struct spool_chunk chunk = {
+		.magic = SPOOL_CHUNK_MAGIC,
+		.ns = slot->ns,
+		.first = slot->first,
+		.size = slot->size,
+		.nevent = slot->nevent,
+	};
+
+	// Padding bytes have been zeroed with the output buffer
+	if (write_all(sp->fd, &chunk, sizeof(chunk))
+	    || write_all(sp->fd, slot->events,
+	                 slot->nevent * sizeof(*slot->events))
+	    || write_all(sp->fd, slot->out, padded))
+		return -1;
+
+	return 0;
+}
+
+
+/**
+ * write_compressed_chunks() - write the chunks compressed in order
+ * @sp:         spool file whose mutex is held
+ *
+ * Chunks are compressed in any order but must be written in the order of
+ * submission. The worker finishing a chunk writes all the consecutive
+ * compressed chunks, unless another worker is already doing it: this one
+ * will find the new chunk when it reacquires the mutex.
+ */
+static
+void write_compressed_chunks(struct spool* sp)
+{
+	struct spool_slot* slot;
+
+	if (sp->writing)
+		return;
+
+	sp->writing = 1;
+	while (sp->nwritten != sp->nsubmitted) {
+		slot = &sp->slots[sp->nwritten % sp->nslot];
+		if (slot->state != SLOT_COMPRESSED)
+			break;
+
+		pthread_mutex_unlock(&sp->mtx);
+		if (!sp->error && write_chunk(sp, slot))
+			sp->error = errno;
+		pthread_mutex_lock(&sp->mtx);
+
+		sp->stats.size += sizeof(struct spool_chunk)
+		                  + slot->nevent * sizeof(*slot->events)
+		                  + ((slot->size + 7) & ~(size_t)7);
+		slot->ns = 0;
+		slot->nevent = 0;
+		slot->state = SLOT_FILLING;
+		sp->nwritten++;
+		pthread_cond_broadcast(&sp->cond);
+	}
+	sp->writing = 0;
+}
+
+
+static
+void* worker_thread(void* arg)
+{
+	struct spool* sp = arg;
+	struct spool_slot* slot;
+	struct mm_timespec start, end;
+	size_t padded;
+
+	pthread_mutex_lock(&sp->mtx);
+	while (1) {
+		if (sp->ntaken == sp->nsubmitted) {
+			if (sp->quit)
+				break;
+
+			pthread_cond_wait(&sp->cond, &sp->mtx);
+			continue;
+		}
+
+		slot = &sp->slots[sp->ntaken % sp->nslot];
+		sp->ntaken++;
+		pthread_mutex_unlock(&sp->mtx);
+
+		mm_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+		slot->size = compress_chunk(&sp->hdr, slot->ns, slot->raw,
+		                            slot->out, slot->res);
+		padded = (slot->size + 7) & ~(size_t)7;
+		memset(slot->out + slot->size, 0, padded - slot->size);
+		mm_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+		pthread_mutex_lock(&sp->mtx);
+		sp->stats.cpu_ns += mm_timediff_ns(&end, &start);
+		slot->state = SLOT_COMPRESSED;
+		write_compressed_chunks(sp);
+	}
+	pthread_mutex_unlock(&sp->mtx);
+
+	return NULL;
+}
+
+
+/**
+ * submit_chunk() - hand filled chunk to workers and get the next one
+ * @sp:         spool file
+ *
+ * This blocks if all the chunks are still being compressed or written,
+ * ie, if the workers do not keep up with the acquisition.
+ *
+ * Return: 0 in case of success, -1 if writing has failed
+ */
+static
+int submit_chunk(struct spool* sp)
+{
+	struct spool_slot *slot, *next;
+	int64_t first;
+	int error;
+
+	slot = &sp->slots[sp->nsubmitted % sp->nslot];
+	next = &sp->slots[(sp->nsubmitted + 1) % sp->nslot];
+	first = slot->first + slot->ns;
+
+	pthread_mutex_lock(&sp->mtx);
+	slot->state = SLOT_SUBMITTED;
+	sp->nsubmitted++;
+	pthread_cond_broadcast(&sp->cond);
+
+	// The next slot is free once the chunk it held has been written
+	while (next->state != SLOT_FILLING)
+		pthread_cond_wait(&sp->cond, &sp->mtx);
+
+	error = sp->error;
+	pthread_mutex_unlock(&sp->mtx);
+
+	next->first = first;
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static
+void free_slots(struct spool* sp)
+{
+	struct spool_slot* slot;
+	int i, j;
+
+	for (i = 0; i < sp->nslot; i++) {
+		slot = &sp->slots[i];
+		for (j = 0; j < 3; j++)
+			free(slot->raw[j]);
+
+		free(slot->res);
+		free(slot->events);
+		free(slot->out);
+	}
+
+	free(sp->slots);
+	sp->slots = NULL;
+}
+
+
+static
+int alloc_slots(struct spool* sp)
+{
+	struct spool_slot* slot;
+	size_t ns = sp->hdr.chunk_ns;
+	int i, j;
+
+	sp->nslot = 2*SPOOL_NWORKER + 2;
+	sp->slots = calloc(sp->nslot, sizeof(*sp->slots));
+	if (!sp->slots)
+		return -1;
+
+	for (i = 0; i < sp->nslot; i++) {
+		slot = &sp->slots[i];
+		for (j = 0; j < 3; j++) {
+			slot->raw[j] = malloc(ns * sp->strides[j] + 1);
+			if (!slot->raw[j])
+				goto failure;
+		}
+
+		slot->res = malloc(ns * sizeof(*slot->res));
+		slot->out = malloc(get_max_payload(&sp->hdr));
+		if (!slot->res || !slot->out)
+			goto failure;
+	}
+
+	return 0;
+
+failure:
+	free_slots(sp);
+	return -1;
+}
+
+
+/**
+ * stop_workers() - stop compression threads once all chunks are written
+ * @sp:         spool file
+ */
+static
+void stop_workers(struct spool* sp)
+{
+	int i;
+
+	pthread_mutex_lock(&sp->mtx);
+	while (sp->nwritten != sp->nsubmitted)
+		pthread_cond_wait(&sp->cond, &sp->mtx);
+
+	sp->quit = 1;
+	pthread_cond_broadcast(&sp->cond);
+	pthread_mutex_unlock(&sp->mtx);
+
+	for (i = 0; i < sp->nworker; i++)
+		pthread_join(sp->workers[i], NULL);
+
+	sp->nworker = 0;
+}
+
+
+static
+void destroy_spool(struct spool* sp)
+{
+	int errnum = errno;
+
+	pthread_cond_destroy(&sp->cond);
+	pthread_mutex_destroy(&sp->mtx);
+	free(sp->workers);
+	free_slots(sp);
+	if (sp->fd >= 0)
+		mm_close(sp->fd);
+
+	free(sp);
+	errno = errnum;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                       API of spool writer                              *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * spool_create() - create spool file and start compression threads
+ * @path:       path of the file to create
+ * @fs:         sampling frequency
+ * @rectime:    start time of the recording (seconds since Epoch)
+ * @nch:        number of channels in each array
+ * @chdesc:     properties of the channels of the 3 arrays
+ *
+ * The samples are passed to spool_write() as 3 arrays of interleaved
+ * samples: float for EEG and sensors, int32 for triggers.
+ *
+ * Return: the spool file in case of success, NULL otherwise with errno set
+ */
+struct spool* spool_create(const char* path, double fs, double rectime,
+                           const int nch[3],
+                           const struct spool_chdesc* chdesc)
+{
+	struct spool* sp;
+	int i, chunk_ns, nchtot;
+
+	chunk_ns = fs * SPOOL_CHUNK_DURATION;
+	if (chunk_ns < SPOOL_CHUNK_NS_MIN)
+		chunk_ns = SPOOL_CHUNK_NS_MIN;
+
+	sp = calloc(1, sizeof(*sp));
+	if (!sp)
+		return NULL;
+
+	sp->fd = -1;
+	sp->hdr = (struct spool_hdr) {
+		.magic = SPOOL_MAGIC,
+		.version = SPOOL_VERSION,
+		.fs = fs,
+		.rectime = rectime,
+		.nch = {nch[0], nch[1], nch[2]},
+		.chunk_ns = chunk_ns,
+	};
+	for (i = 0; i < 3; i++)
+		sp->strides[i] = nch[i] * sizeof(uint32_t);
+
+	pthread_mutex_init(&sp->mtx, NULL);
+	pthread_cond_init(&sp->cond, NULL);
+	sp->workers = calloc(SPOOL_NWORKER, sizeof(*sp->workers));
+	if (!sp->workers || alloc_slots(sp))
+		goto failure;
+
+	nchtot = nch[0] + nch[1] + nch[2];
+	sp->fd = mm_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (sp->fd < 0
+	    || write_all(sp->fd, &sp->hdr, sizeof(sp->hdr))
+	    || write_all(sp->fd, chdesc, nchtot * sizeof(*chdesc)))
+		goto failure;
+
+	for (i = 0; i < SPOOL_NWORKER; i++) {
+		if (pthread_create(&sp->workers[i], NULL, worker_thread, sp))
+			goto failure;
+
+		sp->nworker++;
+	}
+
+	return sp;
+
+failure:
+	stop_workers(sp);
+	if (sp->fd >= 0)
+		mm_unlink(path);
+
+	destroy_spool(sp);
+	return NULL;
+}
+
+
+/**
+ * spool_write() - append samples to spool file
+ * @sp:         spool file
+ * @ns:         number of samples
+ * @eeg:        interleaved EEG samples
+ * @sensor:     interleaved sensor samples
+ * @trigger:    interleaved trigger samples
+ *
+ * The samples are copied and compressed in the background once a chunk is
+ * full. This blocks only if the compression threads do not keep up.
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+int spool_write(struct spool* sp, int ns, const void* eeg,
+                const void* sensor, const void* trigger)
+{
+	const char* src[3] = {eeg, sensor, trigger};
+	struct spool_slot* slot;
+	int i, n;
+
+	while (ns > 0) {
+		slot = &sp->slots[sp->nsubmitted % sp->nslot];
+		n = sp->hdr.chunk_ns - slot->ns;
+		if (n > ns)
+			n = ns;
+
+		for (i = 0; i < 3; i++) {
+			memcpy((char*)slot->raw[i] + slot->ns*sp->strides[i],
+			       src[i], n*sp->strides[i]);
+			src[i] += n*sp->strides[i];
+		}
+
+		slot->ns += n;
+		ns -= n;
+		sp->stats.ns += n;
+		sp->stats.raw_size += n * (sp->strides[0] + sp->strides[1]
+		                           + sp->strides[2]);
+
+		if (slot->ns == (int)sp->hdr.chunk_ns && submit_chunk(sp))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * spool_add_event() - add event to spool file
+ * @sp:         spool file
+ * @code:       event code
+ * @pos:        position of the event in samples since beginning of file
+ * @duration:   duration of the event in seconds
+ *
+ * The event is stored in the chunk currently filled.
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+int spool_add_event(struct spool* sp, uint32_t code, int64_t pos,
+                    float duration)
+{
+	struct spool_slot* slot = &sp->slots[sp->nsubmitted % sp->nslot];
+	struct spool_event* events;
+	int max_event;
+
+	if (slot->nevent == slot->max_event) {
+		max_event = slot->max_event ? 2*slot->max_event : 16;
+		events = realloc(slot->events, max_event * sizeof(*events));
+		if (!events)
+			return -1;
+
+		slot->events = events;
+		slot->max_event = max_event;
+	}
+
+	slot->events[slot->nevent++] = (struct spool_event) {
+		.code = code,
+		.duration = duration,
+		.pos = pos,
+	};
+	return 0;
+}
+
+
+/**
+ * spool_close() - write pending samples and close spool file
+ * @sp:         spool file
+ * @stats:      pointer receiving the compression statistics (can be NULL)
+ *
+ * Return: 0 in case of success, -1 if writing has failed with errno set
+ */
+int spool_close(struct spool* sp, struct spool_stats* stats)
+{
+	struct spool_slot* slot;
+	int error;
+
+	slot = &sp->slots[sp->nsubmitted % sp->nslot];
+	if (slot->ns || slot->nevent)
+		submit_chunk(sp);
+
+	stop_workers(sp);
+	error = sp->error;
+	if (mm_close(sp->fd) && !error)
+		error = errno;
+
+	sp->fd = -1;
+	if (stats)
+		*stats = sp->stats;
+
+	destroy_spool(sp);
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                       API of spool reader                              *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * index_chunks() - locate complete chunks of mapped spool file
+ * @rd:         reader whose file is mapped
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+static
+int index_chunks(struct spool_reader* rd)
+{
+	const struct spool_chunk* chunk;
+	const struct spool_chunk** chunks;
+	const char* map = rd->map;
+	size_t off, len, nchtot;
+	int max_chunk = 0;
+
+	nchtot = rd->hdr->nch[0] + rd->hdr->nch[1] + rd->hdr->nch[2];
+	off = sizeof(*rd->hdr) + nchtot * sizeof(*rd->chdesc);
+	while (off + sizeof(*chunk) <= rd->size) {
+		chunk = (const struct spool_chunk*)(map + off);
+		if (chunk->magic != SPOOL_CHUNK_MAGIC
+		    || chunk->ns > rd->hdr->chunk_ns)
+			break;
+
+		len = sizeof(*chunk) + chunk->nevent * sizeof(struct spool_event)
+		      + (((size_t)chunk->size + 7) & ~(size_t)7);
+		if (off + len > rd->size)
+			break;
+
+		if (rd->nchunk == max_chunk) {
+			max_chunk = max_chunk ? 2*max_chunk : 64;
+			chunks = realloc(rd->chunks,
+			                 max_chunk * sizeof(*chunks));
+			if (!chunks)
+				return -1;
+
+			rd->chunks = chunks;
+		}
+
+		rd->chunks[rd->nchunk++] = chunk;
+		rd->ns += chunk->ns;
+		rd->nevent += chunk->nevent;
+		off += len;
+	}
+
+	rd->end = off;
+	return 0;
+}
+
+
+/**
+ * spool_reader_open() - map spool file for reading
+ * @rd:         reader to initialize
+ * @path:       path of the spool file
+ *
+ * If the file has not been closed properly, only its complete chunks are
+ * readable.
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+int spool_reader_open(struct spool_reader* rd, const char* path)
+{
+	struct mm_stat st;
+	const struct spool_hdr* hdr;
+	size_t nchtot;
+	int fd;
+
+	*rd = (struct spool_reader) {.map = NULL};
+
+	fd = mm_open(path, O_RDONLY, 0);
+	if (fd < 0)
+		return -1;
+
+	if (mm_fstat(fd, &st)) {
+		mm_close(fd);
+		return -1;
+	}
+
+	if ((size_t)st.size < sizeof(*hdr)) {
+		mm_close(fd);
+		errno = EILSEQ;
+		return -1;
+	}
+
+	rd->size = st.size;
+	rd->map = mm_mapfile(fd, 0, rd->size, MM_MAP_READ);
+	mm_close(fd);
+	if (!rd->map)
+		return -1;
+
+	hdr = rd->map;
+	rd->hdr = hdr;
+	rd->chdesc = (const struct spool_chdesc*)(hdr + 1);
+	nchtot = (size_t)hdr->nch[0] + hdr->nch[1] + hdr->nch[2];
+	if (hdr->magic != SPOOL_MAGIC || hdr->version != SPOOL_VERSION
+	    || hdr->chunk_ns == 0
+	    || sizeof(*hdr) + nchtot * sizeof(*rd->chdesc) > rd->size) {
+		errno = EILSEQ;
+		goto failure;
+	}
+
+	if (index_chunks(rd))
+		goto failure;
+
+	return 0;
+
+failure:
+	spool_reader_close(rd);
+	return -1;
+}
+
+
+/**
+ * spool_reader_close() - unmap spool file
+ * @rd:         reader initialized with spool_reader_open()
+ */
+void spool_reader_close(struct spool_reader* rd)
+{
+	int errnum = errno;
+
+	if (rd->map)
+		mm_unmap(rd->map);
+
+	free(rd->chunks);
+	*rd = (struct spool_reader) {.map = NULL};
+	errno = errnum;
+}
+
+
+/**
+ * spool_reader_decode() - decompress samples of a chunk
+ * @rd:         opened reader
+ * @ichunk:     index of the chunk (less than @rd->nchunk)
+ * @data:       3 buffers receiving the interleaved samples of each array.
+ *              Each must be large enough for @rd->hdr->chunk_ns samples.
+ *
+ * Return: the number of samples decoded, -1 if the chunk is corrupted
+ * (errno set to EILSEQ)
+ */
+int spool_reader_decode(const struct spool_reader* rd, int ichunk,
+                        void* data[3])
+{
+	const struct spool_chunk* chunk = rd->chunks[ichunk];
+	struct bitreader br = {
+		.buf = (const uint8_t*)(chunk + 1)
+		       + chunk->nevent * sizeof(struct spool_event),
+		.len = chunk->size,
+	};
+	int i, ch, nch;
+
+	for (i = 0; i < 3; i++) {
+		nch = rd->hdr->nch[i];
+		for (ch = 0; ch < nch; ch++) {
+			if (decode_channel(&br, (uint32_t*)data[i] + ch, nch,
+			                   chunk->ns, i != 2)) {
+				errno = EILSEQ;
+				return -1;
+			}
+		}
+	}
+
+	return chunk->ns;
+}
+
+
+/**
+ * spool_reader_get_events() - get events stored in a chunk
+ * @rd:         opened reader
+ * @ichunk:     index of the chunk (less than @rd->nchunk)
+ * @events:     pointer receiving the location of the events in the mapping
+ *
+ * Return: the number of events in the chunk
+ */
+int spool_reader_get_events(const struct spool_reader* rd, int ichunk,
+                            const struct spool_event** events)
+{
+	const struct spool_chunk* chunk = rd->chunks[ichunk];
+
+	*events = (const struct spool_event*)(chunk + 1);
+	return chunk->nevent;
+}
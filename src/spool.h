@@ -0,0 +1,211 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Compressed spool format
+ *
+ * A spool file holds the samples of the 3 acquisition arrays (EEG and
+ * sensors as float, triggers as int32) losslessly compressed. It is made of
+ * a struct spool_hdr, followed by a struct spool_chdesc per channel (EEG
+ * channels first, then sensors and triggers), followed by chunks. Each
+ * chunk is a struct spool_chunk, followed by its events (struct
+ * spool_event) and its compressed samples, padded to a multiple of 8
+ * bytes. Everything is stored in native byte order.
+ *
+ * The chunks are compressed independently: in a chunk, each channel is
+ * delta encoded and the residuals are Rice coded with a parameter chosen
+ * per channel. Float channels are delta encoded as integers when their
+ * samples are integers scaled by a power of 2, which is the case of most
+ * amplifiers. Since chunks are written only once complete, a file whose
+ * recording has been interrupted is readable up to its last complete
+ * chunk.
+ */
+
+#define SPOOL_EXT               "eegs"
+#define SPOOL_MAGIC             0x53474545      // "EEGS" in little endian
+#define SPOOL_VERSION           1
+#define SPOOL_CHUNK_MAGIC       0x4b4e4843      // "CHNK" in little endian
+
+/**
+ * struct spool_hdr - header of spool file
+ * @magic:      SPOOL_MAGIC
+ * @version:    SPOOL_VERSION
+ * @reserved:   0
+ * @fs:         sampling frequency
+ * @rectime:    start time of the recording (seconds since Epoch)
+ * @nch:        number of channels in each array
+ * @chunk_ns:   maximal number of samples in a chunk
+ */
+struct spool_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	double fs;
+	double rectime;
+	uint32_t nch[3];
+	uint32_t chunk_ns;
+};
+
+/**
+ * struct spool_chdesc - properties of a channel
+ * @label:      name of the channel
+ * @unit:       physical unit
+ * @transducter: transducter description
+ * @filtering:  prefiltering description
+ * @mm:         physical minimum and maximum
+ * @isint:      true if the channel is acquired as integer
+ * @reserved:   0
+ */
+struct spool_chdesc {
+	char label[32];
+	char unit[16];
+	char transducter[128];
+	char filtering[128];
+	double mm[2];
+	int32_t isint;
+	int32_t reserved;
+};
+
+/**
+ * struct spool_chunk - header of a chunk of samples
+ * @magic:      SPOOL_CHUNK_MAGIC
+ * @ns:         number of samples in the chunk
+ * @first:      index in the file of the first sample of the chunk
+ * @size:       size in bytes of the compressed samples (without padding)
+ * @nevent:     number of events following the header
+ */
+struct spool_chunk {
+	uint32_t magic;
+	uint32_t ns;
+	int64_t first;
+	uint32_t size;
+	uint32_t nevent;
+};
+
+/**
+ * struct spool_event - event stored in a chunk
+ * @code:       event code
+ * @duration:   duration of the event in seconds
+ * @pos:        position of the event in samples since beginning of file
+ */
+struct spool_event {
+	uint32_t code;
+	float duration;
+	int64_t pos;
+};
+
+/**
+ * struct spool_stats - compression statistics of a spool file
+ * @ns:         number of samples written
+ * @raw_size:   size in bytes of the samples before compression
+ * @size:       size in bytes of the compressed chunks
+ * @cpu_ns:     CPU time (in ns) spent compressing by the worker threads
+ */
+struct spool_stats {
+	int64_t ns;
+	int64_t raw_size;
+	int64_t size;
+	int64_t cpu_ns;
+};
+
+struct spool_slot;
+
+/**
+ * struct spool - spool file being written
+ * @fd:         file descriptor of the file
+ * @hdr:        header of the file
+ * @strides:    size of one sample in each array
+ * @mtx:        protects the state of @slots and the fields below
+ * @cond:       signaled when the state of a slot changes or when quitting
+ * @nworker:    number of compression threads
+ * @workers:    compression threads
+ * @nslot:      number of chunks being filled, compressed or written
+ * @slots:      ring of chunks
+ * @nsubmitted: number of chunks handed to the workers
+ * @ntaken:     number of chunks taken by the workers
+ * @nwritten:   number of chunks written in file
+ * @writing:    true while a worker writes compressed chunks in file
+ * @quit:       true if the workers must exit
+ * @error:      errno value of the first failure, 0 if none
+ * @stats:      compression statistics
+ */
+struct spool {
+	int fd;
+	struct spool_hdr hdr;
+	size_t strides[3];
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	int nworker;
+	pthread_t* workers;
+	int nslot;
+	struct spool_slot* slots;
+	unsigned int nsubmitted;
+	unsigned int ntaken;
+	unsigned int nwritten;
+	int writing;
+	int quit;
+	int error;
+	struct spool_stats stats;
+};
+
+/**
+ * struct spool_reader - spool file mapped for reading
+ * @map:        mapping of the whole file
+ * @size:       size of the file
+ * @hdr:        header of the file
+ * @chdesc:     properties of the channels
+ * @nchunk:     number of complete chunks
+ * @chunks:     pointers to the chunks in @map
+ * @ns:         number of samples in the complete chunks
+ * @nevent:     number of events in the complete chunks
+ * @end:        offset of the end of the last complete chunk (less than
+ *              @size if the recording has been interrupted)
+ */
+struct spool_reader {
+	void* map;
+	size_t size;
+	const struct spool_hdr* hdr;
+	const struct spool_chdesc* chdesc;
+	int nchunk;
+	const struct spool_chunk** chunks;
+	int64_t ns;
+	int nevent;
+	size_t end;
+};
+
+struct spool* spool_create(const char* path, double fs, double rectime,
+                           const int nch[3],
+                           const struct spool_chdesc* chdesc);
+int spool_write(struct spool* sp, int ns, const void* eeg,
+                const void* sensor, const void* trigger);
+int spool_add_event(struct spool* sp, uint32_t code, int64_t pos,
+                    float duration);
+int spool_close(struct spool* sp, struct spool_stats* stats);
+
+int spool_reader_open(struct spool_reader* rd, const char* path);
+void spool_reader_close(struct spool_reader* rd);
+int spool_reader_decode(const struct spool_reader* rd, int ichunk,
+                        void* data[3]);
+int spool_reader_get_events(const struct spool_reader* rd, int ichunk,
+                            const struct spool_event** events);
+
+#endif
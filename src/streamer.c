@@ -0,0 +1,767 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <mmlog.h>
+#include <mmsysio.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eegview-stream.h"
+#include "net-utils.h"
+#include "streamer.h"
+
+// Amount of signal (in seconds) that can be queued between the acquisition
+// and the streaming thread
+#define STREAM_BUFFER_DURATION  1
+
+// Amount of signal (in seconds) that can be pending in the output buffer
+// of a subscriber before data is dropped
+#define CLIENT_BUFFER_DURATION  2
+#define CLIENT_BUFFER_MINSIZE   (64*1024)
+
+#ifndef MSG_DONTWAIT
+# define MSG_DONTWAIT   0
+#endif
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL   0
+#endif
+
+enum client_state {
+	CLIENT_HANDSHAKE,
+	CLIENT_STREAMING,
+};
+
+/**
+ * struct stream_client - connection of a subscriber
+ * @fd:         socket of the connection
+ * @state:      CLIENT_HANDSHAKE until the subscription has been received
+ * @name:       description of the subscriber
+ * @inlen:      number of bytes in @inbuf
+ * @insize:     size of @inbuf
+ * @inbuf:      subscription request being received
+ * @nsel:       number of selected channels in each group
+ * @sel:        indices of selected channels (of all groups in sequence)
+ * @sample_size: size in bytes of one sample of the selected channels
+ * @outstart:   offset in @out of the first byte not sent yet
+ * @outend:     offset in @out of the end of data to send
+ * @outsize:    size of @out
+ * @out:        data waiting to be sent
+ * @next_index: index of the next sample to be sent (-1 if none sent yet)
+ * @ndropped:   number of samples dropped for this subscriber
+ */
+struct stream_client {
+	int fd;
+	int state;
+	char name[64];
+	size_t inlen;
+	size_t insize;
+	char* inbuf;
+	int nsel[3];
+	uint16_t* sel;
+	size_t sample_size;
+	size_t outstart;
+	size_t outend;
+	size_t outsize;
+	char* out;
+	int64_t next_index;
+	uint64_t ndropped;
+};
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Subscriber connections                                    *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * client_alloc_out() - reserve space at the end of output buffer
+ * @client:     subscriber connection
+ * @len:        number of bytes to reserve
+ *
+ * Return: pointer to the reserved space, NULL if @len bytes cannot be
+ * appended to the data pending in the output buffer.
+ */
+static
+char* client_alloc_out(struct stream_client* client, size_t len)
+{
+	char* ptr;
+
+	if (client->outsize - client->outend < len) {
+		// Move pending data at the beginning of buffer
+		memmove(client->out, client->out + client->outstart,
+		        client->outend - client->outstart);
+		client->outend -= client->outstart;
+		client->outstart = 0;
+
+		if (client->outsize - client->outend < len)
+			return NULL;
+	}
+
+	ptr = client->out + client->outend;
+	client->outend += len;
+	return ptr;
+}
+
+
+/**
+ * client_flush() - send as much pending data as possible without blocking
+ * @client:     subscriber connection
+ *
+ * Return: 0 in case of success, -1 if the connection is broken
+ */
+static
+int client_flush(struct stream_client* client)
+{
+	ssize_t rsz;
+
+	while (client->outstart < client->outend) {
+		rsz = mm_send(client->fd, client->out + client->outstart,
+		              client->outend - client->outstart,
+		              MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (rsz < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			return -1;
+		}
+
+		client->outstart += rsz;
+	}
+
+	if (client->outstart == client->outend)
+		client->outstart = client->outend = 0;
+
+	return 0;
+}
+
+
+/**
+ * client_send_block() - queue block of data to subscriber
+ * @st:         initialized streamer
+ * @client:     subscriber connection in streaming state
+ * @entry:      block to send
+ *
+ * The selected channels of @entry are appended to the output buffer of
+ * @client. If there is not enough room, the block is dropped for this
+ * subscriber and a drop notice is sent before the next block sent.
+ */
+static
+void client_send_block(struct streamer* st, struct stream_client* client,
+                       const struct stream_entry* entry)
+{
+	struct eegview_stream_msg msg;
+	const struct sample_block* blk = entry->blk;
+	const char* src;
+	char* dst;
+	int i, g, c, isel;
+
+	// Notify the samples missed since the last sent block
+	if (client->next_index >= 0 && entry->index > client->next_index) {
+		dst = client_alloc_out(client, sizeof(msg));
+		if (!dst) {
+			client->ndropped += blk->ns;
+			return;
+		}
+
+		msg = (struct eegview_stream_msg) {
+			.type = EEGVIEW_STREAM_DROP,
+			.ns = entry->index - client->next_index,
+			.index = client->next_index,
+		};
+		memcpy(dst, &msg, sizeof(msg));
+		client->next_index = entry->index;
+	}
+
+	dst = client_alloc_out(client,
+	                       sizeof(msg) + blk->ns * client->sample_size);
+	if (!dst) {
+		client->ndropped += blk->ns;
+		if (client->next_index < 0)
+			client->next_index = entry->index;
+		return;
+	}
+
+	msg = (struct eegview_stream_msg) {
+		.type = EEGVIEW_STREAM_DATA,
+		.ns = blk->ns,
+		.index = entry->index,
+		.timestamp = entry->ts,
+	};
+	memcpy(dst, &msg, sizeof(msg));
+	dst += sizeof(msg);
+
+	// Gather selected channels (all channels are 4 bytes wide)
+	for (i = 0; i < blk->ns; i++) {
+		isel = 0;
+		for (g = 0; g < 3; g++) {
+			src = (const char*)blk->data[g] + i * st->nch[g] * 4;
+			for (c = 0; c < client->nsel[g]; c++) {
+				memcpy(dst, src + 4 * client->sel[isel++], 4);
+				dst += 4;
+			}
+		}
+	}
+
+	client->next_index = entry->index + blk->ns;
+}
+
+
+/**
+ * client_parse_subscription() - process subscription request
+ * @st:         initialized streamer
+ * @client:     subscriber connection in handshake state
+ *
+ * Return: 0 if the request is incomplete or has been processed, -1 if it
+ * is invalid.
+ */
+static
+int client_parse_subscription(struct streamer* st,
+                              struct stream_client* client)
+{
+	struct eegview_stream_sub sub;
+	size_t nidx;
+	uint16_t idx;
+	int g, c, isel;
+	const char* ptr;
+
+	if (client->inlen < sizeof(sub))
+		return 0;
+
+	memcpy(&sub, client->inbuf, sizeof(sub));
+	if (sub.magic != EEGVIEW_STREAM_MAGIC)
+		return -1;
+
+	// Count the explicit indices following the request
+	nidx = 0;
+	for (g = 0; g < 3; g++) {
+		if (sub.nch[g] == EEGVIEW_STREAM_ALLCH)
+			continue;
+
+		if (sub.nch[g] > st->nch[g])
+			return -1;
+
+		nidx += sub.nch[g];
+	}
+
+	if (client->inlen < sizeof(sub) + nidx * sizeof(idx))
+		return 0;
+
+	ptr = client->inbuf + sizeof(sub);
+	isel = 0;
+	for (g = 0; g < 3; g++) {
+		if (sub.nch[g] == EEGVIEW_STREAM_ALLCH) {
+			client->nsel[g] = st->nch[g];
+			for (c = 0; c < st->nch[g]; c++)
+				client->sel[isel++] = c;
+
+			continue;
+		}
+
+		client->nsel[g] = sub.nch[g];
+		for (c = 0; c < sub.nch[g]; c++) {
+			memcpy(&idx, ptr, sizeof(idx));
+			ptr += sizeof(idx);
+			if (idx >= st->nch[g])
+				return -1;
+
+			client->sel[isel++] = idx;
+		}
+	}
+
+	client->sample_size = 4 * isel;
+	client->next_index = -1;
+	client->state = CLIENT_STREAMING;
+	atomic_fetch_add(&st->nsubscriber, 1);
+
+	mm_log_info("Subscriber %s streams %i EEG, %i sensor, %i trigger "
+	            "channels", client->name,
+	            client->nsel[0], client->nsel[1], client->nsel[2]);
+	return 0;
+}
+
+
+/**
+ * client_read() - read data sent by subscriber without blocking
+ * @st:         initialized streamer
+ * @client:     subscriber connection
+ *
+ * Return: 0 in case of success or if there is no data to read, -1 if the
+ * connection has been closed or if the subscriber does not follow the
+ * protocol.
+ */
+static
+int client_read(struct streamer* st, struct stream_client* client)
+{
+	ssize_t rsz;
+
+	// Anything sent after subscription is read and ignored
+	if (client->state != CLIENT_HANDSHAKE) {
+		rsz = mm_recv(client->fd, client->inbuf, client->insize,
+		              MSG_DONTWAIT);
+		if (rsz < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+
+		return (rsz <= 0) ? -1 : 0;
+	}
+
+	rsz = mm_recv(client->fd, client->inbuf + client->inlen,
+	              client->insize - client->inlen, MSG_DONTWAIT);
+	if (rsz < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+
+	if (rsz <= 0)
+		return -1;
+
+	client->inlen += rsz;
+	if (client_parse_subscription(st, client)) {
+		mm_log_warn("Subscriber %s sent invalid request", client->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * streamer_close_client() - close connection of subscriber
+ * @st:         initialized streamer
+ * @index:      index of the client in @st->clients
+ */
+static
+void streamer_close_client(struct streamer* st, int index)
+{
+	struct stream_client* client = &st->clients[index];
+
+	if (client->state == CLIENT_STREAMING)
+		atomic_fetch_sub(&st->nsubscriber, 1);
+
+	mm_log_info("Subscriber %s disconnected (%llu samples dropped)",
+	            client->name, (unsigned long long)client->ndropped);
+
+	mm_close(client->fd);
+	free(client->inbuf);
+	free(client->sel);
+	free(client->out);
+
+	// Keep the array and the poll set packed
+	st->nclient--;
+	if (index != st->nclient) {
+		*client = st->clients[st->nclient];
+		st->pfds[st->nfixed + index] = st->pfds[st->nfixed + st->nclient];
+	}
+}
+
+
+/**
+ * streamer_grow_clients() - enlarge client array and poll set
+ * @st:         initialized streamer
+ *
+ * The capacity of @st->clients and @st->pfds is doubled, so that the poll
+ * set does not need to be rebuilt at each wakeup of the streaming thread.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int streamer_grow_clients(struct streamer* st)
+{
+	struct stream_client* clients;
+	struct mm_pollfd* pfds;
+	int maxclient;
+
+	maxclient = st->maxclient ? 2*st->maxclient : 4;
+
+	clients = realloc(st->clients, maxclient*sizeof(*clients));
+	if (!clients)
+		return -1;
+	st->clients = clients;
+
+	pfds = realloc(st->pfds, (st->nfixed+maxclient)*sizeof(*pfds));
+	if (!pfds)
+		return -1;
+	st->pfds = pfds;
+
+	st->maxclient = maxclient;
+	return 0;
+}
+
+
+/**
+ * streamer_accept_client() - accept incoming subscriber connection
+ * @st:         initialized streamer
+ * @listen_fd:  listening socket with pending connection
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int streamer_accept_client(struct streamer* st, int listen_fd)
+{
+	struct sockaddr_storage address;
+	socklen_t addr_len = sizeof(address);
+	struct stream_client* client;
+	struct eegview_stream_info info;
+	int fd, nch_total;
+	double rate;
+
+	fd = mm_accept(listen_fd, (struct sockaddr*)&address, &addr_len);
+	if (fd < 0)
+		return -1;
+
+	if (st->nclient == st->maxclient && streamer_grow_clients(st)) {
+		mm_close(fd);
+		return -1;
+	}
+
+	// Size output buffer to absorb a few seconds of full data
+	nch_total = st->nch[0] + st->nch[1] + st->nch[2];
+	rate = st->fs * (4 * nch_total + sizeof(struct eegview_stream_msg));
+
+	client = &st->clients[st->nclient];
+	*client = (struct stream_client) {
+		.fd = fd,
+		.state = CLIENT_HANDSHAKE,
+		.insize = sizeof(struct eegview_stream_sub)
+		          + nch_total * sizeof(uint16_t),
+		.outsize = CLIENT_BUFFER_DURATION * rate,
+	};
+	if (client->outsize < CLIENT_BUFFER_MINSIZE)
+		client->outsize = CLIENT_BUFFER_MINSIZE;
+
+	client->inbuf = malloc(client->insize);
+	client->sel = malloc((nch_total + 1) * sizeof(*client->sel));
+	client->out = malloc(client->outsize);
+	if (!client->inbuf || !client->sel || !client->out) {
+		free(client->inbuf);
+		free(client->sel);
+		free(client->out);
+		mm_close(fd);
+		return -1;
+	}
+	st->pfds[st->nfixed + st->nclient] = (struct mm_pollfd) {
+		.fd = fd,
+		.events = POLLIN,
+	};
+	st->nclient++;
+
+	if (address.ss_family == AF_INET)
+		mm_getnameinfo((struct sockaddr*)&address, addr_len,
+		               client->name, sizeof(client->name),
+		               NULL, 0, NI_NUMERICHOST);
+	else
+		snprintf(client->name, sizeof(client->name), "unix:%i", fd);
+
+	mm_log_info("Accepted subscriber %s", client->name);
+
+	// Describe the acquisition
+	info = (struct eegview_stream_info) {
+		.magic = EEGVIEW_STREAM_MAGIC,
+		.version = EEGVIEW_STREAM_VERSION,
+		.flags = st->flags,
+		.fs = st->fs,
+		.nch = {st->nch[0], st->nch[1], st->nch[2]},
+	};
+	memcpy(client_alloc_out(client, sizeof(info)), &info, sizeof(info));
+
+	return 0;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *              Streaming thread                                          *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * streamer_drain() - dispatch blocks queued by acquisition to subscribers
+ * @st:         initialized streamer
+ */
+static
+void streamer_drain(struct streamer* st)
+{
+	struct stream_entry* entry;
+	unsigned int tail, head;
+	int i;
+
+	tail = atomic_load_explicit(&st->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&st->head, memory_order_acquire);
+	for (; tail != head; tail++) {
+		entry = &st->ring[tail % st->nblock];
+		for (i = 0; i < st->nclient; i++) {
+			if (st->clients[i].state == CLIENT_STREAMING)
+				client_send_block(st, &st->clients[i], entry);
+		}
+
+		sample_block_unref(entry->blk);
+		atomic_store_explicit(&st->tail, tail + 1, memory_order_release);
+	}
+}
+
+
+static
+void* streaming_thread(void* arg)
+{
+	struct streamer* st = arg;
+	struct mm_pollfd* pfds;
+	struct stream_client* client;
+	char dummy;
+	int i, j, nfds;
+
+	while (!atomic_load(&st->quit)) {
+		// The entries of the wakeup pipe, the listening sockets and the
+		// clients are maintained when clients are added or removed:
+		// only the interest in writing changes between wakeups
+		pfds = st->pfds + st->nfixed;
+		for (i = 0; i < st->nclient; i++)
+			pfds[i].events = POLLIN
+			                 | (st->clients[i].outend ? POLLOUT : 0);
+
+		pfds = st->pfds;
+		nfds = st->nfixed + st->nclient;
+		if (mm_poll(pfds, nfds, -1) < 0) {
+			mm_log_error("Streaming failed: %s", strerror(errno));
+			break;
+		}
+
+		if (pfds[0].revents) {
+			mm_read(st->wakeup_pipe[0], &dummy, 1);
+			atomic_store(&st->wakeup_pending, 0);
+		}
+
+		streamer_drain(st);
+
+		// Process clients from the end so that closing one does not
+		// change the index of the ones remaining to be processed
+		for (i = st->nclient-1; i >= 0; i--) {
+			j = st->nfixed + i;
+			client = &st->clients[i];
+			if (  ((pfds[j].revents & (POLLIN|POLLHUP|POLLERR))
+			       && client_read(st, client))
+			   || client_flush(client))
+				streamer_close_client(st, i);
+		}
+
+		// Accepting a subscriber may move the poll set
+		for (j = 1; j < st->nfixed; j++) {
+			if (  st->pfds[j].revents
+			   && streamer_accept_client(st, st->pfds[j].fd))
+				mm_log_warn("Cannot accept subscriber: %s",
+				            strerror(errno));
+		}
+	}
+
+	return NULL;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                       API of streamer                                  *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * streamer_init() - start serving acquired data to subscribers
+ * @st:         streamer to initialize
+ * @fs:         sampling frequency
+ * @ns_max:     maximal number of samples in a block
+ * @nch:        number of channels in each group (EEG, sensor, trigger)
+ * @cfg:        sockets on which subscribers connect
+ *
+ * If no socket is configured, streaming is disabled and @st->nblock is 0.
+ * Otherwise @st->nblock is the number of blocks that the streamer may hold
+ * and that the pool must provide in addition to the other consumers.
+ * streamer_deinit() must be called even if this function fails.
+ *
+ * Return: 0 in case of success, -1 otherwise (the error is logged)
+ */
+int streamer_init(struct streamer* st, float fs, int ns_max, const int nch[3],
+                  const struct streamer_cfg* cfg)
+{
+	int i, j, nblock;
+
+	*st = (struct streamer) {
+		.fs = fs,
+		.nch = {nch[0], nch[1], nch[2]},
+		.flags = cfg->flags,
+		.listen_fd = {-1, -1},
+		.wakeup_pipe = {-1, -1},
+	};
+
+	if (!cfg->tcp_port && !cfg->unix_path)
+		return 0;
+
+	if (cfg->tcp_port) {
+		st->listen_fd[0] = create_inet_socket(SOCK_STREAM,
+		                                      cfg->tcp_port);
+		if (st->listen_fd[0] < 0) {
+			mm_log_error("Cannot stream on port %i: %s",
+			             cfg->tcp_port, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (cfg->unix_path) {
+		st->listen_fd[1] = create_unix_socket(SOCK_STREAM,
+		                                      cfg->unix_path);
+		if (st->listen_fd[1] < 0) {
+			mm_log_error("Cannot stream on %s: %s",
+			             cfg->unix_path, strerror(errno));
+			return -1;
+		}
+
+		st->unix_path = cfg->unix_path;
+	}
+
+	nblock = (STREAM_BUFFER_DURATION * (int)fs + ns_max - 1) / ns_max;
+	if (nblock < 2)
+		nblock = 2;
+
+	st->ring = calloc(nblock, sizeof(*st->ring));
+	if (!st->ring) {
+		mm_log_error("Cannot allocate streaming buffer");
+		return -1;
+	}
+
+	if (mm_pipe(st->wakeup_pipe)) {
+		st->wakeup_pipe[0] = st->wakeup_pipe[1] = -1;
+		mm_log_error("Cannot create streaming wakeup pipe");
+		return -1;
+	}
+
+	// Poll set of the streaming thread: wakeup pipe then listening
+	// sockets, followed by the clients
+	st->nfixed = 1;
+	for (i = 0; i < 2; i++)
+		if (st->listen_fd[i] >= 0)
+			st->nfixed++;
+
+	if (streamer_grow_clients(st)) {
+		mm_log_error("Cannot allocate poll set");
+		return -1;
+	}
+
+	st->pfds[0] = (struct mm_pollfd){.fd = st->wakeup_pipe[0],
+	                                 .events = POLLIN};
+	for (i = 0, j = 1; i < 2; i++) {
+		if (st->listen_fd[i] >= 0)
+			st->pfds[j++] = (struct mm_pollfd){.fd = st->listen_fd[i],
+			                                   .events = POLLIN};
+	}
+
+	if (pthread_create(&st->thread, NULL, streaming_thread, st)) {
+		mm_log_error("Cannot create streaming thread");
+		return -1;
+	}
+
+	// Streaming is enabled only once everything is ready
+	st->nblock = nblock;
+	return 0;
+}
+
+
+/**
+ * streamer_deinit() - stop streaming and free resources
+ * @st:         streamer initialized with streamer_init()
+ *
+ * The acquisition thread must not push any block when this is called.
+ */
+void streamer_deinit(struct streamer* st)
+{
+	unsigned int tail, head;
+	int i;
+
+	if (st->nblock) {
+		atomic_store(&st->quit, 1);
+		mm_write(st->wakeup_pipe[1], "q", 1);
+		pthread_join(st->thread, NULL);
+
+		// Release the blocks that have not been dispatched
+		tail = atomic_load(&st->tail);
+		head = atomic_load(&st->head);
+		for (; tail != head; tail++)
+			sample_block_unref(st->ring[tail % st->nblock].blk);
+	}
+
+	while (st->nclient)
+		streamer_close_client(st, st->nclient-1);
+
+	free(st->clients);
+	free(st->pfds);
+	free(st->ring);
+	st->clients = NULL;
+	st->pfds = NULL;
+	st->maxclient = 0;
+	st->ring = NULL;
+	st->nblock = 0;
+
+	for (i = 0; i < 2; i++) {
+		if (st->wakeup_pipe[i] >= 0)
+			mm_close(st->wakeup_pipe[i]);
+
+		if (st->listen_fd[i] >= 0)
+			mm_close(st->listen_fd[i]);
+	}
+
+	if (st->unix_path)
+		mm_unlink(st->unix_path);
+}
+
+
+/**
+ * streamer_push() - queue block of data for subscribers
+ * @st:         initialized streamer
+ * @blk:        block of acquired data
+ * @index:      index of the first sample of @blk since acquisition start
+ * @ts:         monotonic time (in ns) at which @blk has been acquired
+ *
+ * This function never blocks nor fails: if there is no subscriber, nothing
+ * is done. If the streaming thread is late, @blk is dropped and the
+ * subscribers get notified of the gap. On success, the streamer holds a
+ * reference on @blk until it is dispatched.
+ */
+void streamer_push(struct streamer* st, struct sample_block* blk,
+                   int64_t index, int64_t ts)
+{
+	struct stream_entry* entry;
+	unsigned int head, tail;
+
+	if (  !st->nblock
+	   || !atomic_load_explicit(&st->nsubscriber, memory_order_relaxed))
+		return;
+
+	head = atomic_load_explicit(&st->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&st->tail, memory_order_acquire);
+	if (head - tail >= (unsigned int)st->nblock)
+		return;
+
+	sample_block_ref(blk);
+	entry = &st->ring[head % st->nblock];
+	entry->blk = blk;
+	entry->index = index;
+	entry->ts = ts;
+	atomic_store_explicit(&st->head, head + 1, memory_order_release);
+
+	// Write in the pipe only if the thread has not been woken up yet
+	if (!atomic_exchange(&st->wakeup_pending, 1))
+		mm_write(st->wakeup_pipe[1], "w", 1);
+}
@@ -0,0 +1,106 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef STREAMER_H
+#define STREAMER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "block-pool.h"
+
+/**
+ * struct streamer_cfg - sockets on which subscribers connect
+ * @tcp_port:   TCP port (0 to disable)
+ * @unix_path:  path of Unix domain socket (NULL to disable)
+ * @flags:      flags advertised to subscribers (EEGVIEW_STREAM_PREPROC...)
+ */
+struct streamer_cfg {
+	int tcp_port;
+	const char* unix_path;
+	unsigned int flags;
+};
+
+/**
+ * struct stream_entry - block of data queued for streaming
+ * @blk:        sample block referenced by the streamer
+ * @index:      index of the first sample of @blk since acquisition start
+ * @ts:         monotonic time (in ns) at which @blk has been acquired
+ */
+struct stream_entry {
+	struct sample_block* blk;
+	int64_t index;
+	int64_t ts;
+};
+
+struct stream_client;
+struct mm_pollfd;
+
+/**
+ * struct streamer - thread serving acquired samples to subscribers
+ * @thread:             streaming thread
+ * @fs:                 sampling frequency
+ * @nch:                number of channels in each group
+ * @flags:              flags advertised to subscribers
+ * @listen_fd:          sockets accepting subscribers (TCP and Unix)
+ * @unix_path:          path of Unix socket to remove at exit (can be NULL)
+ * @wakeup_pipe:        pipe used to wake up the streaming thread
+ * @wakeup_pending:     true if a wake up byte has been written in
+ *                      @wakeup_pipe and not consumed yet
+ * @quit:               true if the streaming thread must exit
+ * @nblock:             capacity of @ring (0 if streaming is disabled)
+ * @ring:               ring of blocks queued by acquisition thread
+ * @head:               number of blocks pushed (written only by producer)
+ * @tail:               number of blocks consumed (written only by thread)
+ * @nsubscriber:        number of clients receiving data, observable by the
+ *                      acquisition thread
+ * @nclient:            number of elements in @clients
+ * @maxclient:          number of elements allocated in @clients
+ * @clients:            connected clients (streaming thread only)
+ * @nfixed:             number of entries of @pfds preceding the clients
+ * @pfds:               poll set of streaming thread: wakeup pipe, listening
+ *                      sockets then the socket of each element of @clients
+ *                      (sized for @maxclient clients, streaming thread only)
+ */
+struct streamer {
+	pthread_t thread;
+	float fs;
+	int nch[3];
+	unsigned int flags;
+	int listen_fd[2];
+	const char* unix_path;
+	int wakeup_pipe[2];
+	atomic_int wakeup_pending;
+	atomic_int quit;
+	int nblock;
+	struct stream_entry* ring;
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_int nsubscriber;
+	int nclient;
+	int maxclient;
+	struct stream_client* clients;
+	int nfixed;
+	struct mm_pollfd* pfds;
+};
+
+int streamer_init(struct streamer* st, float fs, int ns_max, const int nch[3],
+                  const struct streamer_cfg* cfg);
+void streamer_deinit(struct streamer* st);
+void streamer_push(struct streamer* st, struct sample_block* blk,
+                   int64_t index, int64_t ts);
+
+#endif
@@ -0,0 +1,683 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <eegdev.h>
+#include <errno.h>
+#include <math.h>
+#include <mmlib.h>
+#include <mmlog.h>
+#include <mmtime.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "synth.h"
+#include "time-utils.h"
+
+#define NSTYPE          3
+
+// Resolution of the synthetic EEG (in uV), like a 24 bit amplifier
+#define EEG_LSB         (1.0f / 32)
+
+// Duration of the trigger pulses (in ms)
+#define PULSE_DURATION  10
+
+// Wrap-around of the sample counter channel, like a 24 bit device counter
+#define COUNTER_MOD     (1 << 24)
+
+/**
+ * struct synth_cfg - parameters of the synthetic source
+ * @fs:         sampling frequency
+ * @nch:        number of channels of each sensor type
+ * @trigger_period: period (in ms) of the pulses on the first trigger
+ *              channel (0 for no pulse)
+ * @marker_period: period (in ms) of the software events (0 for none)
+ * @buffer:     duration (in ms) of the device buffer
+ * @counter:    if not 0, the last trigger channel is a sample counter
+ */
+struct synth_cfg {
+	int fs;
+	int nch[NSTYPE];
+	int trigger_period;
+	int marker_period;
+	int buffer;
+	int counter;
+};
+
+/**
+ * struct synth - acquisition source generating synthetic signals
+ * @src:        acquisition source interface
+ * @cfg:        parameters of the source
+ * @model:      description of the source reported as device model
+ * @wave_len:   number of samples in @wave (1 second)
+ * @wave:       periodic waveform from which channels are read
+ * @wave_off:   offset in @wave of each EEG channel
+ * @trk:        event tracker receiving the markers (can be NULL)
+ * @ngrp:       number of groups in @grp
+ * @grp:        groups of channels setup for acquisition
+ * @strides:    size of one sample in each acquisition array
+ * @start_ns:   time (in ns) at which the acquisition started
+ * @pos:        index of the next generated sample
+ * @next_marker: index of the sample of the next marker
+ * @nmarker:    number of markers generated
+ * @buffer_ns:  capacity in samples of the device buffer
+ * @noverrun:   number of device buffer overflows
+ * @nlost:      number of samples lost by the overflows
+ */
+struct synth {
+	struct acq_source src;
+	struct synth_cfg cfg;
+	char model[64];
+	int wave_len;
+	float* wave;
+	int* wave_off;
+	struct event_tracker* trk;
+	unsigned int ngrp;
+	struct grpconf* grp;
+	size_t strides[3];
+	int64_t start_ns;
+	int64_t pos;
+	int64_t next_marker;
+	unsigned int nmarker;
+	int64_t buffer_ns;
+	unsigned int noverrun;
+	int64_t nlost;
+};
+
+#define get_synth(src) ((struct synth*)(src))
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      Signal generation                                 *
+ *                                                                        *
+ **************************************************************************/
+/**
+ * init_wave() - create the waveform of the synthetic channels
+ * @sy:         synthetic source whose configuration is set
+ *
+ * The waveform lasts exactly 1 second and mixes alpha rhythm, a slow
+ * oscillation and noise. Each EEG channel reads it with a different
+ * offset, so that neighbour channels are not identical. Computing the
+ * waveform once keeps the cost of generation far below the one of the
+ * processing being benchmarked.
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int init_wave(struct synth* sy)
+{
+	uint64_t rng = 0x9e3779b97f4a7c15ull;
+	double t, v, noise;
+	int i, k, nmax;
+
+	sy->wave_len = sy->cfg.fs;
+	sy->wave = malloc(sy->wave_len * sizeof(*sy->wave));
+	nmax = (sy->cfg.nch[EGD_EEG] > sy->cfg.nch[EGD_SENSOR])
+	       ? sy->cfg.nch[EGD_EEG] : sy->cfg.nch[EGD_SENSOR];
+	sy->wave_off = malloc((nmax + 1) * sizeof(*sy->wave_off));
+	if (!sy->wave || !sy->wave_off)
+		return -1;
+
+	for (i = 0; i < sy->wave_len; i++) {
+		t = (double)i / sy->cfg.fs;
+
+		// Sum of xorshift64* uniforms: approximately gaussian
+		noise = -2.0;
+		for (k = 0; k < 4; k++) {
+			rng ^= rng >> 12;
+			rng ^= rng << 25;
+			rng ^= rng >> 27;
+			noise += ((rng * 2685821657736338717ull) >> 11) * 0x1.0p-53;
+		}
+
+		v = 20.0 * sin(2*M_PI*10.0*t) + 30.0 * sin(2*M_PI*1.0*t)
+		    + 5.0 * 1.7320508 * noise;
+		sy->wave[i] = roundf(v / EEG_LSB) * EEG_LSB;
+	}
+
+	for (i = 0; i < nmax; i++)
+		sy->wave_off[i] = ((int64_t)i * 7919) % sy->wave_len;
+
+	return 0;
+}
+
+
+/**
+ * get_trigger() - get value of a trigger channel
+ * @sy:         synthetic source
+ * @ich:        index of the trigger channel
+ * @pos:        index of the sample
+ *
+ * The first trigger channel carries pulses whose code increments at each
+ * period. If a counter is configured, the last channel carries the index of
+ * the sample, including the ones lost in overruns. The other ones stay at
+ * 0.
+ *
+ * Return: the value of the trigger channel at @pos
+ */
+static inline
+int32_t get_trigger(const struct synth* sy, int ich, int64_t pos)
+{
+	int64_t period = (int64_t)sy->cfg.trigger_period * sy->cfg.fs / 1000;
+	int64_t pulse = (int64_t)PULSE_DURATION * sy->cfg.fs / 1000;
+
+	if (sy->cfg.counter && ich == sy->cfg.nch[EGD_TRIGGER] - 1)
+		return pos % COUNTER_MOD;
+
+	if (ich != 0 || period <= 0)
+		return 0;
+
+	if (pulse < 1)
+		pulse = 1;
+
+	if (pos % period >= pulse)
+		return 0;
+
+	return (pos / period) % 255 + 1;
+}
+
+
+static inline
+void store_value(char* dst, double v, int datatype)
+{
+	float f;
+	int32_t i32;
+
+	if (datatype == EGD_FLOAT) {
+		f = v;
+		memcpy(dst, &f, sizeof(f));
+	} else if (datatype == EGD_DOUBLE) {
+		memcpy(dst, &v, sizeof(v));
+	} else {
+		i32 = lround(v);
+		memcpy(dst, &i32, sizeof(i32));
+	}
+}
+
+
+/**
+ * generate_group() - fill acquisition array with a group of channels
+ * @sy:         synthetic source setup for acquisition
+ * @grp:        group of channels to generate
+ * @ns:         number of samples to generate from @sy->pos
+ * @array:      acquisition array of @grp
+ */
+static
+void generate_group(const struct synth* sy, const struct grpconf* grp,
+                    int ns, void* array)
+{
+	size_t stride = sy->strides[grp->iarray];
+	size_t elsize = (grp->datatype == EGD_DOUBLE)
+	                ? sizeof(double) : sizeof(int32_t);
+	char* row = (char*)array + grp->arr_offset;
+	int i, ch, idx, base;
+	int64_t pos;
+	double v;
+
+	for (i = 0; i < ns; i++, row += stride) {
+		pos = sy->pos + i;
+		base = pos % sy->wave_len;
+		for (ch = 0; ch < (int)grp->nch; ch++) {
+			if (grp->sensortype == EGD_TRIGGER) {
+				v = get_trigger(sy, grp->index + ch, pos);
+			} else {
+				idx = base + sy->wave_off[grp->index + ch];
+				if (idx >= sy->wave_len)
+					idx -= sy->wave_len;
+
+				v = sy->wave[idx];
+				if (grp->sensortype == EGD_SENSOR)
+					v *= 0.01;
+			}
+			store_value(row + ch*elsize, v, grp->datatype);
+		}
+	}
+}
+
+
+/**
+ * post_markers() - post software events of the generated samples
+ * @sy:         synthetic source
+ * @end:        index of the sample following the last generated
+ *
+ * The markers are positioned in the stream of delivered samples, hence
+ * the samples lost in overruns are not counted.
+ */
+static
+void post_markers(struct synth* sy, int64_t end)
+{
+	int64_t period = (int64_t)sy->cfg.marker_period * sy->cfg.fs / 1000;
+
+	if (period <= 0)
+		return;
+
+	// Markers of lost samples are lost too
+	while (sy->next_marker < sy->pos)
+		sy->next_marker += period;
+
+	for (; sy->next_marker < end; sy->next_marker += period) {
+		if (sy->trk)
+			event_tracker_post_event(sy->trk,
+			                         sy->nmarker % 16 + 1,
+			                         sy->next_marker - sy->nlost,
+			                         0.0f);
+		sy->nmarker++;
+	}
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      Acquisition source operations                     *
+ *                                                                        *
+ **************************************************************************/
+static
+void synth_close(struct acq_source* src)
+{
+	struct synth* sy = get_synth(src);
+
+	free(sy->wave);
+	free(sy->wave_off);
+	free(sy->grp);
+	free(sy);
+}
+
+
+static
+int synth_get_fs(struct acq_source* src)
+{
+	return get_synth(src)->cfg.fs;
+}
+
+
+static
+int synth_get_numch(struct acq_source* src, int stype)
+{
+	if (stype < 0 || stype >= NSTYPE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return get_synth(src)->cfg.nch[stype];
+}
+
+
+static
+int synth_get_chinfo(struct acq_source* src, int stype, unsigned int ich,
+                     struct acq_chinfo* info)
+{
+	struct synth* sy = get_synth(src);
+
+	if (stype < 0 || stype >= NSTYPE
+	    || ich >= (unsigned int)sy->cfg.nch[stype]) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*info = (struct acq_chinfo) {.isint = 0};
+	strcpy(info->transducter, "synthetic");
+	strcpy(info->filtering, "none");
+	if (stype == EGD_EEG) {
+		sprintf(info->label, "EEG%03u", ich + 1);
+		strcpy(info->unit, "uV");
+		info->mm[0] = -262144.0;
+		info->mm[1] = 262143.0;
+	} else if (stype == EGD_SENSOR) {
+		sprintf(info->label, "Sensor%u", ich + 1);
+		strcpy(info->unit, "a.u.");
+		info->mm[0] = -1.0;
+		info->mm[1] = 1.0;
+	} else if (sy->cfg.counter
+	           && ich == (unsigned int)sy->cfg.nch[stype] - 1) {
+		strcpy(info->label, "Counter");
+		strcpy(info->unit, "samples");
+		info->isint = 1;
+		info->mm[0] = 0.0;
+		info->mm[1] = COUNTER_MOD - 1;
+	} else {
+		sprintf(info->label, "Trigger%u", ich + 1);
+		strcpy(info->unit, "Boolean");
+		info->isint = 1;
+		info->mm[0] = -2147483648.0;
+		info->mm[1] = 2147483647.0;
+	}
+
+	return 0;
+}
+
+
+static
+void synth_get_devinfo(struct acq_source* src, const char** type,
+                       const char** model)
+{
+	*type = "synthetic";
+	*model = get_synth(src)->model;
+}
+
+
+static
+int synth_setup(struct acq_source* src, const size_t strides[3],
+                unsigned int ngrp, const struct grpconf* grp)
+{
+	struct synth* sy = get_synth(src);
+	struct grpconf* newgrp;
+	unsigned int i;
+
+	for (i = 0; i < ngrp; i++) {
+		if (grp[i].sensortype < 0 || grp[i].sensortype >= NSTYPE
+		    || grp[i].iarray >= 3
+		    || grp[i].index + grp[i].nch
+		       > (unsigned int)sy->cfg.nch[grp[i].sensortype]
+		    || (grp[i].datatype != EGD_FLOAT
+		        && grp[i].datatype != EGD_DOUBLE
+		        && grp[i].datatype != EGD_INT32)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	newgrp = malloc((ngrp + 1) * sizeof(*newgrp));
+	if (!newgrp)
+		return -1;
+
+	memcpy(newgrp, grp, ngrp * sizeof(*newgrp));
+	free(sy->grp);
+	sy->grp = newgrp;
+	sy->ngrp = ngrp;
+	for (i = 0; i < 3; i++)
+		sy->strides[i] = strides[i];
+
+	return 0;
+}
+
+
+static
+int synth_start(struct acq_source* src)
+{
+	struct synth* sy = get_synth(src);
+
+	sy->pos = 0;
+	sy->next_marker = 0;
+	sy->nmarker = 0;
+	sy->noverrun = 0;
+	sy->nlost = 0;
+	sy->start_ns = get_time_ns();
+	return 0;
+}
+
+
+static
+int synth_stop(struct acq_source* src)
+{
+	struct synth* sy = get_synth(src);
+
+	if (sy->noverrun)
+		mm_log_warn("Synthetic device: %u overruns, %lli samples lost",
+		            sy->noverrun, (long long)sy->nlost);
+
+	return 0;
+}
+
+
+/**
+ * synth_get_data() - deliver the next synthetic samples
+ * @src:        synthetic source
+ * @ns:         number of samples requested
+ * @eeg:        array of the first group
+ * @sensor:     array of the second group
+ * @trigger:    array of the third group
+ *
+ * The source behaves like a device sampling in real time in a buffer of
+ * limited capacity: the call sleeps until the requested samples have been
+ * acquired, and if the caller is late by more than the buffer duration,
+ * the oldest samples are dropped as a driver would do (an overrun).
+ *
+ * Return: @ns
+ */
+static
+ssize_t synth_get_data(struct acq_source* src, size_t ns,
+                       void* eeg, void* sensor, void* trigger)
+{
+	struct synth* sy = get_synth(src);
+	void* arrays[3] = {eeg, sensor, trigger};
+	struct mm_timespec deadline;
+	int64_t acquired, lost, end, deadline_ns;
+	unsigned int i;
+
+	acquired = (get_time_ns() - sy->start_ns) * 1e-9 * sy->cfg.fs;
+	if (acquired - sy->pos > sy->buffer_ns) {
+		lost = acquired - sy->pos - sy->buffer_ns;
+		sy->pos += lost;
+		sy->nlost += lost;
+		sy->noverrun++;
+
+		// Report overruns without flooding the log
+		if ((sy->noverrun & (sy->noverrun - 1)) == 0)
+			mm_log_warn("Synthetic device overrun: %lli samples "
+			            "lost so far", (long long)sy->nlost);
+	}
+
+	end = sy->pos + ns;
+	if (acquired < end) {
+		deadline_ns = sy->start_ns + end * 1000000000 / sy->cfg.fs;
+		deadline.tv_sec = deadline_ns / 1000000000;
+		deadline.tv_nsec = deadline_ns % 1000000000;
+		mm_nanosleep(CLOCK_MONOTONIC, &deadline);
+	}
+
+	for (i = 0; i < sy->ngrp; i++)
+		if (sy->grp[i].nch)
+			generate_group(sy, &sy->grp[i], ns,
+			               arrays[sy->grp[i].iarray]);
+
+	post_markers(sy, end);
+	sy->pos = end;
+
+	return ns;
+}
+
+
+static
+int synth_get_status(struct acq_source* src, struct acq_status* status)
+{
+	struct synth* sy = get_synth(src);
+
+	status->last_ts = sy->start_ns + sy->pos * 1000000000 / sy->cfg.fs;
+	status->noverrun = sy->noverrun;
+	status->nlost = sy->nlost;
+	return 0;
+}
+
+
+static
+ssize_t synth_get_available(struct acq_source* src)
+{
+	struct synth* sy = get_synth(src);
+	int64_t avail;
+
+	avail = (get_time_ns() - sy->start_ns) * 1e-9 * sy->cfg.fs - sy->pos;
+	if (avail < 0)
+		return 0;
+
+	return (avail > sy->buffer_ns) ? sy->buffer_ns : avail;
+}
+
+
+static const struct acq_source_ops synth_ops = {
+	.close = synth_close,
+	.get_fs = synth_get_fs,
+	.get_numch = synth_get_numch,
+	.get_chinfo = synth_get_chinfo,
+	.get_devinfo = synth_get_devinfo,
+	.setup = synth_setup,
+	.start = synth_start,
+	.stop = synth_stop,
+	.get_data = synth_get_data,
+	.get_status = synth_get_status,
+	.get_available = synth_get_available,
+};
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      Configuration parsing                             *
+ *                                                                        *
+ **************************************************************************/
+static
+int set_cfg_value(struct synth_cfg* cfg, const char* key, size_t keylen,
+                  int value)
+{
+	static const struct {
+		const char* key;
+		size_t offset;
+	} fields[] = {
+		{"fs", offsetof(struct synth_cfg, fs)},
+		{"eeg", offsetof(struct synth_cfg, nch[EGD_EEG])},
+		{"sensor", offsetof(struct synth_cfg, nch[EGD_SENSOR])},
+		{"trigger", offsetof(struct synth_cfg, nch[EGD_TRIGGER])},
+		{"trigger-period", offsetof(struct synth_cfg, trigger_period)},
+		{"marker-period", offsetof(struct synth_cfg, marker_period)},
+		{"buffer", offsetof(struct synth_cfg, buffer)},
+		{"counter", offsetof(struct synth_cfg, counter)},
+	};
+	int i;
+
+	for (i = 0; i < (int)MM_NELEM(fields); i++) {
+		if (strlen(fields[i].key) == keylen
+		    && !memcmp(fields[i].key, key, keylen)) {
+			*(int*)((char*)cfg + fields[i].offset) = value;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+/**
+ * parse_spec() - parse specification of synthetic source
+ * @cfg:        configuration initialized with default values
+ * @spec:       list of key=value separated by ';' (can be NULL)
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set
+ */
+static
+int parse_spec(struct synth_cfg* cfg, const char* spec)
+{
+	const char *key, *eq, *end;
+	char* vend;
+	long value;
+
+	for (key = spec; key && *key; key = *end ? end + 1 : end) {
+		end = strchr(key, ';');
+		if (!end)
+			end = key + strlen(key);
+
+		eq = memchr(key, '=', end - key);
+		if (!eq)
+			goto invalid;
+
+		value = strtol(eq + 1, &vend, 10);
+		if (vend != end || value < 0 || value > INT32_MAX
+		    || set_cfg_value(cfg, key, eq - key, value))
+			goto invalid;
+	}
+
+	if (cfg->fs <= 0 || cfg->buffer <= 0)
+		goto invalid;
+
+	return 0;
+
+invalid:
+	mm_log_error("Invalid synthetic source specification: %s", spec);
+	errno = EINVAL;
+	return -1;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      API of synthetic source                           *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * synth_open() - open a synthetic acquisition source
+ * @spec:       list of key=value separated by ';' (can be NULL)
+ * @trk:        event tracker in which the markers are posted (can be NULL)
+ *
+ * The source generates EEG-like signals on any number of channels at any
+ * sampling rate, in real time, which allows to load the acquisition
+ * pipeline like a device not available yet. The keys of @spec are:
+ *
+ * fs: sampling frequency (default 2048)
+ * eeg, sensor, trigger: number of channels of each type (64, 8, 1)
+ * trigger-period: period in ms of the pulses of the first trigger channel
+ *                 (1000, 0 to disable)
+ * marker-period: period in ms of the software events posted in @trk
+ *                (0: disabled)
+ * buffer: duration in ms of the device buffer, beyond which samples are
+ *         lost if not read (1000)
+ * counter: if 1, add a trigger channel labelled "Counter" carrying the
+ *          index of each sample modulo 2^24, which exposes the overruns
+ *          (0)
+ *
+ * Return: the opened source, NULL in case of failure with errno set
+ */
+struct acq_source* synth_open(const char* spec, struct event_tracker* trk)
+{
+	struct synth* sy;
+	struct synth_cfg cfg = {
+		.fs = 2048,
+		.nch = {[EGD_EEG] = 64, [EGD_SENSOR] = 8, [EGD_TRIGGER] = 1},
+		.trigger_period = 1000,
+		.marker_period = 0,
+		.buffer = 1000,
+	};
+
+	if (parse_spec(&cfg, spec))
+		return NULL;
+
+	if (cfg.counter)
+		cfg.nch[EGD_TRIGGER]++;
+
+	sy = calloc(1, sizeof(*sy));
+	if (!sy)
+		return NULL;
+
+	sy->src.ops = &synth_ops;
+	sy->cfg = cfg;
+	sy->trk = trk;
+	sy->buffer_ns = (int64_t)cfg.buffer * cfg.fs / 1000;
+	snprintf(sy->model, sizeof(sy->model), "%i+%i+%i channels at %i Hz",
+	         cfg.nch[EGD_EEG], cfg.nch[EGD_SENSOR], cfg.nch[EGD_TRIGGER],
+	         cfg.fs);
+
+	if (init_wave(sy)) {
+		synth_close(&sy->src);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	mm_log_info("Synthetic device: %s", sy->model);
+	return &sy->src;
+}
@@ -0,0 +1,194 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "clock-model.h"
+
+/*
+ * Check that the clock model recovers the drift of a simulated device
+ * whose blocks are observed by the host with a random latency, after a long
+ * uptime, that its incrementally updated fit matches the one computed from
+ * scratch over the window, and that it refuses an implausible fit.
+ */
+
+#define FS              512.0f
+#define BLOCK_NS        32
+#define WSIZE           480             // 30 s of blocks
+#define NBLOCK          2000
+#define TRUE_PPM        150.0
+#define MAX_LATENCY_NS  200000
+#define T0_NS           INT64_C(1000000000000000000)    // ~31 years
+
+static uint32_t rng_state = 0xdeadbeef;
+
+static
+uint32_t rand_u32(void)
+{
+	// xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+
+// Host time at which sample @pos is acquired by the simulated device
+static
+int64_t get_true_ts(int64_t pos)
+{
+	return T0_NS + (int64_t)(pos * 1e9 / (FS * (1.0 + TRUE_PPM * 1e-6)));
+}
+
+
+static
+int check_drift(void)
+{
+	struct clock_model cm;
+	int64_t pos, ts;
+	double err, jitter_ref;
+	int i, rv = 0;
+
+	clock_model_init(&cm, FS, WSIZE);
+	for (i = 1; i <= NBLOCK; i++) {
+		pos = (int64_t)i * BLOCK_NS;
+		ts = get_true_ts(pos) + rand_u32() % MAX_LATENCY_NS;
+		clock_model_update(&cm, pos, ts);
+	}
+
+	if (fabs(cm.ppm - TRUE_PPM) > 5.0) {
+		fprintf(stderr, "estimated drift %g ppm instead of %g ppm\n",
+		        cm.ppm, TRUE_PPM);
+		rv = -1;
+	}
+
+	// RMS of a uniform latency
+	jitter_ref = MAX_LATENCY_NS / sqrt(12.0);
+	if (fabs(cm.jitter_ns - jitter_ref) > 0.2 * jitter_ref) {
+		fprintf(stderr, "estimated jitter %g ns instead of %g ns\n",
+		        cm.jitter_ns, jitter_ref);
+		rv = -1;
+	}
+
+	// The mean latency biases the position by less than 0.1 sample
+	pos = (int64_t)NBLOCK * BLOCK_NS;
+	err = clock_fit_get_pos(&cm.fit, get_true_ts(pos)) - pos;
+	if (fabs(err) > 0.2) {
+		fprintf(stderr, "position error %g samples\n", err);
+		rv = -1;
+	}
+
+	return rv;
+}
+
+
+/*
+ * Fit the last WSIZE points from scratch and compare with the model, whose
+ * moments are updated incrementally between renewals of the window.
+ */
+static
+int check_incremental_fit(void)
+{
+	struct clock_model cm;
+	int64_t pos[WSIZE], ts[WSIZE];
+	double x, y, xm, ym, sxx, sxy, srr, period, jitter;
+	int i, k, n, rv = 0;
+
+	// Stop in the middle of the renewal of the window
+	n = 3*WSIZE + WSIZE/2;
+	clock_model_init(&cm, FS, WSIZE);
+	for (i = 1; i <= n; i++) {
+		k = i % WSIZE;
+		pos[k] = (int64_t)i * BLOCK_NS;
+		ts[k] = get_true_ts(pos[k]) + rand_u32() % MAX_LATENCY_NS;
+		clock_model_update(&cm, pos[k], ts[k]);
+	}
+
+	xm = ym = 0.0;
+	for (k = 0; k < WSIZE; k++) {
+		xm += pos[k] - pos[0];
+		ym += ts[k] - ts[0];
+	}
+	xm /= WSIZE;
+	ym /= WSIZE;
+
+	sxx = sxy = 0.0;
+	for (k = 0; k < WSIZE; k++) {
+		x = (pos[k] - pos[0]) - xm;
+		y = (ts[k] - ts[0]) - ym;
+		sxx += x*x;
+		sxy += x*y;
+	}
+	period = sxy / sxx;
+
+	srr = 0.0;
+	for (k = 0; k < WSIZE; k++) {
+		x = (pos[k] - pos[0]) - xm;
+		y = (ts[k] - ts[0]) - ym;
+		srr += (y - period*x) * (y - period*x);
+	}
+	jitter = sqrt(srr / WSIZE);
+
+	if (  fabs(cm.fit.period_ns / period - 1.0) > 1e-9
+	   || fabs(cm.jitter_ns / jitter - 1.0) > 1e-6) {
+		fprintf(stderr, "incremental fit: period %.9f ns, jitter %g ns "
+		        "instead of %.9f ns, %g ns\n", cm.fit.period_ns,
+		        cm.jitter_ns, period, jitter);
+		rv = -1;
+	}
+
+	return rv;
+}
+
+
+static
+int check_implausible_fit(void)
+{
+	struct clock_model cm;
+	double period = 1e9 / FS;
+	int64_t ts = T0_NS + (int64_t)(2 * BLOCK_NS * period);
+
+	// Second block observed at twice the expected delay
+	clock_model_init(&cm, FS, WSIZE);
+	clock_model_update(&cm, BLOCK_NS, T0_NS);
+	clock_model_update(&cm, 2*BLOCK_NS, ts);
+
+	if (cm.fit.period_ns != period
+	   || cm.fit.ref_pos != 2*BLOCK_NS
+	   || cm.fit.ref_ns != ts) {
+		fprintf(stderr, "implausible fit not discarded\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int main(void)
+{
+	int rv = 0;
+
+	if (check_drift() || check_incremental_fit() || check_implausible_fit())
+		rv = -1;
+
+	return rv ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,323 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "preproc.h"
+
+/*
+ * Check the EEG preprocessing: the scalar implementation is checked on
+ * sine waves (band-pass and notch responses) and on the common average, then
+ * each implementation supported by the CPU is compared with the scalar one
+ * on numbers of channels exercising the vector loops and their tails,
+ * processed by blocks of varying sizes.
+ */
+
+#define FS              512.0f
+#define NS              (8*512)
+#define NS_MAX          64
+#define DC_OFFSET       20000.0f
+
+static uint32_t rng_state = 0x9e3779b9;
+
+static
+uint32_t rand_u32(void)
+{
+	// xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+
+static
+void process_signal(struct preproc* pp, int nch, const float* in, float* out)
+{
+	int i, ns;
+
+	preproc_reset(pp);
+	for (i = 0; i < NS; i += ns) {
+		ns = 1 + rand_u32() % NS_MAX;
+		if (ns > NS - i)
+			ns = NS - i;
+
+		preproc_process(pp, ns, in + i*nch, out + i*nch);
+	}
+}
+
+
+// Gain of the filters at @freq, measured on the second half of the signal
+static
+double get_gain(struct preproc* pp, float* buf, float freq)
+{
+	double in_pow = 0.0, out_pow = 0.0, x;
+	int i;
+	float* out = buf + NS;
+
+	for (i = 0; i < NS; i++)
+		buf[i] = DC_OFFSET + 100.0f * sinf(2.0f * M_PI * freq * i / FS);
+
+	process_signal(pp, 1, buf, out);
+	for (i = NS/2; i < NS; i++) {
+		x = buf[i] - DC_OFFSET;
+		in_pow += x*x;
+		out_pow += (double)out[i] * out[i];
+	}
+
+	return sqrt(out_pow / in_pow);
+}
+
+
+static
+int check_filters(void)
+{
+	const struct preproc_cfg cfg = {
+		.notch = 50.0,
+		.notch_q = 30.0,
+		.hp_cutoff = 1.0,
+		.lp_cutoff = 40.0,
+	};
+	static const struct {
+		float freq;
+		double min, max;
+	} checks[] = {
+		{10.0f, 0.98, 1.02},    // passband
+		{50.0f, 0.0, 0.03},     // notch
+		{120.0f, 0.0, 0.01},    // beyond low-pass
+	};
+	struct preproc pp;
+	float* buf;
+	double gain;
+	int i, rv = 0;
+
+	buf = malloc(2 * NS * sizeof(*buf));
+	if (!buf || preproc_init(&pp, 1, NS_MAX, FS, &cfg)) {
+		free(buf);
+		return -1;
+	}
+
+	for (i = 0; i < (int)(sizeof(checks)/sizeof(checks[0])); i++) {
+		gain = get_gain(&pp, buf, checks[i].freq);
+		if (gain < checks[i].min || gain > checks[i].max) {
+			fprintf(stderr, "gain at %g Hz is %g\n",
+			        checks[i].freq, gain);
+			rv = -1;
+		}
+	}
+
+	preproc_deinit(&pp);
+	free(buf);
+	return rv;
+}
+
+
+static
+int check_average(void)
+{
+	const struct preproc_cfg cfg = {.car = 1};
+	const int nch = 7;
+	struct preproc pp;
+	float in[NS_MAX * 7], out[NS_MAX * 7];
+	double sum;
+	int i, c, rv = 0;
+
+	if (preproc_init(&pp, nch, NS_MAX, FS, &cfg))
+		return -1;
+
+	// Last channel is excluded: the average of the others must vanish
+	preproc_exclude_from_average(&pp, nch-1);
+	for (i = 0; i < NS_MAX * nch; i++)
+		in[i] = DC_OFFSET * (i % nch) + (rand_u32() % 1000);
+
+	preproc_process(&pp, NS_MAX, in, out);
+	for (i = 0; i < NS_MAX; i++) {
+		sum = 0.0;
+		for (c = 0; c < nch-1; c++)
+			sum += out[i*nch + c];
+
+		if (fabs(sum) > 0.1
+		   || fabs(in[i*nch + nch-1] - out[i*nch + nch-1]
+		           - (in[i*nch] - out[i*nch])) > 0.1) {
+			fprintf(stderr, "common average not removed "
+			        "(sample %i)\n", i);
+			rv = -1;
+			break;
+		}
+	}
+
+	preproc_deinit(&pp);
+	return rv;
+}
+
+
+/*
+ * The common average of channels with large DC offsets must not lose
+ * precision: re-referenced samples must be the correctly rounded value of
+ * the difference with the exact average.
+ */
+static
+int check_average_precision(void)
+{
+	const struct preproc_cfg cfg = {.car = 1};
+	const int nch = 64;
+	struct preproc pp;
+	float in[NS_MAX * 64], out[NS_MAX * 64];
+	double mean, exact, ulp;
+	int i, c, rv = 0;
+
+	if (preproc_init(&pp, nch, NS_MAX, FS, &cfg))
+		return -1;
+
+	// Offsets of about 100 mV (values in uV) and a few uV of signal
+	for (i = 0; i < NS_MAX * nch; i++)
+		in[i] = 100000.0f + 997.0f * (i % nch)
+		        + (rand_u32() % 1000) * 0.01f;
+
+	preproc_process(&pp, NS_MAX, in, out);
+	for (i = 0; i < NS_MAX && !rv; i++) {
+		mean = 0.0;
+		for (c = 0; c < nch; c++)
+			mean += in[i*nch + c];
+
+		mean /= nch;
+		for (c = 0; c < nch; c++) {
+			exact = in[i*nch + c] - mean;
+			ulp = nextafterf(fabsf((float)exact), INFINITY)
+			      - fabsf((float)exact);
+			if (fabs(out[i*nch + c] - exact) > 0.5 * ulp + 1e-9) {
+				fprintf(stderr, "common average lost precision "
+				        "(sample %i, channel %i: %g instead of "
+				        "%g)\n", i, c, out[i*nch + c], exact);
+				rv = -1;
+				break;
+			}
+		}
+	}
+
+	preproc_deinit(&pp);
+	return rv;
+}
+
+
+static
+double max_deviation(const float* a, const float* b, size_t len)
+{
+	double dev, maxdev = 0.0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		dev = fabs((double)a[i] - b[i]);
+		if (!(dev <= maxdev))
+			maxdev = dev;
+	}
+
+	return maxdev;
+}
+
+
+static
+int compare_impl(int nch, int car)
+{
+	const struct preproc_cfg cfg = {
+		.notch = 50.0,
+		.notch_q = 30.0,
+		.hp_cutoff = 1.0,
+		.lp_cutoff = 40.0,
+		.car = car,
+	};
+	struct preproc pp;
+	size_t len = (size_t)NS * nch;
+	float *in, *ref, *out;
+	double dev;
+	uint32_t seed;
+	int i, impl, rv = -1;
+
+	in = malloc(len * sizeof(*in));
+	ref = malloc(len * sizeof(*ref));
+	out = malloc(len * sizeof(*out));
+	if (!in || !ref || !out || preproc_init(&pp, nch, NS_MAX, FS, &cfg)) {
+		free(in);
+		free(ref);
+		free(out);
+		return -1;
+	}
+
+	if (nch > 1)
+		preproc_exclude_from_average(&pp, nch/2);
+
+	for (i = 0; i < (int)len; i++)
+		in[i] = DC_OFFSET * ((i % nch) - nch/2)
+		        + (rand_u32() % 2000) * 0.013f;
+
+	// All implementations must see the same block sizes
+	seed = rng_state;
+	preproc_set_impl(&pp, PREPROC_SCALAR);
+	process_signal(&pp, nch, in, ref);
+
+	for (impl = PREPROC_SCALAR + 1; impl < PREPROC_NIMPL; impl++) {
+		if (preproc_set_impl(&pp, impl)) {
+			printf("%s: not supported, skipped\n",
+			       preproc_get_impl_name(impl));
+			continue;
+		}
+
+		rng_state = seed;
+		process_signal(&pp, nch, in, out);
+
+		// The common average is summed in the same order by all
+		// kernels: the results must be bit-exact
+		dev = max_deviation(ref, out, len);
+		if (dev != 0.0) {
+			fprintf(stderr, "%s: %i channels%s: deviation %g "
+			        "from scalar\n", preproc_get_impl_name(impl),
+			        nch, car ? " with average" : "", dev);
+			goto exit;
+		}
+	}
+
+	rv = 0;
+
+exit:
+	preproc_deinit(&pp);
+	free(in);
+	free(ref);
+	free(out);
+	return rv;
+}
+
+
+int main(void)
+{
+	static const int nchs[] = {1, 3, 4, 8, 11, 16, 19, 64};
+	int i, rv = 0;
+
+	if (check_filters() || check_average() || check_average_precision())
+		rv = -1;
+
+	for (i = 0; i < (int)(sizeof(nchs)/sizeof(nchs[0])); i++)
+		if (compare_impl(nchs[i], 0) || compare_impl(nchs[i], 1))
+			rv = -1;
+
+	return rv ? EXIT_FAILURE : EXIT_SUCCESS;
+}
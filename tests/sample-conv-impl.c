@@ -0,0 +1,218 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample-conv.h"
+
+/*
+ * Check that every conversion kernel supported by the CPU gives the same
+ * bytes as the scalar one, for numbers of channels exercising the vector
+ * loops and their tails, with padded rows whose padding must be left
+ * untouched. The scalar kernel is itself checked against a double precision
+ * reference, including saturation of out of range, infinite and NaN values.
+ */
+
+#define NS              257
+#define PAD             5
+#define SENTINEL        0xa5
+
+static uint32_t rng_state = 0x2545f491;
+
+static
+uint32_t rand_u32(void)
+{
+	// xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+
+static
+float rand_float(float min, float max)
+{
+	return min + (max - min) * (rand_u32() / 4294967296.0f);
+}
+
+
+static
+void gen_samples(float* src, int nch, size_t stride)
+{
+	float* row;
+	int i, c;
+
+	for (i = 0; i < NS; i++) {
+		row = (float*)((char*)src + i*stride);
+		for (c = 0; c < nch; c++)
+			row[c] = rand_float(-1.5e3f, 1.5e3f);
+
+		// Values beyond the range of any channel
+		if (i == 1)
+			row[rand_u32() % nch] = INFINITY;
+		if (i == 2)
+			row[rand_u32() % nch] = -INFINITY;
+		if (i == 3)
+			row[rand_u32() % nch] = NAN;
+		if (i == 4)
+			row[rand_u32() % nch] = 1e30f;
+	}
+}
+
+
+static
+int32_t get_packed(const uint8_t* p, int width)
+{
+	uint32_t u = p[0] | (p[1] << 8);
+
+	if (width == 3)
+		u |= (uint32_t)p[2] << 16;
+
+	// Sign extend
+	u <<= 32 - 8*width;
+	return (int32_t)u >> (32 - 8*width);
+}
+
+
+static
+int check_scalar(const struct sample_conv* conv, const float* src,
+                 size_t src_stride, const uint8_t* dst, size_t dst_stride)
+{
+	const float* row;
+	double ref;
+	int32_t d;
+	int i, c;
+
+	for (i = 0; i < NS; i++) {
+		row = (const float*)((const char*)src + i*src_stride);
+		for (c = 0; c < conv->nch; c++) {
+			ref = (double)row[c] * conv->scale[c] + conv->offset[c];
+			if (isnan(ref) || ref < conv->dmin)
+				ref = conv->dmin;
+			if (ref > conv->dmax)
+				ref = conv->dmax;
+
+			// Scale and offset are applied in float, each rounding
+			// adding up to half a step at full 24 bit scale
+			d = get_packed(dst + i*dst_stride + c*conv->width,
+			               conv->width);
+			if (fabs(d - ref) > 1.5) {
+				fprintf(stderr, "scalar: sample %i channel %i: "
+				        "%i instead of %g\n", i, c, d, ref);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+static
+int check_padding(const uint8_t* dst, int row_size, size_t dst_stride)
+{
+	int i, j;
+
+	for (i = 0; i < NS; i++)
+		for (j = row_size; j < (int)dst_stride; j++)
+			if (dst[i*dst_stride + j] != SENTINEL)
+				return -1;
+
+	return 0;
+}
+
+
+static
+int test_conv(int nch, int width)
+{
+	struct sample_conv conv;
+	size_t src_stride, dst_stride, dst_size;
+	float* src;
+	uint8_t *ref, *out;
+	int c, impl, rv = -1;
+
+	if (sample_conv_init(&conv, nch, width))
+		return -1;
+
+	for (c = 0; c < nch; c++)
+		sample_conv_set_range(&conv, c, -1000.0 + c, 500.0 + 3*c);
+
+	src_stride = (nch + 1) * sizeof(float);
+	dst_stride = nch * width + PAD;
+	dst_size = NS * dst_stride;
+	src = malloc(NS * src_stride);
+	ref = malloc(dst_size);
+	out = malloc(dst_size);
+	if (!src || !ref || !out)
+		goto exit;
+
+	gen_samples(src, nch, src_stride);
+
+	sample_conv_set_impl(&conv, SAMPLE_CONV_SCALAR);
+	memset(ref, SENTINEL, dst_size);
+	sample_conv_run(&conv, NS, src, src_stride, ref, dst_stride);
+	if (check_scalar(&conv, src, src_stride, ref, dst_stride)
+	   || check_padding(ref, nch * width, dst_stride))
+		goto exit;
+
+	for (impl = SAMPLE_CONV_SCALAR + 1; impl < SAMPLE_CONV_NIMPL; impl++) {
+		if (sample_conv_set_impl(&conv, impl)) {
+			printf("%s: not supported, skipped\n",
+			       sample_conv_get_impl_name(impl));
+			continue;
+		}
+
+		memset(out, SENTINEL, dst_size);
+		sample_conv_run(&conv, NS, src, src_stride, out, dst_stride);
+		if (memcmp(out, ref, dst_size)) {
+			fprintf(stderr, "%s: %i channels of %i bytes differ "
+			        "from scalar\n",
+			        sample_conv_get_impl_name(impl), nch, width);
+			goto exit;
+		}
+	}
+
+	rv = 0;
+
+exit:
+	free(src);
+	free(ref);
+	free(out);
+	sample_conv_deinit(&conv);
+	return rv;
+}
+
+
+int main(void)
+{
+	static const int nchs[] = {1, 3, 4, 8, 13, 16, 17, 64, 67};
+	int i, width, rv = 0;
+
+	for (width = 2; width <= 3; width++)
+		for (i = 0; i < (int)(sizeof(nchs)/sizeof(nchs[0])); i++)
+			if (test_conv(nchs[i], width))
+				rv = -1;
+
+	return rv ? EXIT_FAILURE : EXIT_SUCCESS;
+}
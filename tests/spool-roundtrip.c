@@ -0,0 +1,238 @@
+/*
+    Copyright (C) 2020  MindMaze Holdings SA
+
+    This program is free software: you can redistribute it and/or modify
+    modify it under the terms of the version 3 of the GNU General Public
+    License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <mmsysio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spool.h"
+
+/*
+ * Check that samples and events written in a spool file are read back
+ * identical. The channels cover the different paths of the codec: floats
+ * that are scaled integers, arbitrary bit patterns (NaN, infinities,
+ * denormals, -0.0) and int32 with deltas overflowing 32 bits. The blocks
+ * are written with varying sizes so that they straddle chunks.
+ */
+
+#define SPOOL_PATH      "spool-roundtrip.eegs"
+#define FS              512
+#define NS              5000
+#define NEEG            6
+#define NSENSOR         2
+#define NTRIGGER        1
+#define EVENT_PERIOD    37
+
+static uint32_t rng_state = 0x12345678;
+static int nevent_written = 0;
+
+static
+uint32_t rand_u32(void)
+{
+	// xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+
+static
+float bits_to_float(uint32_t u)
+{
+	float f;
+
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+
+static
+void gen_signal(float* eeg, float* sensor, int32_t* trigger)
+{
+	int i, walk = 0;
+
+	for (i = 0; i < NS; i++) {
+		// Integers scaled by 2^-5, switching to an unscalable chunk
+		walk += (int)(rand_u32() % 201) - 100;
+		eeg[i*NEEG + 0] = walk / 32.0f;
+		if (i == 3*FS/4)
+			eeg[i*NEEG + 0] = -0.0f;
+
+		eeg[i*NEEG + 1] = 0.0f;
+		eeg[i*NEEG + 2] = bits_to_float(rand_u32());
+		eeg[i*NEEG + 3] = (i % 2 ? -1e30f : 1e30f) * (i % 7);
+		eeg[i*NEEG + 4] = bits_to_float(rand_u32() & 0x807fffffu);
+		eeg[i*NEEG + 5] = (float)(int32_t)rand_u32();
+
+		sensor[i*NSENSOR + 0] = sinf(i * 0.01f) * 1000.0f;
+		sensor[i*NSENSOR + 1] = (i % 3) ? INFINITY : NAN;
+
+		trigger[i] = (i % 2) ? INT32_MIN : INT32_MAX;
+		if (i % 11 == 0)
+			trigger[i] = (int32_t)rand_u32();
+	}
+}
+
+
+static
+int write_spool(const float* eeg, const float* sensor,
+                const int32_t* trigger)
+{
+	const int nch[3] = {NEEG, NSENSOR, NTRIGGER};
+	struct spool_chdesc chdesc[NEEG + NSENSOR + NTRIGGER];
+	struct spool* sp;
+	int i, ns, rv = 0;
+
+	memset(chdesc, 0, sizeof(chdesc));
+	sp = spool_create(SPOOL_PATH, FS, 0.0, nch, chdesc);
+	if (!sp) {
+		fprintf(stderr, "Cannot create %s: %s\n",
+		        SPOOL_PATH, strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < NS; i += ns) {
+		ns = 1 + rand_u32() % 50;
+		if (ns > NS - i)
+			ns = NS - i;
+
+		// Event code is the first sample of the block it ends
+		if (i / EVENT_PERIOD != (i + ns - 1) / EVENT_PERIOD) {
+			rv |= spool_add_event(sp, i, i + ns - 1, i * 0.5f);
+			nevent_written++;
+		}
+
+		rv |= spool_write(sp, ns, eeg + i*NEEG, sensor + i*NSENSOR,
+		                  trigger + i*NTRIGGER);
+	}
+
+	if (spool_close(sp, NULL) || rv) {
+		fprintf(stderr, "Cannot write %s: %s\n",
+		        SPOOL_PATH, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static
+int check_spool(const float* eeg, const float* sensor,
+                const int32_t* trigger)
+{
+	const void* ref[3] = {eeg, sensor, trigger};
+	const size_t strides[3] = {
+		NEEG * sizeof(float),
+		NSENSOR * sizeof(float),
+		NTRIGGER * sizeof(int32_t),
+	};
+	const struct spool_event* events;
+	struct spool_reader rd;
+	void* out[3];
+	int i, j, ns, nevent, first, rv = 0;
+	int64_t last_pos = -1;
+
+	if (spool_reader_open(&rd, SPOOL_PATH)) {
+		fprintf(stderr, "Cannot read %s: %s\n",
+		        SPOOL_PATH, strerror(errno));
+		return -1;
+	}
+
+	for (j = 0; j < 3; j++)
+		out[j] = malloc(rd.hdr->chunk_ns * strides[j]);
+
+	if (rd.ns != NS) {
+		fprintf(stderr, "%lli samples read instead of %i\n",
+		        (long long)rd.ns, NS);
+		rv = -1;
+	}
+
+	for (i = 0; i < rd.nchunk && !rv; i++) {
+		first = rd.chunks[i]->first;
+		ns = spool_reader_decode(&rd, i, out);
+		if (ns < 0) {
+			fprintf(stderr, "chunk %i is corrupted\n", i);
+			rv = -1;
+			break;
+		}
+
+		for (j = 0; j < 3; j++) {
+			if (memcmp(out[j], (const char*)ref[j] + first*strides[j],
+			           ns*strides[j])) {
+				fprintf(stderr, "array %i differs in chunk %i\n",
+				        j, i);
+				rv = -1;
+			}
+		}
+
+		nevent = spool_reader_get_events(&rd, i, &events);
+		for (j = 0; j < nevent; j++) {
+			if (events[j].pos <= last_pos
+			   || events[j].code > events[j].pos
+			   || events[j].pos - events[j].code >= 50
+			   || events[j].duration != events[j].code * 0.5f) {
+				fprintf(stderr, "invalid event %i in chunk %i\n",
+				        j, i);
+				rv = -1;
+			}
+			last_pos = events[j].pos;
+		}
+	}
+
+	if (!rv && rd.nevent != nevent_written) {
+		fprintf(stderr, "%i events read instead of %i\n",
+		        rd.nevent, nevent_written);
+		rv = -1;
+	}
+
+	for (j = 0; j < 3; j++)
+		free(out[j]);
+
+	spool_reader_close(&rd);
+	return rv;
+}
+
+
+int main(void)
+{
+	float* eeg = malloc(NS * NEEG * sizeof(*eeg));
+	float* sensor = malloc(NS * NSENSOR * sizeof(*sensor));
+	int32_t* trigger = malloc(NS * NTRIGGER * sizeof(*trigger));
+	int rv = -1;
+
+	if (!eeg || !sensor || !trigger)
+		goto exit;
+
+	gen_signal(eeg, sensor, trigger);
+	if (!write_spool(eeg, sensor, trigger))
+		rv = check_spool(eeg, sensor, trigger);
+
+	mm_unlink(SPOOL_PATH);
+
+exit:
+	free(eeg);
+	free(sensor);
+	free(trigger);
+	return rv ? EXIT_FAILURE : EXIT_SUCCESS;
+}